@@ -11,6 +11,9 @@ message("      PP_METHD=TATEP    Tate pairing.")
 message("      PP_METHD=WEILP    Weil pairing.")
 message("      PP_METHD=OATEP    Optimal ate pairing.\n")
 
+message("   ** Options for the bilinear pairing module (default = 4):\n")
+message("      PP_DEPTH=w        Width w in [1,8] of precomputation table for fixed-base exponentiation in GT.\n")
+
 # Choose the arithmetic methods.
 if (NOT PP_METHD)
     set(PP_METHD "LAZYR;OATEP")
@@ -23,3 +26,8 @@ endif(PP_LEN LESS 1)
 list(GET PP_METHD 0 PP_EXT)
 list(GET PP_METHD 1 PP_MAP)
 set(PP_METHD ${PP_METHD} CACHE STRING "Method for pairing over prime curves.")
+
+if (NOT PP_DEPTH)
+    set(PP_DEPTH 4)
+endif(NOT PP_DEPTH)
+set(PP_DEPTH "${PP_DEPTH}" CACHE STRING "Width of precomputation table for fixed-base exponentiation in GT.")
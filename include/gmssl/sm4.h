@@ -0,0 +1,69 @@
+/*
+ *  Copyright 2014-2022 The GmSSL Project. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the License); you may
+ *  not use this file except in compliance with the License.
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+
+#ifndef GMSSL_SM4_H
+#define GMSSL_SM4_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+SM4 Public API
+
+	SM4_KEY_SIZE
+	SM4_BLOCK_SIZE
+
+	SM4_KEY
+	sm4_set_encrypt_key
+	sm4_set_decrypt_key
+	sm4_encrypt
+	sm4_decrypt
+	sm4_encrypt_blocks
+	sm4_cbc_encrypt
+	sm4_cbc_decrypt
+	sm4_ctr_encrypt
+*/
+
+#define SM4_KEY_SIZE		(16)
+#define SM4_BLOCK_SIZE		(16)
+#define SM4_NUM_ROUNDS		(32)
+
+
+typedef struct {
+	uint32_t rk[SM4_NUM_ROUNDS];
+} SM4_KEY;
+
+void sm4_set_encrypt_key(SM4_KEY *key, const uint8_t raw_key[SM4_KEY_SIZE]);
+void sm4_set_decrypt_key(SM4_KEY *key, const uint8_t raw_key[SM4_KEY_SIZE]);
+void sm4_encrypt(const SM4_KEY *key, const uint8_t in[SM4_BLOCK_SIZE], uint8_t out[SM4_BLOCK_SIZE]);
+#define sm4_decrypt(key,in,out) sm4_encrypt(key,in,out)
+
+// nblocks independent blocks (ECB), in and out may be the same buffer;
+// on x86-64 with AES-NI and AVX2 runs of 8 blocks use the SIMD kernel
+void sm4_encrypt_blocks(const SM4_KEY *key, const uint8_t *in, size_t nblocks, uint8_t *out);
+
+// iv is updated to the last ciphertext block, so that a message can be processed in pieces
+void sm4_cbc_encrypt(const SM4_KEY *key, uint8_t iv[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t nblocks, uint8_t *out);
+void sm4_cbc_decrypt(const SM4_KEY *key, uint8_t iv[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t nblocks, uint8_t *out);
+// ctr is a 128-bit big-endian counter, incremented once per block (also for a final partial block)
+void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t inlen, uint8_t *out);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif
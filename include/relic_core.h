@@ -480,6 +480,66 @@ ctx_t *core_get(void);
  */
 void core_set(ctx_t *ctx);
 
+/**
+ * Attaches the calling thread to a context whose field, curves and
+ * precomputation tables have already been set up. The new context copies the
+ * curve parameters and points to the precomputation tables of the shared
+ * context instead of rebuilding them; the error state and the random number
+ * generator are its own. The shared context must outlive the attached one and
+ * is not modified afterwards. Without MULTI the context is switched for the
+ * whole process, as with core_set().
+ *
+ * @param[out] ctx					- the context of the calling thread.
+ * @param[in] shared				- the context set up by core_init() and the
+ * 									parameter setting functions.
+ * @return RLC_OK if no error occurs, RLC_ERR otherwise.
+ */
+int core_thread_attach(ctx_t *ctx, const ctx_t *shared);
+
+/**
+ * Detaches the calling thread from its attached context, releasing the state
+ * of its random number generator. The shared context is left untouched.
+ */
+void core_thread_detach(void);
+
+/**
+ * Creates a curve context: a library context with its own field prime,
+ * Montgomery constants, curve parameters and generator tables, so that
+ * operations on different curves can be interleaved by switching contexts
+ * with core_curve_use() instead of setting the parameters again. The current
+ * context is left unchanged when the call returns, but the new context is
+ * built through the current-context pointer. Without MULTI that pointer is
+ * shared by all threads, so no other thread may use the library during the
+ * call.
+ *
+ * @param[in] param					- the curve identifier, e.g. SM2_P256.
+ * @param[in] twist					- the twist type of a pairing-friendly
+ * 									curve, e.g. RLC_EP_MTYPE for SM9_P256, or
+ * 									zero for a curve without pairing.
+ * @return the new context, or NULL if the curve could not be set.
+ */
+ctx_t *core_curve_new(int param, int twist);
+
+/**
+ * Releases a curve context created by core_curve_new(). If it is the current
+ * context, the current context becomes NULL. Like core_curve_new(), it briefly
+ * makes the context current, so without MULTI no other thread may use the
+ * library during the call.
+ *
+ * @param[in] ctx					- the curve context.
+ */
+void core_curve_free(ctx_t *ctx);
+
+/**
+ * Makes a curve context the current context. A context must not be current in
+ * several threads at once; threads sharing a curve context attach to it with
+ * core_thread_attach().
+ *
+ * @param[in] ctx					- the curve context.
+ * @return the previous context.
+ */
+ctx_t *core_curve_use(ctx_t *ctx);
+
 #if defined(MULTI)
 
 #include "relic_multi.h"
@@ -689,6 +689,16 @@ int ep_param_set_any_super(void);
  */
 int ep_param_set_any_pairf(void);
 
+/**
+ * Configures the given pairing-friendly curve and its twist, e.g. the SM9
+ * curve with SM9_P256 and RLC_EP_MTYPE.
+ *
+ * @param[in] EP_TYPE		- the curve identifier.
+ * @param[in] PP_TYPE		- the twist type.
+ * @return RLC_OK.
+ */
+int ep_param_set_any_pairf_t(int EP_TYPE, int PP_TYPE);
+
 /**
  * Returns the parameter identifier of the currently configured prime elliptic
  * curve.
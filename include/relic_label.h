@@ -54,12 +54,22 @@
 #undef core_get
 #undef core_set
 #undef core_set_thread_initializer
+#undef core_thread_attach
+#undef core_thread_detach
+#undef core_curve_new
+#undef core_curve_free
+#undef core_curve_use
 
 #define core_init 	RLC_PREFIX(core_init)
 #define core_clean 	RLC_PREFIX(core_clean)
 #define core_get 	RLC_PREFIX(core_get)
 #define core_set 	RLC_PREFIX(core_set)
 #define core_set_thread_initializer 	RLC_PREFIX(core_set_thread_initializer)
+#define core_thread_attach 	RLC_PREFIX(core_thread_attach)
+#define core_thread_detach 	RLC_PREFIX(core_thread_detach)
+#define core_curve_new 	RLC_PREFIX(core_curve_new)
+#define core_curve_free 	RLC_PREFIX(core_curve_free)
+#define core_curve_use 	RLC_PREFIX(core_curve_use)
 
 #undef arch_init
 #undef arch_clean
@@ -917,6 +927,7 @@
 #undef ep_param_set_any_endom
 #undef ep_param_set_any_super
 #undef ep_param_set_any_pairf
+#undef ep_param_set_any_pairf_t
 #undef ep_param_get
 #undef ep_param_print
 #undef ep_param_level
@@ -1011,6 +1022,7 @@
 #define ep_param_set_any_endom 	RLC_PREFIX(ep_param_set_any_endom)
 #define ep_param_set_any_super 	RLC_PREFIX(ep_param_set_any_super)
 #define ep_param_set_any_pairf 	RLC_PREFIX(ep_param_set_any_pairf)
+#define ep_param_set_any_pairf_t 	RLC_PREFIX(ep_param_set_any_pairf_t)
 #define ep_param_get 	RLC_PREFIX(ep_param_get)
 #define ep_param_print 	RLC_PREFIX(ep_param_print)
 #define ep_param_level 	RLC_PREFIX(ep_param_level)
@@ -29,13 +29,12 @@
 #include "relic.h"
 
 #include "gmssl/sm3.h"
+#include "gmssl/sm4.h"
 
 #include "gmssl/error.h"
 #include "gmssl/mem.h"
 #include "gmssl/asn1.h"
 
-fp_t SM9_ALPHA1, SM9_ALPHA2, SM9_ALPHA3, SM9_ALPHA4, SM9_ALPHA5;
-fp2_t SM9_BETA;
 #define SM9_N		"B640000002A3A6F1D603AB4FF58EC74449F2934B18EA8BEEE56EE19CD69ECF25"
 #define SM9_HID_SIGN		0x01
 #define SM9_HID_EXCH		0x02
@@ -54,6 +53,17 @@ fp2_t SM9_BETA;
 #define SM9_ENC_TYPE_OFB	4
 #define SM9_ENC_TYPE_CFB	8
 
+// GT 固定基 comb 预计算表的大小, 宽度由 cmake 选项 PP_DEPTH 设置
+#define SM9_FIX_TABLE		(1 << PP_DEPTH)
+
+// ds 的 GLV 有符号 comb: 齿数比 EP_DEPTH 多一, 最高齿决定符号, 表的大小与 RELIC 的 COMBS 表相同
+#define SM9_DS_TEETH		(EP_DEPTH + 1)
+#define SM9_DS_TABLE		(1 << (SM9_DS_TEETH - 1))
+
+// P2 的固定基 comb 表默认 2^SM9_G2_GEN_DEPTH 项, 可用 sm9_g2_gen_set 在运行时调整
+#define SM9_G2_GEN_DEPTH	8
+#define SM9_G2_GEN_MAX_DEPTH	12
+
 typedef uint64_t sm9_bn_t[8];
 typedef uint64_t sm9_barrett_bn_t[9];
 typedef sm9_bn_t sm9_fn_t;
@@ -66,6 +76,8 @@ typedef struct {
 typedef struct {
 	ep_t ds;
 	ep2_t Ppubs;
+	ep_t t[SM9_DS_TABLE]; // comb table of ds, see sm9_sign_key_pre_set
+	int ready;
 } SM9_SIGN_KEY;
 
 typedef struct {
@@ -73,10 +85,37 @@ typedef struct {
 	bn_t ks;     // sm9_fn_t
 } SM9_SIGN_MASTER_KEY;
 
+// prepared signing master public key, g = e(P1, Ppubs) only depends on Ppubs
+typedef struct {
+	ep2_t Ppubs;
+	fp12_t g;
+	fp12_t t[SM9_FIX_TABLE]; // fixed-base table of g
+	int ready;
+} SM9_SIGN_MPK_PRE;
+
 typedef struct {
 	SM3_CTX sm3_ctx;
 } SM9_SIGN_CTX;
 
+// one signature of a batch, ctx has been fed with the message by sm9_verify_update
+typedef struct {
+	const char *id;
+	size_t idlen;
+	SM9_SIGN_CTX *ctx;
+	const uint8_t *sig;
+	size_t siglen;
+} SM9_VERIFY_ITEM;
+
+// 65 tangents, 10 additions and the two Frobenius lines of sm9_pairing_fastest
+#define SM9_G2_PRE_LINES	77
+
+// prepared G2 point, line i at P is l[i][0] + l[i][1] * yP + l[i][2] * xP
+typedef struct {
+	ep2_t Q;
+	fp2_t l[SM9_G2_PRE_LINES][3];
+	int len;
+} SM9_G2_PRE;
+
 typedef struct {
 	ep_t Ppube; // Ppube = ke * P1
 	bn_t ke;
@@ -87,7 +126,37 @@ typedef struct {
 	ep2_t de;
 } SM9_ENC_KEY;
 
-void sm9_init();
+// streaming hybrid encryption, the output is
+// enc_type (1 byte) || C1 (65 bytes) || C2 = SM4(K1, M) || C3 = HMAC-SM3(K2, enc_type || C1 || C2) (32 bytes)
+#define SM9_ENC_HEADER_SIZE	(1 + 65)
+
+typedef struct {
+	int enc_type;
+	SM4_KEY sm4_key;
+	uint8_t iv[SM4_BLOCK_SIZE];
+	uint8_t block[SM4_BLOCK_SIZE];
+	size_t num;
+	uint8_t mac[SM3_HMAC_SIZE]; // last bytes of the input when decrypting, C3 at the end
+	size_t maclen;
+	SM3_HMAC_CTX hmac_ctx;
+} SM9_ENC_CTX;
+
+// prepared encryption master public key, g = e(Ppube, P2) only depends on Ppube
+typedef struct {
+	ep_t Ppube;
+	fp12_t g;
+	fp12_t t[SM9_FIX_TABLE]; // fixed-base table of g
+	int ready;
+} SM9_ENC_MPK_PRE;
+
+// sm9_init sets up the SM9 constants and the P2 table once, call it after the curve is set;
+// every sm9_init is paired with a sm9_clean and the last sm9_clean frees them.
+// After that the shared state is only read; with MULTI=PTHREAD the sm9_* functions may run in
+// several threads on distinct output objects, each thread with its own RELIC context (core_init or
+// core_thread_attach). Without MULTI all threads share one context whose error state is written by
+// every call, so the sm9_* functions must not run concurrently.
+// sm9_init returns 1, or -1 if the prime was not set from the SM9 curve parameters
+int sm9_init();
 void sm9_clean();
 int write_file(char filename[],uint8_t output[],int output_size);
 int read_file(uint8_t **output, size_t *output_size,char filename[]);
@@ -102,12 +171,142 @@ int read_file_t(uint8_t output[],int output_size,char filename[]);
 void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P);
 void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P);
 void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P);
+// Miller loop follows the NAF of 6u+2 derived in sm9_init, lines come from fused
+// double/add-and-line steps in homogeneous coordinates, used by the protocol code
+void sm9_pairing_ate(fp12_t r, const ep2_t Q, const ep_t P);
+// r = e(Q[0], P[0]) * ... * e(Q[n-1], P[n-1]) with one shared Miller loop and one final exponentiation
+void sm9_pairing_sim(fp12_t r, const ep2_t Q[], const ep_t P[], int n);
+// r[i] = e(Q[i], P[i]) for n independent pairings with one batched final exponentiation
+void sm9_pairing_batch(fp12_t r[], const ep2_t Q[], const ep_t P[], int n);
+
 
-// 运行arr_size次配对算法，使用threads_num个线程运行
+// pairing with a prepared G2 point, no G2 arithmetic is done per call
+void sm9_g2_pre_init(SM9_G2_PRE *pre);
+void sm9_g2_pre_free(SM9_G2_PRE *pre);
+void sm9_g2_pre_set(SM9_G2_PRE *pre, const ep2_t Q);
+void sm9_pairing_pre(fp12_t r, const SM9_G2_PRE *pre, const ep_t P);
+// r[i] = e(pre->Q, P[i]) for i < n with one batched final exponentiation
+void sm9_pairing_pre_batch(fp12_t r[], const SM9_G2_PRE *pre, const ep_t P[], int n);
+
+// hard part methods of the final exponentiation, all give f^((p^12-1)/n)
+#define SM9_FEXP_CRUDE		0	// generic exponentiation by sm9_bn_t constants
+#define SM9_FEXP_HARD		1	// fp12_pow by a2, a3 and 9
+#define SM9_FEXP_HARD_PARTER	2	// fp12_pow_t, fp12_frb_t
+#define SM9_FEXP_HARD_T		3	// fp12_pow_t, fp12_frobenius
+#define SM9_FEXP_RELIC		4	// RELIC addition chain, 3 exponentiations by u
+#define SM9_FEXP_LATTICE	5	// base-p lattice decomposition, 3 exponentiations by u
+// method used by sm9_pairing_ate, sm9_pairing_pre and sm9_pairing_sim
+#define SM9_FEXP_DEFAULT	SM9_FEXP_LATTICE
+
+// r = f^((p^12-1)/n) with the given hard part method
+void sm9_final_exponent_method(fp12_t r, const fp12_t f, int method);
+// r[i] = f[i]^((p^12-1)/n) with SM9_FEXP_LATTICE, sharing the inversion and
+// the Karabina decompression across blocks of elements, r may be f
+void sm9_final_exponent_sim(fp12_t r[], const fp12_t f[], int n);
+
+void fp12_mul_t(fp12_t c, fp12_t a, fp12_t b);
+// schoolbook product on unreduced accumulators, kept as a cross-check for fp12_mul_t
+void fp12_mul_t1(fp12_t r, const fp12_t a, const fp12_t b);
+// h = f * g for a line value g (g[0][0], g[0][1], g[1][1] set)
+void fp12_mul_sparse(fp12_t h, const fp12_t f, const fp12_t g);
+// c = a * b for two sparse line values (a[0][0], a[0][1], a[1][1] set)
+void fp12_mul_line2(fp12_t c, const fp12_t a, const fp12_t b);
+
+// c = a^b for a in GT (the cyclotomic subgroup), signed window NAF
+void fp12_pow_cyc_t(fp12_t c, fp12_t a, const bn_t b);
+// c = a^b for a in GT, b = k0 + k1 p + k2 p^2 + k3 p^3 with |ki| of about 64 bits
+// fp12_pow_gls interleaves the two pairs in joint sparse form (variable time),
+// fp12_pow_gls_sec uses a fixed-length regular recoding and full-table lookups
+void fp12_pow_gls(fp12_t c, fp12_t a, const bn_t b);
+void fp12_pow_gls_sec(fp12_t c, fp12_t a, const bn_t b);
+
+// fixed-base multiplication in G1 with the GLV endomorphism, t has SM9_DS_TABLE entries,
+// p is the base of the table; constant time in k
+void ep_mul_fix_glv_pre(ep_t *t, const ep_t p);
+void ep_mul_fix_glv_sec(ep_t r, const ep_t *t, const ep_t p, const bn_t k);
+
+// r = k * p in G2 with the 4-dimensional GLS decomposition (psi = ep2_frb), variable time
+void ep2_mul_gls(ep2_t r, ep2_t p, const bn_t k);
+
+// fixed-base comb for P2 with 2^depth entries, 2 <= depth <= SM9_G2_GEN_MAX_DEPTH,
+// sm9_init builds it with SM9_G2_GEN_DEPTH; sm9_g2_mul_gen is variable time like ep2_mul_gen.
+// sm9_g2_gen_set may run while other threads multiply; the old table is freed right away when no
+// multiplication is running, otherwise by a later sm9_g2_gen_set that finds none, or by sm9_clean
+int sm9_g2_gen_set(int depth);
+int sm9_g2_gen_depth(void);
+void sm9_g2_mul_gen(ep2_t r, bn_t k);
+
+// fixed-base exponentiation in GT, t has SM9_FIX_TABLE entries
+// fp12_pow_fix_sec reads the whole table for every digit of k, use it for secret exponents
+void fp12_pow_fix_pre(fp12_t *t, fp12_t g);
+void fp12_pow_fix(fp12_t c, fp12_t *t, const bn_t k);
+void fp12_pow_fix_sec(fp12_t c, fp12_t *t, const bn_t k);
+
+// batch pairing engine, a pool of persistent worker threads
+// pairing kernel run by the pool, e.g. sm9_pairing_ate (default) or sm9_pairing
+typedef void (*sm9_pairing_f)(fp12_t r, const ep2_t Q, const ep_t P);
+typedef struct sm9_pairing_pool_st SM9_PAIRING_POOL;
+
+// threads = 0 uses one thread per online core, call after the curve and sm9_init are set up;
+// without MULTI the threads would share one RELIC context, so no thread is started and
+// sm9_pairing_pool_run computes the pairings in the calling thread
+SM9_PAIRING_POOL *sm9_pairing_pool_new(size_t threads);
+void sm9_pairing_pool_free(SM9_PAIRING_POOL *pool);
+size_t sm9_pairing_pool_size(const SM9_PAIRING_POOL *pool);
+// r[i] = kernel(Q[i], P[i]) for i < n, returns when all of them are done
+int sm9_pairing_pool_run(SM9_PAIRING_POOL *pool, sm9_pairing_f kernel,
+	fp12_t r[], const ep2_t Q[], const ep_t P[], size_t n);
+
+// runs task(arg, begin, end) over [0, n) split into threads ranges, the calling thread takes the first one;
+// threads = 0 uses one thread per online core; without MULTI the ranges run one after another
+typedef void (*sm9_task_f)(void *arg, size_t begin, size_t end);
+int sm9_parallel_run(size_t threads, sm9_task_f task, void *arg, size_t n);
+
+// 运行arr_size次配对算法，使用threads_num个线程运行 (临时线程池)
 void sm9_pairing_omp(fp12_t r_arr[], const ep2_t Q_arr[], const ep_t P_arr[], const size_t arr_size, const size_t threads_num);
 
+// identity cache, a sharded LRU keyed by (master public key, hid, ID)
+// entries keep h1 and Q = h1 * P1 + Ppube (hid 2, 3) or P = h1 * P2 + Ppubs (hid 1)
+#define SM9_ID_CACHE_TABLES	1	// also keep the comb table of Q, for r * Q in encryption and exchange
+#define SM9_ID_CACHE_LINES	2	// also keep the Miller lines of P, for verification
+typedef struct sm9_id_cache_st SM9_ID_CACHE;
+
+int sm9_hash1(bn_t h1, const char *id, size_t idlen, uint8_t hid);
+// capacity is the total number of entries, shards = 0 uses the default
+SM9_ID_CACHE *sm9_id_cache_new(size_t capacity, size_t shards, int flags);
+void sm9_id_cache_free(SM9_ID_CACHE *cache);
+int sm9_id_cache_flags(const SM9_ID_CACHE *cache);
+void sm9_id_cache_stats(SM9_ID_CACHE *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+// return 1 on a hit, 0 on a miss and -1 if a new entry cannot be allocated, cache = NULL only
+// computes; h1, t and pre may be NULL, t and pre are filled only when the cache keeps tables and lines;
+// an entry only holds the table or the lines of its own kind
+int sm9_id_cache_g1(SM9_ID_CACHE *cache, const ep_t Ppube, uint8_t hid,
+	const char *id, size_t idlen, bn_t h1, ep_t Q, ep_t *t);
+int sm9_id_cache_g2(SM9_ID_CACHE *cache, const ep2_t Ppubs,
+	const char *id, size_t idlen, bn_t h1, ep2_t P, SM9_G2_PRE *pre);
+// cache used by the protocol functions, NULL (default) disables it; not owned by the library
+void sm9_set_id_cache(SM9_ID_CACHE *cache);
+SM9_ID_CACHE *sm9_get_id_cache(void);
+
+// offline/online precomputation, a pool of (r, g^r) pairs for one g, e.g. pre->g of a prepared
+// master public key; background = 1 starts a thread that keeps the pool full, it needs MULTI
+// and sm9_rand_pool_new fails without it
+typedef struct sm9_rand_pool_st SM9_RAND_POOL;
+
+SM9_RAND_POOL *sm9_rand_pool_new(fp12_t g, size_t size, int background);
+void sm9_rand_pool_free(SM9_RAND_POOL *pool);
+size_t sm9_rand_pool_count(SM9_RAND_POOL *pool);
+// fills the pool in the calling thread
+int sm9_rand_pool_fill(SM9_RAND_POOL *pool);
+// takes a pair out of the pool (returns 1), computes one when it is empty (returns 0); each pair is used once
+int sm9_rand_pool_get(SM9_RAND_POOL *pool, bn_t r, fp12_t w);
+
 // sm9 signature
 int sm9_sign_master_key_extract_key(SM9_SIGN_MASTER_KEY *msk, const char *id, size_t idlen, SM9_SIGN_KEY *key);
+// bulk extraction of n keys, keys are initialized by the caller; ret[i] is 1 or -1 (t1 = 0 for this ID),
+// returns 1 if all of them are extracted and 0 otherwise; threads as in sm9_parallel_run
+int sm9_sign_master_key_extract_keys(SM9_SIGN_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_SIGN_KEY *keys, int *ret, size_t threads);
 int sm9_sign_init(SM9_SIGN_CTX *ctx);
 int sm9_sign_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen);
 int sm9_sign_finish(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, uint8_t *sig, size_t *siglen);
@@ -117,18 +316,65 @@ int sm9_verify_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen);
 int sm9_verify_finish(SM9_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen,	const SM9_SIGN_KEY *mpk, const char *id, size_t idlen);
 void sign_user_key_init(SM9_SIGN_KEY *key);
 void sign_user_key_free(SM9_SIGN_KEY *key);
+// builds the comb table of key->ds used by signing, sm9_sign_master_key_extract_key calls it;
+// call it again after setting ds by other means, without it signing falls back to ep_mul_lwreg
+int sm9_sign_key_pre_set(SM9_SIGN_KEY *key);
 void sign_master_key_init(SM9_SIGN_MASTER_KEY *key);
 void sign_master_key_free(SM9_SIGN_MASTER_KEY *key);
+
+// sm9 signature with a prepared master public key
+void sign_mpk_pre_init(SM9_SIGN_MPK_PRE *pre);
+void sign_mpk_pre_free(SM9_SIGN_MPK_PRE *pre);
+// (re)computes g = e(P1, Ppubs) and its table, skipped when Ppubs is unchanged
+int sm9_sign_mpk_pre_set(SM9_SIGN_MPK_PRE *pre, const ep2_t Ppubs);
+int sm9_do_sign_pre(const SM9_SIGN_KEY *key, SM9_SIGN_MPK_PRE *pre, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig);
+int sm9_do_verify_pre(SM9_SIGN_MPK_PRE *pre, const char *id, size_t idlen, const SM3_CTX *sm3_ctx, const SM9_SIGNATURE *sig);
+int sm9_sign_finish_pre(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, SM9_SIGN_MPK_PRE *pre, uint8_t *sig, size_t *siglen);
+int sm9_verify_finish_pre(SM9_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen, SM9_SIGN_MPK_PRE *pre, const char *id, size_t idlen);
+// online signing, the pool is built from g = e(P1, Ppubs) of the signer's master public key
+int sm9_do_sign_pool(const SM9_SIGN_KEY *key, SM9_RAND_POOL *pool, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig);
+int sm9_sign_finish_pool(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, SM9_RAND_POOL *pool, uint8_t *sig, size_t *siglen);
+// verifies n signatures under the same master key, ret[i] is 1 (valid), 0 (invalid) or -1 (bad encoding)
+// returns 1 if all of them are valid, 0 otherwise and -1 on error
+int sm9_verify_finish_batch(SM9_SIGN_MPK_PRE *pre, const SM9_VERIFY_ITEM *items, size_t n, int *ret);
 //sm9 crypto
 int sm9_enc_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,SM9_ENC_KEY *key);
+int sm9_enc_master_key_extract_keys(SM9_ENC_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_ENC_KEY *keys, int *ret, size_t threads);
 int sm9_kem_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,size_t klen, uint8_t *kbuf, ep_t C);
 int sm9_kem_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen, const ep_t C,size_t klen, uint8_t *kbuf);
+int sm9_kem_decrypt_pre(const SM9_G2_PRE *de, const char *id, size_t idlen, const ep_t C, size_t klen, uint8_t *kbuf);
+// decapsulates n ciphertexts for the same key, K of item i goes to kbuf + i * klen;
+// ret[i] is 1 (ok) or -1 (bad C1 or zero K, K is cleared), returns 1 if all of them are ok and 0 otherwise
+int sm9_kem_decrypt_batch(const SM9_G2_PRE *de, const char *id, size_t idlen, const ep_t C[], size_t n,
+	size_t klen, uint8_t *kbuf, int *ret);
 int sm9_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
 int sm9_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen,const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+// streaming encryption with enc_type SM9_ENC_TYPE_ECB, CBC, OFB or CFB (XOR is not streamable):
+// init writes the SM9_ENC_HEADER_SIZE header, update writes at most inlen + 16 bytes,
+// encrypt finish at most 16 + 32 bytes and decrypt finish at most 16 bytes; in and out must not overlap.
+// Decrypted data is only authenticated when sm9_decrypt_finish returns 1, discard it otherwise
+int sm9_encrypt_init(SM9_ENC_CTX *ctx, const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
+	int enc_type, uint8_t *out, size_t *outlen);
+int sm9_encrypt_update(SM9_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm9_encrypt_finish(SM9_ENC_CTX *ctx, uint8_t *out, size_t *outlen);
+int sm9_decrypt_init(SM9_ENC_CTX *ctx, const SM9_ENC_KEY *key, const char *id, size_t idlen,
+	const uint8_t *in, size_t inlen);
+int sm9_decrypt_update(SM9_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen);
+int sm9_decrypt_finish(SM9_ENC_CTX *ctx, uint8_t *out, size_t *outlen);
+void enc_mpk_pre_init(SM9_ENC_MPK_PRE *pre);
+void enc_mpk_pre_free(SM9_ENC_MPK_PRE *pre);
+// (re)computes g = e(Ppube, P2) and its table, skipped when Ppube is unchanged
+int sm9_enc_mpk_pre_set(SM9_ENC_MPK_PRE *pre, const ep_t Ppube);
+int sm9_kem_encrypt_pre(SM9_ENC_MPK_PRE *pre, const char *id, size_t idlen, size_t klen, uint8_t *kbuf, ep_t C);
+// online encapsulation, the pool is built from pre->g
+int sm9_kem_encrypt_pool(SM9_ENC_MPK_PRE *pre, SM9_RAND_POOL *pool, const char *id, size_t idlen, size_t klen, uint8_t *kbuf, ep_t C);
 
 
 //sm9 key exchange
 int sm9_exch_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,SM9_ENC_KEY *key);
+int sm9_exch_master_key_extract_keys(SM9_ENC_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_ENC_KEY *keys, int *ret, size_t threads);
 int sm9_exchange_A1(const SM9_ENC_KEY *usr, const char *id, size_t idlen,ep_t Ra,bn_t ra);
 int sm9_exchange_A2(const SM9_ENC_KEY *usr,ep_t Ra,ep_t Rb,bn_t ra,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t salen,uint8_t *sa,size_t datalen,uint8_t *data);
 int sm9_exchange_B1(const SM9_ENC_KEY *usr,fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t sblen,size_t sb);
@@ -141,4 +387,7 @@ int speedtest_sm9_enc_dec();
 int speedtest_sm9_exchange();
 
 void enc_master_key_init(SM9_ENC_MASTER_KEY *tem);
+void enc_master_key_free(SM9_ENC_MASTER_KEY *tem);
+void enc_user_key_init(SM9_ENC_KEY *key);
+void enc_user_key_free(SM9_ENC_KEY *key);
 #endif
\ No newline at end of file
@@ -0,0 +1,423 @@
+/*
+ *  Copyright 2014-2022 The GmSSL Project. All Rights Reserved.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the License); you may
+ *  not use this file except in compliance with the License.
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+
+#include <string.h>
+#include "gmssl/sm4.h"
+#include "gmssl/endian.h"
+#include "gmssl/mem.h"
+
+// x86-64 上默认编译 AES-NI + AVX2 的 8 块并行实现, 运行时检测 CPU 后再使用;
+// 定义 SM4_PORTABLE 只保留查表实现
+#if !defined(SM4_PORTABLE) && defined(__x86_64__) && defined(__GNUC__)
+# define SM4_AESNI_AVX2
+# include <immintrin.h>
+#endif
+
+
+static const uint32_t FK[4] = {
+	0xa3b1bac6, 0x56aa3350, 0x677d9197, 0xb27022dc,
+};
+
+static const uint32_t CK[32] = {
+	0x00070e15, 0x1c232a31, 0x383f464d, 0x545b6269,
+	0x70777e85, 0x8c939aa1, 0xa8afb6bd, 0xc4cbd2d9,
+	0xe0e7eef5, 0xfc030a11, 0x181f262d, 0x343b4249,
+	0x50575e65, 0x6c737a81, 0x888f969d, 0xa4abb2b9,
+	0xc0c7ced5, 0xdce3eaf1, 0xf8ff060d, 0x141b2229,
+	0x30373e45, 0x4c535a61, 0x686f767d, 0x848b9299,
+	0xa0a7aeb5, 0xbcc3cad1, 0xd8dfe6ed, 0xf4fb0209,
+	0x10171e25, 0x2c333a41, 0x484f565d, 0x646b7279,
+};
+
+static const uint8_t S[256] = {
+	0xd6, 0x90, 0xe9, 0xfe, 0xcc, 0xe1, 0x3d, 0xb7, 0x16, 0xb6, 0x14, 0xc2, 0x28, 0xfb, 0x2c, 0x05,
+	0x2b, 0x67, 0x9a, 0x76, 0x2a, 0xbe, 0x04, 0xc3, 0xaa, 0x44, 0x13, 0x26, 0x49, 0x86, 0x06, 0x99,
+	0x9c, 0x42, 0x50, 0xf4, 0x91, 0xef, 0x98, 0x7a, 0x33, 0x54, 0x0b, 0x43, 0xed, 0xcf, 0xac, 0x62,
+	0xe4, 0xb3, 0x1c, 0xa9, 0xc9, 0x08, 0xe8, 0x95, 0x80, 0xdf, 0x94, 0xfa, 0x75, 0x8f, 0x3f, 0xa6,
+	0x47, 0x07, 0xa7, 0xfc, 0xf3, 0x73, 0x17, 0xba, 0x83, 0x59, 0x3c, 0x19, 0xe6, 0x85, 0x4f, 0xa8,
+	0x68, 0x6b, 0x81, 0xb2, 0x71, 0x64, 0xda, 0x8b, 0xf8, 0xeb, 0x0f, 0x4b, 0x70, 0x56, 0x9d, 0x35,
+	0x1e, 0x24, 0x0e, 0x5e, 0x63, 0x58, 0xd1, 0xa2, 0x25, 0x22, 0x7c, 0x3b, 0x01, 0x21, 0x78, 0x87,
+	0xd4, 0x00, 0x46, 0x57, 0x9f, 0xd3, 0x27, 0x52, 0x4c, 0x36, 0x02, 0xe7, 0xa0, 0xc4, 0xc8, 0x9e,
+	0xea, 0xbf, 0x8a, 0xd2, 0x40, 0xc7, 0x38, 0xb5, 0xa3, 0xf7, 0xf2, 0xce, 0xf9, 0x61, 0x15, 0xa1,
+	0xe0, 0xae, 0x5d, 0xa4, 0x9b, 0x34, 0x1a, 0x55, 0xad, 0x93, 0x32, 0x30, 0xf5, 0x8c, 0xb1, 0xe3,
+	0x1d, 0xf6, 0xe2, 0x2e, 0x82, 0x66, 0xca, 0x60, 0xc0, 0x29, 0x23, 0xab, 0x0d, 0x53, 0x4e, 0x6f,
+	0xd5, 0xdb, 0x37, 0x45, 0xde, 0xfd, 0x8e, 0x2f, 0x03, 0xff, 0x6a, 0x72, 0x6d, 0x6c, 0x5b, 0x51,
+	0x8d, 0x1b, 0xaf, 0x92, 0xbb, 0xdd, 0xbc, 0x7f, 0x11, 0xd9, 0x5c, 0x41, 0x1f, 0x10, 0x5a, 0xd8,
+	0x0a, 0xc1, 0x31, 0x88, 0xa5, 0xcd, 0x7b, 0xbd, 0x2d, 0x74, 0xd0, 0x12, 0xb8, 0xe5, 0xb4, 0xb0,
+	0x89, 0x69, 0x97, 0x4a, 0x0c, 0x96, 0x77, 0x7e, 0x65, 0xb9, 0xf1, 0x09, 0xc5, 0x6e, 0xc6, 0x84,
+	0x18, 0xf0, 0x7d, 0xec, 0x3a, 0xdc, 0x4d, 0x20, 0x79, 0xee, 0x5f, 0x3e, 0xd7, 0xcb, 0x39, 0x48,
+};
+
+// SM4_T[x] = L(S[x]), 一轮的 T 变换是四张移位后的表查找之和
+static const uint32_t SM4_T[256] = {
+	0xd55b5b8e, 0x924242d0, 0xeaa7a74d, 0xfdfbfb06, 0xcf3333fc, 0xe2878765, 0x3df4f4c9, 0xb5dede6b,
+	0x1658584e, 0xb4dada6e, 0x14505044, 0xc10b0bca, 0x28a0a088, 0xf8efef17, 0x2cb0b09c, 0x05141411,
+	0x2bacac87, 0x669d9dfb, 0x986a6af2, 0x77d9d9ae, 0x2aa8a882, 0xbcfafa46, 0x04101014, 0xc00f0fcf,
+	0xa8aaaa02, 0x45111154, 0x134c4c5f, 0x269898be, 0x4825256d, 0x841a1a9e, 0x0618181e, 0x9b6666fd,
+	0x9e7272ec, 0x4309094a, 0x51414110, 0xf7d3d324, 0x934646d5, 0xecbfbf53, 0x9a6262f8, 0x7be9e992,
+	0x33ccccff, 0x55515104, 0x0b2c2c27, 0x420d0d4f, 0xeeb7b759, 0xcc3f3ff3, 0xaeb2b21c, 0x638989ea,
+	0xe7939374, 0xb1cece7f, 0x1c70706c, 0xaba6a60d, 0xca2727ed, 0x08202028, 0xeba3a348, 0x975656c1,
+	0x82020280, 0xdc7f7fa3, 0x965252c4, 0xf9ebeb12, 0x74d5d5a1, 0x8d3e3eb3, 0x3ffcfcc3, 0xa49a9a3e,
+	0x461d1d5b, 0x071c1c1b, 0xa59e9e3b, 0xfff3f30c, 0xf0cfcf3f, 0x72cdcdbf, 0x175c5c4b, 0xb8eaea52,
+	0x810e0e8f, 0x5865653d, 0x3cf0f0cc, 0x1964647d, 0xe59b9b7e, 0x87161691, 0x4e3d3d73, 0xaaa2a208,
+	0x69a1a1c8, 0x6aadadc7, 0x83060685, 0xb0caca7a, 0x70c5c5b5, 0x659191f4, 0xd96b6bb2, 0x892e2ea7,
+	0xfbe3e318, 0xe8afaf47, 0x0f3c3c33, 0x4a2d2d67, 0x71c1c1b0, 0x5759590e, 0x9f7676e9, 0x35d4d4e1,
+	0x1e787866, 0x249090b4, 0x0e383836, 0x5f797926, 0x628d8def, 0x59616138, 0xd2474795, 0xa08a8a2a,
+	0x259494b1, 0x228888aa, 0x7df1f18c, 0x3bececd7, 0x01040405, 0x218484a5, 0x79e1e198, 0x851e1e9b,
+	0xd7535384, 0x00000000, 0x4719195e, 0x565d5d0b, 0x9d7e7ee3, 0xd04f4f9f, 0x279c9cbb, 0x5349491a,
+	0x4d31317c, 0x36d8d8ee, 0x0208080a, 0xe49f9f7b, 0xa2828220, 0xc71313d4, 0xcb2323e8, 0x9c7a7ae6,
+	0xe9abab42, 0xbdfefe43, 0x882a2aa2, 0xd14b4b9a, 0x41010140, 0xc41f1fdb, 0x38e0e0d8, 0xb7d6d661,
+	0xa18e8e2f, 0xf4dfdf2b, 0xf1cbcb3a, 0xcd3b3bf6, 0xfae7e71d, 0x608585e5, 0x15545441, 0xa3868625,
+	0xe3838360, 0xacbaba16, 0x5c757529, 0xa6929234, 0x996e6ef7, 0x34d0d0e4, 0x1a686872, 0x54555501,
+	0xafb6b619, 0x914e4edf, 0x32c8c8fa, 0x30c0c0f0, 0xf6d7d721, 0x8e3232bc, 0xb3c6c675, 0xe08f8f6f,
+	0x1d747469, 0xf5dbdb2e, 0xe18b8b6a, 0x2eb8b896, 0x800a0a8a, 0x679999fe, 0xc92b2be2, 0x618181e0,
+	0xc30303c0, 0x29a4a48d, 0x238c8caf, 0xa9aeae07, 0x0d343439, 0x524d4d1f, 0x4f393976, 0x6ebdbdd3,
+	0xd6575781, 0xd86f6fb7, 0x37dcdceb, 0x44151551, 0xdd7b7ba6, 0xfef7f709, 0x8c3a3ab6, 0x2fbcbc93,
+	0x030c0c0f, 0xfcffff03, 0x6ba9a9c2, 0x73c9c9ba, 0x6cb5b5d9, 0x6db1b1dc, 0x5a6d6d37, 0x50454515,
+	0x8f3636b9, 0x1b6c6c77, 0xadbebe13, 0x904a4ada, 0xb9eeee57, 0xde7777a9, 0xbef2f24c, 0x7efdfd83,
+	0x11444455, 0xda6767bd, 0x5d71712c, 0x40050545, 0x1f7c7c63, 0x10404050, 0x5b696932, 0xdb6363b8,
+	0x0a282822, 0xc20707c5, 0x31c4c4f5, 0x8a2222a8, 0xa7969631, 0xce3737f9, 0x7aeded97, 0xbff6f649,
+	0x2db4b499, 0x75d1d1a4, 0xd3434390, 0x1248485a, 0xbae2e258, 0xe6979771, 0xb6d2d264, 0xb2c2c270,
+	0x8b2626ad, 0x68a5a5cd, 0x955e5ecb, 0x4b292962, 0x0c30303c, 0x945a5ace, 0x76ddddab, 0x7ff9f986,
+	0x649595f1, 0xbbe6e65d, 0xf2c7c735, 0x0924242d, 0xc61717d1, 0x6fb9b9d6, 0xc51b1bde, 0x86121294,
+	0x18606078, 0xf3c3c330, 0x7cf5f589, 0xefb3b35c, 0x3ae8e8d2, 0xdf7373ac, 0x4c353579, 0x208080a0,
+	0x78e5e59d, 0xedbbbb56, 0x5e7d7d23, 0x3ef8f8c6, 0xd45f5f8b, 0xc82f2fe7, 0x39e4e4dd, 0x49212168,
+};
+
+#define S32(A)					\
+	((uint32_t)S[((A) >> 24)       ] << 24 |	\
+	 (uint32_t)S[((A) >> 16) & 0xff] << 16 |	\
+	 (uint32_t)S[((A) >>  8) & 0xff] <<  8 |	\
+	 (uint32_t)S[((A))       & 0xff])
+
+#define L32_(X)					\
+	((X) ^					\
+	 ROL32((X), 13) ^			\
+	 ROL32((X), 23))
+
+#define T32(A)						\
+	(SM4_T[(A) & 0xff] ^				\
+	 ROL32(SM4_T[((A) >>  8) & 0xff],  8) ^	\
+	 ROL32(SM4_T[((A) >> 16) & 0xff], 16) ^	\
+	 ROL32(SM4_T[((A) >> 24)       ], 24))
+
+
+void sm4_set_encrypt_key(SM4_KEY *key, const uint8_t user_key[16])
+{
+	uint32_t X0, X1, X2, X3, X4;
+	int i;
+
+	X0 = GETU32(user_key     ) ^ FK[0];
+	X1 = GETU32(user_key  + 4) ^ FK[1];
+	X2 = GETU32(user_key  + 8) ^ FK[2];
+	X3 = GETU32(user_key + 12) ^ FK[3];
+
+	for (i = 0; i < 32; i++) {
+		X4 = X1 ^ X2 ^ X3 ^ CK[i];
+		X4 = S32(X4);
+		X4 = X0 ^ L32_(X4);
+		key->rk[i] = X4;
+
+		X0 = X1;
+		X1 = X2;
+		X2 = X3;
+		X3 = X4;
+	}
+}
+
+void sm4_set_decrypt_key(SM4_KEY *key, const uint8_t user_key[16])
+{
+	uint32_t rk;
+	int i;
+
+	// 解密用逆序的轮密钥
+	sm4_set_encrypt_key(key, user_key);
+	for (i = 0; i < 16; i++) {
+		rk = key->rk[i];
+		key->rk[i] = key->rk[31 - i];
+		key->rk[31 - i] = rk;
+	}
+}
+
+void sm4_encrypt(const SM4_KEY *key, const uint8_t in[16], uint8_t out[16])
+{
+	uint32_t X0, X1, X2, X3, X4;
+	int i;
+
+	X0 = GETU32(in     );
+	X1 = GETU32(in +  4);
+	X2 = GETU32(in +  8);
+	X3 = GETU32(in + 12);
+
+	for (i = 0; i < 32; i++) {
+		X4 = X1 ^ X2 ^ X3 ^ key->rk[i];
+		X4 = X0 ^ T32(X4);
+
+		X0 = X1;
+		X1 = X2;
+		X2 = X3;
+		X3 = X4;
+	}
+
+	PUTU32(out     , X3);
+	PUTU32(out +  4, X2);
+	PUTU32(out +  8, X1);
+	PUTU32(out + 12, X0);
+}
+
+#ifdef SM4_AESNI_AVX2
+
+/*
+ * SM4 的 S 盒与 AES 的 S 盒都是 GF(2^8) 上的求逆加仿射变换, 两个域同构, 所以
+ * S_sm4(x) = post(S_aes(pre(x))), pre 和 post 是 GF(2)^8 上的仿射变换,
+ * 按高低半字节各查一次 16 项的表 (pshufb) 完成; S_aes 用 AESENCLAST 计算,
+ * 输入先做一次逆 ShiftRows, 抵消指令里的 ShiftRows, 轮密钥取 0.
+ */
+static const uint8_t SM4_PRE_LO[16] = {
+	0x3e, 0xb2, 0x0e, 0x82, 0xbb, 0x37, 0x8b, 0x07, 0xa1, 0x2d, 0x91, 0x1d, 0x24, 0xa8, 0x14, 0x98,
+};
+static const uint8_t SM4_PRE_HI[16] = {
+	0x00, 0xdc, 0x2e, 0xf2, 0xc5, 0x19, 0xeb, 0x37, 0x08, 0xd4, 0x26, 0xfa, 0xcd, 0x11, 0xe3, 0x3f,
+};
+static const uint8_t SM4_POST_LO[16] = {
+	0x6c, 0xd4, 0xa6, 0x1e, 0x52, 0xea, 0x98, 0x20, 0x0b, 0xb3, 0xc1, 0x79, 0x35, 0x8d, 0xff, 0x47,
+};
+static const uint8_t SM4_POST_HI[16] = {
+	0x00, 0xe0, 0x50, 0xb0, 0x9d, 0x7d, 0xcd, 0x2d, 0xc0, 0x20, 0x90, 0x70, 0x5d, 0xbd, 0x0d, 0xed,
+};
+
+typedef struct {
+	__m256i bswap, rol8, rol16, rol24, mask4;
+	__m256i pre_lo, pre_hi, post_lo, post_hi;
+	__m128i inv_shift_row;
+} SM4_AVX2_CONST;
+
+__attribute__((target("avx2,aes")))
+static inline __m256i sm4_avx2_t(__m256i x, const SM4_AVX2_CONST *c)
+{
+	__m128i lo, hi;
+	__m256i y;
+
+	// S 盒
+	x = _mm256_xor_si256(
+		_mm256_shuffle_epi8(c->pre_lo, _mm256_and_si256(x, c->mask4)),
+		_mm256_shuffle_epi8(c->pre_hi, _mm256_and_si256(_mm256_srli_epi16(x, 4), c->mask4)));
+	lo = _mm_shuffle_epi8(_mm256_castsi256_si128(x), c->inv_shift_row);
+	hi = _mm_shuffle_epi8(_mm256_extracti128_si256(x, 1), c->inv_shift_row);
+	lo = _mm_aesenclast_si128(lo, _mm_setzero_si128());
+	hi = _mm_aesenclast_si128(hi, _mm_setzero_si128());
+	x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+	x = _mm256_xor_si256(
+		_mm256_shuffle_epi8(c->post_lo, _mm256_and_si256(x, c->mask4)),
+		_mm256_shuffle_epi8(c->post_hi, _mm256_and_si256(_mm256_srli_epi16(x, 4), c->mask4)));
+
+	// L(x) = x ^ (x <<< 24) ^ ((x ^ (x <<< 8) ^ (x <<< 16)) <<< 2)
+	y = _mm256_xor_si256(x, _mm256_xor_si256(_mm256_shuffle_epi8(x, c->rol8), _mm256_shuffle_epi8(x, c->rol16)));
+	y = _mm256_or_si256(_mm256_slli_epi32(y, 2), _mm256_srli_epi32(y, 30));
+	return _mm256_xor_si256(y, _mm256_xor_si256(x, _mm256_shuffle_epi8(x, c->rol24)));
+}
+
+// 8 块一组: 块 j 和 j + 4 放在同一个寄存器的两个 128 位通道, 转置后 x[i] 是 8 块的第 i 个字
+__attribute__((target("avx2,aes")))
+static inline void sm4_avx2_load(__m256i x[4], const uint8_t *in, const SM4_AVX2_CONST *c)
+{
+	__m256i t0, t1, t2, t3;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		x[i] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 16 * i))),
+			_mm_loadu_si128((const __m128i *)(in + 16 * i + 64)), 1);
+		x[i] = _mm256_shuffle_epi8(x[i], c->bswap);
+	}
+	t0 = _mm256_unpacklo_epi32(x[0], x[1]);
+	t1 = _mm256_unpacklo_epi32(x[2], x[3]);
+	t2 = _mm256_unpackhi_epi32(x[0], x[1]);
+	t3 = _mm256_unpackhi_epi32(x[2], x[3]);
+	x[0] = _mm256_unpacklo_epi64(t0, t1);
+	x[1] = _mm256_unpackhi_epi64(t0, t1);
+	x[2] = _mm256_unpacklo_epi64(t2, t3);
+	x[3] = _mm256_unpackhi_epi64(t2, t3);
+}
+
+// 输出是 (X35, X34, X33, X32)
+__attribute__((target("avx2,aes")))
+static inline void sm4_avx2_store(uint8_t *out, const __m256i x[4], const SM4_AVX2_CONST *c)
+{
+	__m256i t0, t1, t2, t3, y[4];
+	int i;
+
+	t0 = _mm256_unpacklo_epi32(x[3], x[2]);
+	t1 = _mm256_unpacklo_epi32(x[1], x[0]);
+	t2 = _mm256_unpackhi_epi32(x[3], x[2]);
+	t3 = _mm256_unpackhi_epi32(x[1], x[0]);
+	y[0] = _mm256_unpacklo_epi64(t0, t1);
+	y[1] = _mm256_unpackhi_epi64(t0, t1);
+	y[2] = _mm256_unpacklo_epi64(t2, t3);
+	y[3] = _mm256_unpackhi_epi64(t2, t3);
+	for (i = 0; i < 4; i++) {
+		y[i] = _mm256_shuffle_epi8(y[i], c->bswap);
+		_mm_storeu_si128((__m128i *)(out + 16 * i), _mm256_castsi256_si128(y[i]));
+		_mm_storeu_si128((__m128i *)(out + 16 * i + 64), _mm256_extracti128_si256(y[i], 1));
+	}
+}
+
+#define SM4_AVX2_ROUND(x, k, c)						\
+	do {								\
+		__m256i _t = _mm256_xor_si256(_mm256_xor_si256((x)[1], (x)[2]),	\
+			_mm256_xor_si256((x)[3], (k)));				\
+		_t = _mm256_xor_si256((x)[0], sm4_avx2_t(_t, (c)));	\
+		(x)[0] = (x)[1];					\
+		(x)[1] = (x)[2];					\
+		(x)[2] = (x)[3];					\
+		(x)[3] = _t;						\
+	} while (0)
+
+// 一轮内部的指令是串行的, 两组 8 块交替计算来填满流水线
+__attribute__((target("avx2,aes")))
+static void sm4_aesni_avx2_encrypt_blocks(const SM4_KEY *key, const uint8_t *in, size_t nblocks, uint8_t *out)
+{
+	SM4_AVX2_CONST c;
+	__m256i a[4], b[4], k;
+	int i;
+
+	c.bswap = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	c.rol8 = _mm256_setr_epi8(
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+		3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+	c.rol16 = _mm256_setr_epi8(
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+		2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+	c.rol24 = _mm256_setr_epi8(
+		1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12,
+		1, 2, 3, 0, 5, 6, 7, 4, 9, 10, 11, 8, 13, 14, 15, 12);
+	c.mask4 = _mm256_set1_epi8(0x0f);
+	c.pre_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)SM4_PRE_LO));
+	c.pre_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)SM4_PRE_HI));
+	c.post_lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)SM4_POST_LO));
+	c.post_hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)SM4_POST_HI));
+	c.inv_shift_row = _mm_setr_epi8(0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3);
+
+	for (; nblocks >= 16; nblocks -= 16, in += 256, out += 256) {
+		sm4_avx2_load(a, in, &c);
+		sm4_avx2_load(b, in + 128, &c);
+		for (i = 0; i < 32; i++) {
+			k = _mm256_set1_epi32((int)key->rk[i]);
+			SM4_AVX2_ROUND(a, k, &c);
+			SM4_AVX2_ROUND(b, k, &c);
+		}
+		sm4_avx2_store(out, a, &c);
+		sm4_avx2_store(out + 128, b, &c);
+	}
+	if (nblocks >= 8) {
+		sm4_avx2_load(a, in, &c);
+		for (i = 0; i < 32; i++) {
+			k = _mm256_set1_epi32((int)key->rk[i]);
+			SM4_AVX2_ROUND(a, k, &c);
+		}
+		sm4_avx2_store(out, a, &c);
+	}
+}
+
+static int sm4_has_aesni_avx2(void)
+{
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("aes");
+}
+#endif
+
+void sm4_encrypt_blocks(const SM4_KEY *key, const uint8_t *in, size_t nblocks, uint8_t *out)
+{
+#ifdef SM4_AESNI_AVX2
+	size_t n = nblocks & ~(size_t)7;
+
+	if (n > 0 && sm4_has_aesni_avx2()) {
+		sm4_aesni_avx2_encrypt_blocks(key, in, n, out);
+		in += 16 * n;
+		out += 16 * n;
+		nblocks -= n;
+	}
+#endif
+	while (nblocks--) {
+		sm4_encrypt(key, in, out);
+		in += 16;
+		out += 16;
+	}
+}
+
+// 一次最多并行处理的块数, 与 8 块的 SIMD 实现对齐
+#define SM4_BATCH	16
+
+void sm4_cbc_encrypt(const SM4_KEY *key, uint8_t iv[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t nblocks, uint8_t *out)
+{
+	while (nblocks--) {
+		gmssl_memxor(out, in, iv, SM4_BLOCK_SIZE);
+		sm4_encrypt(key, out, out);
+		memcpy(iv, out, SM4_BLOCK_SIZE);
+		in += SM4_BLOCK_SIZE;
+		out += SM4_BLOCK_SIZE;
+	}
+}
+
+void sm4_cbc_decrypt(const SM4_KEY *key, uint8_t iv[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t nblocks, uint8_t *out)
+{
+	uint8_t buf[SM4_BATCH * SM4_BLOCK_SIZE];
+	uint8_t next[SM4_BLOCK_SIZE];
+	size_t n, i;
+
+	// 各块的解密互不依赖, 整批解密后再异或前一个密文块; 先写到 buf, in 和 out 可以相同
+	while (nblocks > 0) {
+		n = nblocks < SM4_BATCH ? nblocks : SM4_BATCH;
+		sm4_encrypt_blocks(key, in, n, buf);
+		gmssl_memxor(buf, buf, iv, SM4_BLOCK_SIZE);
+		for (i = 1; i < n; i++) {
+			gmssl_memxor(buf + i * SM4_BLOCK_SIZE, buf + i * SM4_BLOCK_SIZE,
+				in + (i - 1) * SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+		}
+		memcpy(next, in + (n - 1) * SM4_BLOCK_SIZE, SM4_BLOCK_SIZE);
+		memcpy(out, buf, n * SM4_BLOCK_SIZE);
+		memcpy(iv, next, SM4_BLOCK_SIZE);
+		in += n * SM4_BLOCK_SIZE;
+		out += n * SM4_BLOCK_SIZE;
+		nblocks -= n;
+	}
+	gmssl_secure_clear(buf, sizeof(buf));
+}
+
+void sm4_ctr_encrypt(const SM4_KEY *key, uint8_t ctr[SM4_BLOCK_SIZE],
+	const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t buf[SM4_BATCH * SM4_BLOCK_SIZE];
+	uint64_t hi = GETU64(ctr), lo = GETU64(ctr + 8);
+	size_t n, i, len;
+
+	while (inlen > 0) {
+		n = (inlen + SM4_BLOCK_SIZE - 1) / SM4_BLOCK_SIZE;
+		n = n < SM4_BATCH ? n : SM4_BATCH;
+		for (i = 0; i < n; i++) {
+			PUTU64(buf + i * SM4_BLOCK_SIZE, hi);
+			PUTU64(buf + i * SM4_BLOCK_SIZE + 8, lo);
+			if (++lo == 0) {
+				hi++;
+			}
+		}
+		sm4_encrypt_blocks(key, buf, n, buf);
+		len = inlen < n * SM4_BLOCK_SIZE ? inlen : n * SM4_BLOCK_SIZE;
+		gmssl_memxor(out, in, buf, len);
+		in += len;
+		out += len;
+		inlen -= len;
+	}
+	PUTU64(ctr, hi);
+	PUTU64(ctr + 8, lo);
+	gmssl_secure_clear(buf, sizeof(buf));
+}
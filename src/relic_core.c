@@ -212,6 +212,95 @@ void core_set(ctx_t *ctx) {
     core_ctx = ctx;
 }
 
+int core_thread_attach(ctx_t *ctx, const ctx_t *shared) {
+    if (ctx == NULL || shared == NULL) {
+        return RLC_ERR;
+    }
+
+    // 域和曲线参数按值复制; ep_ptr/ep2_ptr/ep4_ptr 仍指向 shared 里的预计算表, 不再重建
+    memcpy(ctx, shared, sizeof(ctx_t));
+
+    // 错误状态和随机数发生器是每个线程自己的
+#ifdef CHECK
+    ctx->last = NULL;
+    ctx->caught = 0;
+#endif
+    ctx->code = RLC_OK;
+#if RAND != CALL
+    memset(ctx->rand, 0, sizeof(ctx->rand));
+#endif
+    ctx->seeded = 0;
+    ctx->counter = 0;
+
+    core_set(ctx);
+    rand_init();
+    return (ctx->seeded ? RLC_OK : RLC_ERR);
+}
+
+void core_thread_detach(void) {
+    if (core_ctx != NULL) {
+        rand_clean();
+        core_ctx = NULL;
+    }
+}
+
+ctx_t *core_curve_new(int param, int twist) {
+    ctx_t *ctx, *old = core_ctx;
+    int ok;
+
+    ctx = (ctx_t *)calloc(1, sizeof(ctx_t));
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    // 在新上下文里从头设置素域和曲线, 预计算表都在 ctx 自己里面.
+    // RELIC 的设置函数都经 core_get() 取上下文, 只能临时切换 core_ctx;
+    // 没有 MULTI 时 core_ctx 是全局的, 调用期间其他线程不能使用本库
+    core_ctx = ctx;
+    ok = (core_init() == RLC_OK);
+#ifdef WITH_EP
+    if (ok) {
+        if (twist != 0) {
+            ep_param_set_any_pairf_t(param, twist);
+        } else {
+            ep_param_set(param);
+        }
+        ok = (ep_param_get() == param && err_get_code() == RLC_OK);
+    }
+#else
+    (void)param;
+    (void)twist;
+    ok = 0;
+#endif
+    if (!ok) {
+        core_clean();
+        free(ctx);
+        ctx = NULL;
+    }
+    core_ctx = old;
+    return ctx;
+}
+
+void core_curve_free(ctx_t *ctx) {
+    ctx_t *old = core_ctx;
+
+    if (ctx == NULL) {
+        return;
+    }
+    // 同 core_curve_new(), 释放期间临时切换 core_ctx
+    core_ctx = ctx;
+    core_clean();
+    core_ctx = (old == ctx ? NULL : old);
+    free(ctx);
+}
+
+ctx_t *core_curve_use(ctx_t *ctx) {
+    ctx_t *old = core_ctx;
+
+    core_ctx = ctx;
+    return old;
+}
+
 #if defined(MULTI)
 void core_set_thread_initializer(void(*init)(void *init_ptr), void* init_ptr) {
     core_thread_initializer = init;
@@ -21,7 +21,11 @@
  * or <https://www.apache.org/licenses/>.
  */
 
+#include <pthread.h>
+
 #include "sm9.h"
+#include "relic_fp_low.h"
+#include "relic_fpx_low.h"
 #include "../test/debug.h"
 
 // for H1() and H2()
@@ -30,8 +34,135 @@ static const sm9_bn_t SM9_ONE = {1,0,0,0,0,0,0,0};
 static const sm9_barrett_bn_t SM9_MU_N_MINUS_ONE = {0xdfc97c31, 0x74df4fd4, 0xc9c073b0, 0x9c95d85e, 0xdcd1312c, 0x55f73aeb, 0xeb5759a6, 0x67980e0b, 0x00000001};
 static const sm9_bn_t SM9_N_MINUS_ONE = {0xd69ecf24, 0xe56ee19c, 0x18ea8bee, 0x49f2934b, 0xf58ec744, 0xd603ab4f, 0x02a3a6f1, 0xb6400000};
 
+// 下面的常量和表只在第一次 sm9_init 时写入, 之后所有线程只读, 不需要加锁;
+// sm9_lock 只保护 sm9_init/sm9_clean 的计数和 P2 comb 表的更换.
+// 多线程并发调用还要求 MULTI, 否则各线程共用一个 RELIC 上下文
+static pthread_mutex_t sm9_lock = PTHREAD_MUTEX_INITIALIZER;
+static int sm9_refs = 0;
+
+static fp_t SM9_ALPHA1, SM9_ALPHA2, SM9_ALPHA3, SM9_ALPHA4, SM9_ALPHA5;
+static fp2_t SM9_BETA;
+
+// Miller loop schedule from the NAF of 6u+2 without its leading digit:
+// sm9_ate_run[i] doubling steps, then T = T + sm9_ate_sgn[i] * Q (no addition when it is 0)
+static int sm9_ate_run[RLC_FP_BITS + 1];
+static int sm9_ate_sgn[RLC_FP_BITS + 1];
+static int sm9_ate_len;
+
+// fixed-base comb table of P2 with 2^depth entries, see sm9_g2_gen_set; a replaced table
+// stays on the prev list while multiplications that may still read it are running
+// (sm9_g2_gen_users > 0) and is freed by the next sm9_g2_gen_set that finds none, or by sm9_clean
+typedef struct sm9_g2_gen_st {
+	ep2_t *tab;
+	int depth;
+	struct sm9_g2_gen_st *prev;
+} SM9_G2_GEN;
+
+static SM9_G2_GEN *sm9_g2_gen = NULL;   // read and written with __atomic
+static int sm9_g2_gen_users = 0;         // multiplications in flight, read and written with __atomic
+static SM9_G2_GEN *sm9_g2_gen_new(int depth);
+static void sm9_g2_gen_publish(SM9_G2_GEN *g);
+
+static void sm9_g2_gen_free_list(SM9_G2_GEN *g){
+	SM9_G2_GEN *prev;
+
+	for (; g != NULL; g = prev) {
+		prev = g->prev;
+		for (int i = 0; i < (1 << g->depth); i++) {
+			ep2_free(g->tab[i]);
+		}
+		free(g->tab);
+		free(g);
+	}
+}
+
+static void sm9_g2_gen_free(){
+	SM9_G2_GEN *g = sm9_g2_gen;
+
+	sm9_g2_gen = NULL;
+	sm9_g2_gen_free_list(g);
+}
+// pi(Q) = (conj(x) * SM9_FRB_X1, conj(y) * SM9_FRB_Y1), -pi^2(Q) = (x * SM9_FRB_X2, -y * SM9_FRB_Y2) for affine Q
+static fp_t SM9_FRB_X1, SM9_FRB_Y1, SM9_FRB_X2, SM9_FRB_Y2;
+
+// SM9 的 BN 参数 u = 0x600000000058F98A, 直线个数, SM9_FRB_* 和最终幂都按它写死,
+// 素数不是按 SM9 曲线参数设置时返回 -1
+#define SM9_PAR_U	"600000000058F98A"
+
+static int sm9_get_par(bn_t x){
+	bn_t u;
+	int ret = 1;
+
+	bn_null(u);
+	bn_new(u);
+	bn_read_str(u, SM9_PAR_U, strlen(SM9_PAR_U), 16);
+	fp_prime_get_par(x);
+	if (bn_cmp(x, u) != RLC_EQ) {
+		error_print();
+		ret = -1;
+	}
+	bn_free(u);
+	return ret;
+}
+
+static int sm9_ate_init(){
+	int8_t naf[RLC_FP_BITS + 1];
+	int len = RLC_FP_BITS + 1, run = 0, lines = 2;
+	bn_t x;
+
+	bn_null(x);
+	bn_new(x);
+
+	// 6u+2
+	if (sm9_get_par(x) != 1) {
+		bn_free(x);
+		return -1;
+	}
+	bn_mul_dig(x, x, 6);
+	bn_add_dig(x, x, 2);
+	bn_rec_naf(naf, &len, x, 2);
+
+	sm9_ate_len = 0;
+	for (int i = len - 2; i >= 0; i--) {
+		run++;
+		lines++;
+		if (naf[i] != 0) {
+			sm9_ate_run[sm9_ate_len] = run;
+			sm9_ate_sgn[sm9_ate_len++] = naf[i];
+			run = 0;
+			lines++;
+		}
+	}
+	if (run > 0) {
+		sm9_ate_run[sm9_ate_len] = run;
+		sm9_ate_sgn[sm9_ate_len++] = 0;
+	}
+	bn_free(x);
+
+	// 倍点和加法直线再加两条 Frobenius 直线, 要放得进 SM9_G2_PRE
+	if (lines > SM9_G2_PRE_LINES) {
+		sm9_ate_len = 0;
+		error_print();
+		return -1;
+	}
+	return 1;
+}
+
+// ep2_pi1/ep2_pi2 give Z = alpha1/alpha2 for affine Q, fold 1/Z^2 and 1/Z^3 into constants
+static void sm9_frb_init(){
+	fp_inv(SM9_FRB_X1, SM9_ALPHA1);
+	fp_mul(SM9_FRB_Y1, SM9_FRB_X1, SM9_FRB_X1);
+	fp_mul(SM9_FRB_Y1, SM9_FRB_Y1, SM9_FRB_X1);
+	fp_sqr(SM9_FRB_X1, SM9_FRB_X1);
 
-void sm9_init(){
+	fp_inv(SM9_FRB_X2, SM9_ALPHA2);
+	fp_mul(SM9_FRB_Y2, SM9_FRB_X2, SM9_FRB_X2);
+	fp_mul(SM9_FRB_Y2, SM9_FRB_Y2, SM9_FRB_X2);
+	fp_sqr(SM9_FRB_X2, SM9_FRB_X2);
+}
+
+
+int sm9_init(){
 	// beta   = 0x6c648de5dc0a3f2cf55acc93ee0baf159f9d411806dc5177f5b21fd3da24d011
 	// alpha1 = 0x3f23ea58e5720bdb843c6cfa9c08674947c5c86e0ddd04eda91d8354377b698b
 	// alpha2 = 0xf300000002a3a6f2780272354f8b78f4d5fc11967be65334
@@ -44,6 +175,20 @@ void sm9_init(){
 	char alpha3[] = "6C648DE5DC0A3F2CF55ACC93EE0BAF159F9D411806DC5177F5B21FD3DA24D011";
 	char alpha4[] = "F300000002A3A6F2780272354F8B78F4D5FC11967BE65333";
 	char alpha5[] = "2D40A38CF6983351711E5F99520347CC57D778A9F8FF4C8A4C949C7FA2A96686";
+	SM9_G2_GEN *g;
+
+	pthread_mutex_lock(&sm9_lock);
+	if (sm9_refs > 0) {
+		sm9_refs++;
+		pthread_mutex_unlock(&sm9_lock);
+		return 1;
+	}
+	if (sm9_ate_init() != 1) {
+		pthread_mutex_unlock(&sm9_lock);
+		error_print();
+		return -1;
+	}
+	sm9_refs = 1;
 
 	fp2_null(SM9_BETA);
 	fp_null(SM9_ALPHA1);
@@ -67,15 +212,29 @@ void sm9_init(){
 	fp_read_str(SM9_ALPHA3, alpha3, strlen(alpha3), 16);
 	fp_read_str(SM9_ALPHA4, alpha4, strlen(alpha4), 16);
 	fp_read_str(SM9_ALPHA5, alpha5, strlen(alpha5), 16);
+
+	sm9_frb_init();
+	if ((g = sm9_g2_gen_new(SM9_G2_GEN_DEPTH)) != NULL) {
+		sm9_g2_gen_publish(g);
+	}
+	pthread_mutex_unlock(&sm9_lock);
+	return 1;
 }
 
 void sm9_clean(){
+	pthread_mutex_lock(&sm9_lock);
+	if (sm9_refs == 0 || --sm9_refs > 0) {
+		pthread_mutex_unlock(&sm9_lock);
+		return;
+	}
 	fp2_free(SM9_BETA);
 	fp_free(SM9_ALPHA1);
 	fp_free(SM9_ALPHA2);
 	fp_free(SM9_ALPHA3);
 	fp_free(SM9_ALPHA4);
 	fp_free(SM9_ALPHA5);
+	sm9_g2_gen_free();
+	pthread_mutex_unlock(&sm9_lock);
 }
 
 //把filename文件的内容读到output里面
@@ -147,7 +306,7 @@ void sign_master_key_init(SM9_SIGN_MASTER_KEY *key){
 	ep2_new(key->Ppubs);
 	char ks[] = "130E78459D78545CB54C587E02CF480CE0B66340F319F348A1D5B1F2DC5F4";
 	bn_read_str(key->ks,ks,strlen(ks),16);
-	ep2_mul_gen(key->Ppubs,key->ks);
+	sm9_g2_mul_gen(key->Ppubs,key->ks);
 	return;
 }
 
@@ -160,7 +319,7 @@ void sign_master_key_set(SM9_SIGN_MASTER_KEY *key,uint8_t ks[],int kslen){
 	ep2_new(key->Ppubs);
 
 	bn_read_bin(key->ks,ks,kslen);
-	ep2_mul_gen(key->Ppubs,key->ks);
+	sm9_g2_mul_gen(key->Ppubs,key->ks);
 
 	return;
 }
@@ -173,7 +332,7 @@ void sign_master_key_read(SM9_SIGN_MASTER_KEY *key,char ks[],int kslen,int radix
 	ep2_new(key->Ppubs);
 
 	bn_read_str(key->ks,ks,kslen,radix);
-	ep2_mul_gen(key->Ppubs,key->ks);
+	sm9_g2_mul_gen(key->Ppubs,key->ks);
 
 	return;
 }
@@ -197,7 +356,7 @@ void sign_master_key_gen(SM9_SIGN_MASTER_KEY *key){
 	while((bn_cmp_dig(key->ks,1) == -1) || (bn_cmp(key->ks,N) == 1)){
 		bn_rand(key->ks,RLC_POS,256);
 	}
-	ep2_mul_gen(key->Ppubs,key->ks);
+	sm9_g2_mul_gen(key->Ppubs,key->ks);
 
 	bn_free(N);
 	return;
@@ -215,12 +374,21 @@ void sign_user_key_init(SM9_SIGN_KEY *key){
 	ep_new(key->ds);
 	ep2_null(key->Ppubs);
 	ep2_new(key->Ppubs);
+	for (int i = 0; i < SM9_DS_TABLE; i++) {
+		ep_null(key->t[i]);
+		ep_new(key->t[i]);
+	}
+	key->ready = 0;
 	return;
 }
 
 void sign_user_key_free(SM9_SIGN_KEY *key){
 	ep_free(key->ds);
 	ep2_free(key->Ppubs);
+	for (int i = 0; i < SM9_DS_TABLE; i++) {
+		ep_free(key->t[i]);
+	}
+	key->ready = 0;
 	return;
 }
 
@@ -305,6 +473,56 @@ void enc_master_key_free(SM9_ENC_MASTER_KEY *tem){
 	return ;
 }
 
+void sign_mpk_pre_init(SM9_SIGN_MPK_PRE *pre){
+	ep2_null(pre->Ppubs);
+	ep2_new(pre->Ppubs);
+	fp12_null(pre->g);
+	fp12_new(pre->g);
+	for (int i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_null(pre->t[i]);
+		fp12_new(pre->t[i]);
+	}
+	ep2_set_infty(pre->Ppubs);
+	fp12_set_dig(pre->g, 1);
+	pre->ready = 0;
+	return;
+}
+
+void sign_mpk_pre_free(SM9_SIGN_MPK_PRE *pre){
+	ep2_free(pre->Ppubs);
+	fp12_free(pre->g);
+	for (int i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_free(pre->t[i]);
+	}
+	pre->ready = 0;
+	return;
+}
+
+void enc_mpk_pre_init(SM9_ENC_MPK_PRE *pre){
+	ep_null(pre->Ppube);
+	ep_new(pre->Ppube);
+	fp12_null(pre->g);
+	fp12_new(pre->g);
+	for (int i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_null(pre->t[i]);
+		fp12_new(pre->t[i]);
+	}
+	ep_set_infty(pre->Ppube);
+	fp12_set_dig(pre->g, 1);
+	pre->ready = 0;
+	return;
+}
+
+void enc_mpk_pre_free(SM9_ENC_MPK_PRE *pre){
+	ep_free(pre->Ppube);
+	fp12_free(pre->g);
+	for (int i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_free(pre->t[i]);
+	}
+	pre->ready = 0;
+	return;
+}
+
 static void fp_to_bn(sm9_bn_t a, fp_t b){
 	uint8_t tmp_buff[32];
 	fp_write_bin(tmp_buff, 32, b);
@@ -426,122 +644,66 @@ static void fp2_conjugate(fp2_t r, const fp2_t a)
 	fp_neg(r[1], a[1]);
 }
 
-static void fp2_mul_u(fp2_t r, const fp2_t a, const fp2_t b)
-{
-	fp_t r0, r1, t;
-
-	fp_null(r0);
-	fp_null(r1);
-	fp_null(t);
-
-	fp_new(r0);
-	fp_new(r1);
-	fp_new(t);
-
-	// r0 = -2 * (a0 * b1 + a1 * b0)
-	fp_mul(r0, a[0], b[1]);
-	fp_mul(t,  a[1], b[0]);
-	fp_add(r0, r0, t);
-	fp_dbl(r0, r0);
-	fp_neg(r0, r0);
+// 这里的 fp12 按 fp4[3] 使用, 第 i 个 fp4 是 fp12 平铺后的第 2i, 2i+1 个 fp2 (a[0][0], a[0][2], a[1][1] 起);
+// SM9_FP2(a, i) 是平铺后的第 i 个 fp2. 两者都去掉 const, 供参数不带 const 的 RELIC 函数使用
+#define SM9_FP4(a, i)	(((fp4_t *)(a))[i])
+#define SM9_FP2(a, i)	(((fp2_t *)(a))[i])
 
-	// r1 = a0 * b0 - 2 * a1 * b1
-	fp_mul(r1, a[0], b[0]);
-	fp_mul(t, a[1], b[1]);
-	fp_dbl(t, t);
-	fp_sub(r1, r1, t);
-
-	fp_copy(r[0], r0);
-	fp_copy(r[1], r1);
-
-	fp_free(r0);
-	fp_free(r1);
-	fp_free(t);
+// 以下 dv4 上的运算不约减, 结果保持在 [0, p*2^N) 内, 由调用者最后统一约减
+static void fp4_addc_low(dv4_t c, dv4_t a, dv4_t b)
+{
+	fp2_addc_low(c[0], a[0], b[0]);
+	fp2_addc_low(c[1], a[1], b[1]);
 }
 
-static void fp2_sqr_u(fp2_t r, const fp2_t a)
+static void fp4_subc_low(dv4_t c, dv4_t a, dv4_t b)
 {
-	fp_t r0, r1, t;
-
-	fp_null(r0);
-	fp_null(r1);
-	fp_null(t);
-
-	fp_new(r0);
-	fp_new(r1);
-	fp_new(t);
-
-	// r0 = -4 * a0 * a1
-	fp_mul(r0, a[0], a[1]);
-	fp_dbl(r0, r0);
-	fp_dbl(r0, r0);
-	fp_neg(r0, r0);
-
-	// r1 = a0^2 - 2 * a1^2
-	fp_sqr(r1, a[0]);
-	fp_sqr(t, a[1]);
-	fp_dbl(t, t);
-	fp_sub(r1, r1, t);
-
-	fp_copy(r[0], r0);
-	fp_copy(r[1], r1);
-
-	fp_free(r0);
-	fp_free(r1);
-	fp_free(t);
+	fp2_subc_low(c[0], a[0], b[0]);
+	fp2_subc_low(c[1], a[1], b[1]);
 }
 
-static void fp4_sqr_v(fp4_t r, const fp4_t a)
+// c = a*v = a1*u + a0*v, 即 fp4_mul_art 的未约减版本
+static void fp4_nord_low(dv4_t c, dv4_t a)
 {
-	fp2_t r0, r1, t;
-	fp2_null(r0);
-	fp2_null(r1);
-	fp2_null(t);
-
-	fp2_new(r0);
-	fp2_new(r1);
-	fp2_new(t);
+	dv2_t t;
 
-	fp2_mul_u(t, a[0], a[1]);
-	fp2_dbl(r0, t);
+	dv2_null(t);
+	dv2_new(t);
 
-	fp2_sqr(r1, a[0]);
-	fp2_sqr_u(t, a[1]);
-	fp2_add(r1, r1, t);
+	dv_copy(t[0], a[0][0], 2 * RLC_FP_DIGS);
+	dv_copy(t[1], a[0][1], 2 * RLC_FP_DIGS);
+	fp2_nord_low(c[0], a[1]);
+	dv_copy(c[1][0], t[0], 2 * RLC_FP_DIGS);
+	dv_copy(c[1][1], t[1], 2 * RLC_FP_DIGS);
 
-	fp2_copy(r[0], r0);
-	fp2_copy(r[1], r1);
-
-	fp2_free(r0);
-	fp2_free(r1);
-	fp2_free(t);
+	dv2_free(t);
 }
 
-static void fp4_mul_v(fp4_t r, const fp4_t a, const fp4_t b)
+static void fp4_rdcn_low(fp4_t c, dv4_t a)
 {
-	fp2_t r0, r1, t;
-	fp2_null(r0);
-	fp2_null(r1);
-	fp2_null(t);
-
-	fp2_new(r0);
-	fp2_new(r1);
-	fp2_new(t);
-
-	fp2_mul_u(r0, a[0], b[1]);
-	fp2_mul_u(t, a[1], b[0]);
-	fp2_add(r0, r0, t);
+	fp2_rdcn_low(c[0], a[0]);
+	fp2_rdcn_low(c[1], a[1]);
+}
 
-	fp2_mul(r1, a[0], b[0]);
-	fp2_mul_u(t, a[1], b[1]);
-	fp2_add(r1, r1, t);
+// c = a*b, b in Fp2, 不约减
+static void fp4_mul_fp2_unr(dv4_t c, fp4_t a, fp2_t b)
+{
+	fp2_muln_low(c[0], a[0], b);
+	fp2_muln_low(c[1], a[1], b);
+}
 
-	fp2_copy(r[0], r0);
-	fp2_copy(r[1], r1);
+// c = a^2*v, 不约减
+static void fp4_sqr_v_unr(dv4_t c, fp4_t a)
+{
+	fp4_sqr_unr(c, a);
+	fp4_nord_low(c, c);
+}
 
-	fp2_free(r0);
-	fp2_free(r1);
-	fp2_free(t);
+// c = a*b*v, 不约减
+static void fp4_mul_v_unr(dv4_t c, fp4_t a, fp4_t b)
+{
+	fp4_mul_unr(c, a, b);
+	fp4_nord_low(c, c);
 }
 
 static void fp4_mul_fp(fp4_t r, const fp4_t a, const fp_t k)
@@ -587,44 +749,44 @@ static void fp4_conjugate(fp4_t r, const fp4_t a)
 
 void fp12_mul_t1(fp12_t r, const fp12_t a, const fp12_t b)
 {
-	fp4_t r0, r1, r2, t;
-
-	fp4_null(r0);
-	fp4_null(r1);
-	fp4_null(r2);
-	fp4_null(t);
-
-	fp4_new(r0);
-	fp4_new(r1);
-	fp4_new(r2);
-	fp4_new(t);
-
-	fp4_mul(r0, a[0][0], b[0][0]);
-	fp4_mul_v(t, a[0][2], b[1][1]);
-	fp4_add(r0, r0, t);
-	fp4_mul_v(t, a[1][1], b[0][2]);
-	fp4_add(r0, r0, t);
-
-	fp4_mul(r1, a[0][0], b[0][2]);
-	fp4_mul(t, a[0][2], b[0][0]);
-	fp4_add(r1, r1, t);
-	fp4_mul_v(t, a[1][1], b[1][1]);
-	fp4_add(r1, r1, t);
-
-	fp4_mul(r2, a[0][0], b[1][1]);
-	fp4_mul(t, a[0][2], b[0][2]);
-	fp4_add(r2, r2, t);
-	fp4_mul(t, a[1][1], b[0][0]);
-	fp4_add(r2, r2, t);
-
-	fp4_copy(r[0][0], r0);
-	fp4_copy(r[0][2], r1);
-	fp4_copy(r[1][1], r2);
-
-	fp4_free(r0);
-	fp4_free(r1);
-	fp4_free(r2);
-	fp4_free(t);
+	dv4_t r0, r1, r2, t;
+
+	dv4_null(r0);
+	dv4_null(r1);
+	dv4_null(r2);
+	dv4_null(t);
+
+	dv4_new(r0);
+	dv4_new(r1);
+	dv4_new(r2);
+	dv4_new(t);
+
+	fp4_mul_unr(r0, SM9_FP4(a, 0), SM9_FP4(b, 0));
+	fp4_mul_v_unr(t, SM9_FP4(a, 1), SM9_FP4(b, 2));
+	fp4_addc_low(r0, r0, t);
+	fp4_mul_v_unr(t, SM9_FP4(a, 2), SM9_FP4(b, 1));
+	fp4_addc_low(r0, r0, t);
+
+	fp4_mul_unr(r1, SM9_FP4(a, 0), SM9_FP4(b, 1));
+	fp4_mul_unr(t, SM9_FP4(a, 1), SM9_FP4(b, 0));
+	fp4_addc_low(r1, r1, t);
+	fp4_mul_v_unr(t, SM9_FP4(a, 2), SM9_FP4(b, 2));
+	fp4_addc_low(r1, r1, t);
+
+	fp4_mul_unr(r2, SM9_FP4(a, 0), SM9_FP4(b, 2));
+	fp4_mul_unr(t, SM9_FP4(a, 1), SM9_FP4(b, 1));
+	fp4_addc_low(r2, r2, t);
+	fp4_mul_unr(t, SM9_FP4(a, 2), SM9_FP4(b, 0));
+	fp4_addc_low(r2, r2, t);
+
+	fp4_rdcn_low(SM9_FP4(r, 0), r0);
+	fp4_rdcn_low(SM9_FP4(r, 1), r1);
+	fp4_rdcn_low(SM9_FP4(r, 2), r2);
+
+	dv4_free(r0);
+	dv4_free(r1);
+	dv4_free(r2);
+	dv4_free(t);
 }
 
 static void fp12_mul_unr_t(dv12_t c, fp12_t a, fp12_t b) {
@@ -740,41 +902,46 @@ void fp12_mul_t(fp12_t c, fp12_t a, fp12_t b) {
 Multiplicative twist curve 乘扭曲线下的稀疏乘法
 */
 void fp12_mul_sparse(fp12_t h, const fp12_t f, const fp12_t g){
-	fp4_t t0, t1, u0, u1, u2, t, h0, h1, h2;
+	dv4_t h0, h1, h2, t;
 
-	// 1. t0 = f0*g0
-	fp4_mul(t0, f[0][0], g[0][0]);
+	dv4_null(h0);
+	dv4_null(h1);
+	dv4_null(h2);
+	dv4_null(t);
 
-	// 2. t1 = Fp4SparseMul(f2, g2')
-	fp4_mul_fp2(t1, f[1][1], g[1][1]);
+	dv4_new(h0);
+	dv4_new(h1);
+	dv4_new(h2);
+	dv4_new(t);
 
-	// 3. u0 = Fp4SparseMul(f1+f2, g2')
-	fp4_add(u0, f[0][2], f[1][1]);
-	fp4_mul_fp2(u0, u0, g[1][1]);
+	// 中间结果都不约减, 最后每个 fp2 分量只约减一次.
+	// 不约减时 dv 上的加减比 Fp2 乘法更显眼, 这里不用 Karatsuba, 多两次 Fp2 乘法换掉全部减法
 
-	// 4. u1 = (f0+f2)*(g0+g2')
-	fp4_copy(t, g[0][0]);
-	fp2_add(t[0], t[0], g[1][1]);  // t = (g0+g2')
-	fp4_add(u1, f[0][0], f[1][1]);  // u1 = (f0+f2)
-	fp4_mul(u1, u1, t);
+	// 1. h0 = f0*g0 + f1*g2'v
+	fp4_mul_fp2_unr(h0, SM9_FP4(f, 1), SM9_FP2(g, 4));
+	fp4_nord_low(h0, h0);
+	fp4_mul_unr(t, SM9_FP4(f, 0), SM9_FP4(g, 0));
+	fp4_addc_low(h0, h0, t);
 
-	// 5. u2 = (f0+f1)*g0
-	fp4_add(u2, f[0][0], f[0][2]);
-	fp4_mul(u2, u2, g[0][0]);
+	// 2. h1 = f1*g0 + f2*g2'v
+	fp4_mul_fp2_unr(h1, SM9_FP4(f, 2), SM9_FP2(g, 4));
+	fp4_nord_low(h1, h1);
+	fp4_mul_unr(t, SM9_FP4(f, 1), SM9_FP4(g, 0));
+	fp4_addc_low(h1, h1, t);
 
-	// 6. h0 = t0 + (u0 - t1)v
-	fp4_sub(t, u0, t1);
-	fp4_mul_art(h[0][0], t);  // h0 = (u0 - t1)v
-	fp4_add(h[0][0], t0, h[0][0]);
+	// 3. h2 = f2*g0 + f0*g2'
+	fp4_mul_fp2_unr(h2, SM9_FP4(f, 0), SM9_FP2(g, 4));
+	fp4_mul_unr(t, SM9_FP4(f, 2), SM9_FP4(g, 0));
+	fp4_addc_low(h2, h2, t);
 
-	// 7. h1 = u2 - t0 + t1v
-	fp4_mul_art(h[0][2], t1);  // h1 = t1v
-	fp4_add(h[0][2], h[0][2], u2);
-	fp4_sub(h[0][2], h[0][2], t0);
+	fp4_rdcn_low(SM9_FP4(h, 0), h0);
+	fp4_rdcn_low(SM9_FP4(h, 1), h1);
+	fp4_rdcn_low(SM9_FP4(h, 2), h2);
 
-	// 8. h2 = u1 - t0 - t1
-	fp4_sub(h[1][1], u1, t0);
-	fp4_sub(h[1][1], h[1][1], t1);
+	dv4_free(h0);
+	dv4_free(h1);
+	dv4_free(h2);
+	dv4_free(t);
 }
 
 //f is normal fp12_t ,g is a sparse fp12_t, g = g0 + g2'w^2, g0 = g0' + g3'w^3，g0',g1',g3' all defined in fp2
@@ -833,6 +1000,49 @@ void fp12_mul_sparse2(fp12_t r, fp12_t a, fp12_t b){
 	fp4_mul_fp2_v(r[1][1], a[1][1], b[0][1]);
 }
 
+// c = a * b, a = a0 + a2'v^2 and b = b0 + b2'v^2 are both lines (a0, b0 in Fp4, a2', b2' in Fp2)
+// c = a0b0 + a2'b2' * v^4 + (a0b2' + a2'b0)v^2, v^4 = v^3 * v puts a2'b2' in c[1][0], c[0][2] = 0
+void fp12_mul_line2(fp12_t c, const fp12_t a, const fp12_t b){
+	fp4_t t1, t2;
+	dv4_t u0, u1;
+	dv2_t t;
+
+	fp4_null(t1);
+	fp4_null(t2);
+	dv4_null(u0);
+	dv4_null(u1);
+	dv2_null(t);
+
+	fp4_new(t1);
+	fp4_new(t2);
+	dv4_new(u0);
+	dv4_new(u1);
+	dv2_new(t);
+
+	fp4_mul_unr(u0, SM9_FP4(a, 0), SM9_FP4(b, 0));
+	fp2_muln_low(t, SM9_FP2(a, 4), SM9_FP2(b, 4));
+
+	// Karatsuba: (a0 + a2')(b0 + b2') - a0b0 - a2'b2', 不约减
+	fp2_add(t1[0], SM9_FP2(a, 0), SM9_FP2(a, 4));
+	fp2_copy(t1[1], SM9_FP2(a, 1));
+	fp2_add(t2[0], SM9_FP2(b, 0), SM9_FP2(b, 4));
+	fp2_copy(t2[1], SM9_FP2(b, 1));
+	fp4_mul_unr(u1, t1, t2);
+	fp4_subc_low(u1, u1, u0);
+	fp2_subc_low(u1[0], u1[0], t);
+
+	fp4_rdcn_low(SM9_FP4(c, 0), u0);
+	fp2_zero(c[0][2]);
+	fp2_rdcn_low(c[1][0], t);
+	fp4_rdcn_low(SM9_FP4(c, 2), u1);
+
+	fp4_free(t1);
+	fp4_free(t2);
+	dv4_free(u0);
+	dv4_free(u1);
+	dv2_free(t);
+}
+
 // as same as conjugate in Fp12
 void fp12_inv_cyc_t(fp12_t c, fp12_t a) {
 	fp2_copy(c[0][0],a[0][0]);
@@ -931,6 +1141,74 @@ void fp12_inv_t(fp12_t r, fp12_t a){
 
 }
 
+// Montgomery 同时求逆: n 个元素共用一次 fp4 求逆
+void fp12_inv_sim_t(fp12_t c[], fp12_t a[], int n) {
+	fp4_t u, *t = RLC_ALLOCA(fp4_t, n * 4);
+	fp4_t
+		*t0 = t + 0 * n,
+		*t1 = t + 1 * n,
+		*t2 = t + 2 * n,
+		*t3 = t + 3 * n;
+
+	if (n == 0) {
+		RLC_FREE(t);
+		return;
+	}
+
+	fp4_null(u);
+
+	RLC_TRY {
+		if (t == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (int i = 0; i < 4 * n; i++) {
+			fp4_null(t[i]);
+			fp4_new(t[i]);
+		}
+		fp4_new(u);
+
+		for (int i = 0; i < n; i++) {
+			/* t0 = a0^2 - a1 * a2 * v. */
+			fp4_sqr(t0[i], SM9_FP4(a[i], 0));
+			fp4_mul(u, SM9_FP4(a[i], 1), SM9_FP4(a[i], 2));
+			fp4_mul_art(u, u);
+			fp4_sub(t0[i], t0[i], u);
+			/* t1 = a2^2 * v - a0 * a1. */
+			fp4_sqr(t1[i], SM9_FP4(a[i], 2));
+			fp4_mul_art(t1[i], t1[i]);
+			fp4_mul(u, SM9_FP4(a[i], 0), SM9_FP4(a[i], 1));
+			fp4_sub(t1[i], t1[i], u);
+			/* t2 = a1^2 - a0 * a2. */
+			fp4_sqr(t2[i], SM9_FP4(a[i], 1));
+			fp4_mul(u, SM9_FP4(a[i], 0), SM9_FP4(a[i], 2));
+			fp4_sub(t2[i], t2[i], u);
+			/* t3 = a0 * t0 + (a2 * t1 + a1 * t2) * v. */
+			fp4_mul(t3[i], SM9_FP4(a[i], 2), t1[i]);
+			fp4_mul(u, SM9_FP4(a[i], 1), t2[i]);
+			fp4_add(t3[i], t3[i], u);
+			fp4_mul_art(t3[i], t3[i]);
+			fp4_mul(u, SM9_FP4(a[i], 0), t0[i]);
+			fp4_add(t3[i], t3[i], u);
+		}
+
+		fp4_inv_sim(t3, t3, n);
+
+		for (int i = 0; i < n; i++) {
+			fp4_mul(SM9_FP4(c[i], 0), t0[i], t3[i]);
+			fp4_mul(SM9_FP4(c[i], 1), t1[i], t3[i]);
+			fp4_mul(SM9_FP4(c[i], 2), t2[i], t3[i]);
+		}
+	} RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	} RLC_FINALLY {
+		for (int i = 0; i < 4 * n; i++) {
+			fp4_free(t[i]);
+		}
+		fp4_free(u);
+		RLC_FREE(t);
+	}
+}
+
 
 
 static void fp12_sqr_unr_t(dv12_t c, fp12_t a) {
@@ -1057,41 +1335,41 @@ void fp12_sqr_t(fp12_t c, const fp12_t a) {
 
 static void fp12_sqr_t1(fp12_t r, const fp12_t a)
 {
-	fp4_t r0, r1, r2, t;
+	dv4_t r0, r1, r2, t;
 
-	fp4_null(r0);
-	fp4_null(r1);
-	fp4_null(r2);
-	fp4_null(t);
+	dv4_null(r0);
+	dv4_null(r1);
+	dv4_null(r2);
+	dv4_null(t);
 
-	fp4_new(r0);
-	fp4_new(r1);
-	fp4_new(r2);
-	fp4_new(t);
+	dv4_new(r0);
+	dv4_new(r1);
+	dv4_new(r2);
+	dv4_new(t);
 
-	fp4_sqr(r0, a[0][0]);
-	fp4_mul_v(t, a[0][2], a[1][1]);
-	fp4_dbl(t, t);
-	fp4_add(r0, r0, t);
+	fp4_sqr_unr(r0, SM9_FP4(a, 0));
+	fp4_mul_v_unr(t, SM9_FP4(a, 1), SM9_FP4(a, 2));
+	fp4_addc_low(t, t, t);
+	fp4_addc_low(r0, r0, t);
 
-	fp4_mul(r1, a[0][0], a[0][2]);
-	fp4_dbl(r1, r1);
-	fp4_sqr_v(t, a[1][1]);
-	fp4_add(r1, r1, t);
+	fp4_mul_unr(r1, SM9_FP4(a, 0), SM9_FP4(a, 1));
+	fp4_addc_low(r1, r1, r1);
+	fp4_sqr_v_unr(t, SM9_FP4(a, 2));
+	fp4_addc_low(r1, r1, t);
 
-	fp4_mul(r2, a[0][0], a[1][1]);
-	fp4_dbl(r2, r2);
-	fp4_sqr(t, a[0][2]);
-	fp4_add(r2, r2, t);
+	fp4_mul_unr(r2, SM9_FP4(a, 0), SM9_FP4(a, 2));
+	fp4_addc_low(r2, r2, r2);
+	fp4_sqr_unr(t, SM9_FP4(a, 1));
+	fp4_addc_low(r2, r2, t);
 
-	fp4_copy(r[0][0], r0);
-	fp4_copy(r[0][2], r1);
-	fp4_copy(r[1][1], r2);
+	fp4_rdcn_low(SM9_FP4(r, 0), r0);
+	fp4_rdcn_low(SM9_FP4(r, 1), r1);
+	fp4_rdcn_low(SM9_FP4(r, 2), r2);
 
-	fp4_free(r0);
-	fp4_free(r1);
-	fp4_free(r2);
-	fp4_free(t);
+	dv4_free(r0);
+	dv4_free(r1);
+	dv4_free(r2);
+	dv4_free(t);
 }
 
 static void fp12_set(fp12_t r, const fp4_t a0, const fp4_t a1, const fp4_t a2)
@@ -1296,6 +1574,17 @@ void fp12_back_cyc_sim_t(fp12_t c[], fp12_t a[], int n) {
 		}
 
 		for (int i = 0; i < n; i++) {
+			if (fp2_is_zero(a[i][0][2])) {
+				/* g2 = 0, t0 = 2 * g4 * g5, t1 = g3. */
+				fp2_mul(t0[i], a[i][1][1], a[i][1][2]);
+				fp2_dbl(t0[i], t0[i]);
+				fp2_copy(t1[i], a[i][1][0]);
+				/* g2 = g3 = 0 only for the identity, then g1 = 0. */
+				if (fp2_is_zero(t1[i])) {
+					fp2_set_dig(t1[i], 1);
+				}
+				continue;
+			}
 			/* t0 = g4^2. */
 			fp2_sqr(t0[i], a[i][1][1]);
 			/* t1 = 3 * g4^2 - 2 * g3. */
@@ -1416,889 +1705,1794 @@ static void fp12_pow_t(fp12_t c, fp12_t a, bn_t b) {
 	}
 }
 
-//modify from fp12_exp_cyc_sps
-void fp12_pow_cyc_sps_t(fp12_t c, fp12_t a, const int *b, int len, int sign) {
-	int i, j, k, w = len;
-    fp12_t t, *u = RLC_ALLOCA(fp12_t, w);
+// GT 变基幂的 wNAF 窗口宽度, 预计算 2^(SM9_GT_WIDTH-2) 个奇数次幂
+#define SM9_GT_WIDTH	5
 
-	if (len == 0) {
-		RLC_FREE(u);
-		fp12_set_dig(c, 1);
-		return;
-	}
+// modify from fp12_exp_cyc, a is in the cyclotomic subgroup (GT), negative digits use the conjugate
+void fp12_pow_cyc_t(fp12_t c, fp12_t a, const bn_t b) {
+	int8_t naf[RLC_FP_BITS + 1];
+	int i, l = RLC_FP_BITS + 1;
+	fp12_t t[1 << (SM9_GT_WIDTH - 2)], u, v;
+	bn_t n, _b;
 
-	fp12_null(t);
+	bn_null(n);
+	bn_null(_b);
+	fp12_null(u);
+	fp12_null(v);
 
 	RLC_TRY {
-		if (u == NULL) {
-			RLC_THROW(ERR_NO_MEMORY);
-		}
-		for (i = 0; i < w; i++) {
-			fp12_null(u[i]);
-			fp12_new(u[i]);
+		bn_new(n);
+		bn_new(_b);
+		fp12_new(u);
+		fp12_new(v);
+		for (i = 0; i < (1 << (SM9_GT_WIDTH - 2)); i++) {
+			fp12_null(t[i]);
+			fp12_new(t[i]);
 		}
-		fp12_new(t);
-
-		fp12_copy(t, a);
-		if (b[0] == 0) {
-			for (j = 0, i = 1; i < len; i++) {
-				k = (b[i] < 0 ? -b[i] : b[i]);
-				for (; j < k; j++) {
-					fp12_sqr_pck_t(t, t);
-				}
-				if (b[i] < 0) {
-					fp12_inv_cyc_t(u[i - 1], t);
-				} else {
-					fp12_copy(u[i - 1], t);
-				}
-			}
 
-			fp12_back_cyc_sim_t(u, u, w - 1);
+		g1_get_ord(n);
+		bn_abs(_b, b);
+		bn_mod(_b, _b, n);
+		if (bn_is_zero(_b)) {
+			fp12_set_dig(c, 1);
+		} else {
+			bn_rec_naf(naf, &l, _b, SM9_GT_WIDTH);
 
-			fp12_copy(c, a);
-			for (i = 0; i < w - 1; i++) {
-				fp12_mul_t(c, c, u[i]);
+			/* t[i] = a^(2i + 1). */
+			fp12_copy(t[0], a);
+			fp12_sqr_cyc_t(u, a);
+			for (i = 1; i < (1 << (SM9_GT_WIDTH - 2)); i++) {
+				fp12_mul_t(t[i], t[i - 1], u);
 			}
-		} else {
-			for (j = 0, i = 0; i < len; i++) {
-				k = (b[i] < 0 ? -b[i] : b[i]);
-				for (; j < k; j++) {
-					fp12_sqr_pck_t(t, t);
-				}
-				if (b[i] < 0) {
-					fp12_inv_cyc_t(u[i], t);
-				} else {
-					fp12_copy(u[i], t);
+
+			/* The leading digit is positive. */
+			fp12_copy(u, t[naf[l - 1] / 2]);
+			for (i = l - 2; i >= 0; i--) {
+				fp12_sqr_cyc_t(u, u);
+				if (naf[i] > 0) {
+					fp12_mul_t(u, u, t[naf[i] / 2]);
+				} else if (naf[i] < 0) {
+					fp12_inv_cyc_t(v, t[-naf[i] / 2]);
+					fp12_mul_t(u, u, v);
 				}
 			}
 
-			fp12_back_cyc_sim_t(u, u, w);
-
-			fp12_copy(c, u[0]);
-			for (i = 1; i < w; i++) {
-				fp12_mul_t(c, c, u[i]);
+			if (bn_sign(b) == RLC_NEG) {
+				fp12_inv_cyc_t(c, u);
+			} else {
+				fp12_copy(c, u);
 			}
 		}
-
-		if (sign == RLC_NEG) {
-			fp12_inv_cyc_t(c, c);
-		}
 	}
 	RLC_CATCH_ANY {
 		RLC_THROW(ERR_CAUGHT);
 	}
 	RLC_FINALLY {
-		for (i = 0; i < w; i++) {
-			fp12_free(u[i]);
+		bn_free(n);
+		bn_free(_b);
+		fp12_free(u);
+		fp12_free(v);
+		for (i = 0; i < (1 << (SM9_GT_WIDTH - 2)); i++) {
+			fp12_free(t[i]);
 		}
-		fp12_free(t);
-		RLC_FREE(u);
 	}
 }
 
-void fp12_frb_t(fp12_t c, fp12_t a, int i) {
+// modify from ep_mul_pre_combs, t[i] = prod g^(2^(j*l)) over the bits j of i
+void fp12_pow_fix_pre(fp12_t *t, fp12_t g) {
+	int i, j, l;
+	bn_t n;
 
-	fp12_copy(c, a);
-	for (; i % 12 > 0; i--) {
-		fp2_frb(c[0][0], c[0][0], 1);
-		fp2_frb(c[1][1], c[1][1], 1);
-		fp2_frb(c[1][0], c[1][0], 1);
-		fp2_mul_frb(c[1][1], c[1][1], 1, 2);
-		fp2_mul_frb(c[1][0], c[1][0], 1, 4);
+	bn_null(n);
 
-		fp2_frb(c[0][2], c[0][2], 1);
-		fp2_frb(c[0][1], c[0][1], 1);
-		fp2_frb(c[1][2], c[1][2], 1);
-		fp2_mul_frb(c[0][2], c[0][2], 1, 1);
-		fp2_mul_frb(c[0][1], c[0][1], 1, 3);
-		fp2_mul_frb(c[1][2], c[1][2], 1, 5);
+	RLC_TRY {
+		bn_new(n);
+
+		g1_get_ord(n);
+		l = RLC_CEIL(bn_bits(n), PP_DEPTH);
+
+		fp12_set_dig(t[0], 1);
+		fp12_copy(t[1], g);
+		for (j = 1; j < PP_DEPTH; j++) {
+			fp12_sqr_cyc_t(t[1 << j], t[1 << (j - 1)]);
+			for (i = 1; i < l; i++) {
+				fp12_sqr_cyc_t(t[1 << j], t[1 << j]);
+			}
+			for (i = 1; i < (1 << j); i++) {
+				fp12_mul_t(t[(1 << j) + i], t[i], t[1 << j]);
+			}
+		}
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
 	}
 }
 
-static void fp12_frobenius(fp12_t r, const fp12_t x)
-{
+// c = a if cond, without a branch on cond
+static void fp12_copy_sec_t(fp12_t c, fp12_t a, dig_t cond) {
+	for (int i = 0; i < 2; i++) {
+		for (int k = 0; k < 3; k++) {
+			dv_copy_cond(c[i][k][0], a[i][k][0], RLC_FP_DIGS, cond);
+			dv_copy_cond(c[i][k][1], a[i][k][1], RLC_FP_DIGS, cond);
+		}
+	}
+}
 
-	const fp2_t *xa = x[0][0];
-	const fp2_t *xb = x[0][2];
-	const fp2_t *xc = x[1][1];
-	fp4_t ra;
-	fp4_t rb;
-	fp4_t rc;
+// c = t[w], every one of the n entries of the table is read
+static void fp12_pow_fix_get(fp12_t c, fp12_t *t, int n, int w) {
+	dig_t d, cond;
 
-	fp4_null(ra);
-	fp4_null(rb);
-	fp4_null(rc);
+	for (int j = 0; j < n; j++) {
+		d = (dig_t)(j ^ w);
+		cond = ((d | -d) >> (RLC_DIG - 1)) ^ 1;
+		fp12_copy_sec_t(c, t[j], cond);
+	}
+}
 
-	fp4_new(ra);
-	fp4_new(rb);
-	fp4_new(rc);
+// modify from ep_mul_combs_plain, g is an element of GT
+static void fp12_pow_fix_imp(fp12_t c, fp12_t *t, const bn_t k, int sec) {
+	int i, j, l, w, p0, p1;
+	bn_t n, _k;
+	fp12_t u;
 
-	fp2_conjugate(ra[0], xa[0]);
-	fp2_conjugate(ra[1], xa[1]);
-	fp2_mul_fp(ra[1], ra[1], SM9_ALPHA3);
+	if (bn_is_zero(k)) {
+		fp12_set_dig(c, 1);
+		return;
+	}
 
-	fp2_conjugate(rb[0], xb[0]);
-	fp2_mul_fp(rb[0], rb[0], SM9_ALPHA1);
-	fp2_conjugate(rb[1], xb[1]);
-	fp2_mul_fp(rb[1], rb[1], SM9_ALPHA4);
+	bn_null(n);
+	bn_null(_k);
+	fp12_null(u);
 
-	fp2_conjugate(rc[0], xc[0]);
-	fp2_mul_fp(rc[0], rc[0], SM9_ALPHA2);
-	fp2_conjugate(rc[1], xc[1]);
-	fp2_mul_fp(rc[1], rc[1], SM9_ALPHA5);
+	RLC_TRY {
+		bn_new(n);
+		bn_new(_k);
+		fp12_new(u);
 
-	fp12_set(r, ra, rb, rc);
+		g1_get_ord(n);
+		l = RLC_CEIL(bn_bits(n), PP_DEPTH);
 
-	fp4_free(ra);
-	fp4_free(rb);
-	fp4_free(rc);
-}
+		bn_abs(_k, k);
+		bn_mod(_k, _k, n);
+		p0 = PP_DEPTH * l - 1;
 
-static void fp12_frobenius2(fp12_t r, const fp12_t x)
-{
-	fp4_t a;
-	fp4_t b;
-	fp4_t c;
-	
-	fp4_null(a);
-	fp4_null(b);
-	fp4_null(c);
+		fp12_set_dig(u, 1);
+		for (i = l - 1; i >= 0; i--) {
+			fp12_sqr_cyc_t(u, u);
 
-	fp4_new(a);
-	fp4_new(b);
-	fp4_new(c);
-	
-	fp4_conjugate(a, x[0][0]);
-	fp4_conjugate(b, x[0][2]);
-	fp4_mul_fp(b, b, SM9_ALPHA2);
-	fp4_conjugate(c, x[1][1]);
-	fp4_mul_fp(c, c, SM9_ALPHA4);
+			w = 0;
+			p1 = p0--;
+			for (j = PP_DEPTH - 1; j >= 0; j--, p1 -= l) {
+				w = (w << 1) | bn_get_bit(_k, p1);
+			}
+			if (sec) {
+				fp12_pow_fix_get(c, t, SM9_FIX_TABLE, w);
+				fp12_mul_t(u, u, c);
+			} else if (w > 0) {
+				fp12_mul_t(u, u, t[w]);
+			}
+		}
 
-	fp4_copy(r[0][0], a);
-	fp4_copy(r[0][2], b);
-	fp4_copy(r[1][1], c);
+		if (bn_sign(k) == RLC_NEG) {
+			fp12_inv_cyc_t(c, u);
+		} else {
+			fp12_copy(c, u);
+		}
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
+		bn_free(_k);
+		fp12_free(u);
+	}
+}
 
-	fp4_free(a);
-	fp4_free(b);
-	fp4_free(c);
+void fp12_pow_fix(fp12_t c, fp12_t *t, const bn_t k) {
+	fp12_pow_fix_imp(c, t, k, 0);
 }
 
-static void fp12_frobenius3(fp12_t r, const fp12_t x)
-{
-	const fp2_t *xa = x[0][0];
-	const fp2_t *xb = x[0][2];
-	const fp2_t *xc = x[1][1];
-	fp4_t ra;
-	fp4_t rb;
-	fp4_t rc;
+void fp12_pow_fix_sec(fp12_t c, fp12_t *t, const bn_t k) {
+	fp12_pow_fix_imp(c, t, k, 1);
+}
 
-	fp4_null(ra);
-	fp4_null(rb);
-	fp4_null(rc);
+// modify from ep_mul_pre_combs, signed comb of SM9_DS_TEETH teeth covering one GLV component,
+// t[i] = B[d-1] + sum_{j<d-1} (bit j of i ? B[j] : -B[j]) with B[j] = 2^(j*l) p, affine entries
+void ep_mul_fix_glv_pre(ep_t *t, const ep_t p) {
+	int i, j, l;
+	bn_t n;
+	ep_t b[SM9_DS_TEETH], u;
 
-	fp4_new(ra);
-	fp4_new(rb);
-	fp4_new(rc);
+	bn_null(n);
+	ep_null(u);
 
-	fp2_conjugate(ra[0], xa[0]);
-	fp2_conjugate(ra[1], xa[1]);
-	fp2_mul(ra[1], ra[1], SM9_BETA);
-	fp2_neg(ra[1], ra[1]);
+	RLC_TRY {
+		bn_new(n);
+		ep_new(u);
+		for (j = 0; j < SM9_DS_TEETH; j++) {
+			ep_null(b[j]);
+			ep_new(b[j]);
+		}
 
-	fp2_conjugate(rb[0], xb[0]);
-	fp2_mul(rb[0], rb[0], SM9_BETA);
-	fp2_conjugate(rb[1], xb[1]);
+		ep_curve_get_ord(n);
+		l = RLC_CEIL(bn_bits(n) / 2 + 1, SM9_DS_TEETH);
 
-	fp2_conjugate(rc[0], xc[0]);
-	fp2_neg(rc[0], rc[0]);
-	fp2_conjugate(rc[1], xc[1]);
-	fp2_mul(rc[1], rc[1], SM9_BETA);
+		ep_norm(b[0], p);
+		for (j = 1; j < SM9_DS_TEETH; j++) {
+			ep_dbl(b[j], b[j - 1]);
+			for (i = 1; i < l; i++) {
+				ep_dbl(b[j], b[j]);
+			}
+		}
 
-	fp4_copy(r[0][0], ra);
-	fp4_copy(r[0][2], rb);
-	fp4_copy(r[1][1], rc);
+		ep_copy(t[0], b[SM9_DS_TEETH - 1]);
+		for (j = 0; j < SM9_DS_TEETH - 1; j++) {
+			ep_sub(t[0], t[0], b[j]);
+		}
+		for (j = 0; j < SM9_DS_TEETH - 1; j++) {
+			ep_dbl(u, b[j]);
+			for (i = 0; i < (1 << j); i++) {
+				ep_add(t[(1 << j) + i], t[i], u);
+			}
+		}
+		ep_norm_sim(t, (const ep_t *)t, SM9_DS_TABLE);
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
+		ep_free(u);
+		for (j = 0; j < SM9_DS_TEETH; j++) {
+			ep_free(b[j]);
+		}
+	}
+}
 
-	fp4_free(ra);
-	fp4_free(rb);
-	fp4_free(rc);
+// r = column i of the comb for e = (k + 2^(d*l) - 1) / 2, whose digits are all +-1,
+// the top tooth fixes the sign; every entry of the table is read
+static void ep_mul_fix_glv_get(ep_t r, const ep_t *t, const bn_t e, int i, int l, int neg) {
+	int j, w, top;
+	dig_t d, cond;
+	fp_t y;
+
+	fp_null(y);
+	fp_new(y);
+
+	w = 0;
+	for (j = SM9_DS_TEETH - 2; j >= 0; j--) {
+		w = (w << 1) | bn_get_bit(e, i + j * l);
+	}
+	top = bn_get_bit(e, i + (SM9_DS_TEETH - 1) * l);
+	w ^= (top - 1) & (SM9_DS_TABLE - 1);
+
+	for (j = 0; j < SM9_DS_TABLE; j++) {
+		d = (dig_t)(j ^ w);
+		cond = ((d | -d) >> (RLC_DIG - 1)) ^ 1;
+		dv_copy_cond(r->x, t[j]->x, RLC_FP_DIGS, cond);
+		dv_copy_cond(r->y, t[j]->y, RLC_FP_DIGS, cond);
+	}
+	fp_set_dig(r->z, 1);
+	r->coord = BASIC;
+
+	fp_neg(y, r->y);
+	dv_copy_cond(r->y, y, RLC_FP_DIGS, (top ^ 1) ^ neg);
+	fp_free(y);
 }
 
-static void fp12_frobenius6(fp12_t r, const fp12_t x)
-{
-	fp4_t a;
-	fp4_t b;
-	fp4_t c;
+// modify from ep_mul_reg_glv, r = k * p with the table of ep_mul_fix_glv_pre, k = k0 + k1 * lambda,
+// both components go through the same comb (psi on the selected point), even components are made odd
+// and corrected at the end; bn_rec_glv itself uses RELIC's variable-time bn arithmetic
+void ep_mul_fix_glv_sec(ep_t r, const ep_t *t, const ep_t p, const bn_t k) {
+	int i, j, l, s[2];
+	dig_t b[2];
+	bn_t n, _k, x, e[2], v1[3], v2[3];
+	ep_t q, u, v;
 
-	fp4_null(a);
-	fp4_null(b);
-	fp4_null(c);
+	bn_null(n);
+	bn_null(_k);
+	bn_null(x);
+	ep_null(q);
+	ep_null(u);
+	ep_null(v);
 
-	fp4_new(a);
-	fp4_new(b);
-	fp4_new(c);
+	RLC_TRY {
+		bn_new(n);
+		bn_new(_k);
+		bn_new(x);
+		ep_new(q);
+		ep_new(u);
+		ep_new(v);
+		for (i = 0; i < 2; i++) {
+			bn_null(e[i]);
+			bn_new(e[i]);
+		}
+		for (i = 0; i < 3; i++) {
+			bn_null(v1[i]);
+			bn_null(v2[i]);
+			bn_new(v1[i]);
+			bn_new(v2[i]);
+		}
 
-	fp4_copy(a, x[0][0]);
-	fp4_copy(b, x[0][2]);
-	fp4_copy(c, x[1][1]);
+		ep_copy(q, p);
+		ep_curve_get_ord(n);
+		ep_curve_get_v1(v1);
+		ep_curve_get_v2(v2);
+
+		bn_abs(_k, k);
+		bn_mod(_k, _k, n);
+		bn_rec_glv(e[0], e[1], _k, n, (const bn_t *)v1, (const bn_t *)v2);
+
+		l = RLC_CEIL(bn_bits(n) / 2 + 1, SM9_DS_TEETH);
+		bn_set_2b(x, SM9_DS_TEETH * l);
+		bn_sub_dig(x, x, 1);
+		for (i = 0; i < 2; i++) {
+			s[i] = (bn_sign(e[i]) == RLC_NEG);
+			bn_abs(e[i], e[i]);
+			b[i] = bn_is_even(e[i]);
+			e[i]->dp[0] |= b[i];
+			bn_add(e[i], e[i], x);
+			bn_hlv(e[i], e[i]);
+		}
 
-	fp4_conjugate(a, a);
-	fp4_conjugate(b, b);
-	fp4_neg(b, b);
-	fp4_conjugate(c, c);
+		ep_mul_fix_glv_get(r, t, e[0], l - 1, l, s[0]);
+		ep_mul_fix_glv_get(u, t, e[1], l - 1, l, s[1]);
+		ep_psi(u, u);
+		ep_add(r, r, u);
+		for (i = l - 2; i >= 0; i--) {
+			ep_dbl(r, r);
+			ep_mul_fix_glv_get(u, t, e[0], i, l, s[0]);
+			ep_add(r, r, u);
+			ep_mul_fix_glv_get(u, t, e[1], i, l, s[1]);
+			ep_psi(u, u);
+			ep_add(r, r, u);
+		}
 
-	fp4_copy(r[0][0], a);
-	fp4_copy(r[0][2], b);
-	fp4_copy(r[1][1], c);
+		// r -= (+-p) for an even k0, r -= psi(+-p) for an even k1
+		for (j = 0; j < 2; j++) {
+			ep_neg(u, q);
+			ep_copy(v, q);
+			dv_copy_cond(v->y, u->y, RLC_FP_DIGS, s[j]);
+			if (j == 1) {
+				ep_psi(v, v);
+			}
+			ep_sub(u, r, v);
+			dv_copy_cond(r->x, u->x, RLC_FP_DIGS, b[j]);
+			dv_copy_cond(r->y, u->y, RLC_FP_DIGS, b[j]);
+			dv_copy_cond(r->z, u->z, RLC_FP_DIGS, b[j]);
+		}
 
-	fp4_free(a);
-	fp4_free(b);
-	fp4_free(c);
+		ep_norm(r, r);
+		ep_neg(u, r);
+		dv_copy_cond(r->y, u->y, RLC_FP_DIGS, bn_sign(k) == RLC_NEG);
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
+		bn_free(_k);
+		bn_free(x);
+		ep_free(q);
+		ep_free(u);
+		ep_free(v);
+		for (i = 0; i < 2; i++) {
+			bn_free(e[i]);
+		}
+		for (i = 0; i < 3; i++) {
+			bn_free(v1[i]);
+			bn_free(v2[i]);
+		}
+	}
 }
 
-void fp12_conv_cyc_t(fp12_t c, fp12_t a) {
-	fp12_t t;
+// modify from ep2_mul_glv_imp, r = k * p with k = k0 + k1 p + k2 p^2 + k3 p^3 (bn_rec_frb),
+// one window NAF of width EP_WIDTH per component, the odd multiples of psi^i(p) come from ep2_frb
+void ep2_mul_gls(ep2_t r, ep2_t p, const bn_t k) {
+	int8_t naf[4][RLC_FP_BITS + 1];
+	int i, j, d, l, _l[4];
+	bn_t n, u, _k[4];
+	ep2_t q, t[4][1 << (EP_WIDTH - 2)];
 
-	fp12_null(t);
+	if (bn_is_zero(k) || ep2_is_infty(p)) {
+		ep2_set_infty(r);
+		return;
+	}
+
+	bn_null(n);
+	bn_null(u);
+	ep2_null(q);
 
 	RLC_TRY {
-		fp12_new(t);
+		bn_new(n);
+		bn_new(u);
+		ep2_new(q);
+		for (i = 0; i < 4; i++) {
+			bn_null(_k[i]);
+			bn_new(_k[i]);
+			for (j = 0; j < (1 << (EP_WIDTH - 2)); j++) {
+				ep2_null(t[i][j]);
+				ep2_new(t[i][j]);
+			}
+		}
 
-		/* First, compute c = a^(p^6 - 1). */
-		/* t = a^{-1}. */
-		fp12_inv_t(t, a);
-		/* c = a^(p^6). */
-		fp12_inv_cyc_t(c, a);
-		/* c = a^(p^6 - 1). */
-		fp12_mul_t(c, c, t);
+		ep2_curve_get_ord(n);
+		if (sm9_get_par(u) != 1) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		bn_abs(_k[0], k);
+		bn_mod(_k[0], _k[0], n);
+		bn_rec_frb(_k, 4, _k[0], u, n, 0);
+
+		/* t[i][j] = (2j + 1) * psi^i(p). */
+		ep2_norm(t[0][0], p);
+		ep2_dbl(q, t[0][0]);
+		for (j = 1; j < (1 << (EP_WIDTH - 2)); j++) {
+			ep2_add(t[0][j], t[0][j - 1], q);
+		}
+		ep2_norm_sim(t[0] + 1, t[0] + 1, (1 << (EP_WIDTH - 2)) - 1);
+		for (i = 1; i < 4; i++) {
+			for (j = 0; j < (1 << (EP_WIDTH - 2)); j++) {
+				ep2_frb(t[i][j], t[i - 1][j], 1);
+			}
+		}
 
-		/* Second, compute c^(p^2 + 1). */
-		/* t = c^(p^2). */
-		fp12_frb_t(t, c, 2);
+		l = 0;
+		for (i = 0; i < 4; i++) {
+			if (bn_sign(_k[i]) == RLC_NEG) {
+				for (j = 0; j < (1 << (EP_WIDTH - 2)); j++) {
+					ep2_neg(t[i][j], t[i][j]);
+				}
+			}
+			_l[i] = RLC_FP_BITS + 1;
+			bn_rec_naf(naf[i], &_l[i], _k[i], EP_WIDTH);
+			l = RLC_MAX(l, _l[i]);
+		}
 
-		/* c = c^(p^2 + 1). */
-		fp12_mul_t(c, c, t);
+		ep2_set_infty(q);
+		for (j = l - 1; j >= 0; j--) {
+			ep2_dbl(q, q);
+			for (i = 0; i < 4; i++) {
+				if (j >= _l[i]) {
+					continue;
+				}
+				d = naf[i][j];
+				if (d > 0) {
+					ep2_add(q, q, t[i][d / 2]);
+				} else if (d < 0) {
+					ep2_sub(q, q, t[i][-d / 2]);
+				}
+			}
+		}
+
+		ep2_norm(r, q);
+		if (bn_sign(k) == RLC_NEG) {
+			ep2_neg(r, r);
+		}
 	}
 	RLC_CATCH_ANY {
 		RLC_THROW(ERR_CAUGHT);
 	}
 	RLC_FINALLY {
-		fp12_free(t);
+		bn_free(n);
+		bn_free(u);
+		ep2_free(q);
+		for (i = 0; i < 4; i++) {
+			bn_free(_k[i]);
+			for (j = 0; j < (1 << (EP_WIDTH - 2)); j++) {
+				ep2_free(t[i][j]);
+			}
+		}
 	}
 }
 
-#include <inttypes.h>
-static void ep2_pi1(ep2_t R, const ep2_t P)
-{
- //const c = 0x3f23ea58e5720bdb843c6cfa9c08674947c5c86e0ddd04eda91d8354377b698bn;
- fp_t c = {0x1a98dfbd4575299f, 0x9ec8547b245c54fd, 0xf51f5eac13df846c, 0x9ef74015d5a16393};
- // fp_null(c);
- // fp_new(c);
+// modify from ep2_mul_pre_combs, the comb table of P2 has 2^depth affine entries
+static SM9_G2_GEN *sm9_g2_gen_new(int depth) {
+	int i, j, l;
+	SM9_G2_GEN *g;
+	ep2_t *t;
+	bn_t n;
 
- // char c_str[] = "3F23EA58E5720BDB843C6CFA9C08674947C5C86E0DDD04EDA91D8354377B698B";
+	g = (SM9_G2_GEN *)malloc(sizeof(SM9_G2_GEN));
+	t = (ep2_t *)malloc(sizeof(ep2_t) << depth);
+	if (g == NULL || t == NULL) {
+		free(g);
+		free(t);
+		error_print();
+		return NULL;
+	}
+	for (i = 0; i < (1 << depth); i++) {
+		ep2_null(t[i]);
+		ep2_new(t[i]);
+	}
 
- // fp_read_str(c, c_str, strlen(c_str), 16);
- // printf("c[0] = %"PRIx64"\n", c[0]);
- // printf("c[1] = %"PRIx64"\n", c[1]);
- // printf("c[2] = %"PRIx64"\n", c[2]);
- // printf("c[3] = %"PRIx64"\n", c[3]);
- // return 1;
+	bn_null(n);
+	bn_new(n);
+	ep2_curve_get_ord(n);
+	l = RLC_CEIL(bn_bits(n), depth);
+
+	ep2_set_infty(t[0]);
+	ep2_curve_get_gen(t[1]);
+	for (j = 1; j < depth; j++) {
+		ep2_dbl(t[1 << j], t[1 << (j - 1)]);
+		for (i = 1; i < l; i++) {
+			ep2_dbl(t[1 << j], t[1 << j]);
+		}
+		for (i = 1; i < (1 << j); i++) {
+			ep2_add(t[(1 << j) + i], t[i], t[1 << j]);
+		}
+	}
+	ep2_norm_sim(t + 2, t + 2, (1 << depth) - 2);
+	bn_free(n);
 
- fp2_conjugate(R->x, P->x);  // X[0], -X[1]
- fp2_conjugate(R->y, P->y);
- fp2_conjugate(R->z, P->z);
- fp2_mul_fp(R->z, R->z, c);
+	g->tab = t;
+	g->depth = depth;
+	g->prev = NULL;
+	return g;
+}
 
- fp_free(c);
+// 在 sm9_lock 内调用. 换表之后没有正在做的乘法时, 旧表不会再被读到, 可以释放;
+// 乘法先加 sm9_g2_gen_users 再读表指针, 两边都用 SEQ_CST, 看到 0 就说明之后的乘法只会读到新表
+static void sm9_g2_gen_publish(SM9_G2_GEN *g) {
+	g->prev = sm9_g2_gen;
+	__atomic_store_n(&sm9_g2_gen, g, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&sm9_g2_gen_users, __ATOMIC_SEQ_CST) == 0) {
+		sm9_g2_gen_free_list(g->prev);
+		g->prev = NULL;
+	}
 }
 
-static void ep2_pi2(ep2_t R, const ep2_t P)
-{
- //c = 0xf300000002a3a6f2780272354f8b78f4d5fc11967be65334
- fp_t c = {0xb626197dce4736ca, 0x8296b3557ed0186, 0x9c705db2fd91512a, 0x1c753e748601c992};
- // fp_null(c);
- // fp_new(c);
+int sm9_g2_gen_set(int depth) {
+	SM9_G2_GEN *g;
 
- // char c_str[] = "F300000002A3A6F2780272354F8B78F4D5FC11967BE65334";
+	if (depth < 2 || depth > SM9_G2_GEN_MAX_DEPTH) {
+		error_print();
+		return -1;
+	}
+	if (depth == sm9_g2_gen_depth()) {
+		return 1;
+	}
+	if ((g = sm9_g2_gen_new(depth)) == NULL) {
+		return -1;
+	}
 
- // fp_read_str(c, c_str, strlen(c_str), 16);
- // printf("c[0] = %"PRIx64"\n", c[0]);
- // printf("c[1] = %"PRIx64"\n", c[1]);
- // printf("c[2] = %"PRIx64"\n", c[2]);
- // printf("c[3] = %"PRIx64"\n", c[3]);
- // return 1;
+	pthread_mutex_lock(&sm9_lock);
+	sm9_g2_gen_publish(g);
+	pthread_mutex_unlock(&sm9_lock);
+	return 1;
+}
 
- fp2_copy(R->x, P->x);
- fp2_neg(R->y, P->y);
- fp2_mul_fp(R->z, P->z, c);
+int sm9_g2_gen_depth(void) {
+	SM9_G2_GEN *g;
+	int depth;
 
- fp_free(c);
+	__atomic_add_fetch(&sm9_g2_gen_users, 1, __ATOMIC_SEQ_CST);
+	g = __atomic_load_n(&sm9_g2_gen, __ATOMIC_SEQ_CST);
+	depth = (g != NULL ? g->depth : 0);
+	__atomic_sub_fetch(&sm9_g2_gen_users, 1, __ATOMIC_SEQ_CST);
+	return depth;
 }
-/* 即ep2_add */
-void ep2_add_full(ep2_t R, ep2_t P, ep2_t Q)
-{
-	const fp_t *X1 = P->x;
-	const fp_t *Y1 = P->y;
-	const fp_t *Z1 = P->z;
-	const fp_t *X2 = Q->x;
-	const fp_t *Y2 = Q->y;
-	const fp_t *Z2 = Q->z;
-	fp2_t T1, T2, T3, T4, T5, T6, T7, T8;
 
-	fp2_null(T1);
-	fp2_null(T2);
-	fp2_null(T3);
-	fp2_null(T4);
-	fp2_null(T5);
-	fp2_null(T6);
-	fp2_null(T7);
-	fp2_null(T8);
+// modify from ep2_mul_fix_combs, k is public or the caller accepts the variable time of ep2_mul_gen
+// norm = 0 leaves r in projective coordinates, for callers that normalize many points at once
+static void sm9_g2_mul_comb(ep2_t r, bn_t k, int norm, const SM9_G2_GEN *g) {
+	int i, j, l, w;
+	bn_t n, _k;
 
-	fp2_new(T1);
-	fp2_new(T2);
-	fp2_new(T3);
-	fp2_new(T4);
-	fp2_new(T5);
-	fp2_new(T6);
-	fp2_new(T7);
-	fp2_new(T8);
+	bn_null(n);
+	bn_null(_k);
 
-	if (ep2_is_infty(Q)) {
-		ep2_copy(R, P);
-		return ;
+	RLC_TRY {
+		bn_new(n);
+		bn_new(_k);
+
+		ep2_curve_get_ord(n);
+		l = RLC_CEIL(bn_bits(n), g->depth);
+		bn_abs(_k, k);
+		bn_mod(_k, _k, n);
+
+		ep2_set_infty(r);
+		for (i = l - 1; i >= 0; i--) {
+			ep2_dbl(r, r);
+			w = 0;
+			for (j = g->depth - 1; j >= 0; j--) {
+				w = (w << 1) | bn_get_bit(_k, i + j * l);
+			}
+			if (w > 0) {
+				ep2_add(r, r, g->tab[w]);
+			}
+		}
+		if (norm) {
+			ep2_norm(r, r);
+		}
+		if (bn_sign(k) == RLC_NEG) {
+			ep2_neg(r, r);
+		}
 	}
-	if (ep2_is_infty(P)) {
-		ep2_copy(R, Q);
-		return ;
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
+		bn_free(_k);
 	}
+}
 
-	fp2_sqr(T1, Z1);
-	fp2_sqr(T2, Z2);
-	fp2_mul(T3, X2, T1);
-	fp2_mul(T4, X1, T2);
-	fp2_add(T5, T3, T4);
-	fp2_sub(T3, T3, T4);
-	fp2_mul(T1, T1, Z1);
-	fp2_mul(T1, T1, Y2);
-	fp2_mul(T2, T2, Z2);
-	fp2_mul(T2, T2, Y1);
-	fp2_add(T6, T1, T2);
-	fp2_sub(T1, T1, T2);
+static void sm9_g2_mul_gen_imp(ep2_t r, bn_t k, int norm) {
+	SM9_G2_GEN *g;
 
-	if (fp2_is_zero(T1) && fp2_is_zero(T3)) {
-		return ep2_dbl_projc(R, P);
+	__atomic_add_fetch(&sm9_g2_gen_users, 1, __ATOMIC_SEQ_CST);
+	g = __atomic_load_n(&sm9_g2_gen, __ATOMIC_SEQ_CST);
+	if (g == NULL) {
+		ep2_mul_gen(r, k);
+	} else if (bn_is_zero(k)) {
+		ep2_set_infty(r);
+	} else {
+		sm9_g2_mul_comb(r, k, norm, g);
 	}
-	
-	if (fp2_is_zero(T1) && fp2_is_zero(T6)) {
-		return ep2_set_infty(R);
+	__atomic_sub_fetch(&sm9_g2_gen_users, 1, __ATOMIC_SEQ_CST);
+}
+
+void sm9_g2_mul_gen(ep2_t r, bn_t k) {
+	sm9_g2_mul_gen_imp(r, k, 1);
+}
+
+//modify from fp12_exp_cyc_sps
+void fp12_pow_cyc_sps_t(fp12_t c, fp12_t a, const int *b, int len, int sign) {
+	int i, j, k, w = len;
+    fp12_t t, *u = RLC_ALLOCA(fp12_t, w);
+
+	if (len == 0) {
+		RLC_FREE(u);
+		fp12_set_dig(c, 1);
+		return;
 	}
 
-	fp2_sqr(T6, T1);
-	fp2_mul(T7, T3, Z1);
-	fp2_mul(T7, T7, Z2);
-	fp2_sqr(T8, T3);
-	fp2_mul(T5, T5, T8);
-	fp2_mul(T3, T3, T8);
-	fp2_mul(T4, T4, T8);
-	fp2_sub(T6, T6, T5);
-	fp2_sub(T4, T4, T6);
-	fp2_mul(T1, T1, T4);
-	fp2_mul(T2, T2, T3);
-	fp2_sub(T1, T1, T2);
+	fp12_null(t);
 
-	fp2_copy(R->x, T6);
-	fp2_copy(R->y, T1);
-	fp2_copy(R->z, T7);
+	RLC_TRY {
+		if (u == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (i = 0; i < w; i++) {
+			fp12_null(u[i]);
+			fp12_new(u[i]);
+		}
+		fp12_new(t);
 
-	fp2_free(T1);
-	fp2_free(T2);
-	fp2_free(T3);
-	fp2_free(T4);
-	fp2_free(T5);
-	fp2_free(T6);
-	fp2_free(T7);
-	fp2_free(T8);
-}
+		fp12_copy(t, a);
+		if (b[0] == 0) {
+			for (j = 0, i = 1; i < len; i++) {
+				k = (b[i] < 0 ? -b[i] : b[i]);
+				for (; j < k; j++) {
+					fp12_sqr_pck_t(t, t);
+				}
+				if (b[i] < 0) {
+					fp12_inv_cyc_t(u[i - 1], t);
+				} else {
+					fp12_copy(u[i - 1], t);
+				}
+			}
 
-/* 特殊加法 当Q.Z =1时适用 */
-void ep2_add_t(ep2_t R, ep2_t P, ep2_t Q){
-	
-	const fp_t *X1 = P->x;
-	const fp_t *Y1 = P->y;
-	const fp_t *Z1 = P->z;
-	const fp_t *X2 = Q->x;
-	const fp_t *Y2 = Q->y;
-	fp2_t T1, T2, T3, T4, X3,Y3,Z3;
+			fp12_back_cyc_sim_t(u, u, w - 1);
 
-	fp2_null(T1);
-	fp2_null(T2);
-	fp2_null(T3);
-	fp2_null(T4);
-	fp2_null(X3);
-	fp2_null(Y3);
-	fp2_null(Z3);
+			fp12_copy(c, a);
+			for (i = 0; i < w - 1; i++) {
+				fp12_mul_t(c, c, u[i]);
+			}
+		} else {
+			for (j = 0, i = 0; i < len; i++) {
+				k = (b[i] < 0 ? -b[i] : b[i]);
+				for (; j < k; j++) {
+					fp12_sqr_pck_t(t, t);
+				}
+				if (b[i] < 0) {
+					fp12_inv_cyc_t(u[i], t);
+				} else {
+					fp12_copy(u[i], t);
+				}
+			}
 
-	fp2_new(T1);
-	fp2_new(T2);
-	fp2_new(T3);
-	fp2_new(T4);
-	fp2_new(X3);
-	fp2_new(Y3);
-	fp2_new(Z3);
+			fp12_back_cyc_sim_t(u, u, w);
 
-	if (ep2_is_infty(Q)) {
-		ep2_copy(R, P);
-		return ;
+			fp12_copy(c, u[0]);
+			for (i = 1; i < w; i++) {
+				fp12_mul_t(c, c, u[i]);
+			}
+		}
+
+		if (sign == RLC_NEG) {
+			fp12_inv_cyc_t(c, c);
+		}
 	}
-	if (ep2_is_infty(P)) {
-		ep2_copy(R, Q);
-		return ;
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		for (i = 0; i < w; i++) {
+			fp12_free(u[i]);
+		}
+		fp12_free(t);
+		RLC_FREE(u);
 	}
+}
 
-	fp2_sqr(T1, Z1);
-	fp2_mul(T2, T1, Z1);
-	fp2_mul(T1, T1, X2);
-	fp2_mul(T2, T2, Y2);
-	fp2_sub(T1, T1, X1);
-	fp2_sub(T2, T2, Y1);
+// c[m] = a[m]^b, 所有元素的压缩平方结果一起解压, 只做一次 fp2 求逆
+void fp12_pow_cyc_sps_sim_t(fp12_t c[], fp12_t a[], int n, const int *b, int len, int sign) {
+	int i, j, k, m, s, w;
+	fp12_t t, *u;
 
-	if (fp2_is_zero(T1)) {
-		if(fp2_is_zero(T2)){
-			ep2_dbl_projc(R, Q);
-			return ;
-		}
-		else{
-			ep2_set_infty(R);
-			return ;
+	if (n == 0) {
+		return;
+	}
+	if (len == 0) {
+		for (m = 0; m < n; m++) {
+			fp12_set_dig(c[m], 1);
 		}
+		return;
 	}
 
-	fp2_mul(Z3, Z1, T1);
-	fp2_sqr(T3, T1);
-	fp2_mul(T4, T3, T1);
-	fp2_mul(T3, T3, X1);
-	fp2_dbl(T1, T3);
-	fp2_sqr(X3, T2);
-	fp2_sub(X3, X3, T1);
-	fp2_sub(X3, X3, T4);
-	fp2_sub(T3, T3, X3);
-	fp2_mul(T3, T3, T2);
-	fp2_mul(T4, T4, Y1);
-	fp2_sub(Y3, T3, T4);
+	/* b[0] = 0 时 a 本身不用解压. */
+	s = (b[0] == 0);
+	w = len - s;
+	u = RLC_ALLOCA(fp12_t, n * w);
 
-	fp2_copy(R->x, X3);
-	fp2_copy(R->y, Y3);
-	fp2_copy(R->z, Z3);
+	fp12_null(t);
 
-	fp2_free(T1);
-	fp2_free(T2);
-	fp2_free(T3);
-	fp2_free(T4);
-	fp2_free(X3);
-	fp2_free(Y3);
-	fp2_free(Z3);
+	RLC_TRY {
+		if (u == NULL) {
+			RLC_THROW(ERR_NO_MEMORY);
+		}
+		for (i = 0; i < n * w; i++) {
+			fp12_null(u[i]);
+			fp12_new(u[i]);
+		}
+		fp12_new(t);
+
+		for (m = 0; m < n; m++) {
+			fp12_copy(t, a[m]);
+			for (j = 0, i = s; i < len; i++) {
+				k = (b[i] < 0 ? -b[i] : b[i]);
+				for (; j < k; j++) {
+					fp12_sqr_pck_t(t, t);
+				}
+				if (b[i] < 0) {
+					fp12_inv_cyc_t(u[m * w + i - s], t);
+				} else {
+					fp12_copy(u[m * w + i - s], t);
+				}
+			}
+		}
+
+		fp12_back_cyc_sim_t(u, u, n * w);
+
+		for (m = 0; m < n; m++) {
+			if (s) {
+				fp12_copy(c[m], a[m]);
+				i = 0;
+			} else {
+				fp12_copy(c[m], u[m * w]);
+				i = 1;
+			}
+			for (; i < w; i++) {
+				fp12_mul_t(c[m], c[m], u[m * w + i]);
+			}
+			if (sign == RLC_NEG) {
+				fp12_inv_cyc_t(c[m], c[m]);
+			}
+		}
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		for (i = 0; i < n * w; i++) {
+			fp12_free(u[i]);
+		}
+		fp12_free(t);
+		RLC_FREE(u);
+	}
 }
 
-static void sm9_eval_g_line(fp12_t num, fp12_t den, ep2_t T, ep2_t P, ep_t Q){
-	const fp_t *XP = P->x;
-	const fp_t *YP = P->y;
-	const fp_t *ZP = P->z;
-	const fp_t *XT = T->x;
-	const fp_t *YT = T->y;
-	const fp_t *ZT = T->z;
-	const uint64_t *xQ = Q->x;
-	const uint64_t *yQ = Q->y;
+void fp12_frb_t(fp12_t c, fp12_t a, int i) {
 
-	fp_t *a0 = num[0][0];
-	fp_t *a1 = num[0][1];
-	fp_t *a4 = num[1][1];
-	fp_t *b1 = den[0][1];
+	fp12_copy(c, a);
+	for (; i % 12 > 0; i--) {
+		fp2_frb(c[0][0], c[0][0], 1);
+		fp2_frb(c[1][1], c[1][1], 1);
+		fp2_frb(c[1][0], c[1][0], 1);
+		fp2_mul_frb(c[1][1], c[1][1], 1, 2);
+		fp2_mul_frb(c[1][0], c[1][0], 1, 4);
 
-	fp2_t T0, T1, T2, T3, T4;
-	fp2_t two_inv;
-	bn_t three;
+		fp2_frb(c[0][2], c[0][2], 1);
+		fp2_frb(c[0][1], c[0][1], 1);
+		fp2_frb(c[1][2], c[1][2], 1);
+		fp2_mul_frb(c[0][2], c[0][2], 1, 1);
+		fp2_mul_frb(c[0][1], c[0][1], 1, 3);
+		fp2_mul_frb(c[1][2], c[1][2], 1, 5);
+	}
+}
 
-	fp2_null(T0);
-	fp2_null(T1);
-	fp2_null(T2);
-	fp2_null(T3);
-	fp2_null(T4);
+// GLS 正则编码的窗口宽度, 每个基预计算 2^(SM9_GLS_WIDTH-2) 个奇数次幂
+#define SM9_GLS_WIDTH	4
 
-	fp2_null(two_inv);
-	bn_null(three);
+// b = k[0] + k[1] p + k[2] p^2 + k[3] p^3 mod n, |k[i]| 约 64 比特 (bn_rec_frb),
+// s[i] = a^(p^i), k[i] < 0 或 b < 0 时换成共轭, 返回时 k[i] >= 0
+static void fp12_pow_gls_rec(fp12_t *s, bn_t *k, fp12_t a, const bn_t b) {
+	bn_t n, x, _b;
+	fp12_t t;
+	int i;
 
-	fp2_new(T0);
-	fp2_new(T1);
-	fp2_new(T2);
-	fp2_new(T3);
-	fp2_new(T4);
-	fp2_new(two_inv);
-	bn_new(three);
-
-	fp12_set_dig(num, 0);
-	fp12_set_dig(den, 0);
-	fp2_set_dig(two_inv, 2);
-	fp2_inv(two_inv, two_inv);
-	bn_set_dig(three, 3);
-
-	fp2_sqr(T0, ZP);
-	fp2_mul(T1, T0, XT);
-	fp2_mul(T0, T0, ZP);
-	fp2_sqr(T2, ZT);
-	fp2_mul(T3, T2, XP);
-	fp2_mul(T2, T2, ZT);
-	fp2_mul(T2, T2, YP);
-	fp2_sub(T1, T1, T3);
-	fp2_mul(T1, T1, ZT);
-	fp2_mul(T1, T1, ZP);
-	fp2_mul(T4, T1, T0);
-	fp2_copy(b1, T4);
-
-	fp2_mul(T1, T1, YP);
-	fp2_mul(T3, T0, YT);
-	fp2_sub(T3, T3, T2);
-	fp2_mul(T0, T0, T3);
-	fp2_mul_fp(T0, T0, xQ);
-	fp2_copy(a4, T0);
-
-	fp2_mul(T3, T3, XP);
-	fp2_mul(T3, T3, ZP);
-	fp2_sub(T1, T1, T3);
-	fp2_copy(a0, T1);
+	bn_null(n);
+	bn_null(x);
+	bn_null(_b);
+	fp12_null(t);
 
-	fp2_mul_fp(T2, T4, yQ);
-	fp2_neg(T2, T2);
-	fp2_copy(a1, T2);
+	RLC_TRY {
+		bn_new(n);
+		bn_new(x);
+		bn_new(_b);
+		fp12_new(t);
 
-	fp2_free(T0);
-	fp2_free(T1);
-	fp2_free(T2);
-	fp2_free(T3);
-	fp2_free(T4);
-	fp2_free(two_inv);
-	bn_free(three);
+		g1_get_ord(n);
+		if (sm9_get_par(x) != 1) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		bn_abs(_b, b);
+		bn_mod(_b, _b, n);
+		bn_rec_frb(k, 4, _b, x, n, 0);
+
+		fp12_inv_cyc_t(t, a);
+		fp12_copy(s[0], a);
+		fp12_copy_sec_t(s[0], t, bn_sign(b) == RLC_NEG);
+		for (i = 1; i < 4; i++) {
+			fp12_frb_t(s[i], s[i - 1], 1);
+		}
+		for (i = 0; i < 4; i++) {
+			fp12_inv_cyc_t(t, s[i]);
+			fp12_copy_sec_t(s[i], t, bn_sign(k[i]) == RLC_NEG);
+			bn_abs(k[i], k[i]);
+		}
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(n);
+		bn_free(x);
+		bn_free(_b);
+		fp12_free(t);
+	}
 }
 
-static void sm9_eval_g_line_no_den(fp12_t num, fp12_t den, ep2_t T, ep2_t P, ep_t Q){
-	const fp_t *XP = P->x;
-	const fp_t *YP = P->y;
-	const fp_t *ZP = P->z;
-	const fp_t *XT = T->x;
-	const fp_t *YT = T->y;
-	const fp_t *ZT = T->z;
-	const uint64_t *xQ = Q->x;
-	const uint64_t *yQ = Q->y;
+// c = a^b for a in GT, Frobenius 四维分解, (k0, k1) 和 (k2, k3) 各用联合稀疏形式 (JSF)
+void fp12_pow_gls(fp12_t c, fp12_t a, const bn_t b) {
+	int8_t jsf[2][2 * (RLC_FP_BITS + 1)];
+	int i, j, d0, d1, len, l[2], off[2];
+	fp12_t s[4], t[2][9], u;
+	bn_t k[4];
 
-	fp_t *a0 = num[0][0];
-	fp_t *a1 = num[0][1];
-	fp_t *a4 = num[1][1];
-	// fp_t *b1 = den[0][1];
+	fp12_null(u);
 
-	fp2_t T0, T1, T2, T3, T4;
-	fp2_t two_inv;
-	bn_t three;
+	RLC_TRY {
+		fp12_new(u);
+		for (i = 0; i < 4; i++) {
+			bn_null(k[i]);
+			bn_new(k[i]);
+			fp12_null(s[i]);
+			fp12_new(s[i]);
+		}
+		for (i = 0; i < 9; i++) {
+			fp12_null(t[0][i]);
+			fp12_null(t[1][i]);
+			fp12_new(t[0][i]);
+			fp12_new(t[1][i]);
+		}
 
-	fp2_null(T0);
-	fp2_null(T1);
-	fp2_null(T2);
-	fp2_null(T3);
-	fp2_null(T4);
+		fp12_pow_gls_rec(s, k, a, b);
+
+		len = 0;
+		for (j = 0; j < 2; j++) {
+			l[j] = 2 * (RLC_FP_BITS + 1);
+			off[j] = RLC_MAX(bn_bits(k[2 * j]), bn_bits(k[2 * j + 1])) + 1;
+			bn_rec_jsf(jsf[j], &l[j], k[2 * j], k[2 * j + 1]);
+			len = RLC_MAX(len, l[j]);
+
+			/* t[j][3 * (u0 + 1) + (u1 + 1)] = s[2j]^u0 * s[2j + 1]^u1. */
+			fp12_set_dig(t[j][4], 1);
+			fp12_copy(t[j][7], s[2 * j]);
+			fp12_copy(t[j][5], s[2 * j + 1]);
+			fp12_inv_cyc_t(t[j][1], t[j][7]);
+			fp12_inv_cyc_t(t[j][3], t[j][5]);
+			fp12_mul_t(t[j][8], t[j][7], t[j][5]);
+			fp12_mul_t(t[j][6], t[j][7], t[j][3]);
+			fp12_inv_cyc_t(t[j][0], t[j][8]);
+			fp12_inv_cyc_t(t[j][2], t[j][6]);
+		}
 
-	fp2_null(two_inv);
-	bn_null(three);
+		fp12_set_dig(u, 1);
+		for (i = len - 1; i >= 0; i--) {
+			fp12_sqr_cyc_t(u, u);
+			for (j = 0; j < 2; j++) {
+				if (i < l[j]) {
+					d0 = jsf[j][i];
+					d1 = jsf[j][i + off[j]];
+					if (d0 != 0 || d1 != 0) {
+						fp12_mul_t(u, u, t[j][3 * (d0 + 1) + d1 + 1]);
+					}
+				}
+			}
+		}
+		fp12_copy(c, u);
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		fp12_free(u);
+		for (i = 0; i < 4; i++) {
+			bn_free(k[i]);
+			fp12_free(s[i]);
+		}
+		for (i = 0; i < 9; i++) {
+			fp12_free(t[0][i]);
+			fp12_free(t[1][i]);
+		}
+	}
+}
 
-	fp2_new(T0);
-	fp2_new(T1);
-	fp2_new(T2);
-	fp2_new(T3);
-	fp2_new(T4);
-	fp2_new(two_inv);
-	bn_new(three);
+// modify from ep_mul_reg_glv, 四个分量都用定长正则编码, 查表读全表, 偶数分量先加一最后再除掉,
+// 平方和乘法的次序与 b 无关; bn_rec_frb 本身用的是 RELIC 的变时间大数运算
+void fp12_pow_gls_sec(fp12_t c, fp12_t a, const bn_t b) {
+	int8_t reg[4][RLC_FP_BITS + 1];
+	int i, j, l, bits, n, s;
+	dig_t even[4];
+	fp12_t g[4], t[4][1 << (SM9_GLS_WIDTH - 2)], u, v;
+	bn_t k[4], x;
 
-	fp12_set_dig(num, 0);
-	fp12_set_dig(den, 0);
-	fp2_set_dig(two_inv, 2);
-	fp2_inv(two_inv, two_inv);
-	bn_set_dig(three, 3);
+	bn_null(x);
+	fp12_null(u);
+	fp12_null(v);
 
-	fp2_sqr(T0, ZP);
-	fp2_mul(T1, T0, XT);
-	fp2_mul(T0, T0, ZP);
-	fp2_sqr(T2, ZT);
-	fp2_mul(T3, T2, XP);
-	fp2_mul(T2, T2, ZT);
-	fp2_mul(T2, T2, YP);
-	fp2_sub(T1, T1, T3);
-	fp2_mul(T1, T1, ZT);
-	fp2_mul(T1, T1, ZP);
-	fp2_mul(T4, T1, T0);
-	// fp2_copy(b1, T4);
+	RLC_TRY {
+		bn_new(x);
+		fp12_new(u);
+		fp12_new(v);
+		for (i = 0; i < 4; i++) {
+			bn_null(k[i]);
+			bn_new(k[i]);
+			fp12_null(g[i]);
+			fp12_new(g[i]);
+			for (j = 0; j < (1 << (SM9_GLS_WIDTH - 2)); j++) {
+				fp12_null(t[i][j]);
+				fp12_new(t[i][j]);
+			}
+		}
 
-	fp2_mul(T1, T1, YP);
-	fp2_mul(T3, T0, YT);
-	fp2_sub(T3, T3, T2);
-	fp2_mul(T0, T0, T3);
-	fp2_mul_fp(T0, T0, xQ);
-	fp2_copy(a4, T0);
+		fp12_pow_gls_rec(g, k, a, b);
 
-	fp2_mul(T3, T3, XP);
-	fp2_mul(T3, T3, ZP);
-	fp2_sub(T1, T1, T3);
-	fp2_copy(a0, T1);
+		// |k[i]| < 2^(bits(u) + 2), 留一位余量给偶数加一
+		if (sm9_get_par(x) != 1) {
+			RLC_THROW(ERR_NO_VALID);
+		}
+		bits = bn_bits(x) + 4;
+
+		for (i = 0; i < 4; i++) {
+			even[i] = bn_is_even(k[i]);
+			bn_add_dig(k[i], k[i], even[i]);
+			l = RLC_FP_BITS + 1;
+			bn_rec_reg(reg[i], &l, k[i], bits, SM9_GLS_WIDTH);
+
+			/* t[i][j] = g[i]^(2j + 1). */
+			fp12_copy(t[i][0], g[i]);
+			fp12_sqr_cyc_t(u, g[i]);
+			for (j = 1; j < (1 << (SM9_GLS_WIDTH - 2)); j++) {
+				fp12_mul_t(t[i][j], t[i][j - 1], u);
+			}
 
-	fp2_mul_fp(T2, T4, yQ);
-	fp2_neg(T2, T2);
-	fp2_copy(a1, T2);
+			// 偶数分量的修正因子 g[i]^-1, 奇数时为 1
+			fp12_inv_cyc_t(v, g[i]);
+			fp12_set_dig(g[i], 1);
+			fp12_copy_sec_t(g[i], v, even[i]);
+		}
 
-	fp2_free(T0);
-	fp2_free(T1);
-	fp2_free(T2);
-	fp2_free(T3);
-	fp2_free(T4);
-	fp2_free(two_inv);
-	bn_free(three);
+		fp12_set_dig(u, 1);
+		for (i = l - 1; i >= 0; i--) {
+			for (j = 0; j < SM9_GLS_WIDTH - 1; j++) {
+				fp12_sqr_cyc_t(u, u);
+			}
+			for (j = 0; j < 4; j++) {
+				n = reg[j][i];
+				s = (n >> 7);
+				n = ((n ^ s) - s) >> 1;
+				fp12_pow_fix_get(v, t[j], 1 << (SM9_GLS_WIDTH - 2), n);
+				fp12_inv_cyc_t(c, v);
+				fp12_copy_sec_t(v, c, s != 0);
+				fp12_mul_t(u, u, v);
+			}
+		}
+		for (i = 0; i < 4; i++) {
+			fp12_mul_t(u, u, g[i]);
+		}
+		fp12_copy(c, u);
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		bn_free(x);
+		fp12_free(u);
+		fp12_free(v);
+		for (i = 0; i < 4; i++) {
+			bn_free(k[i]);
+			fp12_free(g[i]);
+			for (j = 0; j < (1 << (SM9_GLS_WIDTH - 2)); j++) {
+				fp12_free(t[i][j]);
+			}
+		}
+	}
 }
 
-void sm9_eval_g_tangent(fp12_t num, fp12_t den, ep2_t P, ep_t Q){
-	// fp_t *x, *y;
-	// x = Q->x;
-	// y = Q->y;
-	const fp_t *XP = P->x;
-	const fp_t *YP = P->y;
-	const fp_t *ZP = P->z;
-	const uint64_t *xQ = Q->x;
-	const uint64_t *yQ = Q->y;
+static void fp12_frobenius(fp12_t r, const fp12_t x)
+{
 
-	fp_t *a0 = num[0][0];
-	fp_t *a1 = num[0][1];
-	fp_t *a4 = num[1][1];
-	fp_t *b1 = den[0][1];
+	const fp2_t *xa = x[0][0];
+	const fp2_t *xb = x[0][2];
+	const fp2_t *xc = x[1][1];
+	fp4_t ra;
+	fp4_t rb;
+	fp4_t rc;
 
-	fp2_t t0;
-	fp2_t t1;
-	fp2_t t2;
-	fp2_t two_inv;
-	bn_t three;
+	fp4_null(ra);
+	fp4_null(rb);
+	fp4_null(rc);
 
-	fp2_null(t0);
-	fp2_null(t1);
-	fp2_null(t2);
-	fp2_null(two_inv);
-	bn_null(three);
+	fp4_new(ra);
+	fp4_new(rb);
+	fp4_new(rc);
 
-	fp2_new(t0);
-	fp2_new(t1);
-	fp2_new(t2);
-	fp2_new(two_inv);
-	bn_new(three);
+	fp2_conjugate(ra[0], xa[0]);
+	fp2_conjugate(ra[1], xa[1]);
+	fp2_mul_fp(ra[1], ra[1], SM9_ALPHA3);
 
-	fp12_set_dig(num, 0);
-	fp12_set_dig(den, 0);
-	fp2_set_dig(two_inv, 2);
-	fp2_inv(two_inv, two_inv);
-	bn_set_dig(three, 3);
-	
-	fp2_sqr(t0, ZP);
-	fp2_mul(t1, t0, ZP);
-	fp2_mul(b1, t1, YP);
-	fp2_mul_fp(t2, b1, yQ);
-	fp2_neg(a1, t2);
-	fp2_sqr(t1, XP);
-	fp2_mul(t0, t0, t1);
-	fp2_mul_fp(t0, t0, xQ);
-	fp2_mul_dig(t0, t0, 3);
-	fp2_mul(a4, t0, two_inv);
-	fp2_mul(t1, t1, XP);
-	fp2_mul_dig(t1, t1, 3);
-	fp2_mul(t1, t1, two_inv);
-	fp2_sqr(t0, YP);
-	fp2_sub(a0, t0, t1);
+	fp2_conjugate(rb[0], xb[0]);
+	fp2_mul_fp(rb[0], rb[0], SM9_ALPHA1);
+	fp2_conjugate(rb[1], xb[1]);
+	fp2_mul_fp(rb[1], rb[1], SM9_ALPHA4);
 
-	fp2_free(t0);
-	fp2_free(t1);
-	fp2_free(t2);
-	fp2_free(two_inv);
-	bn_free(three);
+	fp2_conjugate(rc[0], xc[0]);
+	fp2_mul_fp(rc[0], rc[0], SM9_ALPHA2);
+	fp2_conjugate(rc[1], xc[1]);
+	fp2_mul_fp(rc[1], rc[1], SM9_ALPHA5);
+
+	fp12_set(r, ra, rb, rc);
+
+	fp4_free(ra);
+	fp4_free(rb);
+	fp4_free(rc);
 }
 
-static void sm9_final_exponent_hard_part(fp12_t r, const fp12_t f)
+static void fp12_frobenius2(fp12_t r, const fp12_t x)
 {
-	// a2 = 0xd8000000019062ed0000b98b0cb27659
-	// a3 = 0x2400000000215d941
-	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
-	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
-	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
-
-	fp12_t t0, t1, t2, t3;
-
-	fp12_null(t0);
-	fp12_null(t1);
-	fp12_null(t2);
-	fp12_null(t3);
-
-	fp12_new(t0);
-	fp12_new(t1);
-	fp12_new(t2);
-	fp12_new(t3);
-
-
-	fp12_pow(t0, f, a3);
-
-	fp12_inv_t(t0, t0);
-	// PERFORMANCE_TEST("fp12_inv_t(t0, t0)",fp12_inv_t(t0, t0),1000);
-	fp12_frobenius(t1, t0);
-	//PERFORMANCE_TEST_NEW("fp12_frobenius(t1, t0)",fp12_frobenius(t1, t0));
-	fp12_mul_t(t1, t0, t1);
-
-	fp12_mul_t(t0, t0, t1);
-	fp12_frobenius(t2, f);
-	//PERFORMANCE_TEST_NEW("fp12_frobenius(t2, f)",fp12_frobenius2(t2, f));
-	fp12_mul_t(t3, t2, f);
-	fp12_pow(t3, t3, nine);
-
-
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t3, f);
-	fp12_sqr_t(t3, t3);
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t2, t2);
-	fp12_mul_t(t2, t2, t1);
-	fp12_frobenius2(t1, f);
-	//PERFORMANCE_TEST_NEW("fp12_frobenius2(t1, f)",fp12_frobenius2(t1, f));
-	fp12_mul_t(t1, t1, t2);
-
-	fp12_pow(t2, t1, a2);
-	// fp12_pow正确性测试
-	// printf("fp12_pow(t2, t1, a2)\n");
-	// fp12_print(t2);
-	// fp12_pow性能测试
-	// PERFORMANCE_TEST_NEW("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2));
-#if 0
-	char a2_str[] = "11011000000000000000000000000000000000011001000001100010111011010000000000000000101110011000101100001100101100100111011001011001";
-	uint64_t a2_t[] = {0x0000b98bcb27659, 0xd8000000019062ed};
-	bn_t tmp;
-	bn_null(tmp);
-	bn_new(tmp);
-	bn_read_str(tmp, a2_str, 128, 2);
-
-	bn_print(tmp);
-
-	fp12_exp(r,t1,tmp);
-	// printf("fp12_exp\n");
-	// fp12_print(r);
-
-	fp12_exp_dig(r,t1,a2_t);
-	// printf("fp12_exp_dig\n");
-	// fp12_print(r);
-
-	// PERFORMANCE_TEST_NEW("fp12_exp(r,r,tmp)",fp12_exp(r,r,tmp));
-	// PERFORMANCE_TEST_NEW("fp12_exp_dig(r,t1,a2_t)",fp12_exp_dig(r,t1,a2));
-
-	bn_free(tmp);
-#endif
-	fp12_mul_t(t0, t2, t0);
-	fp12_frobenius3(t1, f);
+	fp4_t a;
+	fp4_t b;
+	fp4_t c;
 	
-	//PERFORMANCE_TEST_NEW("\nfp12_frobenius3\n",fp12_frobenius3(t1, f));
+	fp4_null(a);
+	fp4_null(b);
+	fp4_null(c);
 
-	fp12_mul_t(t1, t1, t0);
+	fp4_new(a);
+	fp4_new(b);
+	fp4_new(c);
+	
+	fp4_conjugate(a, x[0][0]);
+	fp4_conjugate(b, x[0][2]);
+	fp4_mul_fp(b, b, SM9_ALPHA2);
+	fp4_conjugate(c, x[1][1]);
+	fp4_mul_fp(c, c, SM9_ALPHA4);
 
-	fp12_copy(r, t1);
+	fp4_copy(r[0][0], a);
+	fp4_copy(r[0][2], b);
+	fp4_copy(r[1][1], c);
 
-	fp12_free(t0);
-	fp12_free(t1);
-	fp12_free(t2);
-	fp12_free(t3);
+	fp4_free(a);
+	fp4_free(b);
+	fp4_free(c);
 }
 
-static void sm9_final_exponent_hard_parter(fp12_t r, const fp12_t f)
+static void fp12_frobenius3(fp12_t r, const fp12_t x)
 {
+	const fp2_t *xa = x[0][0];
+	const fp2_t *xb = x[0][2];
+	const fp2_t *xc = x[1][1];
+	fp4_t ra;
+	fp4_t rb;
+	fp4_t rc;
 
-	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
-	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
-	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
-
-	const bn_t a3_t;
-	const bn_t a2_t;
-	const bn_t nine_t;
-
-	bn_null(a3_t);
-	bn_null(a2_t);
-	bn_null(nine_t);
-	bn_new(a3_t);
-	bn_new(a2_t);
-	bn_new(nine_t);
+	fp4_null(ra);
+	fp4_null(rb);
+	fp4_null(rc);
 
-	bn_to_bn(a3_t,a3);
-	bn_to_bn(a2_t,a2);
-	bn_to_bn(nine_t,nine);
+	fp4_new(ra);
+	fp4_new(rb);
+	fp4_new(rc);
 
+	fp2_conjugate(ra[0], xa[0]);
+	fp2_conjugate(ra[1], xa[1]);
+	fp2_mul(ra[1], ra[1], SM9_BETA);
+	fp2_neg(ra[1], ra[1]);
 
-	fp12_t t0, t1, t2, t3;
+	fp2_conjugate(rb[0], xb[0]);
+	fp2_mul(rb[0], rb[0], SM9_BETA);
+	fp2_conjugate(rb[1], xb[1]);
 
-	fp12_null(t0);
-	fp12_null(t1);
-	fp12_null(t2);
-	fp12_null(t3);
+	fp2_conjugate(rc[0], xc[0]);
+	fp2_neg(rc[0], rc[0]);
+	fp2_conjugate(rc[1], xc[1]);
+	fp2_mul(rc[1], rc[1], SM9_BETA);
 
-	fp12_new(t0);
-	fp12_new(t1);
-	fp12_new(t2);
-	fp12_new(t3);
+	fp4_copy(r[0][0], ra);
+	fp4_copy(r[0][2], rb);
+	fp4_copy(r[1][1], rc);
 
-	fp12_pow_t(t0, f, a3_t);
+	fp4_free(ra);
+	fp4_free(rb);
+	fp4_free(rc);
+}
 
-	//PERFORMANCE_TEST_NEW("fp12_pow_t(t0, f, a3_t)",fp12_pow_t(t0, f, a3_t));
+static void fp12_frobenius6(fp12_t r, const fp12_t x)
+{
+	fp4_t a;
+	fp4_t b;
+	fp4_t c;
 
-	fp12_inv_t(t0, t0);
+	fp4_null(a);
+	fp4_null(b);
+	fp4_null(c);
 
-	fp12_frb_t(t1,t0,1);
-	//fp12_frobenius(t1, t0);
-	
-	fp12_mul_t(t1, t0, t1);
+	fp4_new(a);
+	fp4_new(b);
+	fp4_new(c);
 
-	fp12_mul_t(t0, t0, t1);
-	
-	fp12_frb_t(t2,f,1);
-	//fp12_frobenius(t2, f);
-	
-	fp12_mul_t(t3, t2, f);
-	fp12_pow_t(t3, t3, nine_t);
+	fp4_copy(a, x[0][0]);
+	fp4_copy(b, x[0][2]);
+	fp4_copy(c, x[1][1]);
 
+	fp4_conjugate(a, a);
+	fp4_conjugate(b, b);
+	fp4_neg(b, b);
+	fp4_conjugate(c, c);
 
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t3, f);
-	fp12_sqr_t(t3, t3);
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t2, t2);
-	fp12_mul_t(t2, t2, t1);
-	
-	fp12_frb_t(t1,f,2);
-	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,2)",fp12_frb_t(t1, f,2));
-	//fp12_frobenius2(t1, f);
+	fp4_copy(r[0][0], a);
+	fp4_copy(r[0][2], b);
+	fp4_copy(r[1][1], c);
 
-	fp12_mul_t(t1, t1, t2);
+	fp4_free(a);
+	fp4_free(b);
+	fp4_free(c);
+}
 
-	fp12_pow_t(t2, t1, a2_t);
+void fp12_conv_cyc_t(fp12_t c, fp12_t a) {
+	fp12_t t;
 
+	fp12_null(t);
 
-	bn_free(tmp);
+	RLC_TRY {
+		fp12_new(t);
 
-	fp12_mul_t(t0, t2, t0);
-	fp12_frb_t(t1,f,3);
-	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,3)",fp12_frb_t(t1, f,3));
-	//fp12_frobenius3(t1,f);
+		/* First, compute c = a^(p^6 - 1). */
+		/* t = a^{-1}. */
+		fp12_inv_t(t, a);
+		/* c = a^(p^6). */
+		fp12_inv_cyc_t(c, a);
+		/* c = a^(p^6 - 1). */
+		fp12_mul_t(c, c, t);
 
-	fp12_mul_t(t1, t1, t0);
+		/* Second, compute c^(p^2 + 1). */
+		/* t = c^(p^2). */
+		fp12_frb_t(t, c, 2);
 
-	fp12_copy(r, t1);
+		/* c = c^(p^2 + 1). */
+		fp12_mul_t(c, c, t);
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		fp12_free(t);
+	}
+}
 
-	fp12_free(t0);
-	fp12_free(t1);
-	fp12_free(t2);
-	fp12_free(t3);
+#include <inttypes.h>
+static void ep2_pi1(ep2_t R, const ep2_t P)
+{
+ // c = alpha1 = 0x3f23ea58e5720bdb843c6cfa9c08674947c5c86e0ddd04eda91d8354377b698b
+ fp2_conjugate(R->x, P->x);  // X[0], -X[1]
+ fp2_conjugate(R->y, P->y);
+ fp2_conjugate(R->z, P->z);
+ fp2_mul_fp(R->z, R->z, SM9_ALPHA1);
+ R->coord = PROJC;
 }
 
-static void sm9_final_exponent_hard_part_t(fp12_t r, const fp12_t f)
+static void ep2_pi2(ep2_t R, const ep2_t P)
+{
+ // c = alpha2 = 0xf300000002a3a6f2780272354f8b78f4d5fc11967be65334
+ fp2_copy(R->x, P->x);
+ fp2_neg(R->y, P->y);
+ fp2_mul_fp(R->z, P->z, SM9_ALPHA2);
+ R->coord = PROJC;
+}
+/* 即ep2_add */
+void ep2_add_full(ep2_t R, ep2_t P, ep2_t Q)
+{
+	const fp_t *X1 = P->x;
+	const fp_t *Y1 = P->y;
+	const fp_t *Z1 = P->z;
+	const fp_t *X2 = Q->x;
+	const fp_t *Y2 = Q->y;
+	const fp_t *Z2 = Q->z;
+	fp2_t T1, T2, T3, T4, T5, T6, T7, T8;
+
+	fp2_null(T1);
+	fp2_null(T2);
+	fp2_null(T3);
+	fp2_null(T4);
+	fp2_null(T5);
+	fp2_null(T6);
+	fp2_null(T7);
+	fp2_null(T8);
+
+	fp2_new(T1);
+	fp2_new(T2);
+	fp2_new(T3);
+	fp2_new(T4);
+	fp2_new(T5);
+	fp2_new(T6);
+	fp2_new(T7);
+	fp2_new(T8);
+
+	if (ep2_is_infty(Q)) {
+		ep2_copy(R, P);
+		return ;
+	}
+	if (ep2_is_infty(P)) {
+		ep2_copy(R, Q);
+		return ;
+	}
+
+	fp2_sqr(T1, Z1);
+	fp2_sqr(T2, Z2);
+	fp2_mul(T3, X2, T1);
+	fp2_mul(T4, X1, T2);
+	fp2_add(T5, T3, T4);
+	fp2_sub(T3, T3, T4);
+	fp2_mul(T1, T1, Z1);
+	fp2_mul(T1, T1, Y2);
+	fp2_mul(T2, T2, Z2);
+	fp2_mul(T2, T2, Y1);
+	fp2_add(T6, T1, T2);
+	fp2_sub(T1, T1, T2);
+
+	if (fp2_is_zero(T1) && fp2_is_zero(T3)) {
+		return ep2_dbl_projc(R, P);
+	}
+	
+	if (fp2_is_zero(T1) && fp2_is_zero(T6)) {
+		return ep2_set_infty(R);
+	}
+
+	fp2_sqr(T6, T1);
+	fp2_mul(T7, T3, Z1);
+	fp2_mul(T7, T7, Z2);
+	fp2_sqr(T8, T3);
+	fp2_mul(T5, T5, T8);
+	fp2_mul(T3, T3, T8);
+	fp2_mul(T4, T4, T8);
+	fp2_sub(T6, T6, T5);
+	fp2_sub(T4, T4, T6);
+	fp2_mul(T1, T1, T4);
+	fp2_mul(T2, T2, T3);
+	fp2_sub(T1, T1, T2);
+
+	fp2_copy(R->x, T6);
+	fp2_copy(R->y, T1);
+	fp2_copy(R->z, T7);
+
+	fp2_free(T1);
+	fp2_free(T2);
+	fp2_free(T3);
+	fp2_free(T4);
+	fp2_free(T5);
+	fp2_free(T6);
+	fp2_free(T7);
+	fp2_free(T8);
+}
+
+/* 特殊加法 当Q.Z =1时适用 */
+void ep2_add_t(ep2_t R, ep2_t P, ep2_t Q){
+	
+	const fp_t *X1 = P->x;
+	const fp_t *Y1 = P->y;
+	const fp_t *Z1 = P->z;
+	const fp_t *X2 = Q->x;
+	const fp_t *Y2 = Q->y;
+	fp2_t T1, T2, T3, T4, X3,Y3,Z3;
+
+	fp2_null(T1);
+	fp2_null(T2);
+	fp2_null(T3);
+	fp2_null(T4);
+	fp2_null(X3);
+	fp2_null(Y3);
+	fp2_null(Z3);
+
+	fp2_new(T1);
+	fp2_new(T2);
+	fp2_new(T3);
+	fp2_new(T4);
+	fp2_new(X3);
+	fp2_new(Y3);
+	fp2_new(Z3);
+
+	if (ep2_is_infty(Q)) {
+		ep2_copy(R, P);
+		return ;
+	}
+	if (ep2_is_infty(P)) {
+		ep2_copy(R, Q);
+		return ;
+	}
+
+	fp2_sqr(T1, Z1);
+	fp2_mul(T2, T1, Z1);
+	fp2_mul(T1, T1, X2);
+	fp2_mul(T2, T2, Y2);
+	fp2_sub(T1, T1, X1);
+	fp2_sub(T2, T2, Y1);
+
+	if (fp2_is_zero(T1)) {
+		if(fp2_is_zero(T2)){
+			ep2_dbl_projc(R, Q);
+			return ;
+		}
+		else{
+			ep2_set_infty(R);
+			return ;
+		}
+	}
+
+	fp2_mul(Z3, Z1, T1);
+	fp2_sqr(T3, T1);
+	fp2_mul(T4, T3, T1);
+	fp2_mul(T3, T3, X1);
+	fp2_dbl(T1, T3);
+	fp2_sqr(X3, T2);
+	fp2_sub(X3, X3, T1);
+	fp2_sub(X3, X3, T4);
+	fp2_sub(T3, T3, X3);
+	fp2_mul(T3, T3, T2);
+	fp2_mul(T4, T4, Y1);
+	fp2_sub(Y3, T3, T4);
+
+	fp2_copy(R->x, X3);
+	fp2_copy(R->y, Y3);
+	fp2_copy(R->z, Z3);
+
+	fp2_free(T1);
+	fp2_free(T2);
+	fp2_free(T3);
+	fp2_free(T4);
+	fp2_free(X3);
+	fp2_free(Y3);
+	fp2_free(Z3);
+}
+
+static void sm9_eval_g_line(fp12_t num, fp12_t den, ep2_t T, ep2_t P, ep_t Q){
+	const fp_t *XP = P->x;
+	const fp_t *YP = P->y;
+	const fp_t *ZP = P->z;
+	const fp_t *XT = T->x;
+	const fp_t *YT = T->y;
+	const fp_t *ZT = T->z;
+	const uint64_t *xQ = Q->x;
+	const uint64_t *yQ = Q->y;
+
+	fp_t *a0 = num[0][0];
+	fp_t *a1 = num[0][1];
+	fp_t *a4 = num[1][1];
+	fp_t *b1 = den[0][1];
+
+	fp2_t T0, T1, T2, T3, T4;
+	fp2_t two_inv;
+	bn_t three;
+
+	fp2_null(T0);
+	fp2_null(T1);
+	fp2_null(T2);
+	fp2_null(T3);
+	fp2_null(T4);
+
+	fp2_null(two_inv);
+	bn_null(three);
+
+	fp2_new(T0);
+	fp2_new(T1);
+	fp2_new(T2);
+	fp2_new(T3);
+	fp2_new(T4);
+	fp2_new(two_inv);
+	bn_new(three);
+
+	fp12_set_dig(num, 0);
+	fp12_set_dig(den, 0);
+	fp2_set_dig(two_inv, 2);
+	fp2_inv(two_inv, two_inv);
+	bn_set_dig(three, 3);
+
+	fp2_sqr(T0, ZP);
+	fp2_mul(T1, T0, XT);
+	fp2_mul(T0, T0, ZP);
+	fp2_sqr(T2, ZT);
+	fp2_mul(T3, T2, XP);
+	fp2_mul(T2, T2, ZT);
+	fp2_mul(T2, T2, YP);
+	fp2_sub(T1, T1, T3);
+	fp2_mul(T1, T1, ZT);
+	fp2_mul(T1, T1, ZP);
+	fp2_mul(T4, T1, T0);
+	fp2_copy(b1, T4);
+
+	fp2_mul(T1, T1, YP);
+	fp2_mul(T3, T0, YT);
+	fp2_sub(T3, T3, T2);
+	fp2_mul(T0, T0, T3);
+	fp2_mul_fp(T0, T0, xQ);
+	fp2_copy(a4, T0);
+
+	fp2_mul(T3, T3, XP);
+	fp2_mul(T3, T3, ZP);
+	fp2_sub(T1, T1, T3);
+	fp2_copy(a0, T1);
+
+	fp2_mul_fp(T2, T4, yQ);
+	fp2_neg(T2, T2);
+	fp2_copy(a1, T2);
+
+	fp2_free(T0);
+	fp2_free(T1);
+	fp2_free(T2);
+	fp2_free(T3);
+	fp2_free(T4);
+	fp2_free(two_inv);
+	bn_free(three);
+}
+
+static void sm9_eval_g_line_no_den(fp12_t num, fp12_t den, ep2_t T, ep2_t P, ep_t Q){
+	const fp_t *XP = P->x;
+	const fp_t *YP = P->y;
+	const fp_t *ZP = P->z;
+	const fp_t *XT = T->x;
+	const fp_t *YT = T->y;
+	const fp_t *ZT = T->z;
+	const uint64_t *xQ = Q->x;
+	const uint64_t *yQ = Q->y;
+
+	fp_t *a0 = num[0][0];
+	fp_t *a1 = num[0][1];
+	fp_t *a4 = num[1][1];
+	// fp_t *b1 = den[0][1];
+
+	fp2_t T0, T1, T2, T3, T4;
+	fp2_t two_inv;
+	bn_t three;
+
+	fp2_null(T0);
+	fp2_null(T1);
+	fp2_null(T2);
+	fp2_null(T3);
+	fp2_null(T4);
+
+	fp2_null(two_inv);
+	bn_null(three);
+
+	fp2_new(T0);
+	fp2_new(T1);
+	fp2_new(T2);
+	fp2_new(T3);
+	fp2_new(T4);
+	fp2_new(two_inv);
+	bn_new(three);
+
+	fp12_set_dig(num, 0);
+	fp12_set_dig(den, 0);
+	fp2_set_dig(two_inv, 2);
+	fp2_inv(two_inv, two_inv);
+	bn_set_dig(three, 3);
+
+	fp2_sqr(T0, ZP);
+	fp2_mul(T1, T0, XT);
+	fp2_mul(T0, T0, ZP);
+	fp2_sqr(T2, ZT);
+	fp2_mul(T3, T2, XP);
+	fp2_mul(T2, T2, ZT);
+	fp2_mul(T2, T2, YP);
+	fp2_sub(T1, T1, T3);
+	fp2_mul(T1, T1, ZT);
+	fp2_mul(T1, T1, ZP);
+	fp2_mul(T4, T1, T0);
+	// fp2_copy(b1, T4);
+
+	fp2_mul(T1, T1, YP);
+	fp2_mul(T3, T0, YT);
+	fp2_sub(T3, T3, T2);
+	fp2_mul(T0, T0, T3);
+	fp2_mul_fp(T0, T0, xQ);
+	fp2_copy(a4, T0);
+
+	fp2_mul(T3, T3, XP);
+	fp2_mul(T3, T3, ZP);
+	fp2_sub(T1, T1, T3);
+	fp2_copy(a0, T1);
+
+	fp2_mul_fp(T2, T4, yQ);
+	fp2_neg(T2, T2);
+	fp2_copy(a1, T2);
+
+	fp2_free(T0);
+	fp2_free(T1);
+	fp2_free(T2);
+	fp2_free(T3);
+	fp2_free(T4);
+	fp2_free(two_inv);
+	bn_free(three);
+}
+
+void sm9_eval_g_tangent(fp12_t num, fp12_t den, ep2_t P, ep_t Q){
+	// fp_t *x, *y;
+	// x = Q->x;
+	// y = Q->y;
+	const fp_t *XP = P->x;
+	const fp_t *YP = P->y;
+	const fp_t *ZP = P->z;
+	const uint64_t *xQ = Q->x;
+	const uint64_t *yQ = Q->y;
+
+	fp_t *a0 = num[0][0];
+	fp_t *a1 = num[0][1];
+	fp_t *a4 = num[1][1];
+	fp_t *b1 = den[0][1];
+
+	fp2_t t0;
+	fp2_t t1;
+	fp2_t t2;
+	fp2_t two_inv;
+	bn_t three;
+
+	fp2_null(t0);
+	fp2_null(t1);
+	fp2_null(t2);
+	fp2_null(two_inv);
+	bn_null(three);
+
+	fp2_new(t0);
+	fp2_new(t1);
+	fp2_new(t2);
+	fp2_new(two_inv);
+	bn_new(three);
+
+	fp12_set_dig(num, 0);
+	fp12_set_dig(den, 0);
+	fp2_set_dig(two_inv, 2);
+	fp2_inv(two_inv, two_inv);
+	bn_set_dig(three, 3);
+	
+	fp2_sqr(t0, ZP);
+	fp2_mul(t1, t0, ZP);
+	fp2_mul(b1, t1, YP);
+	fp2_mul_fp(t2, b1, yQ);
+	fp2_neg(a1, t2);
+	fp2_sqr(t1, XP);
+	fp2_mul(t0, t0, t1);
+	fp2_mul_fp(t0, t0, xQ);
+	fp2_mul_dig(t0, t0, 3);
+	fp2_mul(a4, t0, two_inv);
+	fp2_mul(t1, t1, XP);
+	fp2_mul_dig(t1, t1, 3);
+	fp2_mul(t1, t1, two_inv);
+	fp2_sqr(t0, YP);
+	fp2_sub(a0, t0, t1);
+
+	fp2_free(t0);
+	fp2_free(t1);
+	fp2_free(t2);
+	fp2_free(two_inv);
+	bn_free(three);
+}
+
+static void sm9_final_exponent_hard_part(fp12_t r, const fp12_t f)
+{
+	// a2 = 0xd8000000019062ed0000b98b0cb27659
+	// a3 = 0x2400000000215d941
+	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
+	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
+	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
+
+	fp12_t t0, t1, t2, t3;
+
+	fp12_null(t0);
+	fp12_null(t1);
+	fp12_null(t2);
+	fp12_null(t3);
+
+	fp12_new(t0);
+	fp12_new(t1);
+	fp12_new(t2);
+	fp12_new(t3);
+
+
+	fp12_pow(t0, f, a3);
+
+	fp12_inv_t(t0, t0);
+	// PERFORMANCE_TEST("fp12_inv_t(t0, t0)",fp12_inv_t(t0, t0),1000);
+	fp12_frobenius(t1, t0);
+	//PERFORMANCE_TEST_NEW("fp12_frobenius(t1, t0)",fp12_frobenius(t1, t0));
+	fp12_mul_t(t1, t0, t1);
+
+	fp12_mul_t(t0, t0, t1);
+	fp12_frobenius(t2, f);
+	//PERFORMANCE_TEST_NEW("fp12_frobenius(t2, f)",fp12_frobenius2(t2, f));
+	fp12_mul_t(t3, t2, f);
+	fp12_pow(t3, t3, nine);
+
+
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t3, f);
+	fp12_sqr_t(t3, t3);
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t2, t2);
+	fp12_mul_t(t2, t2, t1);
+	fp12_frobenius2(t1, f);
+	//PERFORMANCE_TEST_NEW("fp12_frobenius2(t1, f)",fp12_frobenius2(t1, f));
+	fp12_mul_t(t1, t1, t2);
+
+	fp12_pow(t2, t1, a2);
+	// fp12_pow正确性测试
+	// printf("fp12_pow(t2, t1, a2)\n");
+	// fp12_print(t2);
+	// fp12_pow性能测试
+	// PERFORMANCE_TEST_NEW("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2));
+#if 0
+	char a2_str[] = "11011000000000000000000000000000000000011001000001100010111011010000000000000000101110011000101100001100101100100111011001011001";
+	uint64_t a2_t[] = {0x0000b98bcb27659, 0xd8000000019062ed};
+	bn_t tmp;
+	bn_null(tmp);
+	bn_new(tmp);
+	bn_read_str(tmp, a2_str, 128, 2);
+
+	bn_print(tmp);
+
+	fp12_exp(r,t1,tmp);
+	// printf("fp12_exp\n");
+	// fp12_print(r);
+
+	fp12_exp_dig(r,t1,a2_t);
+	// printf("fp12_exp_dig\n");
+	// fp12_print(r);
+
+	// PERFORMANCE_TEST_NEW("fp12_exp(r,r,tmp)",fp12_exp(r,r,tmp));
+	// PERFORMANCE_TEST_NEW("fp12_exp_dig(r,t1,a2_t)",fp12_exp_dig(r,t1,a2));
+
+	bn_free(tmp);
+#endif
+	fp12_mul_t(t0, t2, t0);
+	fp12_frobenius3(t1, f);
+	
+	//PERFORMANCE_TEST_NEW("\nfp12_frobenius3\n",fp12_frobenius3(t1, f));
+
+	fp12_mul_t(t1, t1, t0);
+
+	fp12_copy(r, t1);
+
+	fp12_free(t0);
+	fp12_free(t1);
+	fp12_free(t2);
+	fp12_free(t3);
+}
+
+static void sm9_final_exponent_hard_parter(fp12_t r, const fp12_t f)
+{
+
+	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
+	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
+	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
+
+	const bn_t a3_t;
+	const bn_t a2_t;
+	const bn_t nine_t;
+
+	bn_null(a3_t);
+	bn_null(a2_t);
+	bn_null(nine_t);
+	bn_new(a3_t);
+	bn_new(a2_t);
+	bn_new(nine_t);
+
+	bn_to_bn(a3_t,a3);
+	bn_to_bn(a2_t,a2);
+	bn_to_bn(nine_t,nine);
+
+
+	fp12_t t0, t1, t2, t3;
+
+	fp12_null(t0);
+	fp12_null(t1);
+	fp12_null(t2);
+	fp12_null(t3);
+
+	fp12_new(t0);
+	fp12_new(t1);
+	fp12_new(t2);
+	fp12_new(t3);
+
+	fp12_pow_t(t0, f, a3_t);
+
+	//PERFORMANCE_TEST_NEW("fp12_pow_t(t0, f, a3_t)",fp12_pow_t(t0, f, a3_t));
+
+	fp12_inv_t(t0, t0);
+
+	fp12_frb_t(t1,t0,1);
+	//fp12_frobenius(t1, t0);
+	
+	fp12_mul_t(t1, t0, t1);
+
+	fp12_mul_t(t0, t0, t1);
+	
+	fp12_frb_t(t2,f,1);
+	//fp12_frobenius(t2, f);
+	
+	fp12_mul_t(t3, t2, f);
+	fp12_pow_t(t3, t3, nine_t);
+
+
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t3, f);
+	fp12_sqr_t(t3, t3);
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t2, t2);
+	fp12_mul_t(t2, t2, t1);
+	
+	fp12_frb_t(t1,f,2);
+	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,2)",fp12_frb_t(t1, f,2));
+	//fp12_frobenius2(t1, f);
+
+	fp12_mul_t(t1, t1, t2);
+
+	fp12_pow_t(t2, t1, a2_t);
+
+
+	bn_free(tmp);
+
+	fp12_mul_t(t0, t2, t0);
+	fp12_frb_t(t1,f,3);
+	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,3)",fp12_frb_t(t1, f,3));
+	//fp12_frobenius3(t1,f);
+
+	fp12_mul_t(t1, t1, t0);
+
+	fp12_copy(r, t1);
+
+	fp12_free(t0);
+	fp12_free(t1);
+	fp12_free(t2);
+	fp12_free(t3);
+}
+
+static void sm9_final_exponent_hard_part_t(fp12_t r, const fp12_t f)
 {
 	// a2 = 0xd8000000019062ed0000b98b0cb27659
 	// a3 = 0x2400000000215d941
@@ -2306,22 +3500,379 @@ static void sm9_final_exponent_hard_part_t(fp12_t r, const fp12_t f)
 	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
 	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
 
-	const bn_t a3_t;
-	const bn_t a2_t;
-	const bn_t nine_t;
+	const bn_t a3_t;
+	const bn_t a2_t;
+	const bn_t nine_t;
+
+	bn_null(a3_t);
+	bn_null(a2_t);
+	bn_null(nine_t);
+	bn_new(a3_t);
+	bn_new(a2_t);
+	bn_new(nine_t);
+
+	bn_to_bn(a3_t,a3);
+	bn_to_bn(a2_t,a2);
+	bn_to_bn(nine_t,nine);
+
+
+	fp12_t t0, t1, t2, t3;
+
+	fp12_null(t0);
+	fp12_null(t1);
+	fp12_null(t2);
+	fp12_null(t3);
+
+	fp12_new(t0);
+	fp12_new(t1);
+	fp12_new(t2);
+	fp12_new(t3);
+
+	fp12_pow_t(t0, f, a3_t);
+
+	//PERFORMANCE_TEST_NEW("fp12_pow_t(t0, f, a3_t)",fp12_pow_t(t0, f, a3_t));
+
+	fp12_inv_t(t0, t0);
+
+	//fp12_frb_t(t1,t0,1);
+	fp12_frobenius(t1, t0);
+	
+	fp12_mul_t(t1, t0, t1);
+
+	fp12_mul_t(t0, t0, t1);
+	
+	//fp12_frb_t(t2,f,1);
+	fp12_frobenius(t2, f);
+	
+	fp12_mul_t(t3, t2, f);
+	fp12_pow_t(t3, t3, nine_t);
+
+
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t3, f);
+	fp12_sqr_t(t3, t3);
+	fp12_mul_t(t0, t0, t3);
+	fp12_sqr_t(t2, t2);
+	fp12_mul_t(t2, t2, t1);
+	
+	//fp12_frb_t(t1,f,2);
+	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,2)",fp12_frb_t(t1, f,2));
+	fp12_frobenius2(t1, f);
+
+	fp12_mul_t(t1, t1, t2);
+
+	fp12_pow_t(t2, t1, a2_t);
+	// fp12_pow正确性测试
+	// printf("fp12_pow(t2, t1, a2)\n");
+	// fp12_print(t2);
+	// fp12_pow性能测试
+	// PERFORMANCE_TEST_NEW("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2));
+#if 0
+	char a2_str[] = "11011000000000000000000000000000000000011001000001100010111011010000000000000000101110011000101100001100101100100111011001011001";
+	uint64_t a2_t[] = {0x0000b98bcb27659, 0xd8000000019062ed};
+	bn_t tmp;
+	bn_null(tmp);
+	bn_new(tmp);
+	bn_read_str(tmp, a2_str, 128, 2);
+
+	bn_print(tmp);
+
+	fp12_exp(r,t1,tmp);
+	// printf("fp12_exp\n");
+	// fp12_print(r);
+
+	fp12_exp_dig(r,t1,a2_t);
+	// printf("fp12_exp_dig\n");
+	// fp12_print(r);
+
+	// PERFORMANCE_TEST_NEW("fp12_exp(r,r,tmp)",fp12_exp(r,r,tmp));
+	// PERFORMANCE_TEST_NEW("fp12_exp_dig(r,t1,a2_t)",fp12_exp_dig(r,t1,a2));
+
+	bn_free(tmp);
+#endif
+	fp12_mul_t(t0, t2, t0);
+	//fp12_frb_t(t1,f,3);
+	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,3)",fp12_frb_t(t1, f,3));
+	fp12_frobenius3(t1,f);
+
+	fp12_mul_t(t1, t1, t0);
+
+	fp12_copy(r, t1);
+
+	fp12_free(t0);
+	fp12_free(t1);
+	fp12_free(t2);
+	fp12_free(t3);
+}
+
+// 困难部分, 输入已经在分圆子群中
+static void pp_pow_bn_hard_t(fp12_t c, fp12_t a) {
+	fp12_t y0, y1, y2, y3,T0;
+	bn_t x;
+	const int *b;
+	int l;
+
+	fp12_null(y0);
+	fp12_null(y1);
+	fp12_null(y2);
+	fp12_null(y3);
+	fp12_null(T0);
+	bn_null(x);
+
+	RLC_TRY {
+		fp12_new(y0);
+		fp12_new(y1);
+		fp12_new(y2);
+		fp12_new(y3);
+		fp12_new(T0);
+		bn_new(x);
+
+		fp_prime_get_par(x);                
+		b = fp_prime_get_par_sps(&l);       
+
+		fp12_copy(c, a);
+
+		fp12_inv_cyc_t(y0,c);
+		fp12_pow_cyc_sps_t(T0, y0, b, l, RLC_POS);   
+		fp12_sqr_cyc_t(y3,T0);
+		//PERFORMANCE_TEST_NEW("RELIC 分圆子群", fp12_sqr_cyc_t(y3,T0));
+		fp12_frb_t(y2,y3,1);                         
+		fp12_mul_t(y2,y3,y2);
+		fp12_sqr_cyc_t(y2,y2);
+		fp12_mul_t(y2,y3,y2);
+
+		fp12_mul_t(y1,y3,T0);
+		fp12_pow_cyc_sps_t(T0, y1, b, l, RLC_NEG);
+		fp12_frb_t(y1,T0,2);
+		fp12_mul_t(y1,y0,y1);
+		fp12_inv_cyc_t(T0,T0);
+		fp12_frb_t(y3,T0,1);
+		//PERFORMANCE_TEST_NEW("RELIC fro", fp12_frb_t(y3,T0,1));
+		fp12_mul_t(y3,T0,y3);
+		fp12_sqr_cyc_t(T0,T0);
+		fp12_mul_t(y1,T0,y1);
+		
+		fp12_pow_cyc_sps_t(T0, y3, b, l, RLC_NEG);
+		fp12_sqr_cyc_t(T0,T0);
+		fp12_inv_cyc_t(T0,T0);
+		fp12_mul_t(y3,T0,y3);
+		
+		fp12_frb_t(T0,c,1);
+		fp12_frb_t(y0,c,2);
+		fp12_mul_t(y0,T0,y0);
+		fp12_frb_t(T0,c,3);
+		fp12_mul_t(y0,T0,y0);
+
+		fp12_sqr_cyc_t(T0,y3);
+		fp12_mul_t(T0,T0,y2);
+		fp12_mul_t(y3,T0,y0);
+		fp12_mul_t(T0,T0,y1);
+		fp12_sqr_cyc_t(T0,T0);
+		fp12_mul_t(c,T0,y3);
+
+
+	}
+	RLC_CATCH_ANY {
+		RLC_THROW(ERR_CAUGHT);
+	}
+	RLC_FINALLY {
+		fp12_free(y0);
+		fp12_free(y1);
+		fp12_free(y2);
+		fp12_free(y3);
+		fp12_free(T0);
+		bn_free(x);
+	}
+}
+
+static void pp_pow_bn_t(fp12_t c, fp12_t a) {
+	fp12_conv_cyc_t(c, a);
+	pp_pow_bn_hard_t(c, c);
+}
+
+/* 困难部分 f^((p^4-p^2+1)/n), 指数按 p 进制分解为 l0 + l1*p + l2*p^2 + l3*p^3 (Scott 等):
+ * l3 = 1, l2 = 6u^2+1, l1 = -36u^3-18u^2-12u+1, l0 = -36u^3-30u^2-18u-2.
+ * 精确指数至少要 3 次 u 次幂, 每次都用压缩分圆平方, 之后的向量加法链只用 4 次平方, 13 次乘法和 7 次 Frobenius.
+ */
+// 由 f, fx = f^u, fx2 = f^(u^2), fx3 = f^(u^3) 组合出困难部分
+static void sm9_final_exponent_lattice_chain(fp12_t r, fp12_t f, fp12_t fx, fp12_t fx2, fp12_t fx3)
+{
+	fp12_t y0, y1, y2, y3, y4, y5, y6, t0, t1;
+
+	fp12_null(y0);
+	fp12_null(y1);
+	fp12_null(y2);
+	fp12_null(y3);
+	fp12_null(y4);
+	fp12_null(y5);
+	fp12_null(y6);
+	fp12_null(t0);
+	fp12_null(t1);
+
+	fp12_new(y0);
+	fp12_new(y1);
+	fp12_new(y2);
+	fp12_new(y3);
+	fp12_new(y4);
+	fp12_new(y5);
+	fp12_new(y6);
+	fp12_new(t0);
+	fp12_new(t1);
+
+	// y0 = f^p * f^(p^2) * f^(p^3)
+	fp12_frb_t(y0, f, 1);
+	fp12_frb_t(t0, f, 2);
+	fp12_mul_t(y0, y0, t0);
+	fp12_frb_t(t0, t0, 1);
+	fp12_mul_t(y0, y0, t0);
+
+	// y1 = 1/f
+	fp12_inv_cyc_t(y1, f);
+
+	// y2 = fx2^(p^2)
+	fp12_frb_t(y2, fx2, 2);
+
+	// y3 = 1/fx^p
+	fp12_frb_t(y3, fx, 1);
+	fp12_inv_cyc_t(y3, y3);
+
+	// y4 = 1/(fx * fx2^p)
+	fp12_frb_t(y4, fx2, 1);
+	fp12_mul_t(y4, y4, fx);
+	fp12_inv_cyc_t(y4, y4);
+
+	// y5 = 1/fx2
+	fp12_inv_cyc_t(y5, fx2);
+
+	// y6 = 1/(fx3 * fx3^p)
+	fp12_frb_t(y6, fx3, 1);
+	fp12_mul_t(y6, y6, fx3);
+	fp12_inv_cyc_t(y6, y6);
+
+	// r = y0 * y1^2 * y2^6 * y3^12 * y4^18 * y5^30 * y6^36
+	fp12_sqr_cyc_t(t0, y6);
+	fp12_mul_t(t0, t0, y4);
+	fp12_mul_t(t0, t0, y5);
+	fp12_mul_t(t1, y3, y5);
+	fp12_mul_t(t1, t1, t0);
+	fp12_mul_t(t0, t0, y2);
+	fp12_sqr_cyc_t(t1, t1);
+	fp12_mul_t(t1, t1, t0);
+	fp12_sqr_cyc_t(t1, t1);
+	fp12_mul_t(t0, t1, y1);
+	fp12_mul_t(t1, t1, y0);
+	fp12_sqr_cyc_t(t0, t0);
+	fp12_mul_t(r, t0, t1);
+
+	fp12_free(y0);
+	fp12_free(y1);
+	fp12_free(y2);
+	fp12_free(y3);
+	fp12_free(y4);
+	fp12_free(y5);
+	fp12_free(y6);
+	fp12_free(t0);
+	fp12_free(t1);
+}
+
+static void sm9_final_exponent_hard_lattice(fp12_t r, fp12_t f)
+{
+	fp12_t fx, fx2, fx3;
+	const int *b;
+	int l;
+
+	fp12_null(fx);
+	fp12_null(fx2);
+	fp12_null(fx3);
+
+	fp12_new(fx);
+	fp12_new(fx2);
+	fp12_new(fx3);
+
+	b = fp_prime_get_par_sps(&l);
+
+	fp12_pow_cyc_sps_t(fx, f, b, l, RLC_POS);
+	fp12_pow_cyc_sps_t(fx2, fx, b, l, RLC_POS);
+	fp12_pow_cyc_sps_t(fx3, fx2, b, l, RLC_POS);
+	sm9_final_exponent_lattice_chain(r, f, fx, fx2, fx3);
+
+	fp12_free(fx);
+	fp12_free(fx2);
+	fp12_free(fx3);
+}
+
+static void sm9_final_exponent(fp12_t r, const fp12_t f)
+{
+	fp12_t t0;
+	fp12_t t1;
+
+	fp12_null(t0);
+	fp12_null(t1);
 
-	bn_null(a3_t);
-	bn_null(a2_t);
-	bn_null(nine_t);
-	bn_new(a3_t);
-	bn_new(a2_t);
-	bn_new(nine_t);
+	fp12_new(t0);
+	fp12_new(t1);
 
-	bn_to_bn(a3_t,a3);
-	bn_to_bn(a2_t,a2);
-	bn_to_bn(nine_t,nine);
+	fp12_frobenius6(t0, f);
+	
+	//PERFORMANCE_TEST_NEW("\nfp12_frobenius6\n",fp12_frobenius6(t0, f));
+
+	fp12_inv_t(t1, f);
+
+	fp12_mul_t(t0, t0, t1);
+
+	fp12_frobenius2(t1, t0);
+
+	//PERFORMANCE_TEST_NEW("fp12_frobenius2",fp12_frobenius2(t1, t0));
+	fp12_mul_t(t0, t0, t1);
+
+	sm9_final_exponent_hard_part(t0, t0);
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0));
+	fp12_copy(r, t0);
+	
+	fp12_free(t0);
+	fp12_free(t1);
+}
+
+static void sm9_final_exponent_t(fp12_t r, const fp12_t f)
+{
+	fp12_t t0;
+	fp12_t t1;
+
+	fp12_null(t0);
+	fp12_null(t1);
+
+	fp12_new(t0);
+	fp12_new(t1);
+
+	fp12_frb_t(t0, f,6);
+	//fp12_frobenius6(t0,f);
+
+	fp12_inv_t(t1, f);
+
+	fp12_mul_t(t0, t0, t1);
+	
+	fp12_frb_t(t1, t0,2);
+	//fp12_frobenius2(t1,t0);
+
+	fp12_mul_t(t0, t0, t1);
+
+	sm9_final_exponent_hard_parter(t0, t0);
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0));
+	fp12_copy(r, t0);
+	
+	fp12_free(t0);
+	fp12_free(t1);
+}
 
+#if 1 // crude final exponent
 
+static void sm9_final_exponent_hard_part1(fp12_t r, const fp12_t f)
+{
+	// a2 = 0xd8000000019062ed0000b98b0cb27659
+	// a3 = 0x2400000000215d941
+	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
+	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
+	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
 	fp12_t t0, t1, t2, t3;
 
 	fp12_null(t0);
@@ -2334,330 +3885,647 @@ static void sm9_final_exponent_hard_part_t(fp12_t r, const fp12_t f)
 	fp12_new(t2);
 	fp12_new(t3);
 
-	fp12_pow_t(t0, f, a3_t);
-
-	//PERFORMANCE_TEST_NEW("fp12_pow_t(t0, f, a3_t)",fp12_pow_t(t0, f, a3_t));
-
+	fp12_pow(t0, f, a3);
+	// PERFORMANCE_TEST("fp12_pow(t0, f, a3)",fp12_pow(t0, f, a3),1000);
 	fp12_inv_t(t0, t0);
-
-	//fp12_frb_t(t1,t0,1);
+	// PERFORMANCE_TEST("fp12_inv_t(t0, t0)",fp12_inv_t(t0, t0),1000);
 	fp12_frobenius(t1, t0);
-	
-	fp12_mul_t(t1, t0, t1);
+	// PERFORMANCE_TEST("fp12_frobenius(t1, t0)",fp12_frobenius(t1, t0),1000);
+	fp12_mul_t1(t1, t0, t1);
 
-	fp12_mul_t(t0, t0, t1);
-	
-	//fp12_frb_t(t2,f,1);
+	fp12_mul_t1(t0, t0, t1);
 	fp12_frobenius(t2, f);
-	
-	fp12_mul_t(t3, t2, f);
-	fp12_pow_t(t3, t3, nine_t);
+	fp12_mul_t1(t3, t2, f);
+	fp12_pow(t3, t3, nine);
 
+	fp12_mul_t1(t0, t0, t3);
+	fp12_sqr_t1(t3, f);
+	fp12_sqr_t1(t3, t3);
+	fp12_mul_t1(t0, t0, t3);
+	fp12_sqr_t1(t2, t2);
+	fp12_mul_t1(t2, t2, t1);
+	fp12_frobenius2(t1, f);
+	// PERFORMANCE_TEST("fp12_frobenius2(t1, f)",fp12_frobenius2(t1, f),1000);
+	fp12_mul_t1(t1, t1, t2);
 
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t3, f);
-	fp12_sqr_t(t3, t3);
-	fp12_mul_t(t0, t0, t3);
-	fp12_sqr_t(t2, t2);
-	fp12_mul_t(t2, t2, t1);
+	fp12_pow(t2, t1, a2);
+	// PERFORMANCE_TEST("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2),1000);
+	fp12_mul_t1(t0, t2, t0);
+	fp12_frobenius3(t1, f);
+	fp12_mul_t1(t1, t1, t0);
+
+	fp12_copy(r, t1);
+
+	fp12_free(t0);
+	fp12_free(t1);
+	fp12_free(t2);
+	fp12_free(t3);
+}
+
+static void sm9_final_exponent1(fp12_t r, const fp12_t f)
+{
+	fp12_t t0;
+	fp12_t t1;
+
+	fp12_null(t0);
+	fp12_null(t1);
+
+	fp12_new(t0);
+	fp12_new(t1);
+
+	fp12_frobenius6(t0, f);
+	// PERFORMANCE_TEST("fp12_frobenius6",fp12_frobenius6(t0, f),1000);
+	fp12_inv_t(t1, f);
+
+	fp12_mul_t1(t0, t0, t1);
+
+	fp12_frobenius2(t1, t0);
+	// PERFORMANCE_TEST("fp12_frobenius2",fp12_frobenius2(t1, t0),1000);
+	fp12_mul_t1(t0, t0, t1);
+
+	sm9_final_exponent_hard_part1(t0, t0);
+	// PERFORMANCE_TEST("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0),1000);
+	fp12_copy(r, t0);
 	
-	//fp12_frb_t(t1,f,2);
-	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,2)",fp12_frb_t(t1, f,2));
-	fp12_frobenius2(t1, f);
+	fp12_free(t0);
+	fp12_free(t1);
+}
 
-	fp12_mul_t(t1, t1, t2);
+#endif
 
-	fp12_pow_t(t2, t1, a2_t);
-	// fp12_pow正确性测试
-	// printf("fp12_pow(t2, t1, a2)\n");
-	// fp12_print(t2);
-	// fp12_pow性能测试
-	// PERFORMANCE_TEST_NEW("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2));
-#if 0
-	char a2_str[] = "11011000000000000000000000000000000000011001000001100010111011010000000000000000101110011000101100001100101100100111011001011001";
-	uint64_t a2_t[] = {0x0000b98bcb27659, 0xd8000000019062ed};
-	bn_t tmp;
-	bn_null(tmp);
-	bn_new(tmp);
-	bn_read_str(tmp, a2_str, 128, 2);
+void sm9_final_exponent_method(fp12_t r, const fp12_t f, int method)
+{
+	fp12_t t;
 
-	bn_print(tmp);
+	fp12_null(t);
+	fp12_new(t);
 
-	fp12_exp(r,t1,tmp);
-	// printf("fp12_exp\n");
-	// fp12_print(r);
+	// 简单部分 f^((p^6-1)(p^2+1)) 各方法相同
+	fp12_conv_cyc_t(t, (fp6_t *)f);
+
+	switch (method) {
+	case SM9_FEXP_CRUDE:
+		sm9_final_exponent_hard_part1(r, t);
+		break;
+	case SM9_FEXP_HARD:
+		sm9_final_exponent_hard_part(r, t);
+		break;
+	case SM9_FEXP_HARD_PARTER:
+		sm9_final_exponent_hard_parter(r, t);
+		break;
+	case SM9_FEXP_HARD_T:
+		sm9_final_exponent_hard_part_t(r, t);
+		break;
+	case SM9_FEXP_RELIC:
+		pp_pow_bn_hard_t(r, t);
+		break;
+	case SM9_FEXP_LATTICE:
+	default:
+		sm9_final_exponent_hard_lattice(r, t);
+		break;
+	}
+
+	fp12_free(t);
+}
+
+// 每块的元素个数, 块内共用求逆和解压, 临时数组在栈上, 不宜太大
+#define SM9_FEXP_SIM_BLOCK	16
+
+void sm9_final_exponent_sim(fp12_t r[], const fp12_t f[], int n)
+{
+	fp12_t t[SM9_FEXP_SIM_BLOCK], fx[SM9_FEXP_SIM_BLOCK];
+	fp12_t fx2[SM9_FEXP_SIM_BLOCK], fx3[SM9_FEXP_SIM_BLOCK];
+	fp12_t u;
+	const int *b;
+	int i, j, m, l;
+
+	for (i = 0; i < SM9_FEXP_SIM_BLOCK; i++) {
+		fp12_null(t[i]);
+		fp12_null(fx[i]);
+		fp12_null(fx2[i]);
+		fp12_null(fx3[i]);
+		fp12_new(t[i]);
+		fp12_new(fx[i]);
+		fp12_new(fx2[i]);
+		fp12_new(fx3[i]);
+	}
+	fp12_null(u);
+	fp12_new(u);
+
+	b = fp_prime_get_par_sps(&l);
+
+	for (j = 0; j < n; j += m) {
+		m = RLC_MIN(SM9_FEXP_SIM_BLOCK, n - j);
+
+		// 简单部分 f^((p^6-1)(p^2+1)), f^(p^6-1) = conj(f)/f, 一块只求一次逆
+		fp12_inv_sim_t(t, (fp12_t *)f + j, m);
+		for (i = 0; i < m; i++) {
+			fp12_inv_cyc_t(u, (fp6_t *)f[j + i]);
+			fp12_mul_t(t[i], t[i], u);
+			fp12_frb_t(u, t[i], 2);
+			fp12_mul_t(t[i], t[i], u);
+		}
+
+		// 困难部分, 三次 u 次幂的解压在块内合并
+		fp12_pow_cyc_sps_sim_t(fx, t, m, b, l, RLC_POS);
+		fp12_pow_cyc_sps_sim_t(fx2, fx, m, b, l, RLC_POS);
+		fp12_pow_cyc_sps_sim_t(fx3, fx2, m, b, l, RLC_POS);
+		for (i = 0; i < m; i++) {
+			sm9_final_exponent_lattice_chain(r[j + i], t[i], fx[i], fx2[i], fx3[i]);
+		}
+	}
+
+	for (i = 0; i < SM9_FEXP_SIM_BLOCK; i++) {
+		fp12_free(t[i]);
+		fp12_free(fx[i]);
+		fp12_free(fx2[i]);
+		fp12_free(fx3[i]);
+	}
+	fp12_free(u);
+}
+
+
+static void sm9_twist_point_neg(ep2_t R,const ep2_t Q){
+	fp2_copy(R->x, Q->x);
+	fp2_neg(R->y, Q->y);
+	fp2_copy(R->z, Q->z);
+	R->coord = Q->coord;
+}
+
+
+//original pairing 
+void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
+	// a)
+	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
+	// const char *abits = "1";
+	
+	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
+	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
+	ep_t _p;
+	bn_t n;
+
+	// null
+	ep_null(_p);
+	bn_null(n);
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(ep2_tmp);
+	ep2_null(ep2_tmp2);
+	fp12_null(f);
+	fp12_null(g);
+	fp12_null(f_num);
+	fp12_null(f_den);
+	fp12_null(g_num);
+	fp12_null(g_den);
+	fp12_null(fp12_tmp);
+
+	ep_new(_p);
+	bn_new(n);
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(ep2_tmp);
+	ep2_new(ep2_tmp2);
+	fp12_new(f);
+	fp12_new(g);
+	fp12_new(f_num);
+	fp12_new(f_den);
+	fp12_new(g_num);
+	fp12_new(g_den);
+	fp12_new(fp12_tmp);
 
-	fp12_exp_dig(r,t1,a2_t);
-	// printf("fp12_exp_dig\n");
-	// fp12_print(r);
+	// b)
+	ep2_copy(T, Q);
+	fp12_set_dig(f_num, 1);
+	fp12_set_dig(f_den, 1);
 
-	// PERFORMANCE_TEST_NEW("fp12_exp(r,r,tmp)",fp12_exp(r,r,tmp));
-	// PERFORMANCE_TEST_NEW("fp12_exp_dig(r,t1,a2_t)",fp12_exp_dig(r,t1,a2));
+	for(size_t i = 0; i < strlen(abits); i++)
+	{
+		// c)
+		fp12_sqr_t1(f_num, f_num);
+		fp12_sqr_t1(f_den, f_den);
 
-	bn_free(tmp);
-#endif
-	fp12_mul_t(t0, t2, t0);
-	//fp12_frb_t(t1,f,3);
-	//PERFORMANCE_TEST_NEW("fp12_frb_t(t1, f,3)",fp12_frb_t(t1, f,3));
-	fp12_frobenius3(t1,f);
+		sm9_eval_g_tangent(g_num, g_den, T, P);
+		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
-	fp12_mul_t(t1, t1, t0);
+		fp12_mul_t1(f_num, f_num, g_num);
+		fp12_mul_t1(f_den, f_den, g_den);
 
-	fp12_copy(r, t1);
+		ep2_dbl_projc(T, T);
+		// c.2)
+		if (abits[i] == '1')
+		{
+			sm9_eval_g_line(g_num, g_den, T, Q, P);
+			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
+			fp12_mul_t1(f_num, f_num, g_num);
+			fp12_mul_t1(f_den, f_den, g_den);
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+	}
+	// d)
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
+	
+	// e)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_t1(f_den, f_den, g_den);
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-	fp12_free(t0);
-	fp12_free(t1);
-	fp12_free(t2);
-	fp12_free(t3);
-}
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_t1(f_den, f_den, g_den);
+	// ep2_add_projc(T, T, Q2);  // T = T - Q2
 
-static void pp_pow_bn_t(fp12_t c, fp12_t a) {
-	fp12_t y0, y1, y2, y3,T0;
-	bn_t x;
-	const int *b;
-	int l;
+	// g)
+	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_null(y0);
-	fp12_null(y1);
-	fp12_null(y2);
-	fp12_null(y3);
-	fp12_null(T0);
-	bn_null(x);
+	fp12_mul_t1(r, f_num, f_den);  // r = f_num*f_den = f
 
-	RLC_TRY {
-		fp12_new(y0);
-		fp12_new(y1);
-		fp12_new(y2);
-		fp12_new(y3);
-		fp12_new(T0);
-		bn_new(x);
+	sm9_final_exponent1(r, r);  // r = f^{(q^12-1)/r'}
+	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
 
-		fp_prime_get_par(x);                
-		b = fp_prime_get_par_sps(&l);       
+	ep_free(_p);
+	bn_free(n);
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(ep2_tmp);
+	ep2_free(ep2_tmp2);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(f_num);
+	fp12_free(f_den);
+	fp12_free(g_num);
+	fp12_free(g_den);
+	fp12_free(fp12_tmp);
 
-		fp12_conv_cyc_t(c, a);
+	return ;
+}
 
-		fp12_inv_cyc_t(y0,c);
-		fp12_pow_cyc_sps_t(T0, y0, b, l, RLC_POS);   
-		fp12_sqr_cyc_t(y3,T0);
-		//PERFORMANCE_TEST_NEW("RELIC 分圆子群", fp12_sqr_cyc_t(y3,T0));
-		fp12_frb_t(y2,y3,1);                         
-		fp12_mul_t(y2,y3,y2);
-		fp12_sqr_cyc_t(y2,y2);
-		fp12_mul_t(y2,y3,y2);
+void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
+	// a)
+	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
+	
+	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
+	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
+	ep_t _p;
+	bn_t n;
 
-		fp12_mul_t(y1,y3,T0);
-		fp12_pow_cyc_sps_t(T0, y1, b, l, RLC_NEG);
-		fp12_frb_t(y1,T0,2);
-		fp12_mul_t(y1,y0,y1);
-		fp12_inv_cyc_t(T0,T0);
-		fp12_frb_t(y3,T0,1);
-		//PERFORMANCE_TEST_NEW("RELIC fro", fp12_frb_t(y3,T0,1));
-		fp12_mul_t(y3,T0,y3);
-		fp12_sqr_cyc_t(T0,T0);
-		fp12_mul_t(y1,T0,y1);
-		
-		fp12_pow_cyc_sps_t(T0, y3, b, l, RLC_NEG);
-		fp12_sqr_cyc_t(T0,T0);
-		fp12_inv_cyc_t(T0,T0);
-		fp12_mul_t(y3,T0,y3);
-		
-		fp12_frb_t(T0,c,1);
-		fp12_frb_t(y0,c,2);
-		fp12_mul_t(y0,T0,y0);
-		fp12_frb_t(T0,c,3);
-		fp12_mul_t(y0,T0,y0);
+	// null
+	ep_null(_p);
+	bn_null(n);
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(ep2_tmp);
+	ep2_null(neg_Q);
+	fp12_null(f);
+	fp12_null(g);
+	fp12_null(f_num);
+	fp12_null(f_den);
+	fp12_null(g_num);
+	fp12_null(g_den);
+	fp12_null(fp12_tmp);
 
-		fp12_sqr_cyc_t(T0,y3);
-		fp12_mul_t(T0,T0,y2);
-		fp12_mul_t(y3,T0,y0);
-		fp12_mul_t(T0,T0,y1);
-		fp12_sqr_cyc_t(T0,T0);
-		fp12_mul_t(c,T0,y3);
+	ep_new(_p);
+	bn_new(n);
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(ep2_tmp);
+	ep2_new(neg_Q);
+	fp12_new(f);
+	fp12_new(g);
+	fp12_new(f_num);
+	fp12_new(f_den);
+	fp12_new(g_num);
+	fp12_new(g_den);
+	fp12_new(fp12_tmp);
 
+	sm9_twist_point_neg(neg_Q,Q);
 
-	}
-	RLC_CATCH_ANY {
-		RLC_THROW(ERR_CAUGHT);
-	}
-	RLC_FINALLY {
-		fp12_free(y0);
-		fp12_free(y1);
-		fp12_free(y2);
-		fp12_free(y3);
-		fp12_free(T0);
-		bn_free(x);
-	}
-}
+	// b)
+	ep2_copy(T, Q);
+	fp12_set_dig(f_num, 1);
+	fp12_set_dig(f_den, 1);
 
-static void sm9_final_exponent(fp12_t r, const fp12_t f)
-{
-	fp12_t t0;
-	fp12_t t1;
+	for(size_t i = 0; i < strlen(abits); i++)
+	{
+		// c)
+		fp12_sqr_t(f_num, f_num);
+		fp12_sqr_t(f_den, f_den);
 
-	fp12_null(t0);
-	fp12_null(t1);
+		sm9_eval_g_tangent(g_num, g_den, T, P);
+		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
-	fp12_new(t0);
-	fp12_new(t1);
+		fp12_mul_sparse(f_num, f_num, g_num);
+		fp12_mul_sparse(f_den, f_den, g_den);
 
-	fp12_frobenius6(t0, f);
+		ep2_dbl_projc(T, T);
+		// c.2)
+		if (abits[i] == '1'){
+			sm9_eval_g_line(g_num, g_den, T, Q, P);
+			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		}
+	}
+	// d)
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
 	
-	//PERFORMANCE_TEST_NEW("\nfp12_frobenius6\n",fp12_frobenius6(t0, f));
+	// e)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-	fp12_inv_t(t1, f);
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	//	ep2_add(T, T, Q2);  // T = T - Q2
 
-	fp12_mul_t(t0, t0, t1);
+	// g)
+	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_frobenius2(t1, t0);
+	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
 
-	//PERFORMANCE_TEST_NEW("fp12_frobenius2",fp12_frobenius2(t1, t0));
-	fp12_mul_t(t0, t0, t1);
+	//pp_pow_bn_t(r,r);
+	sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
 
-	sm9_final_exponent_hard_part(t0, t0);
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0));
-	fp12_copy(r, t0);
-	
-	fp12_free(t0);
-	fp12_free(t1);
+	ep_free(_p);
+	bn_free(n);
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(ep2_tmp);
+	ep2_free(neg_Q);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(f_num);
+	fp12_free(f_den);
+	fp12_free(g_num);
+	fp12_free(g_den);
+	fp12_free(fp12_tmp);
+	return ;
 }
 
-static void sm9_final_exponent_t(fp12_t r, const fp12_t f)
-{
-	fp12_t t0;
-	fp12_t t1;
 
-	fp12_null(t0);
-	fp12_null(t1);
+void sm9_pairing_faster(fp12_t r, const ep2_t Q, const ep_t P){
+	// a)
+	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
+	
+	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
+	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
+	ep_t _p;
+	bn_t n;
 
-	fp12_new(t0);
-	fp12_new(t1);
+	// null
+	ep_null(_p);
+	bn_null(n);
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(ep2_tmp);
+	ep2_null(neg_Q);
+	fp12_null(f);
+	fp12_null(g);
+	fp12_null(f_num);
+	fp12_null(f_den);
+	fp12_null(g_num);
+	fp12_null(g_den);
+	fp12_null(fp12_tmp);
 
-	fp12_frb_t(t0, f,6);
-	//fp12_frobenius6(t0,f);
+	ep_new(_p);
+	bn_new(n);
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(ep2_tmp);
+	ep2_new(neg_Q);
+	fp12_new(f);
+	fp12_new(g);
+	fp12_new(f_num);
+	fp12_new(f_den);
+	fp12_new(g_num);
+	fp12_new(g_den);
+	fp12_new(fp12_tmp);
 
-	fp12_inv_t(t1, f);
+	sm9_twist_point_neg(neg_Q,Q);
 
-	fp12_mul_t(t0, t0, t1);
-	
-	fp12_frb_t(t1, t0,2);
-	//fp12_frobenius2(t1,t0);
+	// b)
+	ep2_copy(T, Q);
+	fp12_set_dig(f_num, 1);
+	fp12_set_dig(f_den, 1);
 
-	fp12_mul_t(t0, t0, t1);
+	for(size_t i = 0; i < strlen(abits); i++)
+	{
+		// c)
+		fp12_sqr_t(f_num, f_num);
+		fp12_sqr_t(f_den, f_den);
 
-	sm9_final_exponent_hard_parter(t0, t0);
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0));
-	fp12_copy(r, t0);
-	
-	fp12_free(t0);
-	fp12_free(t1);
-}
+		sm9_eval_g_tangent(g_num, g_den, T, P);
+		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
-#if 1 // crude final exponent
+		fp12_mul_sparse(f_num, f_num, g_num);
+		fp12_mul_sparse(f_den, f_den, g_den);
 
-static void sm9_final_exponent_hard_part1(fp12_t r, const fp12_t f)
-{
-	// a2 = 0xd8000000019062ed0000b98b0cb27659
-	// a3 = 0x2400000000215d941
-	const sm9_bn_t a2 = {0xcb27659, 0x0000b98b, 0x019062ed, 0xd8000000, 0, 0, 0, 0};
-	const sm9_bn_t a3 = {0x215d941, 0x40000000, 0x2, 0, 0, 0, 0, 0};
-	const sm9_bn_t nine = {9,0,0,0,0,0,0,0};
-	fp12_t t0, t1, t2, t3;
+		ep2_dbl_projc(T, T);
+		// c.2)
+		if (abits[i] == '1'){
+			sm9_eval_g_line(g_num, g_den, T, Q, P);
+			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
 
-	fp12_null(t0);
-	fp12_null(t1);
-	fp12_null(t2);
-	fp12_null(t3);
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		}
+	}
+	// d)
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
+	
+	// e)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-	fp12_new(t0);
-	fp12_new(t1);
-	fp12_new(t2);
-	fp12_new(t3);
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	//	ep2_add(T, T, Q2);  // T = T - Q2
 
-	fp12_pow(t0, f, a3);
-	// PERFORMANCE_TEST("fp12_pow(t0, f, a3)",fp12_pow(t0, f, a3),1000);
-	fp12_inv_t(t0, t0);
-	// PERFORMANCE_TEST("fp12_inv_t(t0, t0)",fp12_inv_t(t0, t0),1000);
-	fp12_frobenius(t1, t0);
-	// PERFORMANCE_TEST("fp12_frobenius(t1, t0)",fp12_frobenius(t1, t0),1000);
-	fp12_mul_t1(t1, t0, t1);
+	// g)
+	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_mul_t1(t0, t0, t1);
-	fp12_frobenius(t2, f);
-	fp12_mul_t1(t3, t2, f);
-	fp12_pow(t3, t3, nine);
+	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
 
-	fp12_mul_t1(t0, t0, t3);
-	fp12_sqr_t1(t3, f);
-	fp12_sqr_t1(t3, t3);
-	fp12_mul_t1(t0, t0, t3);
-	fp12_sqr_t1(t2, t2);
-	fp12_mul_t1(t2, t2, t1);
-	fp12_frobenius2(t1, f);
-	// PERFORMANCE_TEST("fp12_frobenius2(t1, f)",fp12_frobenius2(t1, f),1000);
-	fp12_mul_t1(t1, t1, t2);
+	sm9_final_exponent_t(r, r);  // r = f^{(q^12-1)/r'}
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
 
-	fp12_pow(t2, t1, a2);
-	// PERFORMANCE_TEST("fp12_pow(t2, t1, a2)",fp12_pow(t2, t1, a2),1000);
-	fp12_mul_t1(t0, t2, t0);
-	fp12_frobenius3(t1, f);
-	fp12_mul_t1(t1, t1, t0);
+	ep_free(_p);
+	bn_free(n);
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(ep2_tmp);
+	ep2_free(neg_Q);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(f_num);
+	fp12_free(f_den);
+	fp12_free(g_num);
+	fp12_free(g_den);
+	fp12_free(fp12_tmp);
+	return ;
+}
 
-	fp12_copy(r, t1);
+/*input:ep2 ep
+output:fp12
+*/
+void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
+	// a)
+	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
+	
+	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
+	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
+	ep_t _p;
+	bn_t n;
 
-	fp12_free(t0);
-	fp12_free(t1);
-	fp12_free(t2);
-	fp12_free(t3);
-}
+	// null
+	ep_null(_p);
+	bn_null(n);
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(ep2_tmp);
+	ep2_null(neg_Q);
+	fp12_null(f);
+	fp12_null(g);
+	fp12_null(f_num);
+	fp12_null(f_den);
+	fp12_null(g_num);
+	fp12_null(g_den);
+	fp12_null(fp12_tmp);
 
-static void sm9_final_exponent1(fp12_t r, const fp12_t f)
-{
-	fp12_t t0;
-	fp12_t t1;
+	ep_new(_p);
+	bn_new(n);
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(ep2_tmp);
+	ep2_new(neg_Q);
+	fp12_new(f);
+	fp12_new(g);
+	fp12_new(f_num);
+	fp12_new(f_den);
+	fp12_new(g_num);
+	fp12_new(g_den);
+	fp12_new(fp12_tmp);
 
-	fp12_null(t0);
-	fp12_null(t1);
+	sm9_twist_point_neg(neg_Q,Q);
 
-	fp12_new(t0);
-	fp12_new(t1);
+	// b)
+	ep2_copy(T, Q);
+	fp12_set_dig(f_num, 1);
+	fp12_set_dig(f_den, 1);
 
-	fp12_frobenius6(t0, f);
-	// PERFORMANCE_TEST("fp12_frobenius6",fp12_frobenius6(t0, f),1000);
-	fp12_inv_t(t1, f);
+	for(size_t i = 0; i < strlen(abits); i++)
+	{
+		// c)
+		fp12_sqr_t(f_num, f_num);
+		// fp12_sqr_t(f_den, f_den);
 
-	fp12_mul_t1(t0, t0, t1);
+		sm9_eval_g_tangent(g_num, g_den, T, P);
+		fp12_mul_sparse(f_num, f_num, g_num);
+		// fp12_mul_sparse(f_den, f_den, g_den);
 
-	fp12_frobenius2(t1, t0);
-	// PERFORMANCE_TEST("fp12_frobenius2",fp12_frobenius2(t1, t0),1000);
-	fp12_mul_t1(t0, t0, t1);
+		ep2_dbl_projc(T, T);
+		// c.2)
+		if (abits[i] == '1'){
+			sm9_eval_g_line_no_den(g_num, g_den, T, Q, P);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			// fp12_mul_sparse2(f_den, f_den, g_den);
 
-	sm9_final_exponent_hard_part1(t0, t0);
-	// PERFORMANCE_TEST("sm9_final_exponent_hard_part",sm9_final_exponent_hard_part(t0, t0),1000);
-	fp12_copy(r, t0);
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			// fp12_mul_sparse2(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		}
+	}
+	// d)
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
 	
-	fp12_free(t0);
-	fp12_free(t1);
-}
+	// e)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	//PERFORMANCE_TEST_NEW("RELIC 直线", sm9_eval_g_tangent(g_num, g_den, T, P));
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	// fp12_mul_sparse2(f_den, f_den, g_den);
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-#endif
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	// fp12_mul_sparse2(f_den, f_den, g_den);
+	//	ep2_add(T, T, Q2);  // T = T - Q2
 
+	// g)
+	// fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-static void sm9_twist_point_neg(ep2_t R,const ep2_t Q){
-	fp2_copy(R->x, Q->x);
-	fp2_neg(R->y, Q->y);
-	fp2_copy(R->z, Q->z);
+	// fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
+	fp12_copy(r, f_num);
+	pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
+	//PERFORMANCE_TEST_NEW("RELIC final exp", pp_pow_bn_t(r,r));
+	ep_free(_p);
+	bn_free(n);
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(ep2_tmp);
+	ep2_free(neg_Q);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(f_num);
+	fp12_free(f_den);
+	fp12_free(g_num);
+	fp12_free(g_den);
+	fp12_free(fp12_tmp);
+	return ;
 }
 
 
-//original pairing 
-void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
+
+void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
 	// a)
-	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
-	// const char *abits = "1";
+	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
 	
 	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
+	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
 	ep_t _p;
 	bn_t n;
 
@@ -2668,7 +4536,7 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_null(Q1);
 	ep2_null(Q2);
 	ep2_null(ep2_tmp);
-	ep2_null(ep2_tmp2);
+	ep2_null(neg_Q);
 	fp12_null(f);
 	fp12_null(g);
 	fp12_null(f_num);
@@ -2683,7 +4551,7 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_new(Q1);
 	ep2_new(Q2);
 	ep2_new(ep2_tmp);
-	ep2_new(ep2_tmp2);
+	ep2_new(neg_Q);
 	fp12_new(f);
 	fp12_new(g);
 	fp12_new(f_num);
@@ -2692,6 +4560,8 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_new(g_den);
 	fp12_new(fp12_tmp);
 
+	sm9_twist_point_neg(neg_Q,Q);
+
 	// b)
 	ep2_copy(T, Q);
 	fp12_set_dig(f_num, 1);
@@ -2700,25 +4570,31 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	for(size_t i = 0; i < strlen(abits); i++)
 	{
 		// c)
-		fp12_sqr_t1(f_num, f_num);
-		fp12_sqr_t1(f_den, f_den);
+		fp12_sqr_t(f_num, f_num);
+		fp12_sqr_t(f_den, f_den);
 
 		sm9_eval_g_tangent(g_num, g_den, T, P);
 		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
-		fp12_mul_t1(f_num, f_num, g_num);
-		fp12_mul_t1(f_den, f_den, g_den);
+		fp12_mul_t(f_num, f_num, g_num);
+		fp12_mul_sparse(f_den, f_den, g_den);
 
 		ep2_dbl_projc(T, T);
 		// c.2)
-		if (abits[i] == '1')
-		{
+		if (abits[i] == '1'){
 			sm9_eval_g_line(g_num, g_den, T, Q, P);
 			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_t1(f_num, f_num, g_num);
-			fp12_mul_t1(f_den, f_den, g_den);
+			fp12_mul_t(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+
 			ep2_add_projc(T, T, Q);  // T = T + Q
 		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_t(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		}
 	}
 	// d)
 	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
@@ -2726,23 +4602,23 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	
 	// e)
 	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_t1(f_den, f_den, g_den);
+	fp12_mul_t(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
 	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
 	// f)
 	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_t1(f_den, f_den, g_den);
-	// ep2_add_projc(T, T, Q2);  // T = T - Q2
+	fp12_mul_t(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	//	ep2_add(T, T, Q2);  // T = T - Q2
 
 	// g)
 	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_mul_t1(r, f_num, f_den);  // r = f_num*f_den = f
+	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
 
-	sm9_final_exponent1(r, r);  // r = f^{(q^12-1)/r'}
-	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+	pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
 
 	ep_free(_p);
 	bn_free(n);
@@ -2750,7 +4626,7 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_free(Q1);
 	ep2_free(Q2);
 	ep2_free(ep2_tmp);
-	ep2_free(ep2_tmp2);
+	ep2_free(neg_Q);
 	fp12_free(f);
 	fp12_free(g);
 	fp12_free(f_num);
@@ -2758,16 +4634,529 @@ void sm9_pairing(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_free(g_num);
 	fp12_free(g_den);
 	fp12_free(fp12_tmp);
-
 	return ;
 }
 
-void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
+
+// 齐次射影坐标 (x = X/Z, y = Y/Z) 下倍点与切线合并计算, l = l[0] + l[1] * yP + l[2] * xP
+// T = 2T, 3M + 5S, 无求逆
+static void sm9_dbl_line(fp2_t l[3], ep2_t T){
+	fp2_t A, B, C, E, F, G, H;
+
+	fp2_null(A);
+	fp2_null(B);
+	fp2_null(C);
+	fp2_null(E);
+	fp2_null(F);
+	fp2_null(G);
+	fp2_null(H);
+
+	fp2_new(A);
+	fp2_new(B);
+	fp2_new(C);
+	fp2_new(E);
+	fp2_new(F);
+	fp2_new(G);
+	fp2_new(H);
+
+	fp2_mul(A, T->x, T->y);
+	fp_hlv(A[0], A[0]);
+	fp_hlv(A[1], A[1]);  // A = XY/2
+	fp2_sqr(B, T->y);    // B = Y^2
+	fp2_sqr(C, T->z);    // C = Z^2
+	fp2_mul_art(E, C);
+	fp2_mul_dig(E, E, 15);  // E = 3b'Z^2, b' = 5u
+	fp2_dbl(F, E);
+	fp2_add(F, F, E);    // F = 3E
+	fp2_add(G, B, F);
+	fp_hlv(G[0], G[0]);
+	fp_hlv(G[1], G[1]);  // G = (B + F)/2
+	fp2_add(H, T->y, T->z);
+	fp2_sqr(H, H);
+	fp2_sub(H, H, B);
+	fp2_sub(H, H, C);    // H = 2YZ
+
+	// l = (E - B) - H * yP + 3X^2 * xP
+	fp2_sub(l[0], E, B);
+	fp2_neg(l[1], H);
+	fp2_sqr(l[2], T->x);
+	fp2_dbl(C, l[2]);
+	fp2_add(l[2], l[2], C);
+
+	fp2_sub(T->x, B, F);
+	fp2_mul(T->x, T->x, A);  // X3 = A(B - F)
+	fp2_sqr(E, E);
+	fp2_dbl(C, E);
+	fp2_add(E, E, C);
+	fp2_sqr(G, G);
+	fp2_sub(T->y, G, E);     // Y3 = G^2 - 3E^2
+	fp2_mul(T->z, B, H);     // Z3 = BH
+	T->coord = PROJC;
+
+	fp2_free(A);
+	fp2_free(B);
+	fp2_free(C);
+	fp2_free(E);
+	fp2_free(F);
+	fp2_free(G);
+	fp2_free(H);
+}
+
+// T = T + Q, Q 为仿射点, 同时给出过 T, Q 的直线, 11M + 2S
+static void sm9_add_line(fp2_t l[3], ep2_t T, const ep2_t Q){
+	fp2_t t, lambda, C, D, E, F, G;
+
+	fp2_null(t);
+	fp2_null(lambda);
+	fp2_null(C);
+	fp2_null(D);
+	fp2_null(E);
+	fp2_null(F);
+	fp2_null(G);
+
+	fp2_new(t);
+	fp2_new(lambda);
+	fp2_new(C);
+	fp2_new(D);
+	fp2_new(E);
+	fp2_new(F);
+	fp2_new(G);
+
+	fp2_mul(t, (fp_t *)Q->y, T->z);
+	fp2_sub(t, T->y, t);            // theta = Y1 - y2 Z1
+	fp2_mul(lambda, (fp_t *)Q->x, T->z);
+	fp2_sub(lambda, T->x, lambda);  // lambda = X1 - x2 Z1
+
+	// l = (lambda y2 - theta x2) - lambda * yP + theta * xP
+	fp2_mul(C, lambda, (fp_t *)Q->y);
+	fp2_mul(D, t, (fp_t *)Q->x);
+	fp2_sub(l[0], C, D);
+	fp2_neg(l[1], lambda);
+	fp2_copy(l[2], t);
+
+	fp2_sqr(C, t);
+	fp2_sqr(D, lambda);
+	fp2_mul(E, lambda, D);   // E = lambda^3
+	fp2_mul(F, T->z, C);     // F = Z1 theta^2
+	fp2_mul(G, T->x, D);     // G = X1 lambda^2
+	fp2_add(F, F, E);
+	fp2_sub(F, F, G);
+	fp2_sub(F, F, G);        // H = E + F - 2G
+	fp2_mul(T->x, lambda, F);
+	fp2_sub(G, G, F);
+	fp2_mul(G, G, t);
+	fp2_mul(C, T->y, E);
+	fp2_sub(T->y, G, C);     // Y3 = theta(G - H) - Y1 E
+	fp2_mul(T->z, T->z, E);  // Z3 = Z1 E
+	T->coord = PROJC;
+
+	fp2_free(t);
+	fp2_free(lambda);
+	fp2_free(C);
+	fp2_free(D);
+	fp2_free(E);
+	fp2_free(F);
+	fp2_free(G);
+}
+
+// Q1 = pi_q(Q), Q2 = -pi_{q^2}(Q), Q 为仿射点, 结果也是仿射点
+static void sm9_g2_frb(ep2_t Q1, ep2_t Q2, const ep2_t Q){
+	fp2_conjugate(Q1->x, Q->x);
+	fp_mul(Q1->x[0], Q1->x[0], SM9_FRB_X1);
+	fp_mul(Q1->x[1], Q1->x[1], SM9_FRB_X1);
+	fp2_conjugate(Q1->y, Q->y);
+	fp_mul(Q1->y[0], Q1->y[0], SM9_FRB_Y1);
+	fp_mul(Q1->y[1], Q1->y[1], SM9_FRB_Y1);
+	fp2_set_dig(Q1->z, 1);
+	Q1->coord = BASIC;
+
+	fp_mul(Q2->x[0], Q->x[0], SM9_FRB_X2);
+	fp_mul(Q2->x[1], Q->x[1], SM9_FRB_X2);
+	fp_mul(Q2->y[0], Q->y[0], SM9_FRB_Y2);
+	fp_mul(Q2->y[1], Q->y[1], SM9_FRB_Y2);
+	fp2_neg(Q2->y, Q2->y);
+	fp2_set_dig(Q2->z, 1);
+	Q2->coord = BASIC;
+}
+
+// f = f * l(P), g only holds the sparse line
+static void sm9_g2_pre_eval(fp12_t f, fp12_t g, const fp2_t *l, ep_t P){
+	fp2_copy(g[0][0], (fp_t *)l[0]);
+	fp2_mul_fp(g[0][1], l[1], P->y);
+	fp2_mul_fp(g[1][1], l[2], P->x);
+	fp12_mul_sparse(f, f, g);
+}
+
+// f = f * l1(P1) * l2(P2), the two lines are multiplied together first
+static void sm9_g2_pre_eval2(fp12_t f, fp12_t g, fp12_t h, const fp2_t *l1, const fp2_t *l2, ep_t P1, ep_t P2){
+	fp2_copy(g[0][0], (fp_t *)l1[0]);
+	fp2_mul_fp(g[0][1], l1[1], P1->y);
+	fp2_mul_fp(g[1][1], l1[2], P1->x);
+	fp2_copy(h[0][0], (fp_t *)l2[0]);
+	fp2_mul_fp(h[0][1], l2[1], P2->y);
+	fp2_mul_fp(h[1][1], l2[2], P2->x);
+	fp12_mul_line2(h, g, h);
+	fp12_mul_t(f, f, h);
+}
+
+// f = f_{Q}(P) with the two Frobenius lines, Q and P affine
+// the loop follows sm9_ate_run/sm9_ate_sgn, doubling-only runs have no per-step dispatch
+static void sm9_miller_loop(fp12_t f, const ep2_t Q, ep_t P){
+	fp12_t g, h;
+	fp2_t l[3], m[3];
+	ep2_t T, Q1, Q2, neg_Q;
+
+	fp12_null(g);
+	fp12_null(h);
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(neg_Q);
+
+	fp12_new(g);
+	fp12_new(h);
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(neg_Q);
+	for (int j = 0; j < 3; j++) {
+		fp2_null(l[j]);
+		fp2_null(m[j]);
+		fp2_new(l[j]);
+		fp2_new(m[j]);
+	}
+
+	fp12_set_dig(g, 0);
+	fp12_set_dig(h, 0);
+	ep2_neg(neg_Q, (ep2_st *)Q);
+	ep2_copy(T, (ep2_st *)Q);
+	fp12_set_dig(f, 1);
+	for (int i = 0; i < sm9_ate_len; i++) {
+		for (int k = sm9_ate_run[i]; k > 1; k--) {
+			fp12_sqr_t(f, f);
+			sm9_dbl_line(l, T);
+			sm9_g2_pre_eval(f, g, l, P);
+		}
+		// 最后一次倍点的切线与加法直线先相乘
+		fp12_sqr_t(f, f);
+		sm9_dbl_line(l, T);
+		if (sm9_ate_sgn[i] != 0) {
+			sm9_add_line(m, T, sm9_ate_sgn[i] > 0 ? Q : neg_Q);
+			sm9_g2_pre_eval2(f, g, h, l, m, P, P);
+		} else {
+			sm9_g2_pre_eval(f, g, l, P);
+		}
+	}
+
+	sm9_g2_frb(Q1, Q2, Q);
+	sm9_add_line(l, T, Q1);
+	sm9_add_line(m, T, Q2);
+	sm9_g2_pre_eval2(f, g, h, l, m, P, P);
+
+	fp12_free(g);
+	fp12_free(h);
+	for (int j = 0; j < 3; j++) {
+		fp2_free(l[j]);
+		fp2_free(m[j]);
+	}
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(neg_Q);
+}
+
+// same result as sm9_pairing_fastest, with fused line kernels and the schedule from sm9_init
+void sm9_pairing_ate(fp12_t r, const ep2_t Q, const ep_t P){
+	ep2_t _q;
+	ep_t _p;
+
+	if (ep_is_infty(P) || ep2_is_infty((ep2_st *)Q)) {
+		fp12_set_dig(r, 1);
+		return;
+	}
+
+	ep2_null(_q);
+	ep_null(_p);
+	ep2_new(_q);
+	ep_new(_p);
+
+	ep_norm(_p, P);
+	ep2_norm(_q, (ep2_st *)Q);
+	sm9_miller_loop(r, _q, _p);
+	sm9_final_exponent_method(r, r, SM9_FEXP_DEFAULT);
+
+	ep2_free(_q);
+	ep_free(_p);
+}
+
+void sm9_pairing_batch(fp12_t r[], const ep2_t Q[], const ep_t P[], int n){
+	ep2_t _q;
+	ep_t _p;
+
+	ep2_null(_q);
+	ep_null(_p);
+	ep2_new(_q);
+	ep_new(_p);
+
+	for (int i = 0; i < n; i++) {
+		if (ep_is_infty(P[i]) || ep2_is_infty((ep2_st *)Q[i])) {
+			fp12_set_dig(r[i], 1);
+			continue;
+		}
+		ep_norm(_p, P[i]);
+		ep2_norm(_q, (ep2_st *)Q[i]);
+		sm9_miller_loop(r[i], _q, _p);
+	}
+	sm9_final_exponent_sim(r, (const fp12_t *)r, n);
+
+	ep2_free(_q);
+	ep_free(_p);
+}
+
+void sm9_g2_pre_init(SM9_G2_PRE *pre){
+	ep2_null(pre->Q);
+	ep2_new(pre->Q);
+	for (int i = 0; i < SM9_G2_PRE_LINES; i++) {
+		for (int j = 0; j < 3; j++) {
+			fp2_null(pre->l[i][j]);
+			fp2_new(pre->l[i][j]);
+		}
+	}
+	ep2_set_infty(pre->Q);
+	pre->len = 0;
+	return;
+}
+
+void sm9_g2_pre_free(SM9_G2_PRE *pre){
+	ep2_free(pre->Q);
+	for (int i = 0; i < SM9_G2_PRE_LINES; i++) {
+		for (int j = 0; j < 3; j++) {
+			fp2_free(pre->l[i][j]);
+		}
+	}
+	pre->len = 0;
+	return;
+}
+
+// 与 sm9_miller_loop 相同, 只记录直线系数
+void sm9_g2_pre_set(SM9_G2_PRE *pre, const ep2_t Q){
+	ep2_t T, Q1, Q2, neg_Q;
+
+	ep2_null(T);
+	ep2_null(Q1);
+	ep2_null(Q2);
+	ep2_null(neg_Q);
+
+	ep2_new(T);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	ep2_new(neg_Q);
+
+	ep2_norm(pre->Q, (ep2_st *)Q);
+	pre->len = 0;
+	ep2_neg(neg_Q, pre->Q);
+
+	ep2_copy(T, pre->Q);
+	for (int i = 0; i < sm9_ate_len; i++) {
+		for (int k = sm9_ate_run[i]; k > 0; k--) {
+			sm9_dbl_line(pre->l[pre->len++], T);
+		}
+		if (sm9_ate_sgn[i] != 0) {
+			sm9_add_line(pre->l[pre->len++], T, sm9_ate_sgn[i] > 0 ? pre->Q : neg_Q);
+		}
+	}
+	sm9_g2_frb(Q1, Q2, pre->Q);
+	sm9_add_line(pre->l[pre->len++], T, Q1);
+	sm9_add_line(pre->l[pre->len++], T, Q2);
+
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(neg_Q);
+	return;
+}
+
+// Miller loop with prepared lines, f = f_{Q}(P) without the final exponentiation
+static void sm9_miller_pre(fp12_t f, const SM9_G2_PRE *pre, const ep_t P){
+	fp12_t g, h;
+	ep_t _p;
+	int k = 0;
+
+	fp12_null(g);
+	fp12_null(h);
+	ep_null(_p);
+	fp12_new(g);
+	fp12_new(h);
+	ep_new(_p);
+
+	ep_norm(_p, P);
+	fp12_set_dig(g, 0);
+	fp12_set_dig(h, 0);
+
+	fp12_set_dig(f, 1);
+	for (int i = 0; i < sm9_ate_len; i++) {
+		for (int j = sm9_ate_run[i]; j > 1; j--) {
+			fp12_sqr_t(f, f);
+			sm9_g2_pre_eval(f, g, pre->l[k++], _p);
+		}
+		fp12_sqr_t(f, f);
+		if (sm9_ate_sgn[i] != 0) {
+			sm9_g2_pre_eval2(f, g, h, pre->l[k], pre->l[k + 1], _p, _p);
+			k += 2;
+		} else {
+			sm9_g2_pre_eval(f, g, pre->l[k++], _p);
+		}
+	}
+	sm9_g2_pre_eval2(f, g, h, pre->l[k], pre->l[k + 1], _p, _p);
+
+	fp12_free(g);
+	fp12_free(h);
+	ep_free(_p);
+}
+
+void sm9_pairing_pre(fp12_t r, const SM9_G2_PRE *pre, const ep_t P){
+	sm9_miller_pre(r, pre, P);
+	sm9_final_exponent_method(r, r, SM9_FEXP_DEFAULT);
+}
+
+// r[i] = e(pre->Q, P[i]), one prepared Q, the final exponentiations are batched
+void sm9_pairing_pre_batch(fp12_t r[], const SM9_G2_PRE *pre, const ep_t P[], int n){
+	for (int i = 0; i < n; i++) {
+		if (ep_is_infty(P[i])) {
+			fp12_set_dig(r[i], 1);
+			continue;
+		}
+		sm9_miller_pre(r[i], pre, P[i]);
+	}
+	sm9_final_exponent_sim(r, (const fp12_t *)r, n);
+}
+
+// r = e(Q[0], P[0]) * ... * e(Q[n-1], P[n-1]), the Miller loops share the squarings of f
+void sm9_pairing_sim(fp12_t r, const ep2_t Q[], const ep_t P[], int n){
+	fp12_t f, g, h;
+	fp2_t l[3], l2[3];
+	ep2_t Q1, Q2;
+	ep2_t *T = RLC_ALLOCA(ep2_t, n);
+	ep2_t *_q = RLC_ALLOCA(ep2_t, n);
+	ep2_t *neg_Q = RLC_ALLOCA(ep2_t, n);
+	ep_t *_p = RLC_ALLOCA(ep_t, n);
+	int j, m = 0;
+
+	if (T == NULL || _q == NULL || neg_Q == NULL || _p == NULL) {
+		RLC_FREE(T);
+		RLC_FREE(_q);
+		RLC_FREE(neg_Q);
+		RLC_FREE(_p);
+		RLC_THROW(ERR_NO_MEMORY);
+		return;
+	}
+
+	fp12_null(f);
+	fp12_null(g);
+	fp12_null(h);
+	ep2_null(Q1);
+	ep2_null(Q2);
+
+	fp12_new(f);
+	fp12_new(g);
+	fp12_new(h);
+	ep2_new(Q1);
+	ep2_new(Q2);
+	for (j = 0; j < 3; j++) {
+		fp2_null(l[j]);
+		fp2_null(l2[j]);
+		fp2_new(l[j]);
+		fp2_new(l2[j]);
+	}
+
+	for (j = 0; j < n; j++) {
+		ep2_null(T[j]);
+		ep2_null(_q[j]);
+		ep2_null(neg_Q[j]);
+		ep_null(_p[j]);
+		ep2_new(T[j]);
+		ep2_new(_q[j]);
+		ep2_new(neg_Q[j]);
+		ep_new(_p[j]);
+	}
+
+	// 跳过无穷远点, 它们对乘积的贡献为 1
+	for (j = 0; j < n; j++) {
+		if (!ep_is_infty(P[j]) && !ep2_is_infty((ep2_st *)Q[j])) {
+			ep_norm(_p[m], P[j]);
+			ep2_norm(_q[m], (ep2_st *)Q[j]);
+			ep2_neg(neg_Q[m], _q[m]);
+			ep2_copy(T[m], _q[m]);
+			m++;
+		}
+	}
+
+	fp12_set_dig(g, 0);
+	fp12_set_dig(h, 0);
+	fp12_set_dig(f, 1);
+	for (int i = 0; i < sm9_ate_len; i++) {
+		for (int k = sm9_ate_run[i]; k > 0; k--) {
+			fp12_sqr_t(f, f);
+			if (k == 1 && sm9_ate_sgn[i] != 0) {
+				// 每对的切线与加法直线先相乘
+				for (j = 0; j < m; j++) {
+					sm9_dbl_line(l, T[j]);
+					sm9_add_line(l2, T[j], sm9_ate_sgn[i] > 0 ? _q[j] : neg_Q[j]);
+					sm9_g2_pre_eval2(f, g, h, l, l2, _p[j], _p[j]);
+				}
+				break;
+			}
+			// 相邻两对的切线先相乘
+			for (j = 0; j + 1 < m; j += 2) {
+				sm9_dbl_line(l, T[j]);
+				sm9_dbl_line(l2, T[j + 1]);
+				sm9_g2_pre_eval2(f, g, h, l, l2, _p[j], _p[j + 1]);
+			}
+			if (j < m) {
+				sm9_dbl_line(l, T[j]);
+				sm9_g2_pre_eval(f, g, l, _p[j]);
+			}
+		}
+	}
+	for (j = 0; j < m; j++) {
+		sm9_g2_frb(Q1, Q2, _q[j]);
+		sm9_add_line(l, T[j], Q1);
+		sm9_add_line(l2, T[j], Q2);
+		sm9_g2_pre_eval2(f, g, h, l, l2, _p[j], _p[j]);
+	}
+
+	fp12_copy(r, f);
+	sm9_final_exponent_method(r, r, SM9_FEXP_DEFAULT);
+
+	for (j = 0; j < n; j++) {
+		ep2_free(T[j]);
+		ep2_free(_q[j]);
+		ep2_free(neg_Q[j]);
+		ep_free(_p[j]);
+	}
+	RLC_FREE(T);
+	RLC_FREE(_q);
+	RLC_FREE(neg_Q);
+	RLC_FREE(_p);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(h);
+	for (j = 0; j < 3; j++) {
+		fp2_free(l[j]);
+		fp2_free(l2[j]);
+	}
+	ep2_free(Q1);
+	ep2_free(Q2);
+}
+
+void sm9_pairing_function_test(fp12_t r, const ep2_t Q, const ep_t P)
+{
 	// a)
-	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
-	
+	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
+	// const char *abits = "1";
+
 	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
+	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
 	ep_t _p;
 	bn_t n;
 
@@ -2778,7 +5167,7 @@ void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_null(Q1);
 	ep2_null(Q2);
 	ep2_null(ep2_tmp);
-	ep2_null(neg_Q);
+	ep2_null(ep2_tmp2);
 	fp12_null(f);
 	fp12_null(g);
 	fp12_null(f_num);
@@ -2793,7 +5182,7 @@ void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_new(Q1);
 	ep2_new(Q2);
 	ep2_new(ep2_tmp);
-	ep2_new(neg_Q);
+	ep2_new(ep2_tmp2);
 	fp12_new(f);
 	fp12_new(g);
 	fp12_new(f_num);
@@ -2802,74 +5191,40 @@ void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_new(g_den);
 	fp12_new(fp12_tmp);
 
-	sm9_twist_point_neg(neg_Q,Q);
-
 	// b)
 	ep2_copy(T, Q);
 	fp12_set_dig(f_num, 1);
 	fp12_set_dig(f_den, 1);
 
-	for(size_t i = 0; i < strlen(abits); i++)
-	{
-		// c)
-		fp12_sqr_t(f_num, f_num);
-		fp12_sqr_t(f_den, f_den);
-
-		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
-
-		fp12_mul_sparse(f_num, f_num, g_num);
-		fp12_mul_sparse(f_den, f_den, g_den);
-
-		ep2_dbl_projc(T, T);
-		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line(g_num, g_den, T, Q, P);
-			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
+	PERFORMANCE_TEST_NEW("SM9 square ", fp12_sqr_t1(f_num, f_den));
+	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 multiplication ",fp12_mul_t1(f_num, f_num, g_num) );
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
-		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
-		}
-	}
-	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
 	
-	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
-
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	//	ep2_add(T, T, Q2);  // T = T - Q2
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 multiplication improved",fp12_mul_t(f_num, f_num, g_num) );
+	PERFORMANCE_TEST_NEW("SM9 inverse ",fp12_inv_t(f_den, f_den) );
 
-	// g)
-	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
+	
+	PERFORMANCE_TEST_NEW("frobenius map ",ep2_pi1(Q1, Q));
 
-	//pp_pow_bn_t(r,r);
-	sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
+	PERFORMANCE_TEST_NEW("ep2_dbl_projc  ",ep2_dbl_projc(T, T) );
+	PERFORMANCE_TEST_NEW("SM9 evaluation of g_line ",sm9_eval_g_line(g_num, g_den, T, Q, P) );
+	PERFORMANCE_TEST_NEW("SM9 evaluation of g_tangent ",sm9_eval_g_tangent(g_num, g_den, T, P));
+	PERFORMANCE_TEST_NEW("SM9 twisted points add full ",ep2_add_full(T, T, Q1));
 
+	PERFORMANCE_TEST_NEW("SM9 final exponentiation ",sm9_final_exponent1(r, r));
+	PERFORMANCE_TEST_NEW("SM9 final exponentiation improved",sm9_final_exponent(r, r));
+	
 	ep_free(_p);
 	bn_free(n);
 	ep2_free(T);
 	ep2_free(Q1);
 	ep2_free(Q2);
 	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
+	ep2_free(ep2_tmp2);
 	fp12_free(f);
 	fp12_free(g);
 	fp12_free(f_num);
@@ -2877,11 +5232,11 @@ void sm9_pairing_fast(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_free(g_num);
 	fp12_free(g_den);
 	fp12_free(fp12_tmp);
-	return ;
-}
 
+	return 0;
+}
 
-void sm9_pairing_faster(fp12_t r, const ep2_t Q, const ep_t P){
+void sm9_pairing_fastest_function_test(fp12_t r, const ep2_t Q, const ep_t P){
 	// a)
 	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
 	
@@ -2928,59 +5283,33 @@ void sm9_pairing_faster(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_set_dig(f_num, 1);
 	fp12_set_dig(f_den, 1);
 
-	for(size_t i = 0; i < strlen(abits); i++)
-	{
-		// c)
-		fp12_sqr_t(f_num, f_num);
-		fp12_sqr_t(f_den, f_den);
-
-		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
-
-		fp12_mul_sparse(f_num, f_num, g_num);
-		fp12_mul_sparse(f_den, f_den, g_den);
-
-		ep2_dbl_projc(T, T);
-		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line(g_num, g_den, T, Q, P);
-			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
+	printf("raw:\n");
+	PERFORMANCE_TEST_NEW("SM9 square ", fp12_sqr_t1(f_num, f_den));
+	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 multiplication ",fp12_mul_t1(r, f_num, f_den) );
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
-		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
-		}
-	}
-	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
 	
-	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 multiplication improved",fp12_mul_t(r, f_num, f_den) );
+	
+	
+	printf("updated:\n");
 
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	//	ep2_add(T, T, Q2);  // T = T - Q2
 
-	// g)
-	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
+	//PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
+	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 fp12_mul_sparse improved",fp12_mul_sparse(r, f_num, f_den) );
 
-	sm9_final_exponent_t(r, r);  // r = f^{(q^12-1)/r'}
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
+	
+	// fp12_mul_t(f_num, f_num, g_num);
+	PERFORMANCE_TEST_NEW("SM9 fp12_mul_sparse2 improved",fp12_mul_sparse2(r, f_num, f_den) );
+	PERFORMANCE_TEST_NEW("SM9 fp12_mul_t improved",fp12_mul_t(r, f_num, f_den) );
+	PERFORMANCE_TEST_NEW("SM9 fp12_inv_t improved",fp12_inv_t(f_den, f_den) );
 
+	
 	ep_free(_p);
 	bn_free(n);
 	ep2_free(T);
@@ -2998,15 +5327,21 @@ void sm9_pairing_faster(fp12_t r, const ep2_t Q, const ep_t P){
 	return ;
 }
 
-/*input:ep2 ep
-output:fp12
-*/
-void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
+void sm9_TEST(fp12_t r, const ep2_t Q, const ep_t P){
+	PERFORMANCE_TEST_NEW("SM9 RELIC Pairing ",sm9_pairing(r,Q,P));
+
+
+}
+
+
+void sm9_pairing_steps_test(fp12_t r, const ep2_t Q, const ep_t P)
+{
 	// a)
-	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
-	
+	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
+	// const char *abits = "1";
+
 	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
+	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
 	ep_t _p;
 	bn_t n;
 
@@ -3017,7 +5352,7 @@ void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_null(Q1);
 	ep2_null(Q2);
 	ep2_null(ep2_tmp);
-	ep2_null(neg_Q);
+	ep2_null(ep2_tmp2);
 	fp12_null(f);
 	fp12_null(g);
 	fp12_null(f_num);
@@ -3032,7 +5367,7 @@ void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
 	ep2_new(Q1);
 	ep2_new(Q2);
 	ep2_new(ep2_tmp);
-	ep2_new(neg_Q);
+	ep2_new(ep2_tmp2);
 	fp12_new(f);
 	fp12_new(g);
 	fp12_new(f_num);
@@ -3041,70 +5376,94 @@ void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_new(g_den);
 	fp12_new(fp12_tmp);
 
-	sm9_twist_point_neg(neg_Q,Q);
-
+	int  count = 0;
+	int second = 3;
+	double d=0.0;
+	signal(SIGALRM,alarmed_t);
+	alarm(second);
+	run_t = 1;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
 	// b)
 	ep2_copy(T, Q);
 	fp12_set_dig(f_num, 1);
 	fp12_set_dig(f_den, 1);
 
-	for(size_t i = 0; i < strlen(abits); i++)
+
+	for (size_t i = 0; i < strlen(abits); i++)
 	{
 		// c)
-		fp12_sqr_t(f_num, f_num);
-		// fp12_sqr_t(f_den, f_den);
+		fp12_sqr_t1(f_num, f_num);
+		fp12_sqr_t1(f_den, f_den);
 
 		sm9_eval_g_tangent(g_num, g_den, T, P);
-		fp12_mul_sparse(f_num, f_num, g_num);
-		// fp12_mul_sparse(f_den, f_den, g_den);
+		// PERFORMANCE_TEST_NEW("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P));
+
+		fp12_mul_t1(f_num, f_num, g_num);
+		fp12_mul_t1(f_den, f_den, g_den);
 
 		ep2_dbl_projc(T, T);
 		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line_no_den(g_num, g_den, T, Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			// fp12_mul_sparse2(f_den, f_den, g_den);
+		if (abits[i] == '1')
+		{
+			sm9_eval_g_line(g_num, g_den, T, Q, P);
+			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
-		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			// fp12_mul_sparse2(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+			fp12_mul_t1(f_num, f_num, g_num);
+			fp12_mul_t1(f_den, f_den, g_den);
+
+			ep2_add_full(T, T, Q); // T = T + Q
 		}
 	}
 	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
-	
+	ep2_pi1(Q1, Q); // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q); // Q2 = pi_{q^2}(Q), Q2 = -Q2
+
 	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	//PERFORMANCE_TEST_NEW("RELIC 直线", sm9_eval_g_tangent(g_num, g_den, T, P));
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	// fp12_mul_sparse2(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
+	sm9_eval_g_line(g_num, g_den, T, Q1, P); // g = g_{T,Q1}(P)
+	fp12_mul_t1(f_num, f_num, g_num);		 // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_t1(f_den, f_den, g_den);
+	ep2_add_full(T, T, Q1); // T = T + Q1
+
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P); // g = g_{T,-Q2}(P)
+	fp12_mul_t1(f_num, f_num, g_num);		 // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_t1(f_den, f_den, g_den);
+	ep2_add_full(T, T, Q2); // T = T - Q2
+
+	// g)
+	fp12_inv_t(f_den, f_den); // f_den = f_den^{-1}
+
+	fp12_mul_t1(r, f_num, f_den); // r = f_num*f_den = f
+
+
+
+	}
 
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	// fp12_mul_sparse2(f_den, f_den, g_den);
-	//	ep2_add(T, T, Q2);  // T = T - Q2
 
-	// g)
-	// fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
+	d=TIME_F(STOP);
+	printf("SM9 RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+
+	alarm(second);
+	run_t = 1;
+	d=0.0;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
+		sm9_final_exponent1(r, r); // r = f^{(q^12-1)/r'}
+		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+	}
+	d = TIME_F(STOP);
+	printf("SM9 RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
 
-	// fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
-	fp12_copy(r, f_num);
-	pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
-	//PERFORMANCE_TEST_NEW("RELIC final exp", pp_pow_bn_t(r,r));
 	ep_free(_p);
 	bn_free(n);
 	ep2_free(T);
 	ep2_free(Q1);
 	ep2_free(Q2);
 	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
+	ep2_free(ep2_tmp2);
 	fp12_free(f);
 	fp12_free(g);
 	fp12_free(f_num);
@@ -3112,12 +5471,12 @@ void sm9_pairing_fastest(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_free(g_num);
 	fp12_free(g_den);
 	fp12_free(fp12_tmp);
-	return ;
-}
 
+	return 0;
+}
 
 
-void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
+void sm9_pairing_fastest_step_test(fp12_t r, const ep2_t Q, const ep_t P){
 	// a)
 	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
 	
@@ -3157,6 +5516,17 @@ void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_new(g_den);
 	fp12_new(fp12_tmp);
 
+int  count = 0;
+	int second = 3;
+	double d=0.0;
+	signal(SIGALRM,alarmed_t);
+	alarm(second);
+	run_t = 1;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
+
+
 	sm9_twist_point_neg(neg_Q,Q);
 
 	// b)
@@ -3173,22 +5543,22 @@ void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
 		sm9_eval_g_tangent(g_num, g_den, T, P);
 		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
-		fp12_mul_t(f_num, f_num, g_num);
-		fp12_mul_sparse(f_den, f_den, g_den);
+		fp12_mul_sparse(f_num, f_num, g_num);
+		fp12_mul_sparse2(f_den, f_den, g_den);
 
 		ep2_dbl_projc(T, T);
 		// c.2)
 		if (abits[i] == '1'){
 			sm9_eval_g_line(g_num, g_den, T, Q, P);
 			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_t(f_num, f_num, g_num);
+			fp12_mul_sparse(f_num, f_num, g_num);
 			fp12_mul_sparse2(f_den, f_den, g_den);
 
 			ep2_add_projc(T, T, Q);  // T = T + Q
 		}
 		else if(abits[i] == '2'){
 			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_t(f_num, f_num, g_num);
+			fp12_mul_sparse(f_num, f_num, g_num);
 			fp12_mul_sparse2(f_den, f_den, g_den);
 			ep2_add_projc(T, T, neg_Q);  // T = T - Q
 		}
@@ -3199,13 +5569,13 @@ void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
 	
 	// e)
 	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_t(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
 	fp12_mul_sparse2(f_den, f_den, g_den);
 	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
 	// f)
 	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_t(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
 	fp12_mul_sparse2(f_den, f_den, g_den);
 	//	ep2_add(T, T, Q2);  // T = T - Q2
 
@@ -3213,117 +5583,32 @@ void sm9_pairing_fastest2(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
 	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
-
-	pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
-
-	ep_free(_p);
-	bn_free(n);
-	ep2_free(T);
-	ep2_free(Q1);
-	ep2_free(Q2);
-	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
-	fp12_free(f);
-	fp12_free(g);
-	fp12_free(f_num);
-	fp12_free(f_den);
-	fp12_free(g_num);
-	fp12_free(g_den);
-	fp12_free(fp12_tmp);
-	return ;
-}
-
-
-void sm9_pairing_omp(fp12_t r_arr[], const ep2_t Q_arr[], const ep_t P_arr[], const size_t arr_size, const size_t threads_num){
-	omp_set_num_threads(threads_num);	
-	#pragma omp parallel	
-	{
-		int id = omp_get_thread_num();
-		printf("id=%d\n", id);
-		for (size_t i = 0; i < arr_size; i+=threads_num)
-		{
-			sm9_pairing(r_arr[(i+id)%arr_size], Q_arr[(i+id)%arr_size], P_arr[(i+id)%arr_size]);
-		}
 	}
-}
-
-void sm9_pairing_function_test(fp12_t r, const ep2_t Q, const ep_t P)
-{
-	// a)
-	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
-	// const char *abits = "1";
-
-	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
-	ep_t _p;
-	bn_t n;
-
-	// null
-	ep_null(_p);
-	bn_null(n);
-	ep2_null(T);
-	ep2_null(Q1);
-	ep2_null(Q2);
-	ep2_null(ep2_tmp);
-	ep2_null(ep2_tmp2);
-	fp12_null(f);
-	fp12_null(g);
-	fp12_null(f_num);
-	fp12_null(f_den);
-	fp12_null(g_num);
-	fp12_null(g_den);
-	fp12_null(fp12_tmp);
-
-	ep_new(_p);
-	bn_new(n);
-	ep2_new(T);
-	ep2_new(Q1);
-	ep2_new(Q2);
-	ep2_new(ep2_tmp);
-	ep2_new(ep2_tmp2);
-	fp12_new(f);
-	fp12_new(g);
-	fp12_new(f_num);
-	fp12_new(f_den);
-	fp12_new(g_num);
-	fp12_new(g_den);
-	fp12_new(fp12_tmp);
-
-	// b)
-	ep2_copy(T, Q);
-	fp12_set_dig(f_num, 1);
-	fp12_set_dig(f_den, 1);
-
-	PERFORMANCE_TEST_NEW("SM9 square ", fp12_sqr_t1(f_num, f_den));
-	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 multiplication ",fp12_mul_t1(f_num, f_num, g_num) );
-
 	
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 multiplication improved",fp12_mul_t(f_num, f_num, g_num) );
-	PERFORMANCE_TEST_NEW("SM9 inverse ",fp12_inv_t(f_den, f_den) );
+	d=TIME_F(STOP);
+	printf("SM9 RELIC improved Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
 
+	alarm(second);
+	run_t = 1;
+	d=0.0;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
+		pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
+	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
 
-	
-	PERFORMANCE_TEST_NEW("frobenius map ",ep2_pi1(Q1, Q));
+	}
+	d = TIME_F(STOP);
+	printf("SM9 RELIC improved Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
 
-	PERFORMANCE_TEST_NEW("ep2_dbl_projc  ",ep2_dbl_projc(T, T) );
-	PERFORMANCE_TEST_NEW("SM9 evaluation of g_line ",sm9_eval_g_line(g_num, g_den, T, Q, P) );
-	PERFORMANCE_TEST_NEW("SM9 evaluation of g_tangent ",sm9_eval_g_tangent(g_num, g_den, T, P));
-	PERFORMANCE_TEST_NEW("SM9 twisted points add full ",ep2_add_full(T, T, Q1));
 
-	PERFORMANCE_TEST_NEW("SM9 final exponentiation ",sm9_final_exponent1(r, r));
-	PERFORMANCE_TEST_NEW("SM9 final exponentiation improved",sm9_final_exponent(r, r));
-	
 	ep_free(_p);
 	bn_free(n);
 	ep2_free(T);
 	ep2_free(Q1);
 	ep2_free(Q2);
 	ep2_free(ep2_tmp);
-	ep2_free(ep2_tmp2);
+	ep2_free(neg_Q);
 	fp12_free(f);
 	fp12_free(g);
 	fp12_free(f_num);
@@ -3331,11 +5616,11 @@ void sm9_pairing_function_test(fp12_t r, const ep2_t Q, const ep_t P)
 	fp12_free(g_num);
 	fp12_free(g_den);
 	fp12_free(fp12_tmp);
-
-	return 0;
+	return ;
 }
 
-void sm9_pairing_fastest_function_test(fp12_t r, const ep2_t Q, const ep_t P){
+
+void sm9_pairing_fast_step_test(fp12_t r, const ep2_t Q, const ep_t P){
 	// a)
 	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
 	
@@ -3375,40 +5660,92 @@ void sm9_pairing_fastest_function_test(fp12_t r, const ep2_t Q, const ep_t P){
 	fp12_new(g_den);
 	fp12_new(fp12_tmp);
 
+	int  count = 0;
+	int second = 3;
+	double d=0.0;
+	signal(SIGALRM,alarmed_t);
+	alarm(second);
+	run_t = 1;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
 	sm9_twist_point_neg(neg_Q,Q);
 
+
 	// b)
 	ep2_copy(T, Q);
 	fp12_set_dig(f_num, 1);
 	fp12_set_dig(f_den, 1);
 
-	printf("raw:\n");
-	PERFORMANCE_TEST_NEW("SM9 square ", fp12_sqr_t1(f_num, f_den));
-	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 multiplication ",fp12_mul_t1(r, f_num, f_den) );
+	for(size_t i = 0; i < strlen(abits); i++)
+	{
+		// c)
+		fp12_sqr_t(f_num, f_num);
+		fp12_sqr_t(f_den, f_den);
 
+		sm9_eval_g_tangent(g_num, g_den, T, P);
+		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
+
+		fp12_mul_sparse(f_num, f_num, g_num);
+		fp12_mul_sparse(f_den, f_den, g_den);
+
+		ep2_dbl_projc(T, T);
+		// c.2)
+		if (abits[i] == '1'){
+			sm9_eval_g_line(g_num, g_den, T, Q, P);
+			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_sparse(f_num, f_num, g_num);
+			fp12_mul_sparse2(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		}
+	}
+	// d)
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
 	
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 multiplication improved",fp12_mul_t(r, f_num, f_den) );
-	
-	
-	printf("updated:\n");
+	// e)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
+	// f)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
+	fp12_mul_sparse2(f_den, f_den, g_den);
+//	ep2_add(T, T, Q2);  // T = T - Q2
 
+	// g)
+	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
 
-	//PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
-	PERFORMANCE_TEST_NEW("SM9 square improved", fp12_sqr_t(f_num, f_den));
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 fp12_mul_sparse improved",fp12_mul_sparse(r, f_num, f_den) );
+	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
+	}
 
-	
-	// fp12_mul_t(f_num, f_num, g_num);
-	PERFORMANCE_TEST_NEW("SM9 fp12_mul_sparse2 improved",fp12_mul_sparse2(r, f_num, f_den) );
-	PERFORMANCE_TEST_NEW("SM9 fp12_mul_t improved",fp12_mul_t(r, f_num, f_den) );
-	PERFORMANCE_TEST_NEW("SM9 fp12_inv_t improved",fp12_inv_t(f_den, f_den) );
 
-	
+	d=TIME_F(STOP);
+	printf("SM9 fast RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+
+	alarm(second);
+	run_t = 1;
+	d=0.0;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
+		sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
+		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+	}
+	d = TIME_F(STOP);
+	printf("SM9 fast RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+
+	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+
 	ep_free(_p);
 	bn_free(n);
 	ep2_free(T);
@@ -3426,21 +5763,14 @@ void sm9_pairing_fastest_function_test(fp12_t r, const ep2_t Q, const ep_t P){
 	return ;
 }
 
-void sm9_TEST(fp12_t r, const ep2_t Q, const ep_t P){
-	PERFORMANCE_TEST_NEW("SM9 RELIC Pairing ",sm9_pairing(r,Q,P));
-
-
-}
 
 
-void sm9_pairing_steps_test(fp12_t r, const ep2_t Q, const ep_t P)
-{
+void sm9_pairing_fast_step_test2(fp12_t r, const ep2_t Q, const ep_t P){
 	// a)
-	const char *abits = "00100000000000000000000000000000000000010000101011101100100111110";
-	// const char *abits = "1";
-
+	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
+	
 	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, ep2_tmp2;
+	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
 	ep_t _p;
 	bn_t n;
 
@@ -3451,7 +5781,7 @@ void sm9_pairing_steps_test(fp12_t r, const ep2_t Q, const ep_t P)
 	ep2_null(Q1);
 	ep2_null(Q2);
 	ep2_null(ep2_tmp);
-	ep2_null(ep2_tmp2);
+	ep2_null(neg_Q);
 	fp12_null(f);
 	fp12_null(g);
 	fp12_null(f_num);
@@ -3466,7 +5796,7 @@ void sm9_pairing_steps_test(fp12_t r, const ep2_t Q, const ep_t P)
 	ep2_new(Q1);
 	ep2_new(Q2);
 	ep2_new(ep2_tmp);
-	ep2_new(ep2_tmp2);
+	ep2_new(neg_Q);
 	fp12_new(f);
 	fp12_new(g);
 	fp12_new(f_num);
@@ -3484,2069 +5814,2650 @@ void sm9_pairing_steps_test(fp12_t r, const ep2_t Q, const ep_t P)
 	TIME_F(START);
 	for(count=0;run_t&&count<0x7fffffff;count++){
 		
+	sm9_twist_point_neg(neg_Q,Q);
+
 	// b)
 	ep2_copy(T, Q);
 	fp12_set_dig(f_num, 1);
 	fp12_set_dig(f_den, 1);
 
-
-	for (size_t i = 0; i < strlen(abits); i++)
+	for(size_t i = 0; i < strlen(abits); i++)
 	{
 		// c)
 		fp12_sqr_t1(f_num, f_num);
 		fp12_sqr_t1(f_den, f_den);
 
 		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST_NEW("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P));
+		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
 
 		fp12_mul_t1(f_num, f_num, g_num);
 		fp12_mul_t1(f_den, f_den, g_den);
 
 		ep2_dbl_projc(T, T);
 		// c.2)
-		if (abits[i] == '1')
-		{
+		if (abits[i] == '1'){
 			sm9_eval_g_line(g_num, g_den, T, Q, P);
 			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-
 			fp12_mul_t1(f_num, f_num, g_num);
 			fp12_mul_t1(f_den, f_den, g_den);
 
-			ep2_add_full(T, T, Q); // T = T + Q
+			ep2_add_projc(T, T, Q);  // T = T + Q
+		}
+		else if(abits[i] == '2'){
+			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
+			fp12_mul_t1(f_num, f_num, g_num);
+			fp12_mul_t1(f_den, f_den, g_den);
+			ep2_add_projc(T, T, neg_Q);  // T = T - Q
 		}
 	}
 	// d)
-	ep2_pi1(Q1, Q); // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q); // Q2 = pi_{q^2}(Q), Q2 = -Q2
-
+	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
+	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
+	
 	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P); // g = g_{T,Q1}(P)
-	fp12_mul_t1(f_num, f_num, g_num);		 // f = f * g = f * g_{T,Q1}(P)
+	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
+	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
 	fp12_mul_t1(f_den, f_den, g_den);
-	ep2_add_full(T, T, Q1); // T = T + Q1
+	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
 	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P); // g = g_{T,-Q2}(P)
-	fp12_mul_t1(f_num, f_num, g_num);		 // f = f * g = f * g_{T,-Q2}(P)
+	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
+	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
 	fp12_mul_t1(f_den, f_den, g_den);
-	ep2_add_full(T, T, Q2); // T = T - Q2
+//	ep2_add(T, T, Q2);  // T = T - Q2
+
+	// g)
+	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
+
+	fp12_mul_t1(r, f_num, f_den);  // r = f_num*f_den = f
+	}
+
+
+	d=TIME_F(STOP);
+	printf("SM9 fast with slow loop RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+
+	alarm(second);
+	run_t = 1;
+	d=0.0;
+	TIME_F(START);
+	for(count=0;run_t&&count<0x7fffffff;count++){
+		
+		sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
+		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+	}
+	d = TIME_F(STOP);
+	printf("SM9 fast with slow loop RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+	
+	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+
+	ep_free(_p);
+	bn_free(n);
+	ep2_free(T);
+	ep2_free(Q1);
+	ep2_free(Q2);
+	ep2_free(ep2_tmp);
+	ep2_free(neg_Q);
+	fp12_free(f);
+	fp12_free(g);
+	fp12_free(f_num);
+	fp12_free(f_den);
+	fp12_free(g_num);
+	fp12_free(g_den);
+	fp12_free(fp12_tmp);
+	return ;
+}
+
+static int sm9_barrett_bn_cmp(const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
+{
+	int i;
+	for (i = 8; i >= 0; i--) {
+		if (a[i] > b[i])
+			return 1;
+		if (a[i] < b[i])
+			return -1;
+	}
+	return 0;
+}
+
+static void sm9_barrett_bn_add(sm9_barrett_bn_t r, const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
+{
+	int i;
+	r[0] = a[0] + b[0];
+	for (i = 1; i < 9; i++) {
+		r[i] = a[i] + b[i] + (r[i-1] >> 32);
+	}
+	for (i = 0; i < 8; i++) {
+		r[i] &= 0xffffffff;
+	}
+}
+
+static void sm9_barrett_bn_sub(sm9_barrett_bn_t ret, const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
+{
+	sm9_barrett_bn_t r;
+	int i;
+	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
+	for (i = 1; i < 8; i++) {
+		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
+		r[i - 1] &= 0xffffffff;
+	}
+	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
+	r[i - 1] &= 0xffffffff;
+	for (i = 0; i < 9; i++) {
+		ret[i] = r[i];
+	}
+}
+
+static int sm9_bn_cmp(const sm9_bn_t a, const sm9_bn_t b)
+{
+	int i;
+	for (i = 7; i >= 0; i--) {
+		if (a[i] > b[i])
+			return 1;
+		if (a[i] < b[i])
+			return -1;
+	}
+	return 0;
+}
+
+static void sm9_bn_copy(sm9_bn_t r, const sm9_bn_t a)
+{
+	memcpy(r, a, sizeof(sm9_bn_t));
+}
+
+static void sm9_bn_sub(sm9_bn_t ret, const sm9_bn_t a, const sm9_bn_t b)
+{
+	int i;
+	sm9_bn_t r;
+	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
+	for (i = 1; i < 7; i++) {
+		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
+		r[i - 1] &= 0xffffffff;
+	}
+	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
+	r[i - 1] &= 0xffffffff;
+	sm9_bn_copy(ret, r);
+}
+
+
+
+void sm9_fn_from_hash(bn_t h, const uint8_t Ha[40])
+{
+	uint64_t s[18] = {0};
+	sm9_barrett_bn_t zh, zl, q;
+	uint64_t w;
+	int i, j;
+
+	sm9_bn_t h_bn;
+
+	/* s = Ha -> int */
+	for (int i = 0; i < 10; i++) {
+		for (int j = 0; j < 4; j++) {
+			s[i] <<= 8;
+			s[i] += Ha[4 * (9-i) + j];
+		}
+	}
+
+	/* zl = z mod (2^32)^9 = z[0..8]
+	 * zh = z // (2^32)^7 = z[7..15] */
+	for (i = 0; i < 9; i++) {
+		zl[i] = s[i];
+		zh[i] = s[7 + i];
+	}
+
+	/* q = zh * mu // (2^32)^9 */
+	for (i = 0; i < 18; i++) {
+		s[i] = 0;
+	}
+	for (i = 0; i < 9; i++) {
+		w = 0;
+		for (j = 0; j < 9; j++) {
+			w += s[i + j] + zh[i] * SM9_MU_N_MINUS_ONE[j]; //
+			s[i + j] = w & 0xffffffff;
+			w >>= 32;
+		}
+		s[i + 9] = w;
+	}
+	for (i = 0; i < 9; i++) {
+		q[i] = s[9 + i];
+	}
+
+	/* q = q * p mod (2^32)^9 */
+	for (i = 0; i < 18; i++) {
+		s[i] = 0;
+	}
+	for (i = 0; i < 9; i++) {
+		w = 0;
+		for (j = 0; j < 8; j++) {
+			w += s[i + j] + q[i] * SM9_N_MINUS_ONE[j];
+			s[i + j] = w & 0xffffffff;
+			w >>= 32;
+		}
+		s[i + 8] = w;
+	}
+	for (i = 0; i < 9; i++) {
+		q[i] = s[i];
+	}
+
+	/* h = zl - q (mod (2^32)^9) */
+
+	if (sm9_barrett_bn_cmp(zl, q)) {
+		sm9_barrett_bn_sub(zl, zl, q);
+	} else {
+		sm9_barrett_bn_t c = {0,0,0,0,0,0,0,0,0x100000000};
+		sm9_barrett_bn_sub(q, c, q);
+		sm9_barrett_bn_add(zl, q, zl);
+	}
+
+	for (i = 0; i < 8; i++) {
+		h_bn[i] = zl[i];
+	}
+
+	h_bn[7] += (zl[8] << 32);
+
+	/* while h >= (n-1) do: h = h - (n-1) */
+	while (sm9_bn_cmp(h_bn, SM9_N_MINUS_ONE) >= 0) {
+		sm9_bn_sub(h_bn, h_bn, SM9_N_MINUS_ONE);
+	}
+
+	// sm9_fn_add(h, h, SM9_ONE);
+	bn_to_bn(h, h_bn);
+	bn_add_dig(h,h,1);
 
-	// g)
-	fp12_inv_t(f_den, f_den); // f_den = f_den^{-1}
+}
 
-	fp12_mul_t1(r, f_num, f_den); // r = f_num*f_den = f
+#include <stdio.h>
 
+int sm9_hash1(bn_t h1, const char *id, size_t idlen, uint8_t hid)
+{
+	SM3_CTX ctx;
+	uint8_t prefix[1] = { SM9_HASH1_PREFIX };
+	uint8_t ct1[4] = {0x00, 0x00, 0x00, 0x01};
+	uint8_t ct2[4] = {0x00, 0x00, 0x00, 0x02};
+	uint8_t Ha[64];
 
+	sm3_init(&ctx);
+	sm3_update(&ctx, prefix, sizeof(prefix));
+	sm3_update(&ctx, (uint8_t *)id, idlen);
+	sm3_update(&ctx, &hid, 1);
+	sm3_update(&ctx, ct1, sizeof(ct1));
+	sm3_finish(&ctx, Ha);
 
-	}
+	sm3_init(&ctx);
+	sm3_update(&ctx, prefix, sizeof(prefix));
+	sm3_update(&ctx, (uint8_t *)id, idlen);
+	sm3_update(&ctx, &hid, 1);
+	sm3_update(&ctx, ct2, sizeof(ct2));
+	sm3_finish(&ctx, Ha + 32);
 
+	sm9_fn_from_hash(h1, Ha);
+	return 1;
+}
 
-	d=TIME_F(STOP);
-	printf("SM9 RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+int sm9_exch_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,
+	SM9_ENC_KEY *key)
+{
+	bn_t t,group_order;
 
-	alarm(second);
-	run_t = 1;
-	d=0.0;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-		sm9_final_exponent1(r, r); // r = f^{(q^12-1)/r'}
-		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
-	}
-	d = TIME_F(STOP);
-	printf("SM9 RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+	bn_null(t);
+	bn_new(t);
+	bn_null(group_order);
+	bn_new(group_order);
+	g1_get_ord(group_order);
 
-	ep_free(_p);
-	bn_free(n);
-	ep2_free(T);
-	ep2_free(Q1);
-	ep2_free(Q2);
-	ep2_free(ep2_tmp);
-	ep2_free(ep2_tmp2);
-	fp12_free(f);
-	fp12_free(g);
-	fp12_free(f_num);
-	fp12_free(f_den);
-	fp12_free(g_num);
-	fp12_free(g_den);
-	fp12_free(fp12_tmp);
+	// t1 = H1(ID || hid, N) + ke
+	sm9_hash1(t, id, idlen, SM9_HID_EXCH);
+	bn_add(t, t, msk->ke);
+	//sm9_fn_add(t, t, msk->ks);
+	if (bn_is_zero(t)) {
+		error_print();
+		return -1;
+	}
 
-	return 0;
+	// t2 = ke * t1^-1
+	
+	bn_mod_inv(t,t,group_order);
+	bn_mul(t,t,msk->ke);
+	
+	// de = t2 * P2
+	sm9_g2_mul_gen(key->de,t);
+	ep_copy(key->Ppube,msk->Ppube);
+	//key->Ppube = msk->Ppube;
+	bn_free(t);
+	bn_free(group_order);
+	return 1;
 }
 
 
-void sm9_pairing_fastest_step_test(fp12_t r, const ep2_t Q, const ep_t P){
-	// a)
-	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
-	
-	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
-	ep_t _p;
-	bn_t n;
+int sm9_enc_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,
+	SM9_ENC_KEY *key)
+{
+	bn_t t,group_order;
 
-	// null
-	ep_null(_p);
-	bn_null(n);
-	ep2_null(T);
-	ep2_null(Q1);
-	ep2_null(Q2);
-	ep2_null(ep2_tmp);
-	ep2_null(neg_Q);
-	fp12_null(f);
-	fp12_null(g);
-	fp12_null(f_num);
-	fp12_null(f_den);
-	fp12_null(g_num);
-	fp12_null(g_den);
-	fp12_null(fp12_tmp);
+	bn_null(t);
+	bn_new(t);
+	bn_null(group_order);
+	bn_new(group_order);
+	g1_get_ord(group_order);
 
-	ep_new(_p);
-	bn_new(n);
-	ep2_new(T);
-	ep2_new(Q1);
-	ep2_new(Q2);
-	ep2_new(ep2_tmp);
-	ep2_new(neg_Q);
-	fp12_new(f);
-	fp12_new(g);
-	fp12_new(f_num);
-	fp12_new(f_den);
-	fp12_new(g_num);
-	fp12_new(g_den);
-	fp12_new(fp12_tmp);
+	// t1 = H1(ID || hid, N) + ke
+	sm9_hash1(t, id, idlen, SM9_HID_ENC);
+	bn_add(t, t, msk->ke);
+	//sm9_fn_add(t, t, msk->ks);
+	if (bn_is_zero(t)) {
+		error_print();
+		return -1;
+	}
 
-int  count = 0;
-	int second = 3;
-	double d=0.0;
-	signal(SIGALRM,alarmed_t);
-	alarm(second);
-	run_t = 1;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
+	// t2 = ke * t1^-1
+	
+	bn_mod_inv(t,t,group_order);
+	bn_mul(t,t,msk->ke);
+	
+	// de = t2 * P2
+	sm9_g2_mul_gen(key->de,t);
+	ep_copy(key->Ppube,msk->Ppube);
+	//key->Ppube = msk->Ppube;
+	bn_free(t);
+	bn_free(group_order);
+	return 1;
+}
 
+int sm9_sign_key_pre_set(SM9_SIGN_KEY *key)
+{
+	ep_mul_fix_glv_pre(key->t, key->ds);
+	key->ready = 1;
+	return 1;
+}
 
-	sm9_twist_point_neg(neg_Q,Q);
+// S = l * ds, ds 是长期私钥, l 与 r 一样需要保密
+static void sm9_sign_key_mul(ep_t S, const SM9_SIGN_KEY *key, const bn_t l)
+{
+	if (key->ready) {
+		ep_mul_fix_glv_sec(S, key->t, key->ds, l);
+	} else {
+		ep_mul_lwreg(S, key->ds, l);
+	}
+}
 
-	// b)
-	ep2_copy(T, Q);
-	fp12_set_dig(f_num, 1);
-	fp12_set_dig(f_den, 1);
+int sm9_sign_master_key_extract_key(SM9_SIGN_MASTER_KEY *msk, const char *id, size_t idlen, SM9_SIGN_KEY *key)
+{
+	bn_t t,t1;
 
-	for(size_t i = 0; i < strlen(abits); i++)
-	{
-		// c)
-		fp12_sqr_t(f_num, f_num);
-		fp12_sqr_t(f_den, f_den);
+	bn_null(t);
+	bn_new(t);
+	bn_null(t1);
+	bn_new(t1);
 
-		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
+	// t1 = H1(ID || hid, N) + ks
+	sm9_hash1(t, id, idlen, SM9_HID_SIGN);
+	bn_add(t, t, msk->ks);
+	//sm9_fn_add(t, t, msk->ks);
+	if (bn_is_zero(t)) {
+		// 这是一个严重问题，意味着整个msk都需要作废了
+		error_print();
+		return -1;
+	}
 
-		fp12_mul_sparse(f_num, f_num, g_num);
-		fp12_mul_sparse2(f_den, f_den, g_den);
+	// t2 = ks * t1^-1
+	//sm9_fn_inv(t, t);
+	bn_read_str(t1,SM9_N,strlen(SM9_N),16);
+	bn_mod_inv(t,t,t1);
+	bn_mul(t,t,msk->ks);
+	
+	//sm9_fn_mul(t, t, msk->ks);
+	// ds = t2 * P1
+	ep_mul_gen(key->ds,t);
+	//sm9_point_mul_generator(&key->ds, t);
+	sm9_sign_key_pre_set(key);
+	ep2_copy(key->Ppubs,msk->Ppubs);
+	//key->Ppubs = msk->Ppubs;
+	bn_free(t);
+	bn_free(t1);
+	return 1;
+}
 
-		ep2_dbl_projc(T, T);
-		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line(g_num, g_den, T, Q, P);
-			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
+// 批量提取按块进行, 块内共用一次求逆, G2 的私钥再共用一次归一化
+#define SM9_EXTRACT_BLOCK	64
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
+typedef struct {
+	uint8_t hid;
+	bn_st *ms;                  // ks 或 ke
+	const char **ids;
+	const size_t *idlens;
+	SM9_SIGN_MASTER_KEY *smsk;
+	SM9_SIGN_KEY *skeys;
+	SM9_ENC_MASTER_KEY *emsk;
+	SM9_ENC_KEY *ekeys;
+	int *ret;
+} SM9_EXTRACT_ARG;
+
+static void sm9_extract_keys_task(void *arg, size_t begin, size_t end)
+{
+	SM9_EXTRACT_ARG *a = (SM9_EXTRACT_ARG *)arg;
+	size_t b, i, j, m, idx[SM9_EXTRACT_BLOCK];
+	bn_t n, t[SM9_EXTRACT_BLOCK];
+	ep2_t P[SM9_EXTRACT_BLOCK];
+
+	bn_null(n);
+	bn_new(n);
+	for (j = 0; j < SM9_EXTRACT_BLOCK; j++) {
+		bn_null(t[j]);
+		bn_new(t[j]);
+		ep2_null(P[j]);
+		ep2_new(P[j]);
+	}
+	g1_get_ord(n);
+
+	for (b = begin; b < end; b += SM9_EXTRACT_BLOCK) {
+		// t1 = H1(ID || hid, N) + ks mod N, t1 = 0 只让这一个身份失败
+		m = 0;
+		for (i = b; i < end && i < b + SM9_EXTRACT_BLOCK; i++) {
+			sm9_hash1(t[m], a->ids[i], a->idlens[i], a->hid);
+			bn_add(t[m], t[m], a->ms);
+			bn_mod(t[m], t[m], n);
+			if (bn_is_zero(t[m])) {
+				a->ret[i] = -1;
+				continue;
+			}
+			idx[m++] = i;
 		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		if (m == 0) {
+			continue;
 		}
-	}
-	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
-	
-	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	//	ep2_add(T, T, Q2);  // T = T - Q2
+		// t2 = ks * t1^-1, 整块只做一次求逆
+		bn_mod_inv_sim(t, (const bn_t *)t, n, (int)m);
+		for (j = 0; j < m; j++) {
+			bn_mul(t[j], t[j], a->ms);
+			bn_mod(t[j], t[j], n);
+		}
 
-	// g)
-	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
+		if (a->hid == SM9_HID_SIGN) {
+			// ds = t2 * P1
+			for (j = 0; j < m; j++) {
+				ep_mul_gen(a->skeys[idx[j]].ds, t[j]);
+				sm9_sign_key_pre_set(&a->skeys[idx[j]]);
+				ep2_copy(a->skeys[idx[j]].Ppubs, a->smsk->Ppubs);
+				a->ret[idx[j]] = 1;
+			}
+		} else {
+			// de = t2 * P2
+			for (j = 0; j < m; j++) {
+				sm9_g2_mul_gen_imp(P[j], t[j], 0);
+			}
+			ep2_norm_sim(P, P, (int)m);
+			for (j = 0; j < m; j++) {
+				ep2_copy(a->ekeys[idx[j]].de, P[j]);
+				ep_copy(a->ekeys[idx[j]].Ppube, a->emsk->Ppube);
+				a->ret[idx[j]] = 1;
+			}
+		}
+	}
 
-	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
+	for (j = 0; j < SM9_EXTRACT_BLOCK; j++) {
+		bn_zero(t[j]);
+		bn_free(t[j]);
+		ep2_free(P[j]);
 	}
-	
-	d=TIME_F(STOP);
-	printf("SM9 RELIC improved Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+	bn_free(n);
+}
 
-	alarm(second);
-	run_t = 1;
-	d=0.0;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-		pp_pow_bn_t(r,r); // r = f^{(q^12-1)/r'}
-	// PERFORMANCE_TEST_NEW("sm9_final_exponent", sm9_final_exponent(r, r));
+static int sm9_extract_keys(SM9_EXTRACT_ARG *a, size_t n, size_t threads)
+{
+	size_t i;
 
+	for (i = 0; i < n; i++) {
+		a->ret[i] = -1;
 	}
-	d = TIME_F(STOP);
-	printf("SM9 RELIC improved Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+	if (sm9_parallel_run(threads, sm9_extract_keys_task, a, n) != 1) {
+		error_print();
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (a->ret[i] != 1) {
+			return 0;
+		}
+	}
+	return 1;
+}
 
+int sm9_sign_master_key_extract_keys(SM9_SIGN_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_SIGN_KEY *keys, int *ret, size_t threads)
+{
+	SM9_EXTRACT_ARG a = { SM9_HID_SIGN, msk->ks, ids, idlens, msk, keys, NULL, NULL, ret };
+	return sm9_extract_keys(&a, n, threads);
+}
 
-	ep_free(_p);
-	bn_free(n);
-	ep2_free(T);
-	ep2_free(Q1);
-	ep2_free(Q2);
-	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
-	fp12_free(f);
-	fp12_free(g);
-	fp12_free(f_num);
-	fp12_free(f_den);
-	fp12_free(g_num);
-	fp12_free(g_den);
-	fp12_free(fp12_tmp);
-	return ;
+int sm9_enc_master_key_extract_keys(SM9_ENC_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_ENC_KEY *keys, int *ret, size_t threads)
+{
+	SM9_EXTRACT_ARG a = { SM9_HID_ENC, msk->ke, ids, idlens, NULL, NULL, msk, keys, ret };
+	return sm9_extract_keys(&a, n, threads);
 }
 
+int sm9_exch_master_key_extract_keys(SM9_ENC_MASTER_KEY *msk, const char *ids[], const size_t idlens[],
+	size_t n, SM9_ENC_KEY *keys, int *ret, size_t threads)
+{
+	SM9_EXTRACT_ARG a = { SM9_HID_EXCH, msk->ke, ids, idlens, NULL, NULL, msk, keys, ret };
+	return sm9_extract_keys(&a, n, threads);
+}
 
-void sm9_pairing_fast_step_test(fp12_t r, const ep2_t Q, const ep_t P){
-	// a)
-	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
-	
-	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
-	ep_t _p;
-	bn_t n;
+//enc
+int sm9_ciphertext_to_der(const ep_t C1, const uint8_t *c2, size_t c2len,
+	const uint8_t c3[SM3_HMAC_SIZE], uint8_t **out, size_t *outlen)
+{
+	int en_type = SM9_ENC_TYPE_XOR;
+	uint8_t c1[65];
+	size_t len = 0;
 
-	// null
-	ep_null(_p);
-	bn_null(n);
-	ep2_null(T);
-	ep2_null(Q1);
-	ep2_null(Q2);
-	ep2_null(ep2_tmp);
-	ep2_null(neg_Q);
-	fp12_null(f);
-	fp12_null(g);
-	fp12_null(f_num);
-	fp12_null(f_den);
-	fp12_null(g_num);
-	fp12_null(g_den);
-	fp12_null(fp12_tmp);
+	ep_write_bin(c1,65,C1,0);
+	//sm9_point_to_uncompressed_octets(C1, c1);
 
-	ep_new(_p);
-	bn_new(n);
-	ep2_new(T);
-	ep2_new(Q1);
-	ep2_new(Q2);
-	ep2_new(ep2_tmp);
-	ep2_new(neg_Q);
-	fp12_new(f);
-	fp12_new(g);
-	fp12_new(f_num);
-	fp12_new(f_den);
-	fp12_new(g_num);
-	fp12_new(g_den);
-	fp12_new(fp12_tmp);
+	if (asn1_int_to_der(en_type, NULL, &len) != 1
+		|| asn1_bit_octets_to_der(c1, sizeof(c1), NULL, &len) != 1
+		|| asn1_octet_string_to_der(c3, SM3_HMAC_SIZE, NULL, &len) != 1
+		|| asn1_octet_string_to_der(c2, c2len, NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| asn1_int_to_der(en_type, out, outlen) != 1
+		|| asn1_bit_octets_to_der(c1, sizeof(c1), out, outlen) != 1
+		|| asn1_octet_string_to_der(c3, SM3_HMAC_SIZE, out, outlen) != 1
+		|| asn1_octet_string_to_der(c2, c2len, out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
+	return 1;
+}
 
-	int  count = 0;
-	int second = 3;
-	double d=0.0;
-	signal(SIGALRM,alarmed_t);
-	alarm(second);
-	run_t = 1;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-	sm9_twist_point_neg(neg_Q,Q);
+//dec
+int sm9_ciphertext_from_der(ep_t C1, const uint8_t **c2, size_t *c2len,
+	const uint8_t **c3, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *d;
+	size_t dlen;
+	int en_type;
+	const uint8_t *c1;
+	size_t c1len;
+	size_t c3len;
+
+	if ((ret = asn1_sequence_from_der(&d, &dlen, in, inlen)) != 1) {
+		if (ret < 0) error_print();
+		return ret;
+	}
+	if (asn1_int_from_der(&en_type, &d, &dlen) != 1
+		|| asn1_bit_octets_from_der(&c1, &c1len, &d, &dlen) != 1
+		|| asn1_octet_string_from_der(c3, &c3len, &d, &dlen) != 1
+		|| asn1_octet_string_from_der(c2, c2len, &d, &dlen) != 1
+		|| asn1_length_is_zero(dlen) != 1) {
+		error_print();
+		return -1;
+	}
+	if (en_type != SM9_ENC_TYPE_XOR) {
+		error_print();
+		return -1;
+	}
+	if (c1len != 65) {
+		error_print();
+		return -1;
+	}
+	if (c3len != SM3_HMAC_SIZE) {
+		error_print();
+		return -1;
+	}
+	ep_read_bin(C1,c1,65);
+	return 1;
+}
 
+//sign
+int sm9_signature_to_der(const SM9_SIGNATURE *sig, uint8_t **out, size_t *outlen)
+{
+	
+	uint8_t hbuf[32];
+	uint8_t Sbuf[65];
+	size_t len = 0;
 
-	// b)
-	ep2_copy(T, Q);
-	fp12_set_dig(f_num, 1);
-	fp12_set_dig(f_den, 1);
+	// sm9_fn_to_bytes(sig->h, hbuf);
+	bn_write_bin(hbuf, 32, sig->h);
+	//sm9_point_to_uncompressed_octets(&sig->S, Sbuf);
+	ep_write_bin(Sbuf,65,sig->S,0);
 
-	for(size_t i = 0; i < strlen(abits); i++)
-	{
-		// c)
-		fp12_sqr_t(f_num, f_num);
-		fp12_sqr_t(f_den, f_den);
+	if (asn1_octet_string_to_der(hbuf, sizeof(hbuf), NULL, &len) != 1
+		|| asn1_bit_octets_to_der(Sbuf, sizeof(Sbuf), NULL, &len) != 1
+		|| asn1_sequence_header_to_der(len, out, outlen) != 1
+		|| asn1_octet_string_to_der(hbuf, sizeof(hbuf), out, outlen) != 1
+		|| asn1_bit_octets_to_der(Sbuf, sizeof(Sbuf), out, outlen) != 1) {
+		error_print();
+		return -1;
+	}
 
-		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
+	return 1;
+}
 
-		fp12_mul_sparse(f_num, f_num, g_num);
-		fp12_mul_sparse(f_den, f_den, g_den);
+//verify
+int sm9_signature_from_der(SM9_SIGNATURE *sig, const uint8_t **in, size_t *inlen)
+{
+	int ret;
+	const uint8_t *d;
+	size_t dlen;
+	const uint8_t *h;
+	size_t hlen;
+	const uint8_t *S;
+	size_t Slen;
 
-		ep2_dbl_projc(T, T);
-		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line(g_num, g_den, T, Q, P);
-			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
+	if ((ret = asn1_sequence_from_der(&d, &dlen, in, inlen)) != 1) {
+		if (ret < 0) error_print();
+		return ret;
+	}
+	if (asn1_octet_string_from_der(&h, &hlen, &d, &dlen) != 1
+		|| asn1_bit_octets_from_der(&S, &Slen, &d, &dlen) != 1
+		|| asn1_check(hlen == 32) != 1
+		|| asn1_check(Slen == 65) != 1
+		|| asn1_length_is_zero(dlen) != 1) {
+		error_print();
+		return -1;
+	}
+	bn_read_bin(sig->h,h,hlen);
+	ep_read_bin(sig->S,S,Slen);
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
+	return 1;
+}
+
+// R = r * Q, Q = H1(ID || hid, N) * P1 + Ppube, Q and its comb table come from the identity cache when one is set;
+// if the cache cannot take a new entry Q is computed without it
+static void sm9_id_mul_g1(ep_t R, const ep_t Ppube, uint8_t hid, const char *id, size_t idlen, const bn_t r)
+{
+	SM9_ID_CACHE *cache = sm9_get_id_cache();
+	ep_t Q, t[SM9_DS_TABLE];
+	int ret;
+
+	ep_null(Q);
+	ep_new(Q);
+	if (sm9_id_cache_flags(cache) & SM9_ID_CACHE_TABLES) {
+		for (int i = 0; i < SM9_DS_TABLE; i++) {
+			ep_null(t[i]);
+			ep_new(t[i]);
 		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_sparse(f_num, f_num, g_num);
-			fp12_mul_sparse2(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
+		if ((ret = sm9_id_cache_g1(cache, Ppube, hid, id, idlen, NULL, Q, t)) >= 0) {
+			ep_mul_fix_glv_sec(R, t, Q, r);
 		}
+		for (int i = 0; i < SM9_DS_TABLE; i++) {
+			ep_free(t[i]);
+		}
+	} else if ((ret = sm9_id_cache_g1(cache, Ppube, hid, id, idlen, NULL, Q, NULL)) >= 0) {
+		ep_mul(R, Q, r);
 	}
-	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
-	
-	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
-
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_sparse(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_sparse2(f_den, f_den, g_den);
-//	ep2_add(T, T, Q2);  // T = T - Q2
+	if (ret < 0) {
+		sm9_id_cache_g1(NULL, Ppube, hid, id, idlen, NULL, Q, NULL);
+		ep_mul(R, Q, r);
+	}
+	ep_free(Q);
+}
 
-	// g)
-	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
+int sm9_kem_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
+	size_t klen, uint8_t *kbuf, ep_t C)
+{	
+	bn_t r,N;
+	fp12_t w;
+	bn_null(r);
+	bn_new(r);
+	bn_null(N);
+	bn_new(N);
+	fp12_null(w);
+	fp12_new(w);
 
-	fp12_mul_t(r, f_num, f_den);  // r = f_num*f_den = f
-	}
+	ep2_t SM9_P2;
+	ep2_null(SM9_P2);
+	ep2_new(SM9_P2);
+	g2_get_gen(SM9_P2);
 
+	g1_get_ord(N);
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
 
-	d=TIME_F(STOP);
-	printf("SM9 fast RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+	do {
+		// A2: rand r in [1, N-1]
+		do {
+			bn_rand_mod(r, N);
+		} while (bn_is_zero(r));
 
-	alarm(second);
-	run_t = 1;
-	d=0.0;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-		sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
-		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
-	}
-	d = TIME_F(STOP);
-	printf("SM9 fast RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+		// A1, A3: C1 = r * Q, Q = H1(ID||hid,N) * P1 + Ppube
+		sm9_id_mul_g1(C, mpk->Ppube, SM9_HID_ENC, id, idlen, r);
 
-	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+		ep_write_bin(cbuf,65,C,0);
+		//sm9_point_to_uncompressed_octets(C, cbuf);
 
-	ep_free(_p);
-	bn_free(n);
-	ep2_free(T);
-	ep2_free(Q1);
-	ep2_free(Q2);
-	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
-	fp12_free(f);
-	fp12_free(g);
-	fp12_free(f_num);
-	fp12_free(f_den);
-	fp12_free(g_num);
-	fp12_free(g_den);
-	fp12_free(fp12_tmp);
-	return ;
-}
+		// A4: g = e(Ppube, P2)
+		sm9_pairing_ate(w,SM9_P2,mpk->Ppube);
 
+		// A5: w = g^r
+		fp12_pow_gls_sec(w, w, r);
+		fp12_write_bin(wbuf,32*12,w,0);
+		for(int i = 0;i<384;i++){
+			fubw[(11-i/32)*32+i%32] = wbuf[i];
+		}
+		// A6: K = KDF(C || w || ID_B, klen), if K == 0, goto A2
+		sm3_kdf_init(&kdf_ctx, klen);
+		sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+		sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+		sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+		sm3_kdf_finish(&kdf_ctx, kbuf);
 
+	} while (mem_is_zero(kbuf, klen) == 1);
 
-void sm9_pairing_fast_step_test2(fp12_t r, const ep2_t Q, const ep_t P){
-	// a)
-	const char *abits = "00100000000000000000000000000000000000010001020200020200101000020";
-	
-	fp12_t f, g, f_num, f_den, g_num, g_den, fp12_tmp;
-	ep2_t T, Q1, Q2, ep2_tmp, neg_Q;
-	ep_t _p;
-	bn_t n;
+	bn_free(r);
+	bn_free(N);
+	fp12_free(w);
+	ep2_free(SM9_P2);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
 
-	// null
-	ep_null(_p);
-	bn_null(n);
-	ep2_null(T);
-	ep2_null(Q1);
-	ep2_null(Q2);
-	ep2_null(ep2_tmp);
-	ep2_null(neg_Q);
-	fp12_null(f);
-	fp12_null(g);
-	fp12_null(f_num);
-	fp12_null(f_den);
-	fp12_null(g_num);
-	fp12_null(g_den);
-	fp12_null(fp12_tmp);
+	//when using kem, klen = klen - datalen(20)
 
-	ep_new(_p);
-	bn_new(n);
-	ep2_new(T);
-	ep2_new(Q1);
-	ep2_new(Q2);
-	ep2_new(ep2_tmp);
-	ep2_new(neg_Q);
-	fp12_new(f);
-	fp12_new(g);
-	fp12_new(f_num);
-	fp12_new(f_den);
-	fp12_new(g_num);
-	fp12_new(g_den);
-	fp12_new(fp12_tmp);
+	// A7: output (K, C)
+	return 1;
+}
 
-	int  count = 0;
-	int second = 3;
-	double d=0.0;
-	signal(SIGALRM,alarmed_t);
-	alarm(second);
-	run_t = 1;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-	sm9_twist_point_neg(neg_Q,Q);
+int sm9_enc_mpk_pre_set(SM9_ENC_MPK_PRE *pre, const ep_t Ppube)
+{
+	ep2_t SM9_P2;
 
-	// b)
-	ep2_copy(T, Q);
-	fp12_set_dig(f_num, 1);
-	fp12_set_dig(f_den, 1);
+	if (pre->ready && ep_cmp(pre->Ppube, Ppube) == RLC_EQ) {
+		return 1;
+	}
 
-	for(size_t i = 0; i < strlen(abits); i++)
-	{
-		// c)
-		fp12_sqr_t1(f_num, f_num);
-		fp12_sqr_t1(f_den, f_den);
+	ep2_null(SM9_P2);
+	ep2_new(SM9_P2);
+	g2_get_gen(SM9_P2);
 
-		sm9_eval_g_tangent(g_num, g_den, T, P);
-		// PERFORMANCE_TEST("sm9_eval_g_tangent",sm9_eval_g_tangent(g_num, g_den, T, P),10000);
+	// g = e(Ppube, P2)
+	ep_norm(pre->Ppube, Ppube);
+	sm9_pairing_ate(pre->g, SM9_P2, pre->Ppube);
+	fp12_pow_fix_pre(pre->t, pre->g);
+	pre->ready = 1;
 
-		fp12_mul_t1(f_num, f_num, g_num);
-		fp12_mul_t1(f_den, f_den, g_den);
+	ep2_free(SM9_P2);
+	return 1;
+}
 
-		ep2_dbl_projc(T, T);
-		// c.2)
-		if (abits[i] == '1'){
-			sm9_eval_g_line(g_num, g_den, T, Q, P);
-			// PERFORMANCE_TEST("sm9_eval_g_line",sm9_eval_g_line(g_num, g_den, T, Q, P),10000);
-			fp12_mul_t1(f_num, f_num, g_num);
-			fp12_mul_t1(f_den, f_den, g_den);
+int sm9_kem_encrypt_pre(SM9_ENC_MPK_PRE *pre, const char *id, size_t idlen,
+	size_t klen, uint8_t *kbuf, ep_t C)
+{
+	bn_t r, ord;
+	fp12_t w;
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
 
-			ep2_add_projc(T, T, Q);  // T = T + Q
-		}
-		else if(abits[i] == '2'){
-			sm9_eval_g_line(g_num, g_den, T, neg_Q, P);
-			fp12_mul_t1(f_num, f_num, g_num);
-			fp12_mul_t1(f_den, f_den, g_den);
-			ep2_add_projc(T, T, neg_Q);  // T = T - Q
-		}
+	if (!pre->ready) {
+		error_print();
+		return -1;
 	}
-	// d)
-	ep2_pi1(Q1, Q);  // Q1 = pi_q(Q)
-	ep2_pi2(Q2, Q);  // Q2 = pi_{q^2}(Q), Q2 = -Q2
-	
-	// e)
-	sm9_eval_g_line(g_num, g_den, T, Q1, P);  // g = g_{T,Q1}(P)
-	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,Q1}(P)
-	fp12_mul_t1(f_den, f_den, g_den);
-	ep2_add_projc(T, T, Q1);  // T = T + Q1
 
-	// f)
-	sm9_eval_g_line(g_num, g_den, T, Q2, P);  // g = g_{T,-Q2}(P)
-	fp12_mul_t1(f_num, f_num, g_num);  // f = f * g = f * g_{T,-Q2}(P)
-	fp12_mul_t1(f_den, f_den, g_den);
-//	ep2_add(T, T, Q2);  // T = T - Q2
+	bn_null(r);
+	bn_null(ord);
+	fp12_null(w);
 
-	// g)
-	fp12_inv_t(f_den, f_den);  // f_den = f_den^{-1}
+	bn_new(r);
+	bn_new(ord);
+	fp12_new(w);
 
-	fp12_mul_t1(r, f_num, f_den);  // r = f_num*f_den = f
-	}
+	g1_get_ord(ord);
 
+	do {
+		// A2: rand r in [1, N-1]
+		do {
+			bn_rand_mod(r, ord);
+		} while (bn_is_zero(r));
 
-	d=TIME_F(STOP);
-	printf("SM9 fast with slow loop RELIC Miller part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
+		// A1, A3: C1 = r * Q, Q = H1(ID||hid,N) * P1 + Ppube
+		sm9_id_mul_g1(C, pre->Ppube, SM9_HID_ENC, id, idlen, r);
+		ep_write_bin(cbuf, 65, C, 0);
 
-	alarm(second);
-	run_t = 1;
-	d=0.0;
-	TIME_F(START);
-	for(count=0;run_t&&count<0x7fffffff;count++){
-		
-		sm9_final_exponent(r, r);  // r = f^{(q^12-1)/r'}
-		// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
-	}
-	d = TIME_F(STOP);
-	printf("SM9 fast with slow loop RELIC Final Exp part \n\t\t\t run %d times in %.2fs \n",count/second,d/second);
-	
-	// PERFORMANCE_TEST("sm9_final_exponent", sm9_final_exponent(r, r), 1000);
+		// A4, A5: w = g^r, g = e(Ppube, P2) is taken from pre
+		fp12_pow_fix_sec(w, pre->t, r);
+		fp12_write_bin(wbuf, 32*12, w, 0);
+		for(int i = 0;i<384;i++){
+			fubw[(11-i/32)*32+i%32] = wbuf[i];
+		}
 
-	ep_free(_p);
-	bn_free(n);
-	ep2_free(T);
-	ep2_free(Q1);
-	ep2_free(Q2);
-	ep2_free(ep2_tmp);
-	ep2_free(neg_Q);
-	fp12_free(f);
-	fp12_free(g);
-	fp12_free(f_num);
-	fp12_free(f_den);
-	fp12_free(g_num);
-	fp12_free(g_den);
-	fp12_free(fp12_tmp);
-	return ;
-}
+		// A6: K = KDF(C || w || ID_B, klen), if K == 0, goto A2
+		sm3_kdf_init(&kdf_ctx, klen);
+		sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+		sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+		sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+		sm3_kdf_finish(&kdf_ctx, kbuf);
+	} while (mem_is_zero(kbuf, klen) == 1);
 
-static int sm9_barrett_bn_cmp(const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
-{
-	int i;
-	for (i = 8; i >= 0; i--) {
-		if (a[i] > b[i])
-			return 1;
-		if (a[i] < b[i])
-			return -1;
-	}
-	return 0;
+	bn_free(r);
+	bn_free(ord);
+	fp12_free(w);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
+
+	// A7: output (K, C)
+	return 1;
 }
 
-static void sm9_barrett_bn_add(sm9_barrett_bn_t r, const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
+int sm9_kem_encrypt_pool(SM9_ENC_MPK_PRE *pre, SM9_RAND_POOL *pool, const char *id, size_t idlen,
+	size_t klen, uint8_t *kbuf, ep_t C)
 {
-	int i;
-	r[0] = a[0] + b[0];
-	for (i = 1; i < 9; i++) {
-		r[i] = a[i] + b[i] + (r[i-1] >> 32);
-	}
-	for (i = 0; i < 8; i++) {
-		r[i] &= 0xffffffff;
-	}
-}
+	int ret = 1;
+	bn_t r;
+	fp12_t w;
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
 
-static void sm9_barrett_bn_sub(sm9_barrett_bn_t ret, const sm9_barrett_bn_t a, const sm9_barrett_bn_t b)
-{
-	sm9_barrett_bn_t r;
-	int i;
-	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
-	for (i = 1; i < 8; i++) {
-		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
-		r[i - 1] &= 0xffffffff;
-	}
-	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
-	r[i - 1] &= 0xffffffff;
-	for (i = 0; i < 9; i++) {
-		ret[i] = r[i];
+	if (!pre->ready) {
+		error_print();
+		return -1;
 	}
-}
 
-static int sm9_bn_cmp(const sm9_bn_t a, const sm9_bn_t b)
-{
-	int i;
-	for (i = 7; i >= 0; i--) {
-		if (a[i] > b[i])
-			return 1;
-		if (a[i] < b[i])
-			return -1;
-	}
-	return 0;
-}
+	bn_null(r);
+	fp12_null(w);
 
-static void sm9_bn_copy(sm9_bn_t r, const sm9_bn_t a)
-{
-	memcpy(r, a, sizeof(sm9_bn_t));
+	bn_new(r);
+	fp12_new(w);
+
+	do {
+		// A2, A4, A5: r and w = g^r are taken from the pool
+		if (sm9_rand_pool_get(pool, r, w) < 0) {
+			error_print();
+			ret = -1;
+			break;
+		}
+
+		// A1, A3: C1 = r * Q, Q = H1(ID||hid,N) * P1 + Ppube
+		sm9_id_mul_g1(C, pre->Ppube, SM9_HID_ENC, id, idlen, r);
+		ep_write_bin(cbuf, 65, C, 0);
+
+		fp12_write_bin(wbuf, 32*12, w, 0);
+		for(int i = 0;i<384;i++){
+			fubw[(11-i/32)*32+i%32] = wbuf[i];
+		}
+
+		// A6: K = KDF(C || w || ID_B, klen), if K == 0, goto A2
+		sm3_kdf_init(&kdf_ctx, klen);
+		sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+		sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+		sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+		sm3_kdf_finish(&kdf_ctx, kbuf);
+	} while (mem_is_zero(kbuf, klen) == 1);
+
+	bn_zero(r);
+	bn_free(r);
+	fp12_free(w);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
+
+	// A7: output (K, C)
+	return ret;
 }
 
-static void sm9_bn_sub(sm9_bn_t ret, const sm9_bn_t a, const sm9_bn_t b)
+int sm9_kem_decrypt_pre(const SM9_G2_PRE *de, const char *id, size_t idlen, const ep_t C,
+	size_t klen, uint8_t *kbuf)
 {
-	int i;
-	sm9_bn_t r;
-	r[0] = ((uint64_t)1 << 32) + a[0] - b[0];
-	for (i = 1; i < 7; i++) {
-		r[i] = 0xffffffff + a[i] - b[i] + (r[i - 1] >> 32);
-		r[i - 1] &= 0xffffffff;
+	int ret = 1;
+	fp12_t w;
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
+
+	// B1: check C in G1
+	if (!ep_on_curve(C) || ep_is_infty(C)) {
+		error_print();
+		return -1;
 	}
-	r[i] = a[i] - b[i] + (r[i - 1] >> 32) - 1;
-	r[i - 1] &= 0xffffffff;
-	sm9_bn_copy(ret, r);
-}
 
+	fp12_null(w);
+	fp12_new(w);
 
+	ep_write_bin(cbuf, 65, C, 0);
 
-void sm9_fn_from_hash(bn_t h, const uint8_t Ha[40])
-{
-	uint64_t s[18] = {0};
-	sm9_barrett_bn_t zh, zl, q;
-	uint64_t w;
-	int i, j;
+	// B2: w = e(C, de), de is prepared
+	sm9_pairing_pre(w, de, C);
+	fp12_write_bin(wbuf, 32*12, w, 0);
+	for(int i = 0;i<384;i++){
+		fubw[(11-i/32)*32+i%32] = wbuf[i];
+	}
 
-	sm9_bn_t h_bn;
+	// B3: K = KDF(C || w || ID, klen)
+	sm3_kdf_init(&kdf_ctx, klen);
+	sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+	sm3_kdf_finish(&kdf_ctx, kbuf);
 
-	/* s = Ha -> int */
-	for (int i = 0; i < 10; i++) {
-		for (int j = 0; j < 4; j++) {
-			s[i] <<= 8;
-			s[i] += Ha[4 * (9-i) + j];
-		}
+	if (mem_is_zero(kbuf, klen)) {
+		error_print();
+		ret = -1;
 	}
+	fp12_free(w);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
 
-	/* zl = z mod (2^32)^9 = z[0..8]
-	 * zh = z // (2^32)^7 = z[7..15] */
-	for (i = 0; i < 9; i++) {
-		zl[i] = s[i];
-		zh[i] = s[7 + i];
-	}
+	// B4: output K
+	return ret;
+}
 
-	/* q = zh * mu // (2^32)^9 */
-	for (i = 0; i < 18; i++) {
-		s[i] = 0;
-	}
-	for (i = 0; i < 9; i++) {
-		w = 0;
-		for (j = 0; j < 9; j++) {
-			w += s[i + j] + zh[i] * SM9_MU_N_MINUS_ONE[j]; //
-			s[i + j] = w & 0xffffffff;
-			w >>= 32;
-		}
-		s[i + 9] = w;
-	}
-	for (i = 0; i < 9; i++) {
-		q[i] = s[9 + i];
+int sm9_kem_decrypt_batch(const SM9_G2_PRE *de, const char *id, size_t idlen, const ep_t C[], size_t n,
+	size_t klen, uint8_t *kbuf, int *ret)
+{
+	int res = 1;
+	size_t i, m = 0;
+	size_t *idx = NULL;
+	ep_t *P = NULL;
+	fp12_t *w = NULL;
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
+
+	if (n == 0) {
+		return 1;
 	}
 
-	/* q = q * p mod (2^32)^9 */
-	for (i = 0; i < 18; i++) {
-		s[i] = 0;
+	idx = (size_t *)malloc(n * sizeof(size_t));
+	P = (ep_t *)malloc(n * sizeof(ep_t));
+	w = (fp12_t *)malloc(n * sizeof(fp12_t));
+	if (idx == NULL || P == NULL || w == NULL) {
+		free(idx);
+		free(P);
+		free(w);
+		error_print();
+		return -1;
 	}
-	for (i = 0; i < 9; i++) {
-		w = 0;
-		for (j = 0; j < 8; j++) {
-			w += s[i + j] + q[i] * SM9_N_MINUS_ONE[j];
-			s[i + j] = w & 0xffffffff;
-			w >>= 32;
+
+	// B1: check C in G1, a bad C only fails its own item
+	for (i = 0; i < n; i++) {
+		ret[i] = -1;
+		memset(kbuf + i * klen, 0, klen);
+		if (!ep_on_curve(C[i]) || ep_is_infty(C[i])) {
+			res = 0;
+			continue;
 		}
-		s[i + 8] = w;
-	}
-	for (i = 0; i < 9; i++) {
-		q[i] = s[i];
+		ep_null(P[m]);
+		ep_new(P[m]);
+		fp12_null(w[m]);
+		fp12_new(w[m]);
+		ep_norm(P[m], C[i]);
+		idx[m++] = i;
 	}
 
-	/* h = zl - q (mod (2^32)^9) */
+	// B2: w = e(C, de), de is prepared, one batched final exponentiation
+	sm9_pairing_pre_batch(w, de, (const ep_t *)P, (int)m);
 
-	if (sm9_barrett_bn_cmp(zl, q)) {
-		sm9_barrett_bn_sub(zl, zl, q);
-	} else {
-		sm9_barrett_bn_t c = {0,0,0,0,0,0,0,0,0x100000000};
-		sm9_barrett_bn_sub(q, c, q);
-		sm9_barrett_bn_add(zl, q, zl);
-	}
+	for (i = 0; i < m; i++) {
+		ep_write_bin(cbuf, 65, P[i], 0);
+		fp12_write_bin(wbuf, 32*12, w[i], 0);
+		for(int j = 0;j<384;j++){
+			fubw[(11-j/32)*32+j%32] = wbuf[j];
+		}
 
-	for (i = 0; i < 8; i++) {
-		h_bn[i] = zl[i];
+		// B3: K = KDF(C || w || ID, klen)
+		sm3_kdf_init(&kdf_ctx, klen);
+		sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+		sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+		sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+		sm3_kdf_finish(&kdf_ctx, kbuf + idx[i] * klen);
+
+		if (mem_is_zero(kbuf + idx[i] * klen, klen)) {
+			res = 0;
+		} else {
+			ret[idx[i]] = 1;
+		}
+		ep_free(P[i]);
+		fp12_free(w[i]);
 	}
 
-	h_bn[7] += (zl[8] << 32);
+	gmssl_secure_clear(w, m * sizeof(fp12_t));
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
+	free(idx);
+	free(P);
+	free(w);
+	return res;
+}
 
-	/* while h >= (n-1) do: h = h - (n-1) */
-	while (sm9_bn_cmp(h_bn, SM9_N_MINUS_ONE) >= 0) {
-		sm9_bn_sub(h_bn, h_bn, SM9_N_MINUS_ONE);
-	}
+int sm9_kem_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen, const ep_t C,
+	size_t klen, uint8_t *kbuf)
+{
+	fp12_t w;
+	fp12_null(w);
+	fp12_new(w);
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	uint8_t cbuf[65];
+	SM3_KDF_CTX kdf_ctx;
 
-	// sm9_fn_add(h, h, SM9_ONE);
-	bn_to_bn(h, h_bn);
-	bn_add_dig(h,h,1);
+	// B1: check C in G1
 
-}
+	ep_write_bin(cbuf,65,C,0);
+	//sm9_point_to_uncompressed_octets(C, cbuf);
 
-#include <stdio.h>
+	// B2: w = e(C, de);
 
-int sm9_hash1(bn_t h1, const char *id, size_t idlen, uint8_t hid)
-{
-	SM3_CTX ctx;
-	uint8_t prefix[1] = { SM9_HASH1_PREFIX };
-	uint8_t ct1[4] = {0x00, 0x00, 0x00, 0x01};
-	uint8_t ct2[4] = {0x00, 0x00, 0x00, 0x02};
-	uint8_t Ha[64];
+	sm9_pairing_ate(w, key->de, C);
+	fp12_write_bin(wbuf, 32*12, w, 0);  // pack表示是否压缩
+	// A4: h = H2(M || w, N)
+	// hlen = 8*(5*bitlen(N)/32) = 8*40，8*40表示的是比特长度，也就是40字节
+	for(int i = 0;i<384;i++){
+		fubw[(11-i/32)*32+i%32] = wbuf[i];
+	}
 
-	sm3_init(&ctx);
-	sm3_update(&ctx, prefix, sizeof(prefix));
-	sm3_update(&ctx, (uint8_t *)id, idlen);
-	sm3_update(&ctx, &hid, 1);
-	sm3_update(&ctx, ct1, sizeof(ct1));
-	sm3_finish(&ctx, Ha);
+	// B3: K = KDF(C || w || ID, klen)
+	sm3_kdf_init(&kdf_ctx, klen);
+	sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+	sm3_kdf_finish(&kdf_ctx, kbuf);
 
-	sm3_init(&ctx);
-	sm3_update(&ctx, prefix, sizeof(prefix));
-	sm3_update(&ctx, (uint8_t *)id, idlen);
-	sm3_update(&ctx, &hid, 1);
-	sm3_update(&ctx, ct2, sizeof(ct2));
-	sm3_finish(&ctx, Ha + 32);
+	if (mem_is_zero(kbuf, klen)) {
+		error_print();
+		return -1;
+	}
+	fp12_free(w);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
 
-	sm9_fn_from_hash(h1, Ha);
+	// B4: output K
 	return 1;
 }
+//aa
 
-int sm9_exch_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,
-	SM9_ENC_KEY *key)
+int sm9_do_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
+	const uint8_t *in, size_t inlen,
+	ep_t C1, uint8_t *c2, uint8_t c3[SM3_HMAC_SIZE])
 {
-	bn_t t,group_order;
-
-	bn_null(t);
-	bn_new(t);
-	bn_null(group_order);
-	bn_new(group_order);
-	g1_get_ord(group_order);
+	SM3_HMAC_CTX hmac_ctx;
+	uint8_t K[inlen + 32];
 
-	// t1 = H1(ID || hid, N) + ke
-	sm9_hash1(t, id, idlen, SM9_HID_EXCH);
-	bn_add(t, t, msk->ke);
-	//sm9_fn_add(t, t, msk->ks);
-	if (bn_is_zero(t)) {
+	if (sm9_kem_encrypt(mpk, id, idlen, sizeof(K), K, C1) != 1) {
 		error_print();
 		return -1;
 	}
+	gmssl_memxor(c2, K, in, inlen);
 
-	// t2 = ke * t1^-1
-	
-	bn_mod_inv(t,t,group_order);
-	bn_mul(t,t,msk->ke);
-	
-	// de = t2 * P2
-	ep2_mul_gen(key->de,t);
-	ep_copy(key->Ppube,msk->Ppube);
-	//key->Ppube = msk->Ppube;
-	bn_free(t);
-	bn_free(group_order);
+	//sm3_hmac(K + inlen, 32, c2, inlen, c3);
+	sm3_hmac_init(&hmac_ctx, K + inlen, SM3_HMAC_SIZE);
+	sm3_hmac_update(&hmac_ctx, c2, inlen);
+	sm3_hmac_finish(&hmac_ctx, c3);
+	gmssl_secure_clear(&hmac_ctx, sizeof(hmac_ctx));
 	return 1;
-}
 
+}
 
-int sm9_enc_master_key_extract_key(SM9_ENC_MASTER_KEY *msk, const char *id, size_t idlen,
-	SM9_ENC_KEY *key)
+int sm9_do_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen,
+	const ep_t C1, const uint8_t *c2, size_t c2len, const uint8_t c3[SM3_HMAC_SIZE],
+	uint8_t *out)
 {
-	bn_t t,group_order;
+	SM3_HMAC_CTX hmac_ctx;
+	uint8_t k[SM9_MAX_PLAINTEXT_SIZE + SM3_HMAC_SIZE];
+	uint8_t mac[SM3_HMAC_SIZE];
 
-	bn_null(t);
-	bn_new(t);
-	bn_null(group_order);
-	bn_new(group_order);
-	g1_get_ord(group_order);
+	if (c2len > SM9_MAX_PLAINTEXT_SIZE) {
+		error_print();
+		return -1;
+	}
 
-	// t1 = H1(ID || hid, N) + ke
-	sm9_hash1(t, id, idlen, SM9_HID_ENC);
-	bn_add(t, t, msk->ke);
-	//sm9_fn_add(t, t, msk->ks);
-	if (bn_is_zero(t)) {
+	if (sm9_kem_decrypt(key, id, idlen, C1, sizeof(k), k) != 1) {
 		error_print();
 		return -1;
 	}
+	//sm3_hmac(k + c2len, SM3_HMAC_SIZE, c2, c2len, mac);
+	sm3_hmac_init(&hmac_ctx, k + c2len, SM3_HMAC_SIZE);
+	sm3_hmac_update(&hmac_ctx, c2, c2len);
+	sm3_hmac_finish(&hmac_ctx, mac);
+	gmssl_secure_clear(&hmac_ctx, sizeof(hmac_ctx));
 
-	// t2 = ke * t1^-1
-	
-	bn_mod_inv(t,t,group_order);
-	bn_mul(t,t,msk->ke);
+	if (gmssl_secure_memcmp(c3, mac, sizeof(mac)) != 0) {
+		error_print();
+		return -1;
+	}
+	gmssl_memxor(out, k, c2, c2len);
+	return 1;
+}
+
+int sm9_exchange_A1(const SM9_ENC_KEY *usr, const char *id, size_t idlen,ep_t Ra,bn_t ra){
 	
-	// de = t2 * P2
-	ep2_mul_gen(key->de,t);
-	ep_copy(key->Ppube,msk->Ppube);
-	//key->Ppube = msk->Ppube;
-	bn_free(t);
-	bn_free(group_order);
+	bn_t N;
+	bn_null(N);
+	bn_new(N);
+
+	//just for correctness test
+	char exch_ra[] = "5879DD1D51E175946F23B1B41E93BA31C584AE59A426EC1046A4D03B06C8";
+
+	// A2: rand r in [1, N-1]
+	bn_read_str(N,SM9_N,strlen(SM9_N),16);
+	bn_sub_dig(N,N,1);
+	do{
+		bn_rand(ra,RLC_POS,256);
+	}while((bn_cmp_dig(ra,1) == -1) || (bn_cmp(ra,N) == 1));
+	bn_read_str(ra,exch_ra,strlen(exch_ra),16);
+	// A1, A3: R = r * Q, Q = H1(ID_B||hid,N) * P1 + Ppube
+	sm9_id_mul_g1(Ra, usr->Ppube, SM9_HID_EXCH, id, idlen, ra);
 	return 1;
 }
 
-int sm9_sign_master_key_extract_key(SM9_SIGN_MASTER_KEY *msk, const char *id, size_t idlen, SM9_SIGN_KEY *key)
-{
-	bn_t t,t1;
+int sm9_exchange_B1_without_check(const SM9_ENC_KEY *usr,fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf){
 
-	bn_null(t);
-	bn_new(t);
-	bn_null(t1);
-	bn_new(t1);
+	SM3_KDF_CTX kdf_ctx;
 
-	// t1 = H1(ID || hid, N) + ks
-	sm9_hash1(t, id, idlen, SM9_HID_SIGN);
-	bn_add(t, t, msk->ks);
-	//sm9_fn_add(t, t, msk->ks);
-	if (bn_is_zero(t)) {
-		// 这是一个严重问题，意味着整个msk都需要作废了
-		error_print();
-		return -1;
-	}
+	g2_t gen2;
+	g2_null(gen2);
+	g2_new(gen2);	
 
-	// t2 = ks * t1^-1
-	//sm9_fn_inv(t, t);
-	bn_read_str(t1,SM9_N,strlen(SM9_N),16);
-	bn_mod_inv(t,t,t1);
-	bn_mul(t,t,msk->ks);
+	ep_t tmp;
+	ep_null(tmp);
+	ep_new(tmp);
+
+	g2_get_gen(gen2);
+
+	bn_t r,N;
+	bn_null(r);
+	bn_new(r);
+	bn_null(N);
+	bn_new(N);
+
+	uint8_t g1buf[32 * 12];
+	uint8_t g2buf[32 * 12];
+	uint8_t g3buf[32 * 12];
+	uint8_t g1_real[32 * 12];
+	uint8_t g2_real[32 * 12];
+	uint8_t g3_real[32 * 12];
+
+	uint8_t Rbbuf[65];
+	uint8_t Rabuf[65];
 	
-	//sm9_fn_mul(t, t, msk->ks);
-	// ds = t2 * P1
-	ep_mul_gen(key->ds,t);
-	//sm9_point_mul_generator(&key->ds, t);
-	ep2_copy(key->Ppubs,msk->Ppubs);
-	//key->Ppubs = msk->Ppubs;
-	bn_free(t);
-	bn_free(t1);
+	uint8_t eighty_two[1] = {0x82};
+
+	//just for correctness test
+	char exch_rb[] = "18B98C44BEF9F8537FB7D071B2C928B3BC65BD3D69E1EEE213564905634FE";
+
+	// A2: rand r in [1, N-1]
+	bn_read_str(N,SM9_N,strlen(SM9_N),16);
+	bn_sub_dig(N,N,1);
+	do{
+		bn_rand(r,RLC_POS,256);
+	}while((bn_cmp_dig(r,1) == -1) || (bn_cmp(r,N) == 1));
+	bn_read_str(r,exch_rb,strlen(exch_rb),16);
+	// B1, B2: R = r * Q, Q = H1(ID_A||hid,N) * P1 + Ppube
+	sm9_id_mul_g1(Rb, usr->Ppube, SM9_HID_EXCH, ida, idalen, r);
+
+	ep_write_bin(Rabuf,65,Ra,0);
+	ep_write_bin(Rbbuf,65,Rb,0);
+
+	sm9_pairing_ate(g_1,usr->de,Ra);
+	fp12_pow_gls_sec(g_3,g_1,r);
+
+	//sm9_pairing_fastest(g_2,gen2,usr->Ppube);
+	//fp12_pow_t(g_2,g_2,r);
+	ep_mul(tmp,usr->Ppube,r);
+	sm9_pairing_ate(g_2,gen2,tmp);
+
+	fp12_write_bin(g1buf,32*12,g_1,0);
+	fp12_write_bin(g2buf,32*12,g_2,0);
+	fp12_write_bin(g3buf,32*12,g_3,0);
+
+	for(int i = 0;i<384;i++){
+		g1_real[(11-i/32)*32+i%32] = g1buf[i];
+		g2_real[(11-i/32)*32+i%32] = g2buf[i];
+		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	}
+
+	sm3_kdf_init(&kdf_ctx, klen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
+	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
+	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
+	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
+	sm3_kdf_finish(&kdf_ctx, kbuf);
+
+	ep_free(tmp);
+	g2_free(gen2);
+	bn_free(r);
+	bn_free(N);
+
 	return 1;
 }
 
-int sm9_do_sign_prestep1(const SM9_SIGN_KEY *key, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
-{
-	uint8_t wbuf[32 * 12];
-	SM3_CTX ctx = *sm3_ctx;
-	SM3_CTX tmp_ctx;
-	uint8_t ct1[4] = {0,0,0,1};
-	uint8_t ct2[4] = {0,0,0,2};
-	uint8_t Ha[64];
+int sm9_exchange_B1(const SM9_ENC_KEY *usr,fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t sblen,size_t sb){
 
-	sm9_bn_t r;
-	fp12_t g;
-	ep_t SM9_P1;
-	fp_null(r);
-	fp_new(r);
-	fp12_null(g);
-	fp12_new(g);
+	if( sblen < 32 ){
+		RLC_THROW(ERR_NO_BUFFER);
+		return -1;
+	}
 
-	ep_null(SM9_P1);
-	ep_new(SM9_P1);
-	
-	g1_get_gen(SM9_P1);
+	SM3_KDF_CTX kdf_ctx;
+	SM3_CTX sb_ctx;
 
-	double begin, end;
-	uint8_t bin[12 * RLC_FP_BYTES];
-	uint8_t readbin[12 * RLC_FP_BYTES];
-	// 测试pairing性能
-	// PERFORMANCE_TEST_NEW("pairing", sm9_pairing_fast(g, key->Ppubs, SM9_P1));
+	g2_t gen2;
+	g2_null(gen2);
+	g2_new(gen2);	
 
-	// A1: g = e(P1, Ppubs)
+	ep_t tmp;
+	ep_null(tmp);
+	ep_new(tmp);
 
-	sm9_pairing_fastest(g, key->Ppubs, SM9_P1);
-	fp12_write_bin(bin, sizeof(bin), g, 0);
-	//format_bytes(stdout, 0, 0, "bin written", bin, sizeof(bin));
-	FILE *fp = NULL;
-	fp = fopen("pairing_data.da","w");
-	fwrite(bin,sizeof(uint8_t),sizeof(bin),fp);
-	//fputs(bin,fp);
-	fclose(fp);
+	g2_get_gen(gen2);
 
+	bn_t r,N;
+	bn_null(r);
+	bn_new(r);
+	bn_null(N);
+	bn_new(N);
+
+	uint8_t g1buf[32 * 12];
+	uint8_t g2buf[32 * 12];
+	uint8_t g3buf[32 * 12];
+	uint8_t g1_real[32 * 12];
+	uint8_t g2_real[32 * 12];
+	uint8_t g3_real[32 * 12];
+
+	uint8_t Rbbuf[65];
+	uint8_t Rabuf[65];
 	
-	
-	//fp12_read_bin(b, bin, sizeof(bin));	
-	gmssl_secure_clear(&r, sizeof(r));
-	gmssl_secure_clear(&g, sizeof(g));
-	gmssl_secure_clear(wbuf, sizeof(wbuf));
-	gmssl_secure_clear(&tmp_ctx, sizeof(tmp_ctx));
-	gmssl_secure_clear(Ha, sizeof(Ha));
+	uint8_t eighty_two[1] = {0x82};
 
-	return 1;
-}
+	//just for correctness test
+	char exch_rb[] = "18B98C44BEF9F8537FB7D071B2C928B3BC65BD3D69E1EEE213564905634FE";
 
-int sm9_do_sign_prestep2(const SM9_SIGN_KEY *key, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
-{
-	uint8_t wbuf[32 * 12];
-	SM3_CTX ctx = *sm3_ctx;
-	SM3_CTX tmp_ctx;
-	uint8_t ct1[4] = {0,0,0,1};
-	uint8_t ct2[4] = {0,0,0,2};
-	uint8_t Ha[64];
+	// A2: rand r in [1, N-1]
+	bn_read_str(N,SM9_N,strlen(SM9_N),16);
+	bn_sub_dig(N,N,1);
+	do{
+		bn_rand(r,RLC_POS,256);
+	}while((bn_cmp_dig(r,1) == -1) || (bn_cmp(r,N) == 1));
+	bn_read_str(r,exch_rb,strlen(exch_rb),16);
+	// B1, B2: R = r * Q, Q = H1(ID_A||hid,N) * P1 + Ppube
+	sm9_id_mul_g1(Rb, usr->Ppube, SM9_HID_EXCH, ida, idalen, r);
 
-	
-	sm9_bn_t r;
-	fp12_t g;
-	ep_t SM9_P1;
-	fp_null(r);
-	fp_new(r);
-	fp12_null(g);
-	fp12_new(g);
+	ep_write_bin(Rabuf,65,Ra,0);
+	ep_write_bin(Rbbuf,65,Rb,0);
 
-	
-	double begin, end;
-	
-	// 测试pairing性能
-	// PERFORMANCE_TEST_NEW("pairing", sm9_pairing_fast(g, key->Ppubs, SM9_P1));
+	sm9_pairing_ate(g_1,usr->de,Ra);
+	fp12_pow_gls_sec(g_3,g_1,r);
 
-	// A1: g = e(P1, Ppubs)
-	//sm9_pairing_fastest(g, key->Ppubs, SM9_P1);
-	uint8_t bin2[12 * RLC_FP_BYTES];
-	FILE *fp = NULL;
-	
-	
-	fp = fopen("pairing_data.da","r");
-	//fscanf(fp,"%c",bin2);
-	fread(bin2,sizeof(uint8_t),sizeof(bin2),fp);
-	//format_bytes(stdout, 0, 0, "bin read", bin2, sizeof(bin2));
-	fclose(fp);
-	fp12_read_bin(g, bin2, sizeof(bin2));	
-//printf("??\n");
+	//sm9_pairing_fastest(g_2,gen2,usr->Ppube);
+	//fp12_pow_t(g_2,g_2,r);
+	ep_mul(tmp,usr->Ppube,r);
+	sm9_pairing_ate(g_2,gen2,tmp);
 
-	do {
-		// A2: rand r in [1, N-1]
-		// if (fp_rand(r) != 1) {
-		// 	error_print();
-		// 	return -1;
-		// }
-		fp_rand(r);
+	fp12_write_bin(g1buf,32*12,g_1,0);
+	fp12_write_bin(g2buf,32*12,g_2,0);
+	fp12_write_bin(g3buf,32*12,g_3,0);
 
-		// 测试使用
-		// sm9_fn_from_hex(r, "00033C8616B06704813203DFD00965022ED15975C662337AED648835DC4B1CBE"); // for testing
+	for(int i = 0;i<384;i++){
+		g1_real[(11-i/32)*32+i%32] = g1buf[i];
+		g2_real[(11-i/32)*32+i%32] = g2buf[i];
+		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	}
 
-		// A3: w = g^r
-		fp12_pow(g, g, r);
-		fp12_write_bin(wbuf, 32*12, g, 0);  // pack表示是否压缩
+	sm3_kdf_init(&kdf_ctx, klen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
+	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
+	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
+	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
+	sm3_kdf_finish(&kdf_ctx, kbuf);
 
-		// A4: h = H2(M || w, N)
-		// hlen = 8*(5*bitlen(N)/32) = 8*40，8*40表示的是比特长度，也就是40字节
-		sm3_update(&ctx, wbuf, sizeof(wbuf));  // 02||w
-		tmp_ctx = ctx;
-		sm3_update(&ctx, ct1, sizeof(ct1));  // 02||w||1
-		sm3_finish(&ctx, Ha);                // Ha1
-		sm3_update(&tmp_ctx, ct2, sizeof(ct2));  // 02||w||2
-		sm3_finish(&tmp_ctx, Ha + 32);           // Ha2
-		sm9_fn_from_hash(sig->h, Ha);  // 这里的参数Ha是大小为40的uint8_t数组, sig->h = (Ha mod (n-1)) + 1;
-																																							
-		// A5: l = (r - h) mod N, if l = 0, goto A2
-		fp_sub(r, r, sig->h);
-		// sm9_fn_sub(r, r, sig->h);
-	} while (fp_is_zero(r));  // 如果r为0，返回到A2执行
-	// } while (sm9_fn_is_zero(r));  // 如果r为0，返回到A2执行
+	sm3_init(&sb_ctx);
+    sm3_update(&sb_ctx, g2_real,sizeof(g2_real));
+	sm3_update(&sb_ctx, g3_real,sizeof(g3_real));
+	sm3_update(&sb_ctx, (uint8_t *)ida, idalen);
+	sm3_update(&sb_ctx, (uint8_t *)idb, idblen);
+	sm3_update(&sb_ctx, Rabuf + 1, 64);
+	sm3_update(&sb_ctx, Rbbuf + 1, 64);
+	sm3_finish(&sb_ctx, sb);
 
-	// A6: S = l * dsA
-	ep_mul(sig->S, r, key->ds);
-	// sm9_point_mul(&sig->S, r, &key->ds);
+	sm3_init(&sb_ctx);
+	sm3_update(&sb_ctx, eighty_two,sizeof(eighty_two));
+	sm3_update(&sb_ctx, g1_real,sizeof(g1_real));
+	sm3_update(&sb_ctx, sb,sblen);
+	sm3_finish(&sb_ctx, sb);
 
-	gmssl_secure_clear(&r, sizeof(r));
-	gmssl_secure_clear(&g, sizeof(g));
-	gmssl_secure_clear(wbuf, sizeof(wbuf));
-	gmssl_secure_clear(&tmp_ctx, sizeof(tmp_ctx));
-	gmssl_secure_clear(Ha, sizeof(Ha));
+	ep_free(tmp);
+	g2_free(gen2);
+	bn_free(r);
+	bn_free(N);
 
 	return 1;
 }
 
-//enc
-int sm9_ciphertext_to_der(const ep_t C1, const uint8_t *c2, size_t c2len,
-	const uint8_t c3[SM3_HMAC_SIZE], uint8_t **out, size_t *outlen)
-{
-	int en_type = SM9_ENC_TYPE_XOR;
-	uint8_t c1[65];
-	size_t len = 0;
+int sm9_exchange_A2_without_check(const SM9_ENC_KEY *usr,ep_t Ra,ep_t Rb,bn_t ra,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf){
 
-	ep_write_bin(c1,65,C1,0);
-	//sm9_point_to_uncompressed_octets(C1, c1);
+	SM3_KDF_CTX kdf_ctx;
 
-	if (asn1_int_to_der(en_type, NULL, &len) != 1
-		|| asn1_bit_octets_to_der(c1, sizeof(c1), NULL, &len) != 1
-		|| asn1_octet_string_to_der(c3, SM3_HMAC_SIZE, NULL, &len) != 1
-		|| asn1_octet_string_to_der(c2, c2len, NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| asn1_int_to_der(en_type, out, outlen) != 1
-		|| asn1_bit_octets_to_der(c1, sizeof(c1), out, outlen) != 1
-		|| asn1_octet_string_to_der(c3, SM3_HMAC_SIZE, out, outlen) != 1
-		|| asn1_octet_string_to_der(c2, c2len, out, outlen) != 1) {
-		error_print();
-		return -1;
-	}
-	return 1;
-}
+	fp12_t g_1;
+	fp12_null(g_1);
+	fp12_new(g_1);
+	fp12_t g_3;
+	fp12_null(g_3);
+	fp12_new(g_3);
+	fp12_t g_2;
+	fp12_null(g_2);
+	fp12_new(g_2);
 
-//dec
-int sm9_ciphertext_from_der(ep_t C1, const uint8_t **c2, size_t *c2len,
-	const uint8_t **c3, const uint8_t **in, size_t *inlen)
-{
-	int ret;
-	const uint8_t *d;
-	size_t dlen;
-	int en_type;
-	const uint8_t *c1;
-	size_t c1len;
-	size_t c3len;
+	g2_t gen2;
+	g2_null(gen2);
+	g2_new(gen2);	
+	g2_get_gen(gen2);
 
-	if ((ret = asn1_sequence_from_der(&d, &dlen, in, inlen)) != 1) {
-		if (ret < 0) error_print();
-		return ret;
-	}
-	if (asn1_int_from_der(&en_type, &d, &dlen) != 1
-		|| asn1_bit_octets_from_der(&c1, &c1len, &d, &dlen) != 1
-		|| asn1_octet_string_from_der(c3, &c3len, &d, &dlen) != 1
-		|| asn1_octet_string_from_der(c2, c2len, &d, &dlen) != 1
-		|| asn1_length_is_zero(dlen) != 1) {
-		error_print();
-		return -1;
-	}
-	if (en_type != SM9_ENC_TYPE_XOR) {
-		error_print();
-		return -1;
-	}
-	if (c1len != 65) {
-		error_print();
-		return -1;
-	}
-	if (c3len != SM3_HMAC_SIZE) {
-		error_print();
-		return -1;
-	}
-	ep_read_bin(C1,c1,65);
-	return 1;
-}
+	ep_t tmp;
+	ep_null(tmp);
+	ep_new(tmp);
 
-//sign
-int sm9_signature_to_der(const SM9_SIGNATURE *sig, uint8_t **out, size_t *outlen)
-{
-	
-	uint8_t hbuf[32];
-	uint8_t Sbuf[65];
-	size_t len = 0;
+	uint8_t g1buf[32 * 12];
+	uint8_t g2buf[32 * 12];
+	uint8_t g3buf[32 * 12];
+	uint8_t g1_real[32 * 12];
+	uint8_t g2_real[32 * 12];
+	uint8_t g3_real[32 * 12];
+	uint8_t Rbbuf[65];
+	uint8_t Rabuf[65];
+	uint8_t dgst[32];
 
-	// sm9_fn_to_bytes(sig->h, hbuf);
-	bn_write_bin(hbuf, 32, sig->h);
-	//sm9_point_to_uncompressed_octets(&sig->S, Sbuf);
-	ep_write_bin(Sbuf,65,sig->S,0);
+	//sm9_pairing_fastest(g_1,gen2,usr->Ppube);
+	//fp12_pow_t(g_1,g_1,ra);
+	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_1,gen2,usr->Ppube);fp12_pow_t(g_1,g_1,ra));
+	//PERFORMANCE_TEST_NEW("e^r faster",ep_mul(tmp,usr->Ppube,ra);sm9_pairing_fastest(g_1,gen2,tmp));
+	ep_mul(tmp,usr->Ppube,ra);
+	sm9_pairing_ate(g_1,gen2,tmp);
 
-	if (asn1_octet_string_to_der(hbuf, sizeof(hbuf), NULL, &len) != 1
-		|| asn1_bit_octets_to_der(Sbuf, sizeof(Sbuf), NULL, &len) != 1
-		|| asn1_sequence_header_to_der(len, out, outlen) != 1
-		|| asn1_octet_string_to_der(hbuf, sizeof(hbuf), out, outlen) != 1
-		|| asn1_bit_octets_to_der(Sbuf, sizeof(Sbuf), out, outlen) != 1) {
-		error_print();
-		return -1;
-	}
+	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_2,usr->de,Rb);fp12_pow_t(g_3,g_2,ra));
+	sm9_pairing_ate(g_2,usr->de,Rb);
+	fp12_pow_gls_sec(g_3,g_2,ra);
+	//PERFORMANCE_TEST_NEW("e^r low",sm9_pairing_fastest(g_2,usr->de,Rb);ep_mul(tmp,Rb,ra);sm9_pairing_fastest(g_3,usr->de,tmp));
+	
+	fp12_write_bin(g1buf,32*12,g_1,0);
+	fp12_write_bin(g2buf,32*12,g_2,0);
+	fp12_write_bin(g3buf,32*12,g_3,0);
 
-	return 1;
-}
+	for(int i = 0;i<384;i++){
+		g1_real[(11-i/32)*32+i%32] = g1buf[i];
+		g2_real[(11-i/32)*32+i%32] = g2buf[i];
+		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	}
 
-//verify
-int sm9_signature_from_der(SM9_SIGNATURE *sig, const uint8_t **in, size_t *inlen)
-{
-	int ret;
-	const uint8_t *d;
-	size_t dlen;
-	const uint8_t *h;
-	size_t hlen;
-	const uint8_t *S;
-	size_t Slen;
+	ep_write_bin(Rabuf,65,Ra,0);
+	ep_write_bin(Rbbuf,65,Rb,0);
 
-	if ((ret = asn1_sequence_from_der(&d, &dlen, in, inlen)) != 1) {
-		if (ret < 0) error_print();
-		return ret;
-	}
-	if (asn1_octet_string_from_der(&h, &hlen, &d, &dlen) != 1
-		|| asn1_bit_octets_from_der(&S, &Slen, &d, &dlen) != 1
-		|| asn1_check(hlen == 32) != 1
-		|| asn1_check(Slen == 65) != 1
-		|| asn1_length_is_zero(dlen) != 1) {
-		error_print();
-		return -1;
-	}
-	bn_read_bin(sig->h,h,hlen);
-	ep_read_bin(sig->S,S,Slen);
+	sm3_kdf_init(&kdf_ctx, klen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
+	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
+	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
+	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
+	sm3_kdf_finish(&kdf_ctx, kbuf);
+	printf("session key is\n");
+	print_bytes(kbuf,klen);
 
+	fp12_free(g_1);
+	fp12_free(g_2);
+	fp12_free(g_3);
+	g2_free(gen2);
+	ep_free(tmp);
 	return 1;
+
 }
 
-int sm9_kem_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
-	size_t klen, uint8_t *kbuf, ep_t C)
-{	
-	bn_t r,N;
-	fp12_t w;
-	bn_null(r);
-	bn_new(r);
-	bn_null(N);
-	bn_new(N);
-	fp12_null(w);
-	fp12_new(w);
+int sm9_exchange_A2(const SM9_ENC_KEY *usr,ep_t Ra,ep_t Rb,bn_t ra,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t salen,uint8_t *sa,size_t datalen,uint8_t *data){
 
-	ep2_t SM9_P2;
-	ep2_null(SM9_P2);
-	ep2_new(SM9_P2);
-	g2_get_gen(SM9_P2);
+	if(salen < 32 || datalen < 32){
+		RLC_THROW(ERR_NO_BUFFER);
+		return -1;
+	}
 
-	bn_read_str(N,SM9_N,strlen(SM9_N),16);
-	bn_sub_dig(N,N,1);
-	uint8_t wbuf[32 * 12];
-	uint8_t fubw[32 * 12];
-	uint8_t cbuf[65];
 	SM3_KDF_CTX kdf_ctx;
+	SM3_CTX sa_ctx;
 
-	// A1: Q = H1(ID||hid,N) * P1 + Ppube
-	sm9_hash1(r, id, idlen, SM9_HID_ENC);
-	ep_mul_gen(C,r);
-	ep_add(C,C,mpk->Ppube);
-	//just for correctness test
-	char kem_r[] = "74015F8489C01EF4270456F9E6475BFB602BDE7F33FD482AB4E3684A6722";
-	char enc_r[] = "AAC0541779C8FC45E3E2CB25C12B5D2576B2129AE8BB5EE2CBE5EC9E785C";
-	
-	do {
-		// A2: rand r in [1, N-1]
-		do{
-			bn_rand(r,RLC_POS,256);
-		}while((bn_cmp_dig(r,1) == -1) || (bn_cmp(r,N) == 1));
-		
-		bn_read_str(r,kem_r,strlen(kem_r),16);
-		// A3: C1 = r * Q
-		ep_mul(C,C,r);
+	fp12_t g_1;
+	fp12_null(g_1);
+	fp12_new(g_1);
+	fp12_t g_3;
+	fp12_null(g_3);
+	fp12_new(g_3);
+	fp12_t g_2;
+	fp12_null(g_2);
+	fp12_new(g_2);
 
-		ep_write_bin(cbuf,65,C,0);
-		//sm9_point_to_uncompressed_octets(C, cbuf);
+	g2_t gen2;
+	g2_null(gen2);
+	g2_new(gen2);	
+	g2_get_gen(gen2);
 
-		// A4: g = e(Ppube, P2)
-		sm9_pairing_fastest(w,SM9_P2,mpk->Ppube);
+	ep_t tmp;
+	ep_null(tmp);
+	ep_new(tmp);
 
-		// A5: w = g^r
-		fp12_pow_t(w, w, r);
-		fp12_write_bin(wbuf,32*12,w,0);
-		for(int i = 0;i<384;i++){
-			fubw[(11-i/32)*32+i%32] = wbuf[i];
-		}
-		// A6: K = KDF(C || w || ID_B, klen), if K == 0, goto A2
-		sm3_kdf_init(&kdf_ctx, klen);
-		sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
-		sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
-		sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
-		sm3_kdf_finish(&kdf_ctx, kbuf);
+	uint8_t g1buf[32 * 12];
+	uint8_t g2buf[32 * 12];
+	uint8_t g3buf[32 * 12];
+	uint8_t g1_real[32 * 12];
+	uint8_t g2_real[32 * 12];
+	uint8_t g3_real[32 * 12];
+	uint8_t Rbbuf[65];
+	uint8_t Rabuf[65];
+	uint8_t dgst[32];
 
-	} while (mem_is_zero(kbuf, klen) == 1);
+	uint8_t eighty_two_and_three[2] = {0x82,0x83};
 
-	bn_free(r);
-	fp12_free(w);
-	ep2_free(SM9_P2);
-	gmssl_secure_clear(wbuf, sizeof(wbuf));
-	gmssl_secure_clear(fubw, sizeof(fubw));
-	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
+	//sm9_pairing_fastest(g_1,gen2,usr->Ppube);
+	//fp12_pow_t(g_1,g_1,ra);
+	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_1,gen2,usr->Ppube);fp12_pow_t(g_1,g_1,ra));
+	//PERFORMANCE_TEST_NEW("e^r faster",ep_mul(tmp,usr->Ppube,ra);sm9_pairing_fastest(g_1,gen2,tmp));
+	ep_mul(tmp,usr->Ppube,ra);
+	sm9_pairing_ate(g_1,gen2,tmp);
 
-	//when using kem, klen = klen - datalen(20)
+	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_2,usr->de,Rb);fp12_pow_t(g_3,g_2,ra));
+	sm9_pairing_ate(g_2,usr->de,Rb);
+	fp12_pow_gls_sec(g_3,g_2,ra);
+	//PERFORMANCE_TEST_NEW("e^r low",sm9_pairing_fastest(g_2,usr->de,Rb);ep_mul(tmp,Rb,ra);sm9_pairing_fastest(g_3,usr->de,tmp));
+	
+	fp12_write_bin(g1buf,32*12,g_1,0);
+	fp12_write_bin(g2buf,32*12,g_2,0);
+	fp12_write_bin(g3buf,32*12,g_3,0);
 
-	// A7: output (K, C)
-	return 1;
-}
+	for(int i = 0;i<384;i++){
+		g1_real[(11-i/32)*32+i%32] = g1buf[i];
+		g2_real[(11-i/32)*32+i%32] = g2buf[i];
+		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	}
 
-int sm9_kem_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen, const ep_t C,
-	size_t klen, uint8_t *kbuf)
-{
-	fp12_t w;
-	fp12_null(w);
-	fp12_new(w);
-	uint8_t wbuf[32 * 12];
-	uint8_t fubw[32 * 12];
-	uint8_t cbuf[65];
-	SM3_KDF_CTX kdf_ctx;
+	ep_write_bin(Rabuf,65,Ra,0);
+	ep_write_bin(Rbbuf,65,Rb,0);
 
-	// B1: check C in G1
+	sm3_init(&sa_ctx);
+    sm3_update(&sa_ctx, g2_real,sizeof(g2_real));
+	sm3_update(&sa_ctx, g3_real,sizeof(g3_real));
+	sm3_update(&sa_ctx, (uint8_t *)ida, idalen);
+	sm3_update(&sa_ctx, (uint8_t *)idb, idblen);
+	sm3_update(&sa_ctx, Rabuf + 1, 64);
+	sm3_update(&sa_ctx, Rbbuf + 1, 64);
+	sm3_finish(&sa_ctx, dgst);
 
-	ep_write_bin(cbuf,65,C,0);
-	//sm9_point_to_uncompressed_octets(C, cbuf);
+	sm3_init(&sa_ctx);
+	sm3_update(&sa_ctx, eighty_two_and_three+1,sizeof(eighty_two_and_three)/2);
+	sm3_update(&sa_ctx, g1_real,sizeof(g1_real));
+	sm3_update(&sa_ctx, dgst,sizeof(dgst));
+	sm3_finish(&sa_ctx, sa);
 
-	// B2: w = e(C, de);
+	sm3_init(&sa_ctx);
+	sm3_update(&sa_ctx, eighty_two_and_three,sizeof(eighty_two_and_three)/2);
+	sm3_update(&sa_ctx, g1_real,sizeof(g1_real));
+	sm3_update(&sa_ctx, dgst,sizeof(dgst));
+	sm3_finish(&sa_ctx, dgst);
 
-	sm9_pairing_fastest(w, key->de, C);
-	fp12_write_bin(wbuf, 32*12, w, 0);  // pack表示是否压缩
-	// A4: h = H2(M || w, N)
-	// hlen = 8*(5*bitlen(N)/32) = 8*40，8*40表示的是比特长度，也就是40字节
-	for(int i = 0;i<384;i++){
-		fubw[(11-i/32)*32+i%32] = wbuf[i];
+	if(memcmp(dgst,data,32) != 0){
+		printf("ERROR:key exchange fail!\n");
+		return -1;
 	}
 
-	// B3: K = KDF(C || w || ID, klen)
 	sm3_kdf_init(&kdf_ctx, klen);
-	sm3_kdf_update(&kdf_ctx, cbuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, fubw, sizeof(fubw));
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)id, idlen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
+	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
+	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
+	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
+	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
+	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
 	sm3_kdf_finish(&kdf_ctx, kbuf);
+	//printf("session key is:\n");
+	//print_bytes(kbuf,klen);
 
-	if (mem_is_zero(kbuf, klen)) {
-		error_print();
+	fp12_free(g_1);
+	fp12_free(g_2);
+	fp12_free(g_3);
+	g2_free(gen2);
+	ep_free(tmp);
+	return 1;
+}
+
+int sm9_exchange_B2(fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t datalen,uint8_t *data){
+	if( datalen < 32 ){
+		RLC_THROW(ERR_NO_BUFFER);
 		return -1;
 	}
-	fp12_free(w);
-	gmssl_secure_clear(wbuf, sizeof(wbuf));
-	gmssl_secure_clear(fubw, sizeof(fubw));
-	gmssl_secure_clear(&kdf_ctx, sizeof(kdf_ctx));
+	SM3_CTX sb_ctx;
 
-	// B4: output K
-	return 1;
-}
-//aa
+	uint8_t Rbbuf[65];
+	uint8_t Rabuf[65];
+	uint8_t g1buf[32 * 12];
+	uint8_t g2buf[32 * 12];
+	uint8_t g3buf[32 * 12];
+	uint8_t g1_real[32 * 12];
+	uint8_t g2_real[32 * 12];
+	uint8_t g3_real[32 * 12];
+	uint8_t dgst[32];
+	uint8_t eighty_three[1] = {0x83};
 
-int sm9_do_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
-	const uint8_t *in, size_t inlen,
-	ep_t C1, uint8_t *c2, uint8_t c3[SM3_HMAC_SIZE])
-{
-	SM3_HMAC_CTX hmac_ctx;
-	uint8_t K[inlen + 32];
 
-	if (sm9_kem_encrypt(mpk, id, idlen, sizeof(K), K, C1) != 1) {
-		error_print();
-		return -1;
+	ep_write_bin(Rabuf,65,Ra,0);
+	ep_write_bin(Rbbuf,65,Rb,0);
+
+	fp12_write_bin(g1buf,32*12,g_1,0);
+	fp12_write_bin(g2buf,32*12,g_2,0);
+	fp12_write_bin(g3buf,32*12,g_3,0);
+
+	for(int i = 0;i<384;i++){
+		g1_real[(11-i/32)*32+i%32] = g1buf[i];
+		g2_real[(11-i/32)*32+i%32] = g2buf[i];
+		g3_real[(11-i/32)*32+i%32] = g3buf[i];
 	}
-	gmssl_memxor(c2, K, in, inlen);
 
-	//sm3_hmac(K + inlen, 32, c2, inlen, c3);
-	sm3_hmac_init(&hmac_ctx, K + inlen, SM3_HMAC_SIZE);
-	sm3_hmac_update(&hmac_ctx, c2, inlen);
-	sm3_hmac_finish(&hmac_ctx, c3);
-	gmssl_secure_clear(&hmac_ctx, sizeof(hmac_ctx));
-	return 1;
+	sm3_init(&sb_ctx);
+    sm3_update(&sb_ctx, g2_real,sizeof(g2_real));
+	sm3_update(&sb_ctx, g3_real,sizeof(g3_real));
+	sm3_update(&sb_ctx, (uint8_t *)ida, idalen);
+	sm3_update(&sb_ctx, (uint8_t *)idb, idblen);
+	sm3_update(&sb_ctx, Rabuf + 1, 64);
+	sm3_update(&sb_ctx, Rbbuf + 1, 64);
+	sm3_finish(&sb_ctx, dgst);
+	sm3_init(&sb_ctx);
+	sm3_update(&sb_ctx, eighty_three,sizeof(eighty_three));
+	sm3_update(&sb_ctx, g1_real,sizeof(g1_real));
+	sm3_update(&sb_ctx, dgst,sizeof(dgst));
+	sm3_finish(&sb_ctx, dgst);
 
+	if(memcmp(dgst,data,32) != 0){
+		printf("ERROR:key exchange fail!\n");
+		return -1;
+	}
+	else{
+		//printf("key exchange sussess!\n");
+	}
+	return 1;
 }
 
-int sm9_do_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen,
-	const ep_t C1, const uint8_t *c2, size_t c2len, const uint8_t c3[SM3_HMAC_SIZE],
-	uint8_t *out)
+int sm9_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
+	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
 {
-	SM3_HMAC_CTX hmac_ctx;
-	uint8_t k[SM9_MAX_PLAINTEXT_SIZE + SM3_HMAC_SIZE];
-	uint8_t mac[SM3_HMAC_SIZE];
+	ep_t C1;
+	ep_null(C1);
+	ep_new(C1);
+	uint8_t c2[inlen];
+	uint8_t c3[SM3_HMAC_SIZE];
 
-	if (c2len > SM9_MAX_PLAINTEXT_SIZE) {
+	if (sm9_do_encrypt(mpk, id, idlen, in, inlen, C1, c2, c3) != 1) {
+		error_print();
+		return -1;
+	}
+	*outlen = 0;
+	if (sm9_ciphertext_to_der(C1, c2, inlen, c3, &out, outlen) != 1) { // FIXME: when out == NULL	
 		error_print();
 		return -1;
 	}
+	ep_free(C1);
+	return 1;
+}
 
-	if (sm9_kem_decrypt(key, id, idlen, C1, sizeof(k), k) != 1) {
+int sm9_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen,
+	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	ep_t C1;
+	ep_null(C1);
+	ep_new(C1);
+	const uint8_t *c2;
+	size_t c2len;
+	const uint8_t *c3;
+
+	if (sm9_ciphertext_from_der(C1, &c2, &c2len, &c3, &in, &inlen) != 1
+		|| asn1_length_is_zero(inlen) != 1) {
 		error_print();
 		return -1;
 	}
-	//sm3_hmac(k + c2len, SM3_HMAC_SIZE, c2, c2len, mac);
-	sm3_hmac_init(&hmac_ctx, k + c2len, SM3_HMAC_SIZE);
-	sm3_hmac_update(&hmac_ctx, c2, c2len);
-	sm3_hmac_finish(&hmac_ctx, mac);
-	gmssl_secure_clear(&hmac_ctx, sizeof(hmac_ctx));
 
-	if (gmssl_secure_memcmp(c3, mac, sizeof(mac)) != 0) {
+	*outlen = c2len;
+	if (!out) {
+		return 1;
+	}
+	if (sm9_do_decrypt(key, id, idlen, C1, c2, c2len, c3, out) != 1) {
 		error_print();
 		return -1;
 	}
-	gmssl_memxor(out, k, c2, c2len);
+	ep_free(C1);
 	return 1;
 }
 
-int sm9_exchange_A1(const SM9_ENC_KEY *usr, const char *id, size_t idlen,ep_t Ra,bn_t ra){
-	
-	bn_t N;
-	bn_null(N);
-	bn_new(N);
-
-	sm9_hash1(ra, id, idlen, SM9_HID_EXCH);
-	ep_mul_gen(Ra,ra);
-	ep_add(Ra,Ra,usr->Ppube);
-	//just for correctness test
-	char exch_ra[] = "5879DD1D51E175946F23B1B41E93BA31C584AE59A426EC1046A4D03B06C8";
+// 流式混合加密: 用 sm9_kem_encrypt 封装 K = K1 || K2, C2 = SM4(K1, M), C3 = HMAC(K2, enc_type || C1 || C2)
+#define SM9_ENC_KLEN	(SM4_KEY_SIZE + SM3_HMAC_SIZE)
 
-	// A2: rand r in [1, N-1]
-	bn_read_str(N,SM9_N,strlen(SM9_N),16);
-	bn_sub_dig(N,N,1);
-	do{
-		bn_rand(ra,RLC_POS,256);
-	}while((bn_cmp_dig(ra,1) == -1) || (bn_cmp(ra,N) == 1));
-	bn_read_str(ra,exch_ra,strlen(exch_ra),16);
-	// A3: R = r * Q
-	ep_mul(Ra,Ra,ra);
+// header 是 enc_type || C1, 各模式的 K 一样长, 不把 enc_type 算进 C3 就能改模式而不被发现
+static int sm9_enc_ctx_set_key(SM9_ENC_CTX *ctx, int enc, const uint8_t K[SM9_ENC_KLEN],
+	const uint8_t header[SM9_ENC_HEADER_SIZE])
+{
+	int enc_type = header[0];
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->enc_type = enc_type;
+	switch (enc_type) {
+	case SM9_ENC_TYPE_ECB:
+	case SM9_ENC_TYPE_CBC:
+		if (enc) {
+			sm4_set_encrypt_key(&ctx->sm4_key, K);
+		} else {
+			sm4_set_decrypt_key(&ctx->sm4_key, K);
+		}
+		break;
+	case SM9_ENC_TYPE_OFB:
+	case SM9_ENC_TYPE_CFB:
+		// OFB 和 CFB 两个方向都只用加密
+		sm4_set_encrypt_key(&ctx->sm4_key, K);
+		break;
+	default:
+		error_print();
+		return -1;
+	}
+	// K1 每条消息都是新的, IV 取全零
+	sm3_hmac_init(&ctx->hmac_ctx, K + SM4_KEY_SIZE, SM3_HMAC_SIZE);
+	sm3_hmac_update(&ctx->hmac_ctx, header, SM9_ENC_HEADER_SIZE);
 	return 1;
 }
 
-int sm9_exchange_B1_without_check(const SM9_ENC_KEY *usr,fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf){
-
-	SM3_KDF_CTX kdf_ctx;
-
-	g2_t gen2;
-	g2_null(gen2);
-	g2_new(gen2);	
-
-	ep_t tmp;
-	ep_null(tmp);
-	ep_new(tmp);
-
-	g2_get_gen(gen2);
+// ECB/CBC 的 nblocks 个整块
+static void sm9_enc_ctx_blocks(SM9_ENC_CTX *ctx, int enc, const uint8_t *in, size_t nblocks, uint8_t *out)
+{
+	if (ctx->enc_type == SM9_ENC_TYPE_ECB) {
+		sm4_encrypt_blocks(&ctx->sm4_key, in, nblocks, out);
+	} else if (enc) {
+		sm4_cbc_encrypt(&ctx->sm4_key, ctx->iv, in, nblocks, out);
+	} else {
+		sm4_cbc_decrypt(&ctx->sm4_key, ctx->iv, in, nblocks, out);
+	}
+}
 
-	bn_t r,N;
-	bn_null(r);
-	bn_new(r);
-	bn_null(N);
-	bn_new(N);
+// OFB/CFB 按字节处理, block 是当前的密钥流块, num 是其中已用的字节数
+static void sm9_enc_ctx_xor(SM9_ENC_CTX *ctx, int enc, const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t c;
+
+	while (inlen-- > 0) {
+		if (ctx->num == 0) {
+			if (ctx->enc_type == SM9_ENC_TYPE_OFB) {
+				sm4_encrypt(&ctx->sm4_key, ctx->iv, ctx->iv);
+				memcpy(ctx->block, ctx->iv, SM4_BLOCK_SIZE);
+			} else {
+				sm4_encrypt(&ctx->sm4_key, ctx->iv, ctx->block);
+			}
+		}
+		c = *in ^ ctx->block[ctx->num];
+		if (ctx->enc_type == SM9_ENC_TYPE_CFB) {
+			ctx->iv[ctx->num] = (enc ? c : *in);
+		}
+		*out++ = c;
+		in++;
+		ctx->num = (ctx->num + 1) % SM4_BLOCK_SIZE;
+	}
+}
 
-	uint8_t g1buf[32 * 12];
-	uint8_t g2buf[32 * 12];
-	uint8_t g3buf[32 * 12];
-	uint8_t g1_real[32 * 12];
-	uint8_t g2_real[32 * 12];
-	uint8_t g3_real[32 * 12];
+int sm9_encrypt_init(SM9_ENC_CTX *ctx, const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
+	int enc_type, uint8_t *out, size_t *outlen)
+{
+	uint8_t K[SM9_ENC_KLEN];
+	ep_t C1;
+	int ret = -1;
 
-	uint8_t Rbbuf[65];
-	uint8_t Rabuf[65];
-	
-	uint8_t eighty_two[1] = {0x82};
+	ep_null(C1);
+	ep_new(C1);
 
-	sm9_hash1(r, ida, idalen, SM9_HID_EXCH);
-	ep_mul_gen(Rb,r);
-	ep_add(Rb,Rb,usr->Ppube);
-	//just for correctness test
-	char exch_rb[] = "18B98C44BEF9F8537FB7D071B2C928B3BC65BD3D69E1EEE213564905634FE";
+	if (enc_type == SM9_ENC_TYPE_XOR) {
+		// XOR 的密钥流与消息一样长, K2 要在消息结束后才能确定, 不能流式处理
+		error_print();
+		goto end;
+	}
+	if (sm9_kem_encrypt(mpk, id, idlen, sizeof(K), K, C1) != 1) {
+		error_print();
+		goto end;
+	}
+	out[0] = (uint8_t)enc_type;
+	ep_write_bin(out + 1, 65, C1, 0);
+	if (sm9_enc_ctx_set_key(ctx, 1, K, out) != 1) {
+		error_print();
+		goto end;
+	}
+	*outlen = SM9_ENC_HEADER_SIZE;
+	ret = 1;
+end:
+	gmssl_secure_clear(K, sizeof(K));
+	ep_free(C1);
+	return ret;
+}
 
-	// A2: rand r in [1, N-1]
-	bn_read_str(N,SM9_N,strlen(SM9_N),16);
-	bn_sub_dig(N,N,1);
-	do{
-		bn_rand(r,RLC_POS,256);
-	}while((bn_cmp_dig(r,1) == -1) || (bn_cmp(r,N) == 1));
-	bn_read_str(r,exch_rb,strlen(exch_rb),16);
-	// A3: R = r * Q
-	ep_mul(Rb,Rb,r);
+int sm9_encrypt_update(SM9_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	uint8_t *p = out;
+	size_t n;
 
-	ep_write_bin(Rabuf,65,Ra,0);
-	ep_write_bin(Rbbuf,65,Rb,0);
+	if (ctx->enc_type == SM9_ENC_TYPE_OFB || ctx->enc_type == SM9_ENC_TYPE_CFB) {
+		sm9_enc_ctx_xor(ctx, 1, in, inlen, p);
+		p += inlen;
+	} else {
+		// 先补满上次剩下的不完整块
+		if (ctx->num > 0) {
+			n = RLC_MIN(SM4_BLOCK_SIZE - ctx->num, inlen);
+			memcpy(ctx->block + ctx->num, in, n);
+			ctx->num += n;
+			in += n;
+			inlen -= n;
+			if (ctx->num == SM4_BLOCK_SIZE) {
+				sm9_enc_ctx_blocks(ctx, 1, ctx->block, 1, p);
+				p += SM4_BLOCK_SIZE;
+				ctx->num = 0;
+			}
+		}
+		n = inlen / SM4_BLOCK_SIZE;
+		sm9_enc_ctx_blocks(ctx, 1, in, n, p);
+		p += n * SM4_BLOCK_SIZE;
+		in += n * SM4_BLOCK_SIZE;
+		inlen -= n * SM4_BLOCK_SIZE;
+		if (inlen > 0) {
+			memcpy(ctx->block, in, inlen);
+			ctx->num = inlen;
+		}
+	}
+	sm3_hmac_update(&ctx->hmac_ctx, out, p - out);
+	*outlen = p - out;
+	return 1;
+}
 
-	sm9_pairing_fastest(g_1,usr->de,Ra);
-	fp12_pow_t(g_3,g_1,r);
+int sm9_encrypt_finish(SM9_ENC_CTX *ctx, uint8_t *out, size_t *outlen)
+{
+	uint8_t *p = out;
+	size_t pad;
+
+	if (ctx->enc_type == SM9_ENC_TYPE_ECB || ctx->enc_type == SM9_ENC_TYPE_CBC) {
+		// PKCS#7 填充, 整块时也补一整块
+		pad = SM4_BLOCK_SIZE - ctx->num;
+		memset(ctx->block + ctx->num, (int)pad, pad);
+		sm9_enc_ctx_blocks(ctx, 1, ctx->block, 1, p);
+		sm3_hmac_update(&ctx->hmac_ctx, p, SM4_BLOCK_SIZE);
+		p += SM4_BLOCK_SIZE;
+	}
+	sm3_hmac_finish(&ctx->hmac_ctx, p);
+	p += SM3_HMAC_SIZE;
+	*outlen = p - out;
+	gmssl_secure_clear(ctx, sizeof(*ctx));
+	return 1;
+}
 
-	//sm9_pairing_fastest(g_2,gen2,usr->Ppube);
-	//fp12_pow_t(g_2,g_2,r);
-	ep_mul(tmp,usr->Ppube,r);
-	sm9_pairing_fastest(g_2,gen2,tmp);
+int sm9_decrypt_init(SM9_ENC_CTX *ctx, const SM9_ENC_KEY *key, const char *id, size_t idlen,
+	const uint8_t *in, size_t inlen)
+{
+	uint8_t K[SM9_ENC_KLEN];
+	ep_t C1;
+	int ret = -1;
 
-	fp12_write_bin(g1buf,32*12,g_1,0);
-	fp12_write_bin(g2buf,32*12,g_2,0);
-	fp12_write_bin(g3buf,32*12,g_3,0);
+	ep_null(C1);
+	ep_new(C1);
 
-	for(int i = 0;i<384;i++){
-		g1_real[(11-i/32)*32+i%32] = g1buf[i];
-		g2_real[(11-i/32)*32+i%32] = g2buf[i];
-		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	if (inlen != SM9_ENC_HEADER_SIZE || in[0] == SM9_ENC_TYPE_XOR || in[1] != 0x04) {
+		error_print();
+		goto end;
+	}
+	ep_read_bin(C1, in + 1, 65);
+	if (err_get_code() != RLC_OK || ep_is_infty(C1) || !ep_on_curve(C1)) {
+		error_print();
+		goto end;
 	}
+	if (sm9_kem_decrypt(key, id, idlen, C1, sizeof(K), K) != 1
+		|| sm9_enc_ctx_set_key(ctx, 0, K, in) != 1) {
+		error_print();
+		goto end;
+	}
+	ret = 1;
+end:
+	gmssl_secure_clear(K, sizeof(K));
+	ep_free(C1);
+	return ret;
+}
 
-	sm3_kdf_init(&kdf_ctx, klen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
-	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
-	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
-	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
-	sm3_kdf_finish(&kdf_ctx, kbuf);
+// 解密 C2 中的一段, ECB/CBC 的最后一块可能是填充, 一直留到 finish
+static size_t sm9_decrypt_c2(SM9_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out)
+{
+	uint8_t *p = out;
+	size_t n;
 
-	ep_free(tmp);
-	g2_free(gen2);
-	bn_free(r);
-	bn_free(N);
+	sm3_hmac_update(&ctx->hmac_ctx, in, inlen);
+	if (ctx->enc_type == SM9_ENC_TYPE_OFB || ctx->enc_type == SM9_ENC_TYPE_CFB) {
+		sm9_enc_ctx_xor(ctx, 0, in, inlen, p);
+		return inlen;
+	}
+	while (inlen > 0) {
+		if (ctx->num == SM4_BLOCK_SIZE) {
+			sm9_enc_ctx_blocks(ctx, 0, ctx->block, 1, p);
+			p += SM4_BLOCK_SIZE;
+			ctx->num = 0;
+		}
+		if (ctx->num == 0 && inlen > SM4_BLOCK_SIZE) {
+			n = (inlen - 1) / SM4_BLOCK_SIZE;
+			sm9_enc_ctx_blocks(ctx, 0, in, n, p);
+			p += n * SM4_BLOCK_SIZE;
+			in += n * SM4_BLOCK_SIZE;
+			inlen -= n * SM4_BLOCK_SIZE;
+		}
+		n = RLC_MIN(SM4_BLOCK_SIZE - ctx->num, inlen);
+		memcpy(ctx->block + ctx->num, in, n);
+		ctx->num += n;
+		in += n;
+		inlen -= n;
+	}
+	return p - out;
+}
 
+int sm9_decrypt_update(SM9_ENC_CTX *ctx, const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+{
+	uint8_t *p = out;
+	size_t n;
+
+	// 输入的最后 SM3_HMAC_SIZE 字节可能是 C3, 先留在 ctx->mac 里
+	if (ctx->maclen + inlen <= SM3_HMAC_SIZE) {
+		memcpy(ctx->mac + ctx->maclen, in, inlen);
+		ctx->maclen += inlen;
+		*outlen = 0;
+		return 1;
+	}
+	n = RLC_MIN(ctx->maclen + inlen - SM3_HMAC_SIZE, ctx->maclen);
+	p += sm9_decrypt_c2(ctx, ctx->mac, n, p);
+	memmove(ctx->mac, ctx->mac + n, ctx->maclen - n);
+	ctx->maclen -= n;
+
+	n = inlen - (SM3_HMAC_SIZE - ctx->maclen);
+	p += sm9_decrypt_c2(ctx, in, n, p);
+	memcpy(ctx->mac + ctx->maclen, in + n, inlen - n);
+	ctx->maclen = SM3_HMAC_SIZE;
+	*outlen = p - out;
 	return 1;
 }
 
-int sm9_exchange_B1(const SM9_ENC_KEY *usr,fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t sblen,size_t sb){
+int sm9_decrypt_finish(SM9_ENC_CTX *ctx, uint8_t *out, size_t *outlen)
+{
+	uint8_t mac[SM3_HMAC_SIZE];
+	uint8_t block[SM4_BLOCK_SIZE];
+	size_t pad, i;
+	int ret = -1;
 
-	if( sblen < 32 ){
-		RLC_THROW(ERR_NO_BUFFER);
-		return -1;
+	*outlen = 0;
+	if (ctx->maclen != SM3_HMAC_SIZE) {
+		error_print();
+		goto end;
 	}
+	sm3_hmac_finish(&ctx->hmac_ctx, mac);
+	if (gmssl_secure_memcmp(ctx->mac, mac, sizeof(mac)) != 0) {
+		error_print();
+		goto end;
+	}
+	if (ctx->enc_type == SM9_ENC_TYPE_ECB || ctx->enc_type == SM9_ENC_TYPE_CBC) {
+		// C3 验证通过后才解密并检查填充块
+		if (ctx->num != SM4_BLOCK_SIZE) {
+			error_print();
+			goto end;
+		}
+		sm9_enc_ctx_blocks(ctx, 0, ctx->block, 1, block);
+		pad = block[SM4_BLOCK_SIZE - 1];
+		if (pad == 0 || pad > SM4_BLOCK_SIZE) {
+			error_print();
+			goto end;
+		}
+		for (i = SM4_BLOCK_SIZE - pad; i < SM4_BLOCK_SIZE; i++) {
+			if (block[i] != pad) {
+				error_print();
+				goto end;
+			}
+		}
+		memcpy(out, block, SM4_BLOCK_SIZE - pad);
+		*outlen = SM4_BLOCK_SIZE - pad;
+	}
+	ret = 1;
+end:
+	gmssl_secure_clear(block, sizeof(block));
+	gmssl_secure_clear(ctx, sizeof(*ctx));
+	return ret;
+}
 
-	SM3_KDF_CTX kdf_ctx;
-	SM3_CTX sb_ctx;
-
-	g2_t gen2;
-	g2_null(gen2);
-	g2_new(gen2);	
-
-	ep_t tmp;
-	ep_null(tmp);
-	ep_new(tmp);
-
-	g2_get_gen(gen2);
+int sm9_do_sign(const SM9_SIGN_KEY *key, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
+{
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	SM3_CTX ctx = *sm3_ctx;
+	SM3_CTX tmp_ctx;
+	uint8_t ct1[4] = {0,0,0,1};
+	uint8_t ct2[4] = {0,0,0,2};
+	uint8_t Ha[64];
 
-	bn_t r,N;
+	bn_t r;
+	bn_t ord;
+	fp12_t g,w;
+	ep_t SM9_P1;
 	bn_null(r);
 	bn_new(r);
-	bn_null(N);
-	bn_new(N);
-
-	uint8_t g1buf[32 * 12];
-	uint8_t g2buf[32 * 12];
-	uint8_t g3buf[32 * 12];
-	uint8_t g1_real[32 * 12];
-	uint8_t g2_real[32 * 12];
-	uint8_t g3_real[32 * 12];
-
-	uint8_t Rbbuf[65];
-	uint8_t Rabuf[65];
-	
-	uint8_t eighty_two[1] = {0x82};
-
-	sm9_hash1(r, ida, idalen, SM9_HID_EXCH);
-	ep_mul_gen(Rb,r);
-	ep_add(Rb,Rb,usr->Ppube);
-	//just for correctness test
-	char exch_rb[] = "18B98C44BEF9F8537FB7D071B2C928B3BC65BD3D69E1EEE213564905634FE";
-
-	// A2: rand r in [1, N-1]
-	bn_read_str(N,SM9_N,strlen(SM9_N),16);
-	bn_sub_dig(N,N,1);
-	do{
-		bn_rand(r,RLC_POS,256);
-	}while((bn_cmp_dig(r,1) == -1) || (bn_cmp(r,N) == 1));
-	bn_read_str(r,exch_rb,strlen(exch_rb),16);
-	// A3: R = r * Q
-	ep_mul(Rb,Rb,r);
-
-	ep_write_bin(Rabuf,65,Ra,0);
-	ep_write_bin(Rbbuf,65,Rb,0);
+	bn_null(ord);
+	bn_new(ord);
 
-	sm9_pairing_fastest(g_1,usr->de,Ra);
-	fp12_pow_t(g_3,g_1,r);
+	fp12_null(g);
+	fp12_new(g);
 
-	//sm9_pairing_fastest(g_2,gen2,usr->Ppube);
-	//fp12_pow_t(g_2,g_2,r);
-	ep_mul(tmp,usr->Ppube,r);
-	sm9_pairing_fastest(g_2,gen2,tmp);
+	fp12_null(w);
+	fp12_new(w);
 
-	fp12_write_bin(g1buf,32*12,g_1,0);
-	fp12_write_bin(g2buf,32*12,g_2,0);
-	fp12_write_bin(g3buf,32*12,g_3,0);
+	ep_null(SM9_P1);
+	ep_new(SM9_P1);
+	
+	g1_get_gen(SM9_P1);
+	g1_get_ord(ord);
 
-	for(int i = 0;i<384;i++){
-		g1_real[(11-i/32)*32+i%32] = g1buf[i];
-		g2_real[(11-i/32)*32+i%32] = g2buf[i];
-		g3_real[(11-i/32)*32+i%32] = g3buf[i];
-	}
+	// 测试pairing性能
+	// PERFORMANCE_TEST_NEW("pairing", sm9_pairing_fast(g, key->Ppubs, SM9_P1));
 
-	sm3_kdf_init(&kdf_ctx, klen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
-	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
-	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
-	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
-	sm3_kdf_finish(&kdf_ctx, kbuf);
+	// A1: g = e(P1, Ppubs)
+	sm9_pairing_ate(g, key->Ppubs, SM9_P1);
+	do {
+		// A2: rand r in [1, N-1], 固定的 r 会由两个签名直接解出 ds
+		do {
+			bn_rand_mod(r, ord);
+		} while (bn_is_zero(r));
+		// 重选 r 时 H2 从 M 之后重新算
+		ctx = *sm3_ctx;
 
-	sm3_init(&sb_ctx);
-    sm3_update(&sb_ctx, g2_real,sizeof(g2_real));
-	sm3_update(&sb_ctx, g3_real,sizeof(g3_real));
-	sm3_update(&sb_ctx, (uint8_t *)ida, idalen);
-	sm3_update(&sb_ctx, (uint8_t *)idb, idblen);
-	sm3_update(&sb_ctx, Rabuf + 1, 64);
-	sm3_update(&sb_ctx, Rbbuf + 1, 64);
-	sm3_finish(&sb_ctx, sb);
+		// A3: w = g^r
+		fp12_pow_gls_sec(w, g, r);
+		fp12_write_bin(wbuf, 32*12, w, 0);  // pack表示是否压缩
+		// A4: h = H2(M || w, N)
+		// hlen = 8*(5*bitlen(N)/32) = 8*40，8*40表示的是比特长度，也就是40字节
+		
+		for(int i = 0;i<384;i++){
+			fubw[(11-i/32)*32+i%32] = wbuf[i];
+		}
+		sm3_update(&ctx, fubw, sizeof(fubw));  // 02||w
+		tmp_ctx = ctx;
 
-	sm3_init(&sb_ctx);
-	sm3_update(&sb_ctx, eighty_two,sizeof(eighty_two));
-	sm3_update(&sb_ctx, g1_real,sizeof(g1_real));
-	sm3_update(&sb_ctx, sb,sblen);
-	sm3_finish(&sb_ctx, sb);
+		sm3_update(&ctx, ct1, sizeof(ct1));  // 02||w||1
+		sm3_finish(&ctx, Ha);                // Ha1
+		sm3_update(&tmp_ctx, ct2, sizeof(ct2));  // 02||w||2
+		sm3_finish(&tmp_ctx, Ha + 32);           // Ha2
+		sm9_fn_from_hash(sig->h, Ha);  // 这里的参数Ha是大小为40的uint8_t数组, sig->h = (Ha mod (n-1)) + 1;																											
+		// A5: l = (r - h) mod N, if l = 0, goto A2
+		bn_sub(r, r, sig->h);
+		if(r->sign == RLC_NEG){
+			bn_add(r,r,ord);
+		}
+		// sm9_fn_sub(r, r, sig->h);
+	} while (bn_is_zero(r));  // 如果r为0，返回到A2执行
+	// } while (sm9_fn_is_zero(r));  // 如果r为0，返回到A2执行
+	// A6: S = l * dsA
+	sm9_sign_key_mul(sig->S, key, r);
+	// sm9_point_mul(&sig->S, r, &key->ds);
 
-	ep_free(tmp);
-	g2_free(gen2);
 	bn_free(r);
-	bn_free(N);
+	bn_free(ord);
+	fp12_free(g);
+	fp12_free(w);
+	ep_free(SM9_P1);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&tmp_ctx, sizeof(tmp_ctx));
+	gmssl_secure_clear(Ha, sizeof(Ha));
 
 	return 1;
 }
 
-int sm9_exchange_A2_without_check(const SM9_ENC_KEY *usr,ep_t Ra,ep_t Rb,bn_t ra,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf){
+// sm9 签名
+int sm9_sign_init(SM9_SIGN_CTX *ctx)
+{
+	const uint8_t prefix[1] = { SM9_HASH2_PREFIX };
+	sm3_init(&ctx->sm3_ctx);
+	// sm3_ctx以0x02开头
+	sm3_update(&ctx->sm3_ctx, prefix, sizeof(prefix));
+	return 1;
+}
 
-	SM3_KDF_CTX kdf_ctx;
+int sm9_sign_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	sm3_update(&ctx->sm3_ctx, data, datalen);
+	return 1;
+}
 
-	fp12_t g_1;
-	fp12_null(g_1);
-	fp12_new(g_1);
-	fp12_t g_3;
-	fp12_null(g_3);
-	fp12_new(g_3);
-	fp12_t g_2;
-	fp12_null(g_2);
-	fp12_new(g_2);
+sm9_sign_finish(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, uint8_t *sig, size_t *siglen)
+{
+	SM9_SIGNATURE signature;
+	
+	bn_null(signature.h);
+	bn_new(signature.h);
+	ep_null(signature.S);
+	ep_new(signature.S);
+	// 测试sm_do_sign性能
+	// PERFORMANCE_TEST_NEW("sm9_do_sign", sm9_do_sign(key, &ctx->sm3_ctx, &signature));
 
-	g2_t gen2;
-	g2_null(gen2);
-	g2_new(gen2);	
-	g2_get_gen(gen2);
+	// 签名
+	if (sm9_do_sign(key, &ctx->sm3_ctx, &signature) != 1) {
+		error_print();
+		return -1;
+	}
+	*siglen = 0;
 
-	ep_t tmp;
-	ep_null(tmp);
-	ep_new(tmp);
+	// SM9_SIGNATURE 转成 字节数组
+	if (sm9_signature_to_der(&signature, &sig, siglen) != 1) {
+		error_print();
+		return -1;
+	}
+	bn_free(signature.h);
+	ep_free(signature.S);
+	return 1;
+}
 
-	uint8_t g1buf[32 * 12];
-	uint8_t g2buf[32 * 12];
-	uint8_t g3buf[32 * 12];
-	uint8_t g1_real[32 * 12];
-	uint8_t g2_real[32 * 12];
-	uint8_t g3_real[32 * 12];
-	uint8_t Rbbuf[65];
-	uint8_t Rabuf[65];
-	uint8_t dgst[32];
 
-	//sm9_pairing_fastest(g_1,gen2,usr->Ppube);
-	//fp12_pow_t(g_1,g_1,ra);
-	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_1,gen2,usr->Ppube);fp12_pow_t(g_1,g_1,ra));
-	//PERFORMANCE_TEST_NEW("e^r faster",ep_mul(tmp,usr->Ppube,ra);sm9_pairing_fastest(g_1,gen2,tmp));
-	ep_mul(tmp,usr->Ppube,ra);
-	sm9_pairing_fastest(g_1,gen2,tmp);
+int sm9_do_verify(const SM9_SIGN_KEY *mpk, const char *id, size_t idlen,
+	const SM3_CTX *sm3_ctx, const SM9_SIGNATURE *sig)
+{	
+	int ret = 0;
+	bn_t h1,h2;
+	bn_null(h1);
+	bn_new(h1);
+	bn_null(h2);
+	bn_new(h2);
 
-	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_2,usr->de,Rb);fp12_pow_t(g_3,g_2,ra));
-	sm9_pairing_fastest(g_2,usr->de,Rb);
-	fp12_pow_t(g_3,g_2,ra);
-	//PERFORMANCE_TEST_NEW("e^r low",sm9_pairing_fastest(g_2,usr->de,Rb);ep_mul(tmp,Rb,ra);sm9_pairing_fastest(g_3,usr->de,tmp));
-	
-	fp12_write_bin(g1buf,32*12,g_1,0);
-	fp12_write_bin(g2buf,32*12,g_2,0);
-	fp12_write_bin(g3buf,32*12,g_3,0);
+	fp12_t w;
 
-	for(int i = 0;i<384;i++){
-		g1_real[(11-i/32)*32+i%32] = g1buf[i];
-		g2_real[(11-i/32)*32+i%32] = g2buf[i];
-		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+	fp12_null(w);
+	fp12_new(w);
+
+	ep2_t P;
+	ep2_null(P);
+	ep2_new(P);
+
+	ep2_t Qs[2];
+	ep_t Ps[2];
+	for (int i = 0; i < 2; i++) {
+		ep2_null(Qs[i]);
+		ep2_new(Qs[i]);
+		ep_null(Ps[i]);
+		ep_new(Ps[i]);
 	}
+	
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32*12];
+	SM3_CTX ctx = *sm3_ctx;
+	SM3_CTX tmp_ctx;
+	uint8_t ct1[4] = {0,0,0,1};
+	uint8_t ct2[4] = {0,0,0,2};
+	uint8_t hid[4] = {0,0,0,1};
+	uint8_t Ha[64];
 
-	ep_write_bin(Rabuf,65,Ra,0);
-	ep_write_bin(Rbbuf,65,Rb,0);
+	ep_t hP1;
+	ep_null(hP1);
+	ep_new(hP1);
 
-	sm3_kdf_init(&kdf_ctx, klen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
-	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
-	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
-	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
-	sm3_kdf_finish(&kdf_ctx, kbuf);
-	printf("session key is\n");
-	print_bytes(kbuf,klen);
+	// B1: check h in [1, N-1]
 
-	fp12_free(g_1);
-	fp12_free(g_2);
-	fp12_free(g_3);
-	g2_free(gen2);
-	ep_free(tmp);
-	return 1;
+	// B2: check S in G1
 
-}
+	// B5, B6: P = H1(ID || hid, N) * P2 + Ppubs, from the identity cache when one is set
+	if (sm9_id_cache_g2(sm9_get_id_cache(), mpk->Ppubs, id, idlen, h1, P, NULL) < 0) {
+		error_print();
+		ret = -1;
+		goto end;
+	}
 
-int sm9_exchange_A2(const SM9_ENC_KEY *usr,ep_t Ra,ep_t Rb,bn_t ra,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t klen,uint8_t *kbuf,size_t salen,uint8_t *sa,size_t datalen,uint8_t *data){
+	// B3, B4, B7, B8: w = e(S, P) * e(P1, Ppubs)^h = e(S, P) * e(h * P1, Ppubs)
+	ep_mul_gen(hP1, sig->h);
+	ep2_copy(Qs[0], P);
+	ep2_copy(Qs[1], (ep2_st *)mpk->Ppubs);
+	ep_copy(Ps[0], sig->S);
+	ep_copy(Ps[1], hP1);
+	sm9_pairing_sim(w, Qs, Ps, 2);
 
-	if(salen < 32 || datalen < 32){
-		RLC_THROW(ERR_NO_BUFFER);
-		return -1;
+	//sm9_fp12_to_bytes(w, wbuf);
+	fp12_write_bin(wbuf, 32*12, w, 0);
+
+	for(int i = 0;i<384;i++){
+		fubw[(11-i/32)*32+i%32] = wbuf[i];
 	}
 
-	SM3_KDF_CTX kdf_ctx;
-	SM3_CTX sa_ctx;
+	// B9: h2 = H2(M || w, N), check h2 == h
+	sm3_update(&ctx, fubw, sizeof(fubw));
+	tmp_ctx = ctx;
+	sm3_update(&ctx, ct1, sizeof(ct1));
+	sm3_finish(&ctx, Ha);
+	sm3_update(&tmp_ctx, ct2, sizeof(ct2));
+	sm3_finish(&tmp_ctx, Ha + 32);
+	sm9_fn_from_hash(h2, Ha);
 
-	fp12_t g_1;
-	fp12_null(g_1);
-	fp12_new(g_1);
-	fp12_t g_3;
-	fp12_null(g_3);
-	fp12_new(g_3);
-	fp12_t g_2;
-	fp12_null(g_2);
-	fp12_new(g_2);
+	if (bn_cmp(h2, sig->h) == RLC_EQ) {
+		ret = 1;
+	}
 
-	g2_t gen2;
-	g2_null(gen2);
-	g2_new(gen2);	
-	g2_get_gen(gen2);
+end:
+	bn_free(h1);
+	bn_free(h2);
+	fp12_free(w);
+	ep_free(hP1);
+	ep2_free(P);
+	for (int i = 0; i < 2; i++) {
+		ep2_free(Qs[i]);
+		ep_free(Ps[i]);
+	}
 
-	ep_t tmp;
-	ep_null(tmp);
-	ep_new(tmp);
+	return ret;
+}
 
-	uint8_t g1buf[32 * 12];
-	uint8_t g2buf[32 * 12];
-	uint8_t g3buf[32 * 12];
-	uint8_t g1_real[32 * 12];
-	uint8_t g2_real[32 * 12];
-	uint8_t g3_real[32 * 12];
-	uint8_t Rbbuf[65];
-	uint8_t Rabuf[65];
-	uint8_t dgst[32];
+int sm9_verify_init(SM9_SIGN_CTX *ctx)
+{
+	const uint8_t prefix[1] = { SM9_HASH2_PREFIX };
+	sm3_init(&ctx->sm3_ctx);
+	sm3_update(&ctx->sm3_ctx, prefix, sizeof(prefix));
+	return 1;
+}
 
-	uint8_t eighty_two_and_three[2] = {0x82,0x83};
+int sm9_verify_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen)
+{
+	sm3_update(&ctx->sm3_ctx, data, datalen);
+	return 1;
+}
 
-	//sm9_pairing_fastest(g_1,gen2,usr->Ppube);
-	//fp12_pow_t(g_1,g_1,ra);
-	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_1,gen2,usr->Ppube);fp12_pow_t(g_1,g_1,ra));
-	//PERFORMANCE_TEST_NEW("e^r faster",ep_mul(tmp,usr->Ppube,ra);sm9_pairing_fastest(g_1,gen2,tmp));
-	ep_mul(tmp,usr->Ppube,ra);
-	sm9_pairing_fastest(g_1,gen2,tmp);
+int sm9_verify_finish(SM9_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen,
+	const SM9_SIGN_KEY *mpk, const char *id, size_t idlen)
+{
+	int ret;
+	SM9_SIGNATURE signature;
+	bn_null(signature.h);
+	bn_new(signature.h);
+	ep_null(signature.S);
+	ep_new(signature.S);
 
-	//PERFORMANCE_TEST_NEW("e^r",sm9_pairing_fastest(g_2,usr->de,Rb);fp12_pow_t(g_3,g_2,ra));
-	sm9_pairing_fastest(g_2,usr->de,Rb);
-	fp12_pow_t(g_3,g_2,ra);
-	//PERFORMANCE_TEST_NEW("e^r low",sm9_pairing_fastest(g_2,usr->de,Rb);ep_mul(tmp,Rb,ra);sm9_pairing_fastest(g_3,usr->de,tmp));
-	
-	fp12_write_bin(g1buf,32*12,g_1,0);
-	fp12_write_bin(g2buf,32*12,g_2,0);
-	fp12_write_bin(g3buf,32*12,g_3,0);
+	if (sm9_signature_from_der(&signature, &sig, &siglen) != 1
+		|| asn1_length_is_zero(siglen) != 1) {
+		error_print();
+		ret = -1;
+	} else if ((ret = sm9_do_verify(mpk, id, idlen, &ctx->sm3_ctx, &signature)) < 0) {
+		error_print();
+		ret = -1;
+	}
+	//printf("\nsignature.h2 is :\n");
+	//bn_print(signature.h);
+	bn_free(signature.h);
+	ep_free(signature.S);
+	return ret;
+}
+
+// h = H2(M || w, N), sm3_ctx already holds 0x02 || M
+static void sm9_hash2_w(bn_t h, const SM3_CTX *sm3_ctx, fp12_t w)
+{
+	uint8_t wbuf[32 * 12];
+	uint8_t fubw[32 * 12];
+	SM3_CTX ctx = *sm3_ctx;
+	SM3_CTX tmp_ctx;
+	uint8_t ct1[4] = {0,0,0,1};
+	uint8_t ct2[4] = {0,0,0,2};
+	uint8_t Ha[64];
 
+	fp12_write_bin(wbuf, 32*12, w, 0);
 	for(int i = 0;i<384;i++){
-		g1_real[(11-i/32)*32+i%32] = g1buf[i];
-		g2_real[(11-i/32)*32+i%32] = g2buf[i];
-		g3_real[(11-i/32)*32+i%32] = g3buf[i];
+		fubw[(11-i/32)*32+i%32] = wbuf[i];
 	}
 
-	ep_write_bin(Rabuf,65,Ra,0);
-	ep_write_bin(Rbbuf,65,Rb,0);
-
-	sm3_init(&sa_ctx);
-    sm3_update(&sa_ctx, g2_real,sizeof(g2_real));
-	sm3_update(&sa_ctx, g3_real,sizeof(g3_real));
-	sm3_update(&sa_ctx, (uint8_t *)ida, idalen);
-	sm3_update(&sa_ctx, (uint8_t *)idb, idblen);
-	sm3_update(&sa_ctx, Rabuf + 1, 64);
-	sm3_update(&sa_ctx, Rbbuf + 1, 64);
-	sm3_finish(&sa_ctx, dgst);
+	sm3_update(&ctx, fubw, sizeof(fubw));  // 02||M||w
+	tmp_ctx = ctx;
+	sm3_update(&ctx, ct1, sizeof(ct1));
+	sm3_finish(&ctx, Ha);
+	sm3_update(&tmp_ctx, ct2, sizeof(ct2));
+	sm3_finish(&tmp_ctx, Ha + 32);
+	sm9_fn_from_hash(h, Ha);
 
-	sm3_init(&sa_ctx);
-	sm3_update(&sa_ctx, eighty_two_and_three+1,sizeof(eighty_two_and_three)/2);
-	sm3_update(&sa_ctx, g1_real,sizeof(g1_real));
-	sm3_update(&sa_ctx, dgst,sizeof(dgst));
-	sm3_finish(&sa_ctx, sa);
+	gmssl_secure_clear(wbuf, sizeof(wbuf));
+	gmssl_secure_clear(fubw, sizeof(fubw));
+	gmssl_secure_clear(&tmp_ctx, sizeof(tmp_ctx));
+	gmssl_secure_clear(Ha, sizeof(Ha));
+}
 
-	sm3_init(&sa_ctx);
-	sm3_update(&sa_ctx, eighty_two_and_three,sizeof(eighty_two_and_three)/2);
-	sm3_update(&sa_ctx, g1_real,sizeof(g1_real));
-	sm3_update(&sa_ctx, dgst,sizeof(dgst));
-	sm3_finish(&sa_ctx, dgst);
+int sm9_sign_mpk_pre_set(SM9_SIGN_MPK_PRE *pre, const ep2_t Ppubs)
+{
+	ep_t SM9_P1;
 
-	if(memcmp(dgst,data,32) != 0){
-		printf("ERROR:key exchange fail!\n");
-		return -1;
+	if (pre->ready && ep2_cmp(pre->Ppubs, (ep2_st *)Ppubs) == RLC_EQ) {
+		return 1;
 	}
 
-	sm3_kdf_init(&kdf_ctx, klen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)ida, idalen);
-	sm3_kdf_update(&kdf_ctx, (uint8_t *)idb, idblen);
-	sm3_kdf_update(&kdf_ctx, Rabuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, Rbbuf + 1, 64);
-	sm3_kdf_update(&kdf_ctx, g1_real,sizeof(g1_real));
-	sm3_kdf_update(&kdf_ctx, g2_real,sizeof(g2_real));
-	sm3_kdf_update(&kdf_ctx, g3_real,sizeof(g3_real));
-	sm3_kdf_finish(&kdf_ctx, kbuf);
-	//printf("session key is:\n");
-	//print_bytes(kbuf,klen);
+	ep_null(SM9_P1);
+	ep_new(SM9_P1);
+	g1_get_gen(SM9_P1);
 
-	fp12_free(g_1);
-	fp12_free(g_2);
-	fp12_free(g_3);
-	g2_free(gen2);
-	ep_free(tmp);
+	// g = e(P1, Ppubs)
+	ep2_norm(pre->Ppubs, (ep2_st *)Ppubs);
+	sm9_pairing_ate(pre->g, pre->Ppubs, SM9_P1);
+	fp12_pow_fix_pre(pre->t, pre->g);
+	pre->ready = 1;
+
+	ep_free(SM9_P1);
 	return 1;
 }
 
-int sm9_exchange_B2(fp12_t g_1,fp12_t g_2,fp12_t g_3,ep_t Ra,ep_t Rb,const char *ida,size_t idalen,const char *idb, size_t idblen,size_t datalen,uint8_t *data){
-	if( datalen < 32 ){
-		RLC_THROW(ERR_NO_BUFFER);
+int sm9_do_sign_pre(const SM9_SIGN_KEY *key, SM9_SIGN_MPK_PRE *pre, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
+{
+	bn_t r, ord;
+	fp12_t w;
+
+	if (!pre->ready) {
+		error_print();
 		return -1;
 	}
-	SM3_CTX sb_ctx;
 
-	uint8_t Rbbuf[65];
-	uint8_t Rabuf[65];
-	uint8_t g1buf[32 * 12];
-	uint8_t g2buf[32 * 12];
-	uint8_t g3buf[32 * 12];
-	uint8_t g1_real[32 * 12];
-	uint8_t g2_real[32 * 12];
-	uint8_t g3_real[32 * 12];
-	uint8_t dgst[32];
-	uint8_t eighty_three[1] = {0x83};
+	bn_null(r);
+	bn_null(ord);
+	fp12_null(w);
 
+	bn_new(r);
+	bn_new(ord);
+	fp12_new(w);
 
-	ep_write_bin(Rabuf,65,Ra,0);
-	ep_write_bin(Rbbuf,65,Rb,0);
+	g1_get_ord(ord);
 
-	fp12_write_bin(g1buf,32*12,g_1,0);
-	fp12_write_bin(g2buf,32*12,g_2,0);
-	fp12_write_bin(g3buf,32*12,g_3,0);
+	do {
+		// A2: rand r in [1, N-1]
+		do {
+			bn_rand_mod(r, ord);
+		} while (bn_is_zero(r));
 
-	for(int i = 0;i<384;i++){
-		g1_real[(11-i/32)*32+i%32] = g1buf[i];
-		g2_real[(11-i/32)*32+i%32] = g2buf[i];
-		g3_real[(11-i/32)*32+i%32] = g3buf[i];
-	}
+		// A3: w = g^r, g = e(P1, Ppubs) is taken from pre
+		fp12_pow_fix_sec(w, pre->t, r);
 
-	sm3_init(&sb_ctx);
-    sm3_update(&sb_ctx, g2_real,sizeof(g2_real));
-	sm3_update(&sb_ctx, g3_real,sizeof(g3_real));
-	sm3_update(&sb_ctx, (uint8_t *)ida, idalen);
-	sm3_update(&sb_ctx, (uint8_t *)idb, idblen);
-	sm3_update(&sb_ctx, Rabuf + 1, 64);
-	sm3_update(&sb_ctx, Rbbuf + 1, 64);
-	sm3_finish(&sb_ctx, dgst);
-	sm3_init(&sb_ctx);
-	sm3_update(&sb_ctx, eighty_three,sizeof(eighty_three));
-	sm3_update(&sb_ctx, g1_real,sizeof(g1_real));
-	sm3_update(&sb_ctx, dgst,sizeof(dgst));
-	sm3_finish(&sb_ctx, dgst);
+		// A4: h = H2(M || w, N)
+		sm9_hash2_w(sig->h, sm3_ctx, w);
 
-	if(memcmp(dgst,data,32) != 0){
-		printf("ERROR:key exchange fail!\n");
-		return -1;
-	}
-	else{
-		//printf("key exchange sussess!\n");
-	}
+		// A5: l = (r - h) mod N, if l = 0, goto A2
+		bn_sub(r, r, sig->h);
+		if (bn_sign(r) == RLC_NEG) {
+			bn_add(r, r, ord);
+		}
+	} while (bn_is_zero(r));
+
+	// A6: S = l * dsA
+	sm9_sign_key_mul(sig->S, key, r);
+
+	bn_free(r);
+	bn_free(ord);
+	fp12_free(w);
 	return 1;
 }
 
-int sm9_encrypt(const SM9_ENC_KEY *mpk, const char *id, size_t idlen,
-	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
+int sm9_do_verify_pre(SM9_SIGN_MPK_PRE *pre, const char *id, size_t idlen,
+	const SM3_CTX *sm3_ctx, const SM9_SIGNATURE *sig)
 {
-	ep_t C1;
-	ep_null(C1);
-	ep_new(C1);
-	uint8_t c2[inlen];
-	uint8_t c3[SM3_HMAC_SIZE];
+	int ret = 0;
+	bn_t h1, h2, ord;
+	fp12_t t, u;
+	ep2_t P;
+	SM9_G2_PRE lines;
+	SM9_ID_CACHE *cache;
 
-	if (sm9_do_encrypt(mpk, id, idlen, in, inlen, C1, c2, c3) != 1) {
+	if (!pre->ready) {
 		error_print();
 		return -1;
 	}
-	*outlen = 0;
-	if (sm9_ciphertext_to_der(C1, c2, inlen, c3, &out, outlen) != 1) { // FIXME: when out == NULL	
-		error_print();
-		return -1;
+
+	bn_null(h1);
+	bn_null(h2);
+	bn_null(ord);
+	fp12_null(t);
+	fp12_null(u);
+	ep2_null(P);
+
+	bn_new(h1);
+	bn_new(h2);
+	bn_new(ord);
+	fp12_new(t);
+	fp12_new(u);
+	ep2_new(P);
+
+	g1_get_ord(ord);
+
+	// B1: check h in [1, N-1]
+	if (bn_is_zero(sig->h) || bn_sign(sig->h) == RLC_NEG || bn_cmp(sig->h, ord) != RLC_LT) {
+		goto end;
 	}
-	ep_free(C1);
-	return 1;
-}
 
-int sm9_decrypt(const SM9_ENC_KEY *key, const char *id, size_t idlen,
-	const uint8_t *in, size_t inlen, uint8_t *out, size_t *outlen)
-{
-	ep_t C1;
-	ep_null(C1);
-	ep_new(C1);
-	const uint8_t *c2;
-	size_t c2len;
-	const uint8_t *c3;
+	// B2: check S in G1
+	if (!ep_on_curve(sig->S) || ep_is_infty(sig->S)) {
+		goto end;
+	}
 
-	if (sm9_ciphertext_from_der(C1, &c2, &c2len, &c3, &in, &inlen) != 1
-		|| asn1_length_is_zero(inlen) != 1) {
-		error_print();
-		return -1;
+	// B4: t = g^h, g = e(P1, Ppubs) is taken from pre
+	fp12_pow_fix(t, pre->t, sig->h);
+
+	// B5, B6: P = H1(ID || hid, N) * P2 + Ppubs, from the identity cache when one is set
+	// B7: u = e(S, P), with the cached Miller lines of P when the cache keeps them
+	cache = sm9_get_id_cache();
+	if (sm9_id_cache_flags(cache) & SM9_ID_CACHE_LINES) {
+		sm9_g2_pre_init(&lines);
+		if (sm9_id_cache_g2(cache, pre->Ppubs, id, idlen, h1, P, &lines) < 0) {
+			sm9_g2_pre_free(&lines);
+			error_print();
+			ret = -1;
+			goto end;
+		}
+		sm9_pairing_pre(u, &lines, sig->S);
+		sm9_g2_pre_free(&lines);
+	} else {
+		if (sm9_id_cache_g2(cache, pre->Ppubs, id, idlen, h1, P, NULL) < 0) {
+			error_print();
+			ret = -1;
+			goto end;
+		}
+		sm9_pairing_ate(u, P, sig->S);
 	}
 
-	*outlen = c2len;
-	if (!out) {
-		return 1;
+	// B8: w = u * t
+	fp12_mul_t(u, u, t);
+
+	// B9: h2 = H2(M || w, N), check h2 == h
+	sm9_hash2_w(h2, sm3_ctx, u);
+	if (bn_cmp(h2, sig->h) == RLC_EQ) {
+		ret = 1;
 	}
-	if (sm9_do_decrypt(key, id, idlen, C1, c2, c2len, c3, out) != 1) {
+
+end:
+	bn_free(h1);
+	bn_free(h2);
+	bn_free(ord);
+	fp12_free(t);
+	fp12_free(u);
+	ep2_free(P);
+	return ret;
+}
+
+int sm9_sign_finish_pre(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, SM9_SIGN_MPK_PRE *pre, uint8_t *sig, size_t *siglen)
+{
+	int ret = 1;
+	SM9_SIGNATURE signature;
+
+	bn_null(signature.h);
+	bn_new(signature.h);
+	ep_null(signature.S);
+	ep_new(signature.S);
+
+	*siglen = 0;
+	if (sm9_do_sign_pre(key, pre, &ctx->sm3_ctx, &signature) != 1
+		|| sm9_signature_to_der(&signature, &sig, siglen) != 1) {
 		error_print();
-		return -1;
+		ret = -1;
 	}
-	ep_free(C1);
-	return 1;
+
+	bn_free(signature.h);
+	ep_free(signature.S);
+	return ret;
 }
 
-int sm9_do_sign(const SM9_SIGN_KEY *key, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
+int sm9_do_sign_pool(const SM9_SIGN_KEY *key, SM9_RAND_POOL *pool, const SM3_CTX *sm3_ctx, SM9_SIGNATURE *sig)
 {
-	uint8_t wbuf[32 * 12];
-	uint8_t fubw[32 * 12];
-	SM3_CTX ctx = *sm3_ctx;
-	SM3_CTX tmp_ctx;
-	uint8_t ct1[4] = {0,0,0,1};
-	uint8_t ct2[4] = {0,0,0,2};
-	uint8_t Ha[64];
+	int ret = 1;
+	bn_t r, ord;
+	fp12_t w;
 
-	bn_t r;
-	bn_t ord;
-	fp12_t g,w;
-	ep_t SM9_P1;
 	bn_null(r);
-	bn_new(r);
 	bn_null(ord);
-	bn_new(ord);
-
-	fp12_null(g);
-	fp12_new(g);
-
 	fp12_null(w);
+
+	bn_new(r);
+	bn_new(ord);
 	fp12_new(w);
 
-	ep_null(SM9_P1);
-	ep_new(SM9_P1);
-	
-	g1_get_gen(SM9_P1);
 	g1_get_ord(ord);
 
-	char rr[] = "33C8616B06704813203DFD00965022ED15975C662337AED648835DC4B1CBE";
-	//sm9_bn_t rr = {0xDC4B1CBE,0xED648835,0xC662337A,0x2ED15975,0xD0096502,0x813203DF,0x16B06704,0x033C86};
-	// 测试pairing性能
-	// PERFORMANCE_TEST_NEW("pairing", sm9_pairing_fast(g, key->Ppubs, SM9_P1));
-
-	// A1: g = e(P1, Ppubs)
-	sm9_pairing_fastest(g, key->Ppubs, SM9_P1);
 	do {
-		// A2: rand r in [1, N-1]
-		// if (fp_rand(r) != 1) {
-		// 	error_print();
-		// 	return -1;
-		// }
-		//fp_rand(r);
-		bn_read_str(r,rr,strlen(rr),16);
-		// 测试使用
-		//sm9_fn_from_hex(r, "00033C8616B06704813203DFD00965022ED15975C662337AED648835DC4B1CBE"); // for testing
+		// A2, A3: r and w = g^r are taken from the pool
+		if (sm9_rand_pool_get(pool, r, w) < 0) {
+			error_print();
+			ret = -1;
+			goto end;
+		}
 
-		// A3: w = g^r
-		fp12_pow_t(w, g, r);
-		fp12_write_bin(wbuf, 32*12, w, 0);  // pack表示是否压缩
 		// A4: h = H2(M || w, N)
-		// hlen = 8*(5*bitlen(N)/32) = 8*40，8*40表示的是比特长度，也就是40字节
-		
-		for(int i = 0;i<384;i++){
-			fubw[(11-i/32)*32+i%32] = wbuf[i];
-		}
-		sm3_update(&ctx, fubw, sizeof(fubw));  // 02||w
-		tmp_ctx = ctx;
+		sm9_hash2_w(sig->h, sm3_ctx, w);
 
-		sm3_update(&ctx, ct1, sizeof(ct1));  // 02||w||1
-		sm3_finish(&ctx, Ha);                // Ha1
-		sm3_update(&tmp_ctx, ct2, sizeof(ct2));  // 02||w||2
-		sm3_finish(&tmp_ctx, Ha + 32);           // Ha2
-		sm9_fn_from_hash(sig->h, Ha);  // 这里的参数Ha是大小为40的uint8_t数组, sig->h = (Ha mod (n-1)) + 1;																											
 		// A5: l = (r - h) mod N, if l = 0, goto A2
 		bn_sub(r, r, sig->h);
-		if(r->sign == RLC_NEG){
-			bn_add(r,r,ord);
+		if (bn_sign(r) == RLC_NEG) {
+			bn_add(r, r, ord);
 		}
-		// sm9_fn_sub(r, r, sig->h);
-	} while (bn_is_zero(r));  // 如果r为0，返回到A2执行
-	// } while (sm9_fn_is_zero(r));  // 如果r为0，返回到A2执行
+	} while (bn_is_zero(r));
+
 	// A6: S = l * dsA
-	ep_mul(sig->S, key->ds,r);
-	// sm9_point_mul(&sig->S, r, &key->ds);
+	sm9_sign_key_mul(sig->S, key, r);
 
+end:
+	bn_zero(r);
 	bn_free(r);
 	bn_free(ord);
-	fp12_free(g);
 	fp12_free(w);
-	ep_free(SM9_P1);
-	gmssl_secure_clear(wbuf, sizeof(wbuf));
-	gmssl_secure_clear(fubw, sizeof(fubw));
-	gmssl_secure_clear(&tmp_ctx, sizeof(tmp_ctx));
-	gmssl_secure_clear(Ha, sizeof(Ha));
-
-	return 1;
+	return ret;
 }
 
-// sm9 签名
-int sm9_sign_init(SM9_SIGN_CTX *ctx)
+int sm9_sign_finish_pool(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, SM9_RAND_POOL *pool, uint8_t *sig, size_t *siglen)
 {
-	const uint8_t prefix[1] = { SM9_HASH2_PREFIX };
-	sm3_init(&ctx->sm3_ctx);
-	// sm3_ctx以0x02开头
-	sm3_update(&ctx->sm3_ctx, prefix, sizeof(prefix));
-	return 1;
-}
+	int ret = 1;
+	SM9_SIGNATURE signature;
 
-int sm9_sign_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen)
-{
-	sm3_update(&ctx->sm3_ctx, data, datalen);
-	return 1;
+	bn_null(signature.h);
+	bn_new(signature.h);
+	ep_null(signature.S);
+	ep_new(signature.S);
+
+	*siglen = 0;
+	if (sm9_do_sign_pool(key, pool, &ctx->sm3_ctx, &signature) != 1
+		|| sm9_signature_to_der(&signature, &sig, siglen) != 1) {
+		error_print();
+		ret = -1;
+	}
+
+	bn_free(signature.h);
+	ep_free(signature.S);
+	return ret;
 }
 
-sm9_sign_finish(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, uint8_t *sig, size_t *siglen)
+int sm9_verify_finish_pre(SM9_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen,
+	SM9_SIGN_MPK_PRE *pre, const char *id, size_t idlen)
 {
+	int ret;
 	SM9_SIGNATURE signature;
-	
+
 	bn_null(signature.h);
 	bn_new(signature.h);
 	ep_null(signature.S);
 	ep_new(signature.S);
-	// 测试sm_do_sign性能
-	// PERFORMANCE_TEST_NEW("sm9_do_sign", sm9_do_sign(key, &ctx->sm3_ctx, &signature));
 
-	// 签名
-	if (sm9_do_sign(key, &ctx->sm3_ctx, &signature) != 1) {
+	if (sm9_signature_from_der(&signature, &sig, &siglen) != 1
+		|| asn1_length_is_zero(siglen) != 1) {
 		error_print();
-		return -1;
-	}
-	*siglen = 0;
-
-	// SM9_SIGNATURE 转成 字节数组
-	if (sm9_signature_to_der(&signature, &sig, siglen) != 1) {
+		ret = -1;
+	} else if ((ret = sm9_do_verify_pre(pre, id, idlen, &ctx->sm3_ctx, &signature)) < 0) {
 		error_print();
-		return -1;
+		ret = -1;
 	}
+
 	bn_free(signature.h);
 	ep_free(signature.S);
-	return 1;
+	return ret;
 }
 
+typedef struct {
+	const char *id;
+	size_t idlen;
+	size_t i;
+} SM9_VERIFY_ORDER;
 
-int sm9_sign_finish_precompute_step1(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, uint8_t *sig, size_t *siglen)
+// 按 (idlen, id) 排序, 相同 ID 的项排在一起
+static int sm9_verify_order_cmp(const void *a, const void *b)
 {
-	SM9_SIGNATURE signature;
-
-	// 测试sm_do_sign性能
-	// PERFORMANCE_TEST_NEW("sm9_do_sign", sm9_do_sign(key, &ctx->sm3_ctx, &signature));
+	const SM9_VERIFY_ORDER *x = (const SM9_VERIFY_ORDER *)a;
+	const SM9_VERIFY_ORDER *y = (const SM9_VERIFY_ORDER *)b;
+	int c;
 
-	// 签名
-	sm9_do_sign_prestep1(key, &ctx->sm3_ctx, &signature);
-	return 1;
+	if (x->idlen != y->idlen) {
+		return (x->idlen < y->idlen ? -1 : 1);
+	}
+	if ((c = memcmp(x->id, y->id, x->idlen)) != 0) {
+		return c;
+	}
+	return (x->i < y->i ? -1 : (x->i > y->i));
 }
-int sm9_sign_finish_precompute_step2(SM9_SIGN_CTX *ctx, const SM9_SIGN_KEY *key, uint8_t *sig, size_t *siglen)
-{
-	SM9_SIGNATURE signature;
 
-	// 测试sm_do_sign性能
-	// PERFORMANCE_TEST_NEW("sm9_do_sign", sm9_do_sign(key, &ctx->sm3_ctx, &signature));
+// 批量验签: h = H2(M || w) 只能对每个 w 单独验证, 因此分摊的是 g 的预计算表和同一 ID 的直线系数.
+// 按 ID 排序后逐组处理, 同时只保留一组直线系数; 只出现一次的 ID 直接用 sm9_pairing_ate
+int sm9_verify_finish_batch(SM9_SIGN_MPK_PRE *pre, const SM9_VERIFY_ITEM *items, size_t n, int *ret)
+{
+	int res = 1, use_lines = 0, have;
+	size_t g, k, j, i;
+	SM9_VERIFY_ORDER *order = NULL;
+	SM9_G2_PRE lines;
+	SM9_SIGNATURE sig;
+	const uint8_t *p;
+	size_t len;
+	bn_t h1, h2, ord;
+	fp12_t t, u;
+	ep2_t P;
+	SM9_ID_CACHE *cache = sm9_get_id_cache();
+	int cached = (sm9_id_cache_flags(cache) & SM9_ID_CACHE_LINES);
 
-	// 签名
-	if (sm9_do_sign_prestep2(key, &ctx->sm3_ctx, &signature) != 1) {
+	if (!pre->ready) {
 		error_print();
 		return -1;
 	}
-	*siglen = 0;
-	
-	// SM9_SIGNATURE 转成 字节数组
-	if (sm9_signature_to_der(&signature, &sig, siglen) != 1) {
+	if (n == 0) {
+		return 1;
+	}
+
+	order = (SM9_VERIFY_ORDER *)malloc(n * sizeof(SM9_VERIFY_ORDER));
+	if (order == NULL) {
 		error_print();
 		return -1;
 	}
-	return 1;
-}
+	for (i = 0; i < n; i++) {
+		order[i].id = items[i].id;
+		order[i].idlen = items[i].idlen;
+		order[i].i = i;
+	}
+	qsort(order, n, sizeof(SM9_VERIFY_ORDER), sm9_verify_order_cmp);
 
-int sm9_do_verify(const SM9_SIGN_KEY *mpk, const char *id, size_t idlen,
-	const SM3_CTX *sm3_ctx, const SM9_SIGNATURE *sig)
-{	
-	bn_t h1,h2;
+	bn_null(sig.h);
+	ep_null(sig.S);
 	bn_null(h1);
-	bn_new(h1);
 	bn_null(h2);
-	bn_new(h2);
-
-	fp12_t g;
-	fp12_t t;
-	fp12_t u;
-	fp12_t w;
-
-	fp12_null(g);
+	bn_null(ord);
 	fp12_null(t);
 	fp12_null(u);
-	fp12_null(w);
-	fp12_new(g);
+	ep2_null(P);
+
+	bn_new(sig.h);
+	ep_new(sig.S);
+	bn_new(h1);
+	bn_new(h2);
+	bn_new(ord);
 	fp12_new(t);
 	fp12_new(u);
-	fp12_new(w);
-
-	ep2_t P;
-	ep2_null(P);
 	ep2_new(P);
-	
-	uint8_t wbuf[32 * 12];
-	uint8_t fubw[32*12];
-	SM3_CTX ctx = *sm3_ctx;
-	SM3_CTX tmp_ctx;
-	uint8_t ct1[4] = {0,0,0,1};
-	uint8_t ct2[4] = {0,0,0,2};
-	uint8_t hid[4] = {0,0,0,1};
-	uint8_t Ha[64];
-
-	ep_t SM9_P1;
-	ep_null(SM9_P1);
-	ep_new(SM9_P1);
-	g1_get_gen(SM9_P1);
-
-	// B1: check h in [1, N-1]
-
-	// B2: check S in G1
+	sm9_g2_pre_init(&lines);
 
-	// B3: g = e(P1, Ppubs)
+	g1_get_ord(ord);
 
-	sm9_pairing_fastest(g, mpk->Ppubs, SM9_P1);
-	// B4: t = g^h
-	fp12_pow_t(t, g, sig->h);
+	for (g = 0; g < n; g += k) {
+		// [g, g + k) 是同一个 ID 的项
+		for (k = 1; g + k < n && order[g + k].idlen == order[g].idlen
+			&& memcmp(order[g + k].id, order[g].id, order[g].idlen) == 0; k++);
+		// 缓存里有直线系数时直接取用, 否则只在 ID 重复时才值得预计算
+		use_lines = (cached || k > 1);
+		have = 0;
+
+		for (j = g; j < g + k; j++) {
+			i = order[j].i;
+			ret[i] = 0;
+
+			p = items[i].sig;
+			len = items[i].siglen;
+			if (sm9_signature_from_der(&sig, &p, &len) != 1
+				|| asn1_length_is_zero(len) != 1) {
+				ret[i] = -1;
+				res = RLC_MIN(res, 0);
+				continue;
+			}
 
-	// B5: h1 = H1(ID || hid, N)
-	sm9_hash1(h1, id, idlen, SM9_HID_SIGN);
-	// B6: P = h1 * P2 + Ppubs
-	//sm9_twist_point_mul_generator(&P, h1);
-	
-	ep2_mul_gen(P,h1);
-	ep2_add(P, P, mpk->Ppubs);
+			// B1: check h in [1, N-1]
+			if (bn_is_zero(sig.h) || bn_sign(sig.h) == RLC_NEG || bn_cmp(sig.h, ord) != RLC_LT) {
+				res = RLC_MIN(res, 0);
+				continue;
+			}
 
-	// B7: u = e(S, P)
-	sm9_pairing_fastest(u, P, sig->S);
+			// B2: check S in G1
+			if (!ep_on_curve(sig.S) || ep_is_infty(sig.S)) {
+				res = RLC_MIN(res, 0);
+				continue;
+			}
 
+			// B5, B6: P = H1(ID || hid, N) * P2 + Ppubs, 每组只算一次
+			if (!have) {
+				if (sm9_id_cache_g2(cache, pre->Ppubs, items[i].id, items[i].idlen,
+					h1, P, use_lines ? &lines : NULL) < 0) {
+					error_print();
+					for (; j < g + k; j++) {
+						ret[order[j].i] = -1;
+					}
+					res = -1;
+					break;
+				}
+				if (use_lines && !cached) {
+					sm9_g2_pre_set(&lines, P);
+				}
+				have = 1;
+			}
 
-	// B8: w = u * t
-	fp12_mul_t(w, u, t);
-	//sm9_fp12_to_bytes(w, wbuf);
-	fp12_write_bin(wbuf, 32*12, w, 0);
+			// B4: t = g^h
+			fp12_pow_fix(t, pre->t, sig.h);
 
-	for(int i = 0;i<384;i++){
-		fubw[(11-i/32)*32+i%32] = wbuf[i];
-	}
+			// B7: u = e(S, P)
+			if (use_lines) {
+				sm9_pairing_pre(u, &lines, sig.S);
+			} else {
+				sm9_pairing_ate(u, P, sig.S);
+			}
 
-	// B9: h2 = H2(M || w, N), check h2 == h
-	sm3_update(&ctx, fubw, sizeof(fubw));
-	tmp_ctx = ctx;
-	sm3_update(&ctx, ct1, sizeof(ct1));
-	sm3_finish(&ctx, Ha);
-	sm3_update(&tmp_ctx, ct2, sizeof(ct2));
-	sm3_finish(&tmp_ctx, Ha + 32);
-	sm9_fn_from_hash(h2, Ha);
+			// B8: w = u * t
+			fp12_mul_t(u, u, t);
 
-	if (bn_cmp(h2, sig->h) != 0) {
-		return 0;
+			// B9: h2 = H2(M || w, N), check h2 == h
+			sm9_hash2_w(h2, &items[i].ctx->sm3_ctx, u);
+			if (bn_cmp(h2, sig.h) == RLC_EQ) {
+				ret[i] = 1;
+			} else {
+				res = RLC_MIN(res, 0);
+			}
+		}
 	}
 
+	free(order);
+	sm9_g2_pre_free(&lines);
+	bn_free(sig.h);
+	ep_free(sig.S);
 	bn_free(h1);
 	bn_free(h2);
-	fp12_free(g);
+	bn_free(ord);
 	fp12_free(t);
 	fp12_free(u);
-	fp12_free(w);
-	ep_free(SM9_P1);
 	ep2_free(P);
-
-	return 1;
-}
-
-int sm9_verify_init(SM9_SIGN_CTX *ctx)
-{
-	const uint8_t prefix[1] = { SM9_HASH2_PREFIX };
-	sm3_init(&ctx->sm3_ctx);
-	sm3_update(&ctx->sm3_ctx, prefix, sizeof(prefix));
-	return 1;
-}
-
-int sm9_verify_update(SM9_SIGN_CTX *ctx, const uint8_t *data, size_t datalen)
-{
-	sm3_update(&ctx->sm3_ctx, data, datalen);
-	return 1;
-}
-
-int sm9_verify_finish(SM9_SIGN_CTX *ctx, const uint8_t *sig, size_t siglen,
-	const SM9_SIGN_KEY *mpk, const char *id, size_t idlen)
-{
-	int ret;
-	SM9_SIGNATURE signature;
-	bn_null(signature.h);
-	bn_new(signature.h);
-	ep_null(signature.S);
-	ep_new(signature.S);
-
-	if (sm9_signature_from_der(&signature, &sig, &siglen) != 1
-		|| asn1_length_is_zero(siglen) != 1) {
-		error_print();
-		return -1;
-	}
-
-	if ((ret = sm9_do_verify(mpk, id, idlen, &ctx->sm3_ctx, &signature)) < 0) {
-		error_print();
-		return -1;
-	}
-	//printf("\nsignature.h2 is :\n");
-	//bn_print(signature.h);
-	bn_free(signature.h);
-	ep_free(signature.S);
-	return ret;
+	return res;
 }
 
 //----------------------------speed test modules-------------------
@@ -0,0 +1,518 @@
+/*
+ * RELIC is an Efficient LIbrary for Cryptography
+ * Copyright (c) 2012 RELIC Authors
+ *
+ * This file is part of RELIC. RELIC is legal property of its developers,
+ * whose names are not listed here. Please refer to the COPYRIGHT file
+ * for contact information.
+ *
+ * RELIC is free software; you can redistribute it and/or modify it under the
+ * terms of the version 2.1 (or later) of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; or version 2.0 of the Apache
+ * License as published by the Apache Software Foundation. See the LICENSE files
+ * for more details.
+ *
+ * RELIC is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the LICENSE files for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public or the
+ * Apache License along with RELIC. If not, see <https://www.gnu.org/licenses/>
+ * or <https://www.apache.org/licenses/>.
+ */
+
+// 身份缓存: 键为 SM3(主公钥 || hid || ID), 按键分片, 每片一把锁, 片内是哈希链加 LRU 双向链表
+
+#include <pthread.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sm9.h"
+
+// 未指定分片数时的默认值
+#define SM9_CACHE_SHARDS	16
+
+typedef struct sm9_id_entry_st SM9_ID_ENTRY;
+
+// 两类项的值, 插入时按类型分配, 不用的表和直线不分配
+typedef struct {
+	ep_t Q;                       // h1 * P1 + Ppube, hid 为 2 或 3
+	ep_t t[SM9_DS_TABLE];         // Q 的 comb 表, SM9_ID_CACHE_TABLES
+} SM9_ID_G1;
+
+typedef struct {
+	ep2_t P;                      // h1 * P2 + Ppubs, hid 为 1
+	SM9_G2_PRE pre;               // P 的 Miller 线, SM9_ID_CACHE_LINES
+} SM9_ID_G2;
+
+struct sm9_id_entry_st {
+	uint8_t key[SM3_DIGEST_SIZE];
+	SM9_ID_ENTRY *chain;          // 同一个桶里的下一项, 空闲时串成空闲链表
+	SM9_ID_ENTRY *prev, *next;    // LRU 链表, head 是最近用过的
+	bn_t h1;
+	int g2;                       // val 是 SM9_ID_G2 还是 SM9_ID_G1
+	void *val;                    // 空闲项为 NULL
+};
+
+typedef struct {
+	pthread_mutex_t lock;
+	SM9_ID_ENTRY *entries;
+	SM9_ID_ENTRY **buckets;
+	size_t mask;                  // 桶数减一, 桶数是 2 的幂
+	SM9_ID_ENTRY *head, *tail, *idle;
+	uint64_t hits, misses, evictions;
+} SM9_ID_SHARD;
+
+struct sm9_id_cache_st {
+	SM9_ID_SHARD *shards;
+	size_t num;
+	size_t cap;                   // 每片的项数
+	int flags;
+};
+
+static SM9_ID_CACHE *sm9_id_cache_used = NULL;
+
+static uint32_t sm9_id_cache_u32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void sm9_id_cache_key(uint8_t key[SM3_DIGEST_SIZE], const uint8_t *mpk, size_t mpklen,
+	uint8_t hid, const char *id, size_t idlen)
+{
+	SM3_CTX ctx;
+
+	sm3_init(&ctx);
+	sm3_update(&ctx, mpk, mpklen);
+	sm3_update(&ctx, &hid, 1);
+	sm3_update(&ctx, (const uint8_t *)id, idlen);
+	sm3_finish(&ctx, key);
+}
+
+static void sm9_g2_pre_copy(SM9_G2_PRE *r, const SM9_G2_PRE *a)
+{
+	ep2_copy(r->Q, (ep2_st *)a->Q);
+	for (int i = 0; i < a->len; i++) {
+		for (int j = 0; j < 3; j++) {
+			fp2_copy(r->l[i][j], (fp_t *)a->l[i][j]);
+		}
+	}
+	r->len = a->len;
+}
+
+static SM9_ID_G1 *sm9_id_g1_new(int tab)
+{
+	SM9_ID_G1 *v = (SM9_ID_G1 *)malloc(tab ? sizeof(SM9_ID_G1) : offsetof(SM9_ID_G1, t));
+
+	if (v == NULL) {
+		return NULL;
+	}
+	ep_null(v->Q);
+	ep_new(v->Q);
+	for (int i = 0; tab && i < SM9_DS_TABLE; i++) {
+		ep_null(v->t[i]);
+		ep_new(v->t[i]);
+	}
+	return v;
+}
+
+static SM9_ID_G2 *sm9_id_g2_new(int lines)
+{
+	SM9_ID_G2 *v = (SM9_ID_G2 *)malloc(lines ? sizeof(SM9_ID_G2) : offsetof(SM9_ID_G2, pre));
+
+	if (v == NULL) {
+		return NULL;
+	}
+	ep2_null(v->P);
+	ep2_new(v->P);
+	if (lines) {
+		sm9_g2_pre_init(&v->pre);
+	}
+	return v;
+}
+
+static void sm9_id_val_free(void *val, int g2, int flags)
+{
+	if (val == NULL) {
+		return;
+	}
+	if (g2) {
+		ep2_free(((SM9_ID_G2 *)val)->P);
+		if (flags & SM9_ID_CACHE_LINES) {
+			sm9_g2_pre_free(&((SM9_ID_G2 *)val)->pre);
+		}
+	} else {
+		ep_free(((SM9_ID_G1 *)val)->Q);
+		for (int i = 0; (flags & SM9_ID_CACHE_TABLES) && i < SM9_DS_TABLE; i++) {
+			ep_free(((SM9_ID_G1 *)val)->t[i]);
+		}
+	}
+	free(val);
+}
+
+static void sm9_id_entry_init(SM9_ID_ENTRY *e)
+{
+	bn_null(e->h1);
+	bn_new(e->h1);
+	e->g2 = 0;
+	e->val = NULL;
+}
+
+static void sm9_id_entry_free(SM9_ID_ENTRY *e, int flags)
+{
+	bn_free(e->h1);
+	sm9_id_val_free(e->val, e->g2, flags);
+}
+
+static void sm9_id_lru_unlink(SM9_ID_SHARD *s, SM9_ID_ENTRY *e)
+{
+	if (e->prev != NULL) {
+		e->prev->next = e->next;
+	} else {
+		s->head = e->next;
+	}
+	if (e->next != NULL) {
+		e->next->prev = e->prev;
+	} else {
+		s->tail = e->prev;
+	}
+}
+
+static void sm9_id_lru_push(SM9_ID_SHARD *s, SM9_ID_ENTRY *e)
+{
+	e->prev = NULL;
+	e->next = s->head;
+	if (s->head != NULL) {
+		s->head->prev = e;
+	}
+	s->head = e;
+	if (s->tail == NULL) {
+		s->tail = e;
+	}
+}
+
+static void sm9_id_chain_remove(SM9_ID_SHARD *s, SM9_ID_ENTRY *e)
+{
+	SM9_ID_ENTRY **p = &s->buckets[sm9_id_cache_u32(e->key + 4) & s->mask];
+
+	while (*p != e) {
+		p = &(*p)->chain;
+	}
+	*p = e->chain;
+}
+
+// 在锁内调用, 命中时把它移到 LRU 头部
+static SM9_ID_ENTRY *sm9_id_lookup(SM9_ID_SHARD *s, const uint8_t key[SM3_DIGEST_SIZE])
+{
+	SM9_ID_ENTRY *e = s->buckets[sm9_id_cache_u32(key + 4) & s->mask];
+
+	while (e != NULL && memcmp(e->key, key, SM3_DIGEST_SIZE) != 0) {
+		e = e->chain;
+	}
+	if (e != NULL && e != s->head) {
+		sm9_id_lru_unlink(s, e);
+		sm9_id_lru_push(s, e);
+	}
+	return e;
+}
+
+// 在锁内调用, 取一个空闲项, 没有时淘汰最久未用的一项
+static SM9_ID_ENTRY *sm9_id_insert(SM9_ID_SHARD *s, const uint8_t key[SM3_DIGEST_SIZE])
+{
+	SM9_ID_ENTRY *e, **b;
+
+	if (s->idle != NULL) {
+		e = s->idle;
+		s->idle = e->chain;
+	} else {
+		e = s->tail;
+		sm9_id_lru_unlink(s, e);
+		sm9_id_chain_remove(s, e);
+		s->evictions++;
+	}
+	memcpy(e->key, key, SM3_DIGEST_SIZE);
+	b = &s->buckets[sm9_id_cache_u32(key + 4) & s->mask];
+	e->chain = *b;
+	*b = e;
+	sm9_id_lru_push(s, e);
+	return e;
+}
+
+SM9_ID_CACHE *sm9_id_cache_new(size_t capacity, size_t shards, int flags)
+{
+	SM9_ID_CACHE *cache;
+	SM9_ID_SHARD *s;
+	size_t i, j, buckets;
+
+	if (shards == 0) {
+		shards = SM9_CACHE_SHARDS;
+	}
+	if (capacity == 0) {
+		error_print();
+		return NULL;
+	}
+	shards = RLC_MIN(shards, capacity);
+
+	cache = (SM9_ID_CACHE *)calloc(1, sizeof(SM9_ID_CACHE));
+	if (cache == NULL) {
+		error_print();
+		return NULL;
+	}
+	cache->shards = (SM9_ID_SHARD *)calloc(shards, sizeof(SM9_ID_SHARD));
+	if (cache->shards == NULL) {
+		free(cache);
+		error_print();
+		return NULL;
+	}
+	cache->cap = (capacity + shards - 1) / shards;
+	cache->flags = flags;
+
+	for (buckets = 1; buckets < 2 * cache->cap; buckets <<= 1);
+
+	for (i = 0; i < shards; i++) {
+		s = &cache->shards[i];
+		pthread_mutex_init(&s->lock, NULL);
+		cache->num = i + 1;
+		s->entries = (SM9_ID_ENTRY *)calloc(cache->cap, sizeof(SM9_ID_ENTRY));
+		s->buckets = (SM9_ID_ENTRY **)calloc(buckets, sizeof(SM9_ID_ENTRY *));
+		if (s->entries == NULL || s->buckets == NULL) {
+			break;
+		}
+		s->mask = buckets - 1;
+		for (j = 0; j < cache->cap; j++) {
+			sm9_id_entry_init(&s->entries[j]);
+			s->entries[j].chain = s->idle;
+			s->idle = &s->entries[j];
+		}
+	}
+
+	if (i < shards) {
+		sm9_id_cache_free(cache);
+		error_print();
+		return NULL;
+	}
+	return cache;
+}
+
+void sm9_id_cache_free(SM9_ID_CACHE *cache)
+{
+	SM9_ID_CACHE *used;
+	SM9_ID_SHARD *s;
+
+	if (cache == NULL) {
+		return;
+	}
+	// 若它还是当前使用的缓存, 先摘下来
+	used = cache;
+	__atomic_compare_exchange_n(&sm9_id_cache_used, &used, NULL, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	for (size_t i = 0; i < cache->num; i++) {
+		s = &cache->shards[i];
+		for (size_t j = 0; s->entries != NULL && j < cache->cap; j++) {
+			sm9_id_entry_free(&s->entries[j], cache->flags);
+		}
+		pthread_mutex_destroy(&s->lock);
+		free(s->entries);
+		free(s->buckets);
+	}
+	free(cache->shards);
+	free(cache);
+}
+
+int sm9_id_cache_flags(const SM9_ID_CACHE *cache)
+{
+	return (cache != NULL ? cache->flags : 0);
+}
+
+void sm9_id_cache_stats(SM9_ID_CACHE *cache, uint64_t *hits, uint64_t *misses, uint64_t *evictions)
+{
+	uint64_t h = 0, m = 0, e = 0;
+
+	for (size_t i = 0; cache != NULL && i < cache->num; i++) {
+		pthread_mutex_lock(&cache->shards[i].lock);
+		h += cache->shards[i].hits;
+		m += cache->shards[i].misses;
+		e += cache->shards[i].evictions;
+		pthread_mutex_unlock(&cache->shards[i].lock);
+	}
+	if (hits != NULL) {
+		*hits = h;
+	}
+	if (misses != NULL) {
+		*misses = m;
+	}
+	if (evictions != NULL) {
+		*evictions = e;
+	}
+}
+
+int sm9_id_cache_g1(SM9_ID_CACHE *cache, const ep_t Ppube, uint8_t hid,
+	const char *id, size_t idlen, bn_t h1, ep_t Q, ep_t *t)
+{
+	uint8_t mpk[65], key[SM3_DIGEST_SIZE];
+	SM9_ID_SHARD *s = NULL;
+	SM9_ID_ENTRY *e;
+	SM9_ID_G1 *v = NULL;
+	void *old = NULL;
+	int old_g2 = 0;
+	int tab = (sm9_id_cache_flags(cache) & SM9_ID_CACHE_TABLES);
+	bn_t h;
+
+	if (cache != NULL) {
+		ep_write_bin(mpk, sizeof(mpk), Ppube, 0);
+		sm9_id_cache_key(key, mpk, sizeof(mpk), hid, id, idlen);
+		s = &cache->shards[sm9_id_cache_u32(key) % cache->num];
+
+		pthread_mutex_lock(&s->lock);
+		e = sm9_id_lookup(s, key);
+		if (e != NULL) {
+			s->hits++;
+			v = (SM9_ID_G1 *)e->val;
+			if (h1 != NULL) {
+				bn_copy(h1, e->h1);
+			}
+			ep_copy(Q, v->Q);
+			for (int i = 0; tab && t != NULL && i < SM9_DS_TABLE; i++) {
+				ep_copy(t[i], v->t[i]);
+			}
+			pthread_mutex_unlock(&s->lock);
+			return 1;
+		}
+		s->misses++;
+		pthread_mutex_unlock(&s->lock);
+
+		v = sm9_id_g1_new(tab);
+		if (v == NULL) {
+			error_print();
+			return -1;
+		}
+	}
+
+	// 未命中时在锁外计算, 缓存要存的表也直接算进新项里
+	bn_null(h);
+	bn_new(h);
+
+	sm9_hash1(h, id, idlen, hid);
+	ep_mul_gen(Q, h);
+	ep_add(Q, Q, Ppube);
+	ep_norm(Q, Q);
+	if (h1 != NULL) {
+		bn_copy(h1, h);
+	}
+
+	if (s != NULL) {
+		ep_copy(v->Q, Q);
+		if (tab) {
+			ep_mul_fix_glv_pre(v->t, Q);
+			for (int i = 0; t != NULL && i < SM9_DS_TABLE; i++) {
+				ep_copy(t[i], v->t[i]);
+			}
+		}
+		pthread_mutex_lock(&s->lock);
+		if (sm9_id_lookup(s, key) == NULL) {
+			e = sm9_id_insert(s, key);
+			old = e->val;
+			old_g2 = e->g2;
+			bn_copy(e->h1, h);
+			e->g2 = 0;
+			e->val = v;
+			v = NULL;
+		}
+		pthread_mutex_unlock(&s->lock);
+		// 被淘汰的值和没插进去的值都在锁外释放
+		sm9_id_val_free(old, old_g2, cache->flags);
+		sm9_id_val_free(v, 0, cache->flags);
+	}
+
+	bn_free(h);
+	return 0;
+}
+
+int sm9_id_cache_g2(SM9_ID_CACHE *cache, const ep2_t Ppubs,
+	const char *id, size_t idlen, bn_t h1, ep2_t P, SM9_G2_PRE *pre)
+{
+	uint8_t mpk[129], key[SM3_DIGEST_SIZE];
+	SM9_ID_SHARD *s = NULL;
+	SM9_ID_ENTRY *e;
+	SM9_ID_G2 *v = NULL;
+	void *old = NULL;
+	int old_g2 = 0;
+	int lines = (sm9_id_cache_flags(cache) & SM9_ID_CACHE_LINES);
+	bn_t h;
+
+	if (cache != NULL) {
+		ep2_write_bin(mpk, sizeof(mpk), (ep2_st *)Ppubs, 0);
+		sm9_id_cache_key(key, mpk, sizeof(mpk), SM9_HID_SIGN, id, idlen);
+		s = &cache->shards[sm9_id_cache_u32(key) % cache->num];
+
+		pthread_mutex_lock(&s->lock);
+		e = sm9_id_lookup(s, key);
+		if (e != NULL) {
+			s->hits++;
+			v = (SM9_ID_G2 *)e->val;
+			if (h1 != NULL) {
+				bn_copy(h1, e->h1);
+			}
+			ep2_copy(P, v->P);
+			if (lines && pre != NULL) {
+				sm9_g2_pre_copy(pre, &v->pre);
+			}
+			pthread_mutex_unlock(&s->lock);
+			return 1;
+		}
+		s->misses++;
+		pthread_mutex_unlock(&s->lock);
+
+		v = sm9_id_g2_new(lines);
+		if (v == NULL) {
+			error_print();
+			return -1;
+		}
+	}
+
+	bn_null(h);
+	bn_new(h);
+
+	sm9_hash1(h, id, idlen, SM9_HID_SIGN);
+	sm9_g2_mul_gen(P, h);
+	ep2_add(P, P, (ep2_st *)Ppubs);
+	ep2_norm(P, P);
+	if (h1 != NULL) {
+		bn_copy(h1, h);
+	}
+
+	if (s != NULL) {
+		ep2_copy(v->P, P);
+		if (lines) {
+			sm9_g2_pre_set(&v->pre, P);
+			if (pre != NULL) {
+				sm9_g2_pre_copy(pre, &v->pre);
+			}
+		}
+		pthread_mutex_lock(&s->lock);
+		if (sm9_id_lookup(s, key) == NULL) {
+			e = sm9_id_insert(s, key);
+			old = e->val;
+			old_g2 = e->g2;
+			bn_copy(e->h1, h);
+			e->g2 = 1;
+			e->val = v;
+			v = NULL;
+		}
+		pthread_mutex_unlock(&s->lock);
+		sm9_id_val_free(old, old_g2, cache->flags);
+		sm9_id_val_free(v, 1, cache->flags);
+	}
+
+	bn_free(h);
+	return 0;
+}
+
+void sm9_set_id_cache(SM9_ID_CACHE *cache)
+{
+	__atomic_store_n(&sm9_id_cache_used, cache, __ATOMIC_RELEASE);
+}
+
+SM9_ID_CACHE *sm9_get_id_cache(void)
+{
+	return __atomic_load_n(&sm9_id_cache_used, __ATOMIC_ACQUIRE);
+}
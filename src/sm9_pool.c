@@ -0,0 +1,335 @@
+/*
+ * RELIC is an Efficient LIbrary for Cryptography
+ * Copyright (c) 2012 RELIC Authors
+ *
+ * This file is part of RELIC. RELIC is legal property of its developers,
+ * whose names are not listed here. Please refer to the COPYRIGHT file
+ * for contact information.
+ *
+ * RELIC is free software; you can redistribute it and/or modify it under the
+ * terms of the version 2.1 (or later) of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; or version 2.0 of the Apache
+ * License as published by the Apache Software Foundation. See the LICENSE files
+ * for more details.
+ *
+ * RELIC is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the LICENSE files for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public or the
+ * Apache License along with RELIC. If not, see <https://www.gnu.org/licenses/>
+ * or <https://www.apache.org/licenses/>.
+ */
+
+// 批量配对的线程池: 线程常驻, 任务按块动态领取;
+// 没有 MULTI 时所有线程共用同一个 RELIC 上下文, 这时不起线程, 在调用者线程里依次计算
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "sm9.h"
+
+// 每个线程平均领取的块数, 块越小负载越均衡
+#define SM9_POOL_CHUNKS		8
+
+struct sm9_pairing_pool_st {
+	pthread_t *threads;
+	size_t num;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t done;
+	unsigned long gen;   // 任务编号, 每提交一次加一
+	size_t busy;         // 还在处理当前任务的线程数
+	int stop;
+
+	// 当前任务
+	sm9_pairing_f kernel;
+	fp12_t *r;
+	const ep2_t *Q;
+	const ep_t *P;
+	size_t n;
+	size_t chunk;
+	size_t next;
+
+#if defined(MULTI)
+	ctx_t *ctx;          // 每个线程一个 RELIC 上下文
+	const ctx_t *shared; // 创建者的上下文, 曲线和预计算表从这里共享
+#endif
+};
+
+typedef struct {
+	SM9_PAIRING_POOL *pool;
+	size_t id;
+} SM9_POOL_ARG;
+
+static void *sm9_pairing_pool_worker(void *arg)
+{
+	SM9_POOL_ARG *a = (SM9_POOL_ARG *)arg;
+	SM9_PAIRING_POOL *pool = a->pool;
+	unsigned long seen = 0;
+	size_t i, j, end;
+
+#if defined(MULTI)
+	core_thread_attach(&pool->ctx[a->id], pool->shared);
+#endif
+	free(a);
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->stop && pool->gen == seen) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		seen = pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+
+		while ((i = __sync_fetch_and_add(&pool->next, pool->chunk)) < pool->n) {
+			end = RLC_MIN(i + pool->chunk, pool->n);
+			for (j = i; j < end; j++) {
+				pool->kernel(pool->r[j], pool->Q[j], pool->P[j]);
+			}
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+#if defined(MULTI)
+	core_thread_detach();
+#endif
+	return NULL;
+}
+
+SM9_PAIRING_POOL *sm9_pairing_pool_new(size_t threads)
+{
+	SM9_PAIRING_POOL *pool;
+	SM9_POOL_ARG *arg;
+	size_t i;
+
+	if (threads == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cores > 0 ? (size_t)cores : 1);
+	}
+
+	pool = (SM9_PAIRING_POOL *)calloc(1, sizeof(SM9_PAIRING_POOL));
+	if (pool == NULL) {
+		error_print();
+		return NULL;
+	}
+	pool->threads = (pthread_t *)calloc(threads, sizeof(pthread_t));
+#if defined(MULTI)
+	pool->ctx = (ctx_t *)calloc(threads, sizeof(ctx_t));
+	if (pool->ctx == NULL) {
+		free(pool->threads);
+		pool->threads = NULL;
+	}
+#endif
+	if (pool->threads == NULL) {
+		free(pool);
+		error_print();
+		return NULL;
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+#if defined(MULTI)
+	pool->shared = core_get();
+#else
+	threads = 0;
+#endif
+
+	for (i = 0; i < threads; i++) {
+		arg = (SM9_POOL_ARG *)malloc(sizeof(SM9_POOL_ARG));
+		if (arg == NULL) {
+			break;
+		}
+		arg->pool = pool;
+		arg->id = i;
+		if (pthread_create(&pool->threads[i], NULL, sm9_pairing_pool_worker, arg) != 0) {
+			free(arg);
+			break;
+		}
+	}
+	pool->num = i;
+
+	if (pool->num == 0 && threads > 0) {
+		sm9_pairing_pool_free(pool);
+		error_print();
+		return NULL;
+	}
+	return pool;
+}
+
+void sm9_pairing_pool_free(SM9_PAIRING_POOL *pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (size_t i = 0; i < pool->num; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+#if defined(MULTI)
+	free(pool->ctx);
+#endif
+	free(pool);
+}
+
+size_t sm9_pairing_pool_size(const SM9_PAIRING_POOL *pool)
+{
+	return RLC_MAX(pool->num, 1);
+}
+
+int sm9_pairing_pool_run(SM9_PAIRING_POOL *pool, sm9_pairing_f kernel,
+	fp12_t r[], const ep2_t Q[], const ep_t P[], size_t n)
+{
+	if (pool == NULL) {
+		error_print();
+		return -1;
+	}
+	if (kernel == NULL) {
+		kernel = sm9_pairing_ate;
+	}
+	if (pool->num == 0) {
+		for (size_t i = 0; i < n; i++) {
+			kernel(r[i], Q[i], P[i]);
+		}
+		return 1;
+	}
+	if (n == 0) {
+		return 1;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->kernel = kernel;
+	pool->r = r;
+	pool->Q = Q;
+	pool->P = P;
+	pool->n = n;
+	pool->chunk = RLC_MAX(1, n / (pool->num * SM9_POOL_CHUNKS));
+	pool->next = 0;
+	pool->busy = pool->num;
+	pool->gen++;
+	pthread_cond_broadcast(&pool->work);
+	while (pool->busy > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 1;
+}
+
+void sm9_pairing_omp(fp12_t r_arr[], const ep2_t Q_arr[], const ep_t P_arr[], const size_t arr_size, const size_t threads_num)
+{
+	SM9_PAIRING_POOL *pool = sm9_pairing_pool_new(threads_num);
+
+	if (pool == NULL) {
+		for (size_t i = 0; i < arr_size; i++) {
+			sm9_pairing_ate(r_arr[i], Q_arr[i], P_arr[i]);
+		}
+		return;
+	}
+	sm9_pairing_pool_run(pool, sm9_pairing_ate, r_arr, Q_arr, P_arr, arr_size);
+	sm9_pairing_pool_free(pool);
+}
+
+typedef struct {
+	sm9_task_f task;
+	void *arg;
+	size_t begin;
+	size_t end;
+#if defined(MULTI)
+	ctx_t ctx;
+	const ctx_t *shared;
+#endif
+} SM9_RANGE_ARG;
+
+static void *sm9_parallel_worker(void *arg)
+{
+	SM9_RANGE_ARG *a = (SM9_RANGE_ARG *)arg;
+
+#if defined(MULTI)
+	core_thread_attach(&a->ctx, a->shared);
+#endif
+	a->task(a->arg, a->begin, a->end);
+#if defined(MULTI)
+	core_thread_detach();
+#endif
+	return NULL;
+}
+
+int sm9_parallel_run(size_t threads, sm9_task_f task, void *arg, size_t n)
+{
+	SM9_RANGE_ARG *a;
+	pthread_t *tid;
+	size_t i, num, step;
+
+	if (threads == 0) {
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cores > 0 ? (size_t)cores : 1);
+	}
+	threads = RLC_MIN(threads, n);
+#if !defined(MULTI)
+	// 共用一个上下文, 只能串行
+	threads = 1;
+#endif
+	if (threads <= 1) {
+		if (n > 0) {
+			task(arg, 0, n);
+		}
+		return 1;
+	}
+
+	a = (SM9_RANGE_ARG *)calloc(threads, sizeof(SM9_RANGE_ARG));
+	tid = (pthread_t *)calloc(threads, sizeof(pthread_t));
+	if (a == NULL || tid == NULL) {
+		free(a);
+		free(tid);
+		error_print();
+		return -1;
+	}
+
+	// 调用者自己处理第 0 段
+	step = (n + threads - 1) / threads;
+	for (i = 0; i < threads; i++) {
+		a[i].task = task;
+		a[i].arg = arg;
+		a[i].begin = RLC_MIN(i * step, n);
+		a[i].end = RLC_MIN(a[i].begin + step, n);
+#if defined(MULTI)
+		a[i].shared = core_get();
+#endif
+	}
+	for (num = 1; num < threads; num++) {
+		if (pthread_create(&tid[num], NULL, sm9_parallel_worker, &a[num]) != 0) {
+			break;
+		}
+	}
+	task(arg, a[0].begin, a[0].end);
+	for (i = 1; i < num; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	// 没能启动的线程的那几段也在这里做完
+	for (i = num; i < threads; i++) {
+		task(arg, a[i].begin, a[i].end);
+	}
+
+	free(a);
+	free(tid);
+	return 1;
+}
@@ -0,0 +1,307 @@
+/*
+ * RELIC is an Efficient LIbrary for Cryptography
+ * Copyright (c) 2012 RELIC Authors
+ *
+ * This file is part of RELIC. RELIC is legal property of its developers,
+ * whose names are not listed here. Please refer to the COPYRIGHT file
+ * for contact information.
+ *
+ * RELIC is free software; you can redistribute it and/or modify it under the
+ * terms of the version 2.1 (or later) of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; or version 2.0 of the Apache
+ * License as published by the Apache Software Foundation. See the LICENSE files
+ * for more details.
+ *
+ * RELIC is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+ * A PARTICULAR PURPOSE. See the LICENSE files for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public or the
+ * Apache License along with RELIC. If not, see <https://www.gnu.org/licenses/>
+ * or <https://www.apache.org/licenses/>.
+ */
+
+
+// 离线/在线签名与封装: 预先算好与消息和接收方无关的 (r, g^r), 在线时只剩一次哈希, 一次模运算和一次点乘
+
+#include <pthread.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/random.h>
+
+#include "sm9.h"
+
+struct sm9_rand_pool_st {
+	fp12_t g;
+	fp12_t t[SM9_FIX_TABLE];      // g 的固定基表
+	bn_t n1;                      // N - 1
+	bn_t *r;
+	fp12_t *w;                    // w[i] = g^r[i]
+	size_t cap;
+	size_t num;                   // 已填好的对数, 按栈使用
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_t thread;
+	int running;
+	int stop;
+#if defined(MULTI)
+	ctx_t ctx;
+	const ctx_t *shared;
+#endif
+};
+
+// r 取自操作系统, 不动 RELIC 上下文里的随机数状态, 后台线程和调用者可以同时取
+static int sm9_rand_pool_rand(SM9_RAND_POOL *pool, bn_t r)
+{
+	uint8_t buf[40];
+	size_t len = 0;
+	ssize_t n;
+
+	while (len < sizeof(buf)) {
+		n = getrandom(buf + len, sizeof(buf) - len, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			error_print();
+			return -1;
+		}
+		len += (size_t)n;
+	}
+
+	// r = (buf mod (N - 1)) + 1, 320 位对 256 位取模的偏差可以忽略
+	bn_read_bin(r, buf, sizeof(buf));
+	bn_mod(r, r, pool->n1);
+	bn_add_dig(r, r, 1);
+	memset(buf, 0, sizeof(buf));
+	return 1;
+}
+
+static int sm9_rand_pool_pair(SM9_RAND_POOL *pool, bn_t r, fp12_t w)
+{
+	if (sm9_rand_pool_rand(pool, r) != 1) {
+		return -1;
+	}
+	fp12_pow_fix_sec(w, pool->t, r);
+	return 1;
+}
+
+// 把一对放回池里, 池满时返回 0
+static int sm9_rand_pool_push(SM9_RAND_POOL *pool, const bn_t r, fp12_t w)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num < pool->cap) {
+		bn_copy(pool->r[pool->num], r);
+		fp12_copy(pool->w[pool->num], w);
+		pool->num++;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return ret;
+}
+
+static void *sm9_rand_pool_worker(void *arg)
+{
+	SM9_RAND_POOL *pool = (SM9_RAND_POOL *)arg;
+	bn_t r;
+	fp12_t w;
+
+#if defined(MULTI)
+	core_thread_attach(&pool->ctx, pool->shared);
+#endif
+	bn_null(r);
+	bn_new(r);
+	fp12_null(w);
+	fp12_new(w);
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->stop && pool->num == pool->cap) {
+			pthread_cond_wait(&pool->work, &pool->lock);
+		}
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		// 在锁外计算
+		if (sm9_rand_pool_pair(pool, r, w) != 1) {
+			break;
+		}
+		sm9_rand_pool_push(pool, r, w);
+	}
+
+	bn_zero(r);
+	bn_free(r);
+	fp12_free(w);
+#if defined(MULTI)
+	core_thread_detach();
+#endif
+	return NULL;
+}
+
+SM9_RAND_POOL *sm9_rand_pool_new(fp12_t g, size_t size, int background)
+{
+	SM9_RAND_POOL *pool;
+	size_t i;
+
+	if (size == 0) {
+		error_print();
+		return NULL;
+	}
+#if !defined(MULTI)
+	// 没有 MULTI 时后台线程只能用调用者的上下文, 两边的 RLC_TRY 和错误状态会互相覆盖
+	if (background) {
+		error_print();
+		return NULL;
+	}
+#endif
+
+	pool = (SM9_RAND_POOL *)calloc(1, sizeof(SM9_RAND_POOL));
+	if (pool == NULL) {
+		error_print();
+		return NULL;
+	}
+	pool->r = (bn_t *)calloc(size, sizeof(bn_t));
+	pool->w = (fp12_t *)calloc(size, sizeof(fp12_t));
+	if (pool->r == NULL || pool->w == NULL) {
+		free(pool->r);
+		free(pool->w);
+		free(pool);
+		error_print();
+		return NULL;
+	}
+	pool->cap = size;
+
+	fp12_null(pool->g);
+	fp12_new(pool->g);
+	for (i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_null(pool->t[i]);
+		fp12_new(pool->t[i]);
+	}
+	bn_null(pool->n1);
+	bn_new(pool->n1);
+	for (i = 0; i < size; i++) {
+		bn_null(pool->r[i]);
+		bn_new(pool->r[i]);
+		fp12_null(pool->w[i]);
+		fp12_new(pool->w[i]);
+	}
+
+	fp12_copy(pool->g, g);
+	fp12_pow_fix_pre(pool->t, pool->g);
+	g1_get_ord(pool->n1);
+	bn_sub_dig(pool->n1, pool->n1, 1);
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+
+	if (background) {
+#if defined(MULTI)
+		// 与 sm9_pairing_pool_new 相同, 线程里挂接到调用者的上下文
+		pool->shared = core_get();
+#endif
+		if (pthread_create(&pool->thread, NULL, sm9_rand_pool_worker, pool) != 0) {
+			sm9_rand_pool_free(pool);
+			error_print();
+			return NULL;
+		}
+		pool->running = 1;
+	}
+	return pool;
+}
+
+void sm9_rand_pool_free(SM9_RAND_POOL *pool)
+{
+	if (pool == NULL) {
+		return;
+	}
+
+	if (pool->running) {
+		pthread_mutex_lock(&pool->lock);
+		pool->stop = 1;
+		pthread_cond_broadcast(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+		pthread_join(pool->thread, NULL);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	for (size_t i = 0; i < pool->cap; i++) {
+		bn_zero(pool->r[i]);
+		bn_free(pool->r[i]);
+		fp12_free(pool->w[i]);
+	}
+	fp12_free(pool->g);
+	for (int i = 0; i < SM9_FIX_TABLE; i++) {
+		fp12_free(pool->t[i]);
+	}
+	bn_free(pool->n1);
+	free(pool->r);
+	free(pool->w);
+	free(pool);
+}
+
+size_t sm9_rand_pool_count(SM9_RAND_POOL *pool)
+{
+	size_t num;
+
+	pthread_mutex_lock(&pool->lock);
+	num = pool->num;
+	pthread_mutex_unlock(&pool->lock);
+	return num;
+}
+
+int sm9_rand_pool_fill(SM9_RAND_POOL *pool)
+{
+	int ret = 1;
+	bn_t r;
+	fp12_t w;
+
+	bn_null(r);
+	bn_new(r);
+	fp12_null(w);
+	fp12_new(w);
+
+	while (sm9_rand_pool_count(pool) < pool->cap) {
+		if (sm9_rand_pool_pair(pool, r, w) != 1) {
+			ret = -1;
+			break;
+		}
+		if (sm9_rand_pool_push(pool, r, w) != 1) {
+			break;
+		}
+	}
+
+	bn_zero(r);
+	bn_free(r);
+	fp12_free(w);
+	return ret;
+}
+
+int sm9_rand_pool_get(SM9_RAND_POOL *pool, bn_t r, fp12_t w)
+{
+	pthread_mutex_lock(&pool->lock);
+	if (pool->num > 0) {
+		pool->num--;
+		bn_copy(r, pool->r[pool->num]);
+		fp12_copy(w, pool->w[pool->num]);
+		// 每一对只用一次
+		bn_zero(pool->r[pool->num]);
+		pthread_cond_signal(&pool->work);
+		pthread_mutex_unlock(&pool->lock);
+		return 1;
+	}
+	pthread_cond_signal(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+
+	// 池空时当场计算
+	if (sm9_rand_pool_pair(pool, r, w) != 1) {
+		error_print();
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,1309 @@
+/**
+ * @file
+ *
+ * Tests for the SM9 protocols.
+ *
+ * @ingroup test
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "relic.h"
+#include "relic_test.h"
+#include "sm9.h"
+
+static int pairing(void) {
+    int code = RLC_ERR;
+    SM9_G2_PRE pre;
+    fp12_t a, b;
+    bn_t k, n;
+    ep_t P;
+    ep2_t Q;
+
+    fp12_null(a);
+    fp12_null(b);
+    bn_null(k);
+    bn_null(n);
+    ep_null(P);
+    ep2_null(Q);
+
+    fp12_new(a);
+    fp12_new(b);
+    bn_new(k);
+    bn_new(n);
+    ep_new(P);
+    ep2_new(Q);
+    sm9_g2_pre_init(&pre);
+
+    g1_get_ord(n);
+
+    TEST_CASE("scheduled miller loop matches the reference pairings") {
+        for (int i = 0; i < 4; i++) {
+            bn_rand_mod(k, n);
+            ep_mul_gen(P, k);
+            bn_rand_mod(k, n);
+            ep2_mul_gen(Q, k);
+            sm9_pairing_ate(a, Q, P);
+            sm9_pairing_fastest(b, Q, P);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+            sm9_pairing_fast(b, Q, P);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        }
+        ep_set_infty(P);
+        sm9_pairing_ate(a, Q, P);
+        fp12_set_dig(b, 1);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("product of two lines is correct") {
+        fp12_t c;
+        fp12_null(c);
+        fp12_new(c);
+        fp12_set_dig(a, 0);
+        fp12_set_dig(b, 0);
+        fp2_rand(a[0][0]);
+        fp2_rand(a[0][1]);
+        fp2_rand(a[1][1]);
+        fp2_rand(b[0][0]);
+        fp2_rand(b[0][1]);
+        fp2_rand(b[1][1]);
+        fp12_mul_line2(c, a, b);
+        fp12_mul_t(a, a, b);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        fp12_free(c);
+    } TEST_END;
+
+    TEST_CASE("lazily reduced tower products are correct") {
+        fp12_t c, d;
+        fp12_null(c);
+        fp12_null(d);
+        fp12_new(c);
+        fp12_new(d);
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 3; j++) {
+                fp2_rand(a[i][j]);
+            }
+        }
+        fp12_set_dig(b, 0);
+        fp2_rand(b[0][0]);
+        fp2_rand(b[0][1]);
+        fp2_rand(b[1][1]);
+        fp12_mul_t(d, a, b);
+        fp12_mul_sparse(c, a, b);
+        TEST_ASSERT(fp12_cmp(c, d) == RLC_EQ, end);
+        fp12_mul_t1(c, a, b);
+        TEST_ASSERT(fp12_cmp(c, d) == RLC_EQ, end);
+        fp12_copy(c, a);
+        fp12_mul_sparse(c, c, b);
+        TEST_ASSERT(fp12_cmp(c, d) == RLC_EQ, end);
+        fp12_copy(c, b);
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 3; j++) {
+                fp2_rand(b[i][j]);
+            }
+        }
+        fp12_mul_t(d, a, b);
+        fp12_mul_t1(a, a, b);
+        TEST_ASSERT(fp12_cmp(a, d) == RLC_EQ, end);
+        fp12_free(c);
+        fp12_free(d);
+    } TEST_END;
+
+    TEST_CASE("final exponentiation methods agree") {
+        fp12_t c;
+        fp12_null(c);
+        fp12_new(c);
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 3; j++) {
+                fp2_rand(a[i][j]);
+            }
+        }
+        sm9_final_exponent_method(b, a, SM9_FEXP_LATTICE);
+        for (int m = SM9_FEXP_CRUDE; m < SM9_FEXP_LATTICE; m++) {
+            sm9_final_exponent_method(c, a, m);
+            TEST_ASSERT(fp12_cmp(b, c) == RLC_EQ, end);
+        }
+        sm9_final_exponent_method(a, a, SM9_FEXP_DEFAULT);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        fp12_free(c);
+    } TEST_END;
+
+    TEST_CASE("batch final exponentiation is correct") {
+        fp12_t f[3], r[3];
+        ep_t Ps[3];
+        ep2_t Qs[3];
+        for (int i = 0; i < 3; i++) {
+            fp12_null(f[i]);
+            fp12_null(r[i]);
+            ep_null(Ps[i]);
+            ep2_null(Qs[i]);
+            fp12_new(f[i]);
+            fp12_new(r[i]);
+            ep_new(Ps[i]);
+            ep2_new(Qs[i]);
+            for (int j = 0; j < 2; j++) {
+                for (int l = 0; l < 3; l++) {
+                    fp2_rand(f[i][j][l]);
+                }
+            }
+        }
+        fp12_set_dig(f[1], 1);
+        sm9_final_exponent_sim(r, f, 3);
+        for (int i = 0; i < 3; i++) {
+            sm9_final_exponent_method(a, f[i], SM9_FEXP_RELIC);
+            TEST_ASSERT(fp12_cmp(a, r[i]) == RLC_EQ, end);
+        }
+        for (int i = 0; i < 3; i++) {
+            bn_rand_mod(k, n);
+            ep_mul_gen(Ps[i], k);
+            bn_rand_mod(k, n);
+            ep2_mul_gen(Qs[i], k);
+        }
+        ep_set_infty(Ps[2]);
+        sm9_pairing_batch(r, Qs, Ps, 3);
+        for (int i = 0; i < 3; i++) {
+            sm9_pairing_fastest(a, Qs[i], Ps[i]);
+            if (i == 2) {
+                fp12_set_dig(a, 1);
+            }
+            TEST_ASSERT(fp12_cmp(a, r[i]) == RLC_EQ, end);
+        }
+        for (int i = 0; i < 3; i++) {
+            fp12_free(f[i]);
+            fp12_free(r[i]);
+            ep_free(Ps[i]);
+            ep2_free(Qs[i]);
+        }
+    } TEST_END;
+
+    TEST_CASE("pairing with prepared lines is correct") {
+        g2_get_gen(Q);
+        sm9_g2_pre_set(&pre, Q);
+        TEST_ASSERT(pre.len == SM9_G2_PRE_LINES, end);
+        for (int i = 0; i < 4; i++) {
+            bn_rand_mod(k, n);
+            ep_mul_gen(P, k);
+            sm9_pairing_fastest(a, Q, P);
+            sm9_pairing_pre(b, &pre, P);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        }
+        bn_rand_mod(k, n);
+        ep2_mul_gen(Q, k);
+        sm9_g2_pre_set(&pre, Q);
+        sm9_pairing_fastest(a, Q, P);
+        sm9_pairing_pre(b, &pre, P);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("product of pairings is correct") {
+        ep_t Ps[3];
+        ep2_t Qs[3];
+        for (int i = 0; i < 3; i++) {
+            ep_null(Ps[i]);
+            ep_new(Ps[i]);
+            ep2_null(Qs[i]);
+            ep2_new(Qs[i]);
+            bn_rand_mod(k, n);
+            ep_mul_gen(Ps[i], k);
+            bn_rand_mod(k, n);
+            ep2_mul_gen(Qs[i], k);
+        }
+        sm9_pairing_sim(a, Qs, Ps, 1);
+        sm9_pairing_fastest(b, Qs[0], Ps[0]);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        fp12_set_dig(b, 1);
+        for (int i = 0; i < 3; i++) {
+            sm9_pairing_fastest(a, Qs[i], Ps[i]);
+            fp12_mul_t(b, b, a);
+        }
+        sm9_pairing_sim(a, Qs, Ps, 3);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        /* e(P, Q) * e(-P, Q) = 1, infinity is skipped. */
+        ep_neg(Ps[1], Ps[0]);
+        ep2_copy(Qs[1], Qs[0]);
+        ep_set_infty(Ps[2]);
+        sm9_pairing_sim(a, Qs, Ps, 3);
+        fp12_set_dig(b, 1);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        for (int i = 0; i < 3; i++) {
+            ep_free(Ps[i]);
+            ep2_free(Qs[i]);
+        }
+    } TEST_END;
+
+    TEST_CASE("batch pairing engine is correct") {
+        SM9_PAIRING_POOL *pool = sm9_pairing_pool_new(3);
+        fp12_t rs[10];
+        ep_t Ps[10];
+        ep2_t Qs[10];
+        int ok = (pool != NULL);
+        for (int i = 0; i < 10; i++) {
+            fp12_null(rs[i]);
+            fp12_new(rs[i]);
+            ep_null(Ps[i]);
+            ep_new(Ps[i]);
+            ep2_null(Qs[i]);
+            ep2_new(Qs[i]);
+            bn_rand_mod(k, n);
+            ep_mul_gen(Ps[i], k);
+            bn_rand_mod(k, n);
+            ep2_mul_gen(Qs[i], k);
+        }
+        /* Run twice with sizes that are not a multiple of the pool size. */
+        for (int m = 10; ok && m >= 7; m -= 3) {
+            ok &= (sm9_pairing_pool_run(pool, NULL, rs, Qs, Ps, m) == 1);
+            for (int i = 0; i < m; i++) {
+                sm9_pairing_fastest(a, Qs[i], Ps[i]);
+                ok &= (fp12_cmp(a, rs[i]) == RLC_EQ);
+            }
+        }
+        sm9_pairing_pool_free(pool);
+        for (int i = 0; i < 10; i++) {
+            fp12_free(rs[i]);
+            ep_free(Ps[i]);
+            ep2_free(Qs[i]);
+        }
+        TEST_ASSERT(ok, end);
+    } TEST_END;
+
+    code = RLC_OK;
+  end:
+    fp12_free(a);
+    fp12_free(b);
+    bn_free(k);
+    bn_free(n);
+    ep_free(P);
+    ep2_free(Q);
+    sm9_g2_pre_free(&pre);
+    return code;
+}
+
+static int exponentiation(void) {
+    int code = RLC_ERR;
+    fp12_t g, a, b, c, t[SM9_FIX_TABLE];
+    bn_t k, l, n;
+    ep_t P1;
+    ep2_t P2;
+
+    fp12_null(g);
+    fp12_null(a);
+    fp12_null(b);
+    fp12_null(c);
+    bn_null(k);
+    bn_null(l);
+    bn_null(n);
+    ep_null(P1);
+    ep2_null(P2);
+
+    fp12_new(g);
+    fp12_new(a);
+    fp12_new(b);
+    fp12_new(c);
+    bn_new(k);
+    bn_new(l);
+    bn_new(n);
+    ep_new(P1);
+    ep2_new(P2);
+    for (int i = 0; i < SM9_FIX_TABLE; i++) {
+        fp12_null(t[i]);
+        fp12_new(t[i]);
+    }
+
+    g1_get_gen(P1);
+    g2_get_gen(P2);
+    g1_get_ord(n);
+    sm9_pairing_fastest(g, P2, P1);
+    fp12_pow_fix_pre(t, g);
+
+    TEST_CASE("fixed-base exponentiation is correct") {
+        fp12_set_dig(c, 1);
+        bn_set_dig(k, 0);
+        fp12_pow_fix(a, t, k);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        bn_set_dig(k, 1);
+        fp12_pow_fix(a, t, k);
+        TEST_ASSERT(fp12_cmp(a, g) == RLC_EQ, end);
+        fp12_pow_fix(a, t, n);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        bn_rand_mod(k, n);
+        bn_rand_mod(l, n);
+        fp12_pow_fix(a, t, k);
+        fp12_pow_fix(b, t, l);
+        fp12_mul_t(a, a, b);
+        bn_add(k, k, l);
+        fp12_pow_fix(b, t, k);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        bn_neg(l, l);
+        fp12_pow_fix(a, t, l);
+        fp12_pow_fix(c, t, k);
+        fp12_mul_t(a, a, c);
+        bn_add(k, k, l);
+        fp12_pow_fix(b, t, k);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("constant-time fixed-base exponentiation is correct") {
+        bn_rand_mod(k, n);
+        fp12_pow_fix(a, t, k);
+        fp12_pow_fix_sec(b, t, k);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        fp12_set_dig(c, 1);
+        bn_set_dig(k, 0);
+        fp12_pow_fix_sec(a, t, k);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        bn_set_dig(k, 1);
+        fp12_pow_fix_sec(a, t, k);
+        TEST_ASSERT(fp12_cmp(a, g) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("cyclotomic exponentiation is correct") {
+        fp12_set_dig(c, 1);
+        bn_set_dig(k, 0);
+        fp12_pow_cyc_t(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        fp12_pow_cyc_t(a, g, n);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        bn_set_dig(k, 1);
+        fp12_pow_cyc_t(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, g) == RLC_EQ, end);
+        for (int i = 0; i < 4; i++) {
+            bn_rand_mod(k, n);
+            fp12_pow_fix(a, t, k);
+            fp12_pow_cyc_t(b, g, k);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        }
+        bn_neg(k, k);
+        fp12_pow_fix(a, t, k);
+        fp12_copy(b, g);
+        fp12_pow_cyc_t(b, b, k);
+        TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("frobenius decomposed exponentiation is correct") {
+        fp12_set_dig(c, 1);
+        bn_set_dig(k, 0);
+        fp12_pow_gls(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        fp12_pow_gls_sec(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        fp12_pow_gls_sec(a, g, n);
+        TEST_ASSERT(fp12_cmp(a, c) == RLC_EQ, end);
+        bn_set_dig(k, 1);
+        fp12_pow_gls(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, g) == RLC_EQ, end);
+        fp12_pow_gls_sec(a, g, k);
+        TEST_ASSERT(fp12_cmp(a, g) == RLC_EQ, end);
+        for (int i = 0; i < 8; i++) {
+            bn_rand_mod(k, n);
+            if (i & 1) {
+                bn_neg(k, k);
+            }
+            fp12_pow_cyc_t(a, g, k);
+            fp12_pow_gls(b, g, k);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+            fp12_copy(b, g);
+            fp12_pow_gls_sec(b, b, k);
+            TEST_ASSERT(fp12_cmp(a, b) == RLC_EQ, end);
+        }
+    } TEST_END;
+
+    code = RLC_OK;
+  end:
+    fp12_free(g);
+    fp12_free(a);
+    fp12_free(b);
+    fp12_free(c);
+    bn_free(k);
+    bn_free(l);
+    bn_free(n);
+    ep_free(P1);
+    ep2_free(P2);
+    for (int i = 0; i < SM9_FIX_TABLE; i++) {
+        fp12_free(t[i]);
+    }
+    return code;
+}
+
+typedef struct {
+    SM9_SIGN_MPK_PRE *pre;
+    const char *id;
+    const uint8_t *msg;
+    size_t msglen;
+    const uint8_t *sig;
+    size_t siglen;
+    int ok;
+#if defined(MULTI)
+    ctx_t ctx;
+    const ctx_t *shared;
+#endif
+} SHARED_ARG;
+
+// 只读共享状态的线程: 验签, P2 的固定基乘法, 以及成对的 sm9_init/sm9_clean
+static void *shared_state_worker(void *arg) {
+    SHARED_ARG *a = (SHARED_ARG *)arg;
+    SM9_SIGN_CTX ctx;
+    bn_t k;
+    ep2_t P, Q;
+
+#if defined(MULTI)
+    core_thread_attach(&a->ctx, a->shared);
+#endif
+    bn_null(k);
+    ep2_null(P);
+    ep2_null(Q);
+    bn_new(k);
+    ep2_new(P);
+    ep2_new(Q);
+
+    a->ok = 1;
+    for (int i = 0; i < 4; i++) {
+        sm9_init();
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, a->msg, a->msglen);
+        if (sm9_verify_finish_pre(&ctx, a->sig, a->siglen, a->pre, a->id, strlen(a->id)) != 1) {
+            a->ok = 0;
+        }
+        bn_set_dig(k, 12345 + i);
+        sm9_g2_mul_gen(P, k);
+        ep2_mul_gen(Q, k);
+        if (ep2_cmp(P, Q) != RLC_EQ) {
+            a->ok = 0;
+        }
+        sm9_clean();
+    }
+
+    bn_free(k);
+    ep2_free(P);
+    ep2_free(Q);
+#if defined(MULTI)
+    core_thread_detach();
+#endif
+    return NULL;
+}
+
+static int sign(void) {
+    int code = RLC_ERR;
+    SM9_SIGN_MASTER_KEY msk;
+    SM9_SIGN_KEY key, bob;
+    SM9_SIGN_MPK_PRE pre;
+    SM9_SIGN_CTX ctx;
+    char id[] = "Alice";
+    uint8_t msg[] = "Chinese IBS standard";
+    uint8_t sig[104];
+    size_t siglen;
+    fp12_t g;
+    ep_t P1;
+    SM9_ID_CACHE *cache = NULL;
+
+    fp12_null(g);
+    fp12_new(g);
+    ep_null(P1);
+    ep_new(P1);
+    g1_get_gen(P1);
+
+    sign_master_key_init(&msk);
+    sign_user_key_init(&key);
+    sign_user_key_init(&bob);
+    sign_mpk_pre_init(&pre);
+
+    sm9_sign_master_key_extract_key(&msk, id, strlen(id), &key);
+
+    TEST_CASE("prepared master public key caches e(P1, Ppubs)") {
+        TEST_ASSERT(sm9_sign_mpk_pre_set(&pre, msk.Ppubs) == 1, end);
+        sm9_pairing_fastest(g, msk.Ppubs, P1);
+        TEST_ASSERT(fp12_cmp(g, pre.g) == RLC_EQ, end);
+        TEST_ASSERT(sm9_sign_mpk_pre_set(&pre, key.Ppubs) == 1, end);
+        TEST_ASSERT(fp12_cmp(g, pre.g) == RLC_EQ, end);
+    } TEST_END;
+
+    TEST_CASE("prepared signature is correct") {
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish(&ctx, sig, siglen, &key, id, strlen(id)) == 1, end);
+
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 2);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 0, end);
+
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, "Bob", 3) == 0, end);
+    } TEST_END;
+
+    TEST_CASE("signatures of the same message use a fresh r") {
+        uint8_t sig2[104];
+        size_t siglen2;
+
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish(&ctx, &key, sig, &siglen) == 1, end);
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish(&ctx, &key, sig2, &siglen2) == 1, end);
+        TEST_ASSERT(siglen != siglen2 || memcmp(sig, sig2, siglen) != 0, end);
+
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish(&ctx, sig, siglen, &key, id, strlen(id)) == 1, end);
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish(&ctx, sig2, siglen2, &key, id, strlen(id)) == 1, end);
+    } TEST_END;
+
+    TEST_CASE("comb multiplication by the signing key is correct") {
+        bn_t k, n;
+        ep_t a, b;
+
+        bn_null(k);
+        bn_null(n);
+        ep_null(a);
+        ep_null(b);
+        bn_new(k);
+        bn_new(n);
+        ep_new(a);
+        ep_new(b);
+        ep_curve_get_ord(n);
+
+        TEST_ASSERT(key.ready, end);
+        bn_zero(k);
+        ep_mul_fix_glv_sec(a, key.t, key.ds, k);
+        TEST_ASSERT(ep_is_infty(a), end);
+        ep_mul_fix_glv_sec(a, key.t, key.ds, n);
+        TEST_ASSERT(ep_is_infty(a), end);
+        for (int i = 0; i < 8; i++) {
+            bn_rand_mod(k, n);
+            if (i & 1) {
+                bn_neg(k, k);
+            }
+            ep_mul_basic(a, key.ds, k);
+            ep_mul_fix_glv_sec(b, key.t, key.ds, k);
+            TEST_ASSERT(ep_cmp(a, b) == RLC_EQ, end);
+        }
+
+        // without the table signing falls back to the regular GLV multiplication
+        key.ready = 0;
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+        TEST_ASSERT(sm9_sign_key_pre_set(&key) == 1 && key.ready, end);
+
+        bn_free(k);
+        bn_free(n);
+        ep_free(a);
+        ep_free(b);
+    } TEST_END;
+
+    TEST_CASE("fixed-base and frobenius decomposed multiplications in G2 are correct") {
+        bn_t k, n;
+        ep2_t a, b, q;
+
+        bn_null(k);
+        bn_null(n);
+        ep2_null(a);
+        ep2_null(b);
+        ep2_null(q);
+        bn_new(k);
+        bn_new(n);
+        ep2_new(a);
+        ep2_new(b);
+        ep2_new(q);
+        ep2_curve_get_ord(n);
+
+        TEST_ASSERT(sm9_g2_gen_depth() == SM9_G2_GEN_DEPTH, end);
+        TEST_ASSERT(sm9_g2_gen_set(1) == -1, end);
+        TEST_ASSERT(sm9_g2_gen_set(SM9_G2_GEN_MAX_DEPTH + 1) == -1, end);
+        for (int d = 3; d <= SM9_G2_GEN_DEPTH; d += SM9_G2_GEN_DEPTH - 3) {
+            TEST_ASSERT(sm9_g2_gen_set(d) == 1 && sm9_g2_gen_depth() == d, end);
+            for (int i = 0; i < 4; i++) {
+                bn_rand_mod(k, n);
+                if (i & 1) {
+                    bn_neg(k, k);
+                }
+                ep2_mul_gen(a, k);
+                sm9_g2_mul_gen(b, k);
+                TEST_ASSERT(ep2_cmp(a, b) == RLC_EQ, end);
+            }
+        }
+        bn_zero(k);
+        sm9_g2_mul_gen(b, k);
+        TEST_ASSERT(ep2_is_infty(b), end);
+
+        ep2_rand(q);
+        ep2_mul_gls(b, q, k);
+        TEST_ASSERT(ep2_is_infty(b), end);
+        ep2_mul_gls(b, q, n);
+        TEST_ASSERT(ep2_is_infty(b), end);
+        for (int i = 0; i < 4; i++) {
+            bn_rand_mod(k, n);
+            if (i & 1) {
+                bn_neg(k, k);
+            }
+            ep2_mul_basic(a, q, k);
+            ep2_mul_gls(b, q, k);
+            TEST_ASSERT(ep2_cmp(a, b) == RLC_EQ, end);
+        }
+
+        bn_free(k);
+        bn_free(n);
+        ep2_free(a);
+        ep2_free(b);
+        ep2_free(q);
+    } TEST_END;
+
+    TEST_CASE("batch verification is correct") {
+        SM9_SIGN_CTX ctxs[4];
+        SM9_VERIFY_ITEM items[4];
+        uint8_t sigs[4][104];
+        int ret[4];
+
+        sm9_sign_master_key_extract_key(&msk, "Bob", 3, &bob);
+        for (int i = 0; i < 4; i++) {
+            sm9_sign_init(&ctx);
+            sm9_sign_update(&ctx, msg, sizeof(msg) - 1 - i);
+            items[i].id = (i == 2 ? "Bob" : id);
+            items[i].idlen = strlen(items[i].id);
+            TEST_ASSERT(sm9_sign_finish_pre(&ctx, (i == 2 ? &bob : &key), &pre, sigs[i], &items[i].siglen) == 1, end);
+            items[i].sig = sigs[i];
+            sm9_verify_init(&ctxs[i]);
+            sm9_verify_update(&ctxs[i], msg, sizeof(msg) - 1 - i);
+            items[i].ctx = &ctxs[i];
+        }
+        TEST_ASSERT(sm9_verify_finish_batch(&pre, items, 4, ret) == 1, end);
+        for (int i = 0; i < 4; i++) {
+            TEST_ASSERT(ret[i] == 1, end);
+        }
+        sm9_verify_init(&ctxs[1]);
+        sm9_verify_update(&ctxs[1], msg, sizeof(msg) - 1);
+        items[3].siglen--;
+        TEST_ASSERT(sm9_verify_finish_batch(&pre, items, 4, ret) == 0, end);
+        TEST_ASSERT(ret[0] == 1 && ret[1] == 0 && ret[2] == 1 && ret[3] == -1, end);
+    } TEST_END;
+
+    TEST_CASE("bulk key extraction is correct") {
+        const char *ids[3] = { "Alice", "Bob", "Carol" };
+        size_t idlens[3] = { 5, 3, 5 };
+        SM9_SIGN_KEY keys[3], one;
+        int ret[3];
+
+        sign_user_key_init(&one);
+        for (int i = 0; i < 3; i++) {
+            sign_user_key_init(&keys[i]);
+        }
+        TEST_ASSERT(sm9_sign_master_key_extract_keys(&msk, ids, idlens, 3, keys, ret, 2) == 1, end);
+        for (int i = 0; i < 3; i++) {
+            sm9_sign_master_key_extract_key(&msk, ids[i], idlens[i], &one);
+            TEST_ASSERT(ret[i] == 1 && keys[i].ready, end);
+            TEST_ASSERT(ep_cmp(keys[i].ds, one.ds) == RLC_EQ, end);
+            TEST_ASSERT(ep2_cmp(keys[i].Ppubs, msk.Ppubs) == RLC_EQ, end);
+        }
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &keys[2], &pre, sig, &siglen) == 1, end);
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, ids[2], idlens[2]) == 1, end);
+        for (int i = 0; i < 3; i++) {
+            sign_user_key_free(&keys[i]);
+        }
+        sign_user_key_free(&one);
+    } TEST_END;
+
+    TEST_CASE("signature with precomputed pairs is correct") {
+        SM9_RAND_POOL *pool;
+        bn_t r;
+        fp12_t w;
+
+        bn_null(r);
+        fp12_null(w);
+        bn_new(r);
+        fp12_new(w);
+
+        pool = sm9_rand_pool_new(pre.g, 2, 0);
+        TEST_ASSERT(pool != NULL, end);
+        TEST_ASSERT(sm9_rand_pool_count(pool) == 0, end);
+        TEST_ASSERT(sm9_rand_pool_fill(pool) == 1 && sm9_rand_pool_count(pool) == 2, end);
+        TEST_ASSERT(sm9_rand_pool_get(pool, r, w) == 1, end);
+        fp12_pow_gls(g, pre.g, r);
+        TEST_ASSERT(fp12_cmp(g, w) == RLC_EQ, end);
+        for (int i = 0; i < 2; i++) {
+            sm9_sign_init(&ctx);
+            sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_sign_finish_pool(&ctx, &key, pool, sig, &siglen) == 1, end);
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+        }
+        // 池已取空, 当场计算
+        TEST_ASSERT(sm9_rand_pool_count(pool) == 0, end);
+        TEST_ASSERT(sm9_rand_pool_get(pool, r, w) == 0, end);
+        fp12_pow_gls(g, pre.g, r);
+        TEST_ASSERT(fp12_cmp(g, w) == RLC_EQ, end);
+        sm9_rand_pool_free(pool);
+
+#if defined(MULTI)
+        pool = sm9_rand_pool_new(pre.g, 4, 1);
+#else
+        // 没有 MULTI 时不能起后台线程
+        TEST_ASSERT(sm9_rand_pool_new(pre.g, 4, 1) == NULL, end);
+        pool = sm9_rand_pool_new(pre.g, 4, 0);
+#endif
+        TEST_ASSERT(pool != NULL, end);
+        for (int i = 0; i < 4; i++) {
+            sm9_sign_init(&ctx);
+            sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_sign_finish_pool(&ctx, &key, pool, sig, &siglen) == 1, end);
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish(&ctx, sig, siglen, &key, id, strlen(id)) == 1, end);
+        }
+        sm9_rand_pool_free(pool);
+        bn_free(r);
+        fp12_free(w);
+    } TEST_END;
+
+    TEST_CASE("shared state can be used from several threads") {
+#if defined(MULTI)
+        pthread_t tid[3];
+#endif
+        SHARED_ARG args[3];
+
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+        for (int i = 0; i < 3; i++) {
+            args[i].pre = &pre;
+            args[i].id = id;
+            args[i].msg = msg;
+            args[i].msglen = sizeof(msg) - 1;
+            args[i].sig = sig;
+            args[i].siglen = siglen;
+#if defined(MULTI)
+            args[i].shared = core_get();
+            TEST_ASSERT(pthread_create(&tid[i], NULL, shared_state_worker, &args[i]) == 0, end);
+#else
+            // 没有 MULTI 时各线程共用一个 RELIC 上下文, 不能并发, 依次运行
+            shared_state_worker(&args[i]);
+#endif
+        }
+        // 其他线程在用 P2 的表时换表
+        TEST_ASSERT(sm9_g2_gen_set(6) == 1, end);
+        TEST_ASSERT(sm9_g2_gen_set(SM9_G2_GEN_DEPTH) == 1, end);
+        for (int i = 0; i < 3; i++) {
+#if defined(MULTI)
+            pthread_join(tid[i], NULL);
+#endif
+            TEST_ASSERT(args[i].ok == 1, end);
+        }
+        TEST_ASSERT(sm9_g2_gen_depth() == SM9_G2_GEN_DEPTH, end);
+    } TEST_END;
+
+    TEST_CASE("attached context shares the precomputation tables") {
+        ctx_t *shared = core_get(), *local;
+        const ep_t *tab = ep_curve_get_tab();
+        bn_t k;
+
+        bn_null(k);
+        bn_new(k);
+        local = (ctx_t *)malloc(sizeof(ctx_t));
+        TEST_ASSERT(local != NULL, end);
+        TEST_ASSERT(core_thread_attach(local, shared) == RLC_OK, end);
+        TEST_ASSERT(core_get() == local, end);
+        // 表不重建, 仍是共享上下文里的那一份
+        TEST_ASSERT(local->ep_ptr[0] == shared->ep_ptr[0], end);
+        TEST_ASSERT(local->ep2_ptr[0] == shared->ep2_ptr[0], end);
+        TEST_ASSERT(ep_curve_get_tab() == tab, end);
+        bn_rand(k, RLC_POS, 128);
+        TEST_ASSERT(err_get_code() == RLC_OK, end);
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+        sm9_verify_init(&ctx);
+        sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+        core_thread_detach();
+        core_set(shared);
+        free(local);
+        bn_free(k);
+    } TEST_END;
+
+    TEST_CASE("SM2 and SM9 signatures can be interleaved on curve contexts") {
+        ctx_t *sm9 = core_get(), *sm2;
+        bn_t d, r, s;
+        ec_t q;
+
+        bn_null(d);
+        bn_null(r);
+        bn_null(s);
+        ec_null(q);
+        bn_new(d);
+        bn_new(r);
+        bn_new(s);
+        ec_new(q);
+
+        sm2 = core_curve_new(SM2_P256, 0);
+        TEST_ASSERT(sm2 != NULL, end);
+        TEST_ASSERT(core_get() == sm9 && ep_param_get() == SM9_P256, end);
+        TEST_ASSERT(core_curve_use(sm2) == sm9, end);
+        TEST_ASSERT(ep_param_get() == SM2_P256, end);
+        TEST_ASSERT(cp_sm2_gen(d, q) == RLC_OK, end);
+        for (int i = 0; i < 2; i++) {
+            core_curve_use(sm2);
+            TEST_ASSERT(cp_sm2_sig(r, s, msg, sizeof(msg) - 1, 0, d) == RLC_OK, end);
+            core_curve_use(sm9);
+            sm9_sign_init(&ctx);
+            sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+            core_curve_use(sm2);
+            TEST_ASSERT(cp_sm2_ver(r, s, msg, sizeof(msg) - 1, 0, q) == 1, end);
+            core_curve_use(sm9);
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+        }
+        core_curve_free(sm2);
+        TEST_ASSERT(core_get() == sm9, end);
+        bn_free(d);
+        bn_free(r);
+        bn_free(s);
+        ec_free(q);
+    } TEST_END;
+
+    TEST_CASE("verification with the identity cache is correct") {
+        SM9_G2_PRE lines;
+        uint64_t hits, misses, evictions;
+        bn_t h1, h2;
+        ep2_t P, Q;
+
+        bn_null(h1);
+        bn_null(h2);
+        ep2_null(P);
+        ep2_null(Q);
+        bn_new(h1);
+        bn_new(h2);
+        ep2_new(P);
+        ep2_new(Q);
+        sm9_g2_pre_init(&lines);
+
+        cache = sm9_id_cache_new(4, 2, SM9_ID_CACHE_LINES);
+        TEST_ASSERT(cache != NULL, end);
+        sm9_set_id_cache(cache);
+
+        sm9_sign_init(&ctx);
+        sm9_sign_update(&ctx, msg, sizeof(msg) - 1);
+        TEST_ASSERT(sm9_sign_finish_pre(&ctx, &key, &pre, sig, &siglen) == 1, end);
+        for (int i = 0; i < 2; i++) {
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish(&ctx, sig, siglen, &key, id, strlen(id)) == 1, end);
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, id, strlen(id)) == 1, end);
+            sm9_verify_init(&ctx);
+            sm9_verify_update(&ctx, msg, sizeof(msg) - 1);
+            TEST_ASSERT(sm9_verify_finish_pre(&ctx, sig, siglen, &pre, "Bob", 3) == 0, end);
+        }
+        sm9_id_cache_stats(cache, &hits, &misses, &evictions);
+        TEST_ASSERT(misses == 2 && hits == 4 && evictions == 0, end);
+
+        TEST_ASSERT(sm9_id_cache_g2(cache, msk.Ppubs, id, strlen(id), h1, P, &lines) == 1, end);
+        TEST_ASSERT(sm9_id_cache_g2(NULL, msk.Ppubs, id, strlen(id), h2, Q, NULL) == 0, end);
+        TEST_ASSERT(bn_cmp(h1, h2) == RLC_EQ && ep2_cmp(P, Q) == RLC_EQ, end);
+        TEST_ASSERT(ep2_cmp(lines.Q, Q) == RLC_EQ, end);
+
+        sm9_set_id_cache(NULL);
+        sm9_id_cache_free(cache);
+        cache = NULL;
+        sm9_g2_pre_free(&lines);
+        bn_free(h1);
+        bn_free(h2);
+        ep2_free(P);
+        ep2_free(Q);
+    } TEST_END;
+
+    code = RLC_OK;
+  end:
+    sm9_set_id_cache(NULL);
+    sm9_id_cache_free(cache);
+    fp12_free(g);
+    ep_free(P1);
+    sign_mpk_pre_free(&pre);
+    sign_user_key_free(&bob);
+    sign_user_key_free(&key);
+    sign_master_key_free(&msk);
+    return code;
+}
+
+static int encrypt(void) {
+    int code = RLC_ERR;
+    SM9_ENC_MASTER_KEY msk;
+    SM9_ENC_KEY key;
+    SM9_ENC_MPK_PRE pre;
+    SM9_G2_PRE de;
+    char id[] = "Bob";
+    uint8_t k1[32], k2[32];
+    ep_t C;
+    SM9_ID_CACHE *cache = NULL;
+
+    ep_null(C);
+    ep_new(C);
+
+    enc_master_key_init(&msk);
+    enc_user_key_init(&key);
+    enc_mpk_pre_init(&pre);
+    sm9_g2_pre_init(&de);
+
+    sm9_enc_master_key_extract_key(&msk, id, strlen(id), &key);
+
+    TEST_CASE("prepared key encapsulation is correct") {
+        TEST_ASSERT(sm9_enc_mpk_pre_set(&pre, msk.Ppube) == 1, end);
+        TEST_ASSERT(sm9_kem_encrypt_pre(&pre, id, strlen(id), sizeof(k1), k1, C) == 1, end);
+        TEST_ASSERT(sm9_kem_decrypt(&key, id, strlen(id), C, sizeof(k2), k2) == 1, end);
+        TEST_ASSERT(memcmp(k1, k2, sizeof(k1)) == 0, end);
+    } TEST_END;
+
+    TEST_CASE("key decapsulation with prepared de is correct") {
+        sm9_g2_pre_set(&de, key.de);
+        TEST_ASSERT(sm9_kem_encrypt_pre(&pre, id, strlen(id), sizeof(k1), k1, C) == 1, end);
+        TEST_ASSERT(sm9_kem_decrypt_pre(&de, id, strlen(id), C, sizeof(k2), k2) == 1, end);
+        TEST_ASSERT(memcmp(k1, k2, sizeof(k1)) == 0, end);
+    } TEST_END;
+
+    TEST_CASE("bulk key extraction is correct") {
+        const char *ids[5] = { "Alice", "Bob", "Carol", "Dave", "Eve" };
+        size_t idlens[5] = { 5, 3, 5, 4, 3 };
+        SM9_ENC_KEY keys[5], one;
+        int ret[5];
+
+        enc_user_key_init(&one);
+        for (int i = 0; i < 5; i++) {
+            enc_user_key_init(&keys[i]);
+        }
+        TEST_ASSERT(sm9_enc_master_key_extract_keys(&msk, ids, idlens, 5, keys, ret, 2) == 1, end);
+        for (int i = 0; i < 5; i++) {
+            sm9_enc_master_key_extract_key(&msk, ids[i], idlens[i], &one);
+            TEST_ASSERT(ret[i] == 1 && ep2_cmp(keys[i].de, one.de) == RLC_EQ, end);
+            TEST_ASSERT(ep_cmp(keys[i].Ppube, msk.Ppube) == RLC_EQ, end);
+        }
+        TEST_ASSERT(sm9_exch_master_key_extract_keys(&msk, ids, idlens, 5, keys, ret, 0) == 1, end);
+        for (int i = 0; i < 5; i++) {
+            sm9_exch_master_key_extract_key(&msk, ids[i], idlens[i], &one);
+            TEST_ASSERT(ret[i] == 1 && ep2_cmp(keys[i].de, one.de) == RLC_EQ, end);
+        }
+        for (int i = 0; i < 5; i++) {
+            enc_user_key_free(&keys[i]);
+        }
+        enc_user_key_free(&one);
+    } TEST_END;
+
+    TEST_CASE("batch key decapsulation is correct") {
+        ep_t Cs[4];
+        uint8_t ks[4][32], kb[4][32];
+        int ret[4];
+
+        for (int i = 0; i < 4; i++) {
+            ep_null(Cs[i]);
+            ep_new(Cs[i]);
+            TEST_ASSERT(sm9_kem_encrypt_pre(&pre, id, strlen(id), sizeof(ks[i]), ks[i], Cs[i]) == 1, end);
+        }
+        TEST_ASSERT(sm9_kem_decrypt_batch(&de, id, strlen(id), (const ep_t *)Cs, 4, 32, kb[0], ret) == 1, end);
+        for (int i = 0; i < 4; i++) {
+            TEST_ASSERT(ret[i] == 1 && memcmp(ks[i], kb[i], 32) == 0, end);
+        }
+        ep_set_infty(Cs[1]);
+        TEST_ASSERT(sm9_kem_decrypt_batch(&de, id, strlen(id), (const ep_t *)Cs, 4, 32, kb[0], ret) == 0, end);
+        TEST_ASSERT(ret[0] == 1 && ret[1] == -1 && ret[2] == 1 && ret[3] == 1, end);
+        TEST_ASSERT(memcmp(ks[3], kb[3], 32) == 0, end);
+        for (int i = 0; i < 4; i++) {
+            ep_free(Cs[i]);
+        }
+    } TEST_END;
+
+    TEST_CASE("encapsulation with precomputed pairs is correct") {
+#if defined(MULTI)
+        SM9_RAND_POOL *pool = sm9_rand_pool_new(pre.g, 4, 1);
+#else
+        SM9_RAND_POOL *pool = sm9_rand_pool_new(pre.g, 4, 0);
+#endif
+
+        TEST_ASSERT(pool != NULL, end);
+        for (int i = 0; i < 6; i++) {
+            TEST_ASSERT(sm9_kem_encrypt_pool(&pre, pool, id, strlen(id), sizeof(k1), k1, C) == 1, end);
+            TEST_ASSERT(sm9_kem_decrypt(&key, id, strlen(id), C, sizeof(k2), k2) == 1, end);
+            TEST_ASSERT(memcmp(k1, k2, sizeof(k1)) == 0, end);
+        }
+        sm9_rand_pool_free(pool);
+    } TEST_END;
+
+    TEST_CASE("encapsulation with the identity cache is correct") {
+        uint64_t hits, misses, evictions;
+        ep_t Q, R, t[SM9_DS_TABLE];
+        bn_t k;
+
+        bn_null(k);
+        bn_new(k);
+        ep_curve_get_ord(k);
+        bn_rand_mod(k, k);
+        ep_null(Q);
+        ep_null(R);
+        ep_new(Q);
+        ep_new(R);
+        for (int i = 0; i < SM9_DS_TABLE; i++) {
+            ep_null(t[i]);
+            ep_new(t[i]);
+        }
+
+        cache = sm9_id_cache_new(1, 1, SM9_ID_CACHE_TABLES);
+        TEST_ASSERT(cache != NULL, end);
+        sm9_set_id_cache(cache);
+
+        for (int i = 0; i < 2; i++) {
+            TEST_ASSERT(sm9_kem_encrypt_pre(&pre, id, strlen(id), sizeof(k1), k1, C) == 1, end);
+            TEST_ASSERT(sm9_kem_decrypt(&key, id, strlen(id), C, sizeof(k2), k2) == 1, end);
+            TEST_ASSERT(memcmp(k1, k2, sizeof(k1)) == 0, end);
+            TEST_ASSERT(sm9_kem_encrypt(&key, id, strlen(id), sizeof(k1), k1, C) == 1, end);
+            TEST_ASSERT(sm9_kem_decrypt_pre(&de, id, strlen(id), C, sizeof(k2), k2) == 1, end);
+            TEST_ASSERT(memcmp(k1, k2, sizeof(k1)) == 0, end);
+        }
+        sm9_id_cache_stats(cache, &hits, &misses, &evictions);
+        TEST_ASSERT(misses == 1 && hits == 3 && evictions == 0, end);
+
+        TEST_ASSERT(sm9_id_cache_g1(cache, msk.Ppube, SM9_HID_ENC, id, strlen(id), NULL, Q, t) == 1, end);
+        TEST_ASSERT(sm9_id_cache_g1(NULL, msk.Ppube, SM9_HID_ENC, id, strlen(id), NULL, R, NULL) == 0, end);
+        TEST_ASSERT(ep_cmp(Q, R) == RLC_EQ, end);
+        ep_mul_fix_glv_sec(Q, t, R, k);
+        ep_mul(R, R, k);
+        TEST_ASSERT(ep_cmp(Q, R) == RLC_EQ, end);
+        // 容量为 1, 换一个身份会淘汰原来的项
+        TEST_ASSERT(sm9_id_cache_g1(cache, msk.Ppube, SM9_HID_ENC, "Carol", 5, NULL, Q, NULL) == 0, end);
+        TEST_ASSERT(sm9_id_cache_g1(cache, msk.Ppube, SM9_HID_ENC, id, strlen(id), NULL, Q, NULL) == 0, end);
+        sm9_id_cache_stats(cache, &hits, &misses, &evictions);
+        TEST_ASSERT(evictions == 2, end);
+
+        sm9_set_id_cache(NULL);
+        sm9_id_cache_free(cache);
+        cache = NULL;
+        bn_free(k);
+        ep_free(Q);
+        ep_free(R);
+        for (int i = 0; i < SM9_DS_TABLE; i++) {
+            ep_free(t[i]);
+        }
+    } TEST_END;
+
+    TEST_CASE("SM4 block cipher matches the standard test vector") {
+        uint8_t raw[16] = {
+            0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+            0xfe, 0xdc, 0xba, 0x98, 0x76, 0x54, 0x32, 0x10,
+        };
+        uint8_t cipher[16] = {
+            0x68, 0x1e, 0xdf, 0x34, 0xd2, 0x06, 0x96, 0x5e,
+            0x86, 0xb3, 0xe9, 0x4f, 0x53, 0x6e, 0x42, 0x46,
+        };
+        uint8_t buf[16];
+        SM4_KEY sm4_key;
+
+        sm4_set_encrypt_key(&sm4_key, raw);
+        sm4_encrypt(&sm4_key, raw, buf);
+        TEST_ASSERT(memcmp(buf, cipher, sizeof(buf)) == 0, end);
+        sm4_set_decrypt_key(&sm4_key, raw);
+        sm4_decrypt(&sm4_key, buf, buf);
+        TEST_ASSERT(memcmp(buf, raw, sizeof(buf)) == 0, end);
+    } TEST_END;
+
+    TEST_CASE("SM4 multi-block modes match the single-block cipher") {
+        uint8_t raw[16] = { 0 }, iv[16], ctr[16], x[16];
+        uint8_t m[37 * 16], c[37 * 16], d[37 * 16];
+        SM4_KEY ek, dk;
+
+        for (size_t i = 0; i < sizeof(m); i++) {
+            m[i] = (uint8_t)(i * 7 + 1);
+        }
+        raw[0] = 0x5a;
+        sm4_set_encrypt_key(&ek, raw);
+        sm4_set_decrypt_key(&dk, raw);
+
+        // 37 块: 4 组 8 块的并行实现加 5 块查表实现
+        sm4_encrypt_blocks(&ek, m, 37, c);
+        for (int i = 0; i < 37; i++) {
+            sm4_encrypt(&ek, m + 16 * i, x);
+            TEST_ASSERT(memcmp(x, c + 16 * i, 16) == 0, end);
+        }
+        memcpy(d, c, sizeof(c));
+        sm4_encrypt_blocks(&dk, d, 37, d);
+        TEST_ASSERT(memcmp(d, m, sizeof(m)) == 0, end);
+
+        memset(iv, 0x11, sizeof(iv));
+        sm4_cbc_encrypt(&ek, iv, m, 37, c);
+        memset(iv, 0x11, sizeof(iv));
+        sm4_cbc_decrypt(&dk, iv, c, 20, d);
+        sm4_cbc_decrypt(&dk, iv, c + 20 * 16, 17, d + 20 * 16);
+        TEST_ASSERT(memcmp(d, m, sizeof(m)) == 0, end);
+        TEST_ASSERT(memcmp(iv, c + 36 * 16, 16) == 0, end);
+
+        memset(ctr, 0xff, sizeof(ctr));
+        sm4_ctr_encrypt(&ek, ctr, m, sizeof(m) - 3, c);
+        memset(ctr, 0xff, sizeof(ctr));
+        for (int i = 0; i < 37; i++) {
+            sm4_encrypt(&ek, ctr, x);
+            for (int j = 0; j < 16 && 16 * i + j < (int)sizeof(m) - 3; j++) {
+                TEST_ASSERT(c[16 * i + j] == (m[16 * i + j] ^ x[j]), end);
+            }
+            // 计数器按 128 位大端数加一, 第一块之后回绕到 0
+            for (int j = 15; j >= 0 && ++ctr[j] == 0; j--);
+        }
+    } TEST_END;
+
+    TEST_CASE("streaming hybrid encryption is correct") {
+        int types[4] = { SM9_ENC_TYPE_ECB, SM9_ENC_TYPE_CBC, SM9_ENC_TYPE_OFB, SM9_ENC_TYPE_CFB };
+        size_t steps[5] = { 1, 7, 16, 33, 100 };
+        size_t lens[3] = { 0, 32, 1000 };
+        size_t mlen = 1000, clen, len, off;
+        uint8_t *m = malloc(mlen), *c = malloc(SM9_ENC_HEADER_SIZE + mlen + 48), *d = malloc(mlen + 32);
+        SM9_ENC_CTX ctx;
+
+        TEST_ASSERT(m != NULL && c != NULL && d != NULL, end);
+        for (size_t i = 0; i < mlen; i++) {
+            m[i] = (uint8_t)(i * 31 + 7);
+        }
+        TEST_ASSERT(sm9_encrypt_init(&ctx, &key, id, strlen(id), SM9_ENC_TYPE_XOR, c, &len) == -1, end);
+        for (int t = 0; t < 4; t++) {
+            for (int l = 0; l < 3; l++) {
+                // 加密和解密都按不规则的长度分段输入
+                TEST_ASSERT(sm9_encrypt_init(&ctx, &key, id, strlen(id), types[t], c, &clen) == 1, end);
+                for (off = 0; off < lens[l]; off += len) {
+                    len = RLC_MIN(steps[(off / 7) % 5], lens[l] - off);
+                    TEST_ASSERT(sm9_encrypt_update(&ctx, m + off, len, c + clen, &len) == 1, end);
+                    clen += len;
+                    len = RLC_MIN(steps[(off / 7) % 5], lens[l] - off);
+                }
+                TEST_ASSERT(sm9_encrypt_finish(&ctx, c + clen, &len) == 1, end);
+                clen += len;
+                TEST_ASSERT(clen == SM9_ENC_HEADER_SIZE + SM3_HMAC_SIZE + (types[t] & (SM9_ENC_TYPE_ECB | SM9_ENC_TYPE_CBC)
+                    ? (lens[l] / 16 + 1) * 16 : lens[l]), end);
+
+                TEST_ASSERT(sm9_decrypt_init(&ctx, &key, id, strlen(id), c, SM9_ENC_HEADER_SIZE) == 1, end);
+                mlen = 0;
+                for (off = SM9_ENC_HEADER_SIZE; off < clen; off += len) {
+                    len = RLC_MIN(steps[(off / 5) % 5], clen - off);
+                    TEST_ASSERT(sm9_decrypt_update(&ctx, c + off, len, d + mlen, &len) == 1, end);
+                    mlen += len;
+                    len = RLC_MIN(steps[(off / 5) % 5], clen - off);
+                }
+                TEST_ASSERT(sm9_decrypt_finish(&ctx, d + mlen, &len) == 1, end);
+                mlen += len;
+                TEST_ASSERT(mlen == lens[l] && memcmp(m, d, mlen) == 0, end);
+            }
+            // C2 或 C3 被改动时 finish 失败
+            c[clen - 40] ^= 1;
+            TEST_ASSERT(sm9_decrypt_init(&ctx, &key, id, strlen(id), c, SM9_ENC_HEADER_SIZE) == 1, end);
+            TEST_ASSERT(sm9_decrypt_update(&ctx, c + SM9_ENC_HEADER_SIZE, clen - SM9_ENC_HEADER_SIZE, d, &len) == 1, end);
+            TEST_ASSERT(sm9_decrypt_finish(&ctx, d + len, &len) == -1, end);
+            mlen = 1000;
+        }
+        // 每次加密的 r 都是新取的, 同一消息两次加密的 C1 和 C2 都不同
+        for (int t = 0; t < 4; t++) {
+            TEST_ASSERT(sm9_encrypt_init(&ctx, &key, id, strlen(id), types[t], c, &clen) == 1, end);
+            TEST_ASSERT(sm9_encrypt_update(&ctx, m, 32, c + clen, &len) == 1, end);
+            clen += len;
+            TEST_ASSERT(sm9_encrypt_finish(&ctx, c + clen, &len) == 1, end);
+            TEST_ASSERT(sm9_encrypt_init(&ctx, &key, id, strlen(id), types[t], d, &clen) == 1, end);
+            TEST_ASSERT(sm9_encrypt_update(&ctx, m, 32, d + clen, &len) == 1, end);
+            clen += len;
+            TEST_ASSERT(sm9_encrypt_finish(&ctx, d + clen, &len) == 1, end);
+            TEST_ASSERT(memcmp(c + 1, d + 1, SM9_ENC_HEADER_SIZE - 1) != 0, end);
+            TEST_ASSERT(memcmp(c + SM9_ENC_HEADER_SIZE, d + SM9_ENC_HEADER_SIZE, 16) != 0, end);
+            TEST_ASSERT(memcmp(c + SM9_ENC_HEADER_SIZE + 16, d + SM9_ENC_HEADER_SIZE + 16, 16) != 0, end);
+        }
+        // C3 也覆盖头部, ECB 与 CBC, OFB 与 CFB 互换模式字节后 finish 失败
+        for (int t = 0; t < 4; t++) {
+            TEST_ASSERT(sm9_encrypt_init(&ctx, &key, id, strlen(id), types[t], c, &clen) == 1, end);
+            TEST_ASSERT(sm9_encrypt_update(&ctx, m, 32, c + clen, &len) == 1, end);
+            clen += len;
+            TEST_ASSERT(sm9_encrypt_finish(&ctx, c + clen, &len) == 1, end);
+            clen += len;
+            c[0] = (uint8_t)types[t ^ 1];
+            TEST_ASSERT(sm9_decrypt_init(&ctx, &key, id, strlen(id), c, SM9_ENC_HEADER_SIZE) == 1, end);
+            TEST_ASSERT(sm9_decrypt_update(&ctx, c + SM9_ENC_HEADER_SIZE, clen - SM9_ENC_HEADER_SIZE, d, &len) == 1, end);
+            TEST_ASSERT(sm9_decrypt_finish(&ctx, d + len, &len) == -1, end);
+        }
+        free(m);
+        free(c);
+        free(d);
+    } TEST_END;
+
+    code = RLC_OK;
+  end:
+    sm9_set_id_cache(NULL);
+    sm9_id_cache_free(cache);
+    ep_free(C);
+    enc_mpk_pre_free(&pre);
+    sm9_g2_pre_free(&de);
+    enc_user_key_free(&key);
+    enc_master_key_free(&msk);
+    return code;
+}
+
+int main(void) {
+    if (core_init() != RLC_OK) {
+        core_clean();
+        return 1;
+    }
+
+    util_banner("Tests for the SM9 module", 0);
+
+    if (ep_param_set_any_pairf_t(SM9_P256, RLC_EP_MTYPE) != RLC_OK) {
+        core_clean();
+        return 1;
+    }
+    if (sm9_init() != 1) {
+        core_clean();
+        return 1;
+    }
+
+    util_banner("Pairing:", 1);
+    if (pairing() != RLC_OK) {
+        sm9_clean();
+        core_clean();
+        return 1;
+    }
+
+    util_banner("Exponentiation:", 1);
+    if (exponentiation() != RLC_OK) {
+        sm9_clean();
+        core_clean();
+        return 1;
+    }
+
+    util_banner("Signature:", 1);
+    if (sign() != RLC_OK) {
+        sm9_clean();
+        core_clean();
+        return 1;
+    }
+
+    util_banner("Encryption:", 1);
+    if (encrypt() != RLC_OK) {
+        sm9_clean();
+        core_clean();
+        return 1;
+    }
+
+    util_banner("All tests have passed.\n", 0);
+
+    sm9_clean();
+    core_clean();
+    return 0;
+}
@@ -1,7 +1,7 @@
 #include "relic.h"
 #include "sm9.h"
 
-void test_sm9_pairing(){
+int test_sm9_pairing(){
     ep_t g1;
     ep2_t Ppub;
     fp12_t r;
@@ -37,7 +37,12 @@ void test_sm9_pairing(){
     fp12_null(r);
     fp12_new(r);
 
-    sm9_init();
+    if (sm9_init() != 1) {
+        g1_free(g1);
+        ep2_free(Ppub);
+        fp12_free(r);
+        return 1;
+    }
 
 #if 1
     // 测试正确性
@@ -54,6 +59,7 @@ void test_sm9_pairing(){
     g1_free(g1);
     ep2_free(Ppub);
     fp12_free(r);
+    return 0;
 }
 
 //
@@ -64,13 +70,16 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (pc_param_set_any() != RLC_OK) {
+    // 设置曲线参数, sm9_init 只接受 SM9 曲线
+    if (ep_param_set_any_pairf_t(SM9_P256, RLC_EP_MTYPE) != RLC_OK) {
         core_clean();
         return 1;
     }
 
-    // 设置曲线参数
-    test_sm9_pairing();
+    if (test_sm9_pairing() != 0) {
+        core_clean();
+        return 1;
+    }
 
     core_clean();
 